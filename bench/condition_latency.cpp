@@ -0,0 +1,114 @@
+// Measures the input-to-output latency of the host condition renderer with
+// an aircraft-like pitch curve: a breakout force around the center, a force
+// gradient stiffening towards the stops, a trim detent and some damping.
+//
+// The latency runs from the completion of an input report to the completion
+// of the Set Constant Force report computed from it; the input age stops at
+// its submission, i.e. the host share of the latency.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "clsp.hpp"
+
+namespace {
+
+// Breakout force, and its width around the center
+const float BREAKOUT_FORCE = 0.15f;
+const float BREAKOUT_WIDTH = 0.02f;
+// Force at the stops past the breakout
+const float GRADIENT_FORCE = 0.6f;
+// Detent at the take-off trim position
+const float DETENT_POSITION = -0.3f;
+const float DETENT_FORCE = 0.1f;
+const float DETENT_WIDTH = 0.03f;
+// Force at the fastest tabulated velocity, i.e. one full travel per 100 ms
+const float DAMPING_FORCE = 0.2f;
+const float VELOCITY_RANGE = 20.0f;
+
+float pitchForce(float position) {
+  float breakout = BREAKOUT_FORCE * std::tanh(position / BREAKOUT_WIDTH);
+  float gradient = GRADIENT_FORCE *
+                   (0.5f * position + 0.5f * position * position * position);
+
+  // Derivative of a gaussian: pulls the stick into the detent
+  float offset = (position - DETENT_POSITION) / DETENT_WIDTH;
+  float detent = DETENT_FORCE * 1.6487f * offset *
+                 std::exp(-0.5f * offset * offset);
+
+  return -(breakout + gradient + detent);
+}
+
+float damping(float velocity) {
+  return -DAMPING_FORCE * velocity / VELOCITY_RANGE;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* backend = argc > 1 ? argv[1] : "sim";
+  int seconds = argc > 2 ? std::atoi(argv[2]) : 10;
+
+  CLSPBackend type = CLSP_BACKEND_SIM;
+  if (std::strcmp(backend, "libusb") == 0) {
+    type = CLSP_BACKEND_LIBUSB;
+  } else if (std::strcmp(backend, "hidraw") == 0) {
+    type = CLSP_BACKEND_HIDRAW;
+  } else if (std::strcmp(backend, "sim") != 0) {
+    std::cerr << "Unknown backend: " << backend << std::endl;
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto curve = std::make_shared<const CLSPConditionCurve>(pitchForce, damping,
+                                                          VELOCITY_RANGE);
+  double tabulation_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  std::unique_ptr<CLSPJoystick> joystick;
+  try {
+    joystick = std::make_unique<CLSPJoystick>("", type);
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  int ret = joystick->startConditionRenderer(curve, CLSP_AXIS_Y, 1000);
+  if (ret < 0) {
+    std::cerr << "Unable to start the condition renderer: " << ret
+              << std::endl;
+    return 1;
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+  CLSPStreamStats stats = joystick->getStreamStats();
+  joystick->stopForceStream();
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "tables     " << tabulation_ms << " ms" << std::endl;
+  std::cout << "policy     " << (stats.realtime ? "SCHED_FIFO" : "default")
+            << std::endl;
+  std::cout << "rate       " << stats.rate_hz << " Hz (target "
+            << stats.target_hz << " Hz) | jitter " << stats.period_stddev_us
+            << " us" << std::endl;
+  std::cout << "input age  mean " << stats.input_age_mean_us << " us | max "
+            << stats.input_age_max_us << " us" << std::endl;
+  std::cout << "latency    p50 " << stats.latency_p50_us << " us | p99 "
+            << stats.latency_p99_us << " us | max " << stats.latency_max_us
+            << " us" << std::endl;
+  std::cout << "ticks      " << stats.ticks << " | sent " << stats.sent
+            << " | from input " << stats.input_reports << " | unchanged "
+            << stats.unchanged << " | busy " << stats.busy << " | errors "
+            << stats.errors << std::endl;
+
+  return 0;
+}
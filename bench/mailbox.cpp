@@ -0,0 +1,217 @@
+// Measures how many reports the parameter mailboxes save: producer threads
+// write the magnitude and offset of a periodic effect at a rate far above
+// the USB frames, first through the direct calls, then through the
+// mailboxes, and the transfers each way are compared. A last run swings the
+// magnitudes with one slew call per swing instead.
+//
+// The post cost runs from the call to its return on the producer thread.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "clsp.hpp"
+#include "clsp_clock.hpp"
+
+namespace {
+
+// Producer threads, each writing its own periodic effect block
+const int PRODUCERS = 2;
+// Pause between two writes of a producer
+const auto PRODUCER_PERIOD = std::chrono::microseconds(50);
+// Magnitude swings of the slew run, and their slew time
+const auto SWING_PERIOD = std::chrono::milliseconds(100);
+const unsigned int SWING_SLEW_MS = 80;
+
+struct Run {
+  uint64_t writes = 0;
+  uint64_t transfers = 0;
+  // Post cost in ns
+  double mean_ns = 0.0;
+  double max_ns = 0.0;
+};
+
+uint64_t sentReports(CLSPJoystick& joystick) {
+  CLSPSchedulerStats stats = joystick.getSchedulerStats();
+  uint64_t sent = 0;
+  for (const CLSPReportClassStats& type : stats.classes) {
+    sent += type.sent;
+  }
+
+  return sent;
+}
+
+// Writes both fields from every producer for a while
+Run produce(CLSPJoystick& joystick, const std::vector<uint8_t>& blocks,
+            bool mailboxes, double seconds) {
+  std::atomic<uint64_t> writes{0};
+  std::atomic<uint64_t> total_ns{0};
+  std::atomic<uint64_t> max_ns{0};
+
+  uint64_t sent = sentReports(joystick);
+  auto end = std::chrono::steady_clock::now() +
+             std::chrono::duration<double>(seconds);
+
+  std::vector<std::thread> producers;
+  for (uint8_t block : blocks) {
+    producers.emplace_back([&, block] {
+      uint64_t local_ns = 0;
+      uint64_t local_max = 0;
+      uint64_t count = 0;
+
+      for (int tick = 0; std::chrono::steady_clock::now() < end; tick++) {
+        int magnitude = 128 + static_cast<int>(127 * std::sin(tick * 0.01));
+        int offset = static_cast<int>(64 * std::cos(tick * 0.01));
+
+        uint64_t start = clspMonotonicNs();
+        if (mailboxes) {
+          joystick.postParameter(block, CLSP_FIELD_PERIODIC_MAGNITUDE,
+                                 magnitude);
+          joystick.postParameter(block, CLSP_FIELD_PERIODIC_OFFSET, offset);
+        } else {
+          joystick.setPeriodicSettings(magnitude, offset, 0x00, 100, block);
+        }
+        uint64_t cost = clspMonotonicNs() - start;
+
+        local_ns += cost;
+        local_max = std::max(local_max, cost);
+        count++;
+
+        std::this_thread::sleep_for(PRODUCER_PERIOD);
+      }
+
+      writes += count;
+      total_ns += local_ns;
+      uint64_t seen = max_ns;
+      while (local_max > seen && !max_ns.compare_exchange_weak(seen,
+                                                                local_max)) {
+      }
+    });
+  }
+
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+
+  // Lets the last frame go out
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  Run run;
+  run.writes = writes;
+  run.transfers = sentReports(joystick) - sent;
+  run.mean_ns = run.writes > 0 ? static_cast<double>(total_ns) / run.writes
+                               : 0.0;
+  run.max_ns = static_cast<double>(max_ns);
+
+  return run;
+}
+
+// Swings the magnitude of every block between its bounds with slews
+Run swing(CLSPJoystick& joystick, const std::vector<uint8_t>& blocks,
+          double seconds) {
+  uint64_t sent = sentReports(joystick);
+  auto end = std::chrono::steady_clock::now() +
+             std::chrono::duration<double>(seconds);
+
+  Run run;
+  double total_ns = 0.0;
+  for (int swing = 0; std::chrono::steady_clock::now() < end; swing++) {
+    int target = swing % 2 == 0 ? 255 : 0;
+
+    for (uint8_t block : blocks) {
+      uint64_t start = clspMonotonicNs();
+      joystick.slewParameter(block, CLSP_FIELD_PERIODIC_MAGNITUDE, target,
+                             SWING_SLEW_MS);
+      double cost = static_cast<double>(clspMonotonicNs() - start);
+
+      total_ns += cost;
+      run.max_ns = std::max(run.max_ns, cost);
+      run.writes++;
+    }
+
+    std::this_thread::sleep_for(SWING_PERIOD);
+  }
+
+  run.transfers = sentReports(joystick) - sent;
+  run.mean_ns = run.writes > 0 ? total_ns / run.writes : 0.0;
+
+  return run;
+}
+
+void print(const char* name, const Run& run) {
+  std::cout << name << " writes " << run.writes << " | transfers "
+            << run.transfers << " | call mean " << run.mean_ns / 1000.0
+            << " us | max " << run.max_ns / 1000.0 << " us" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* backend = argc > 1 ? argv[1] : "sim";
+  double seconds = argc > 2 ? std::atof(argv[2]) : 2.0;
+
+  CLSPBackend type = CLSP_BACKEND_SIM;
+  if (std::strcmp(backend, "libusb") == 0) {
+    type = CLSP_BACKEND_LIBUSB;
+  } else if (std::strcmp(backend, "hidraw") == 0) {
+    type = CLSP_BACKEND_HIDRAW;
+  } else if (std::strcmp(backend, "sim") != 0) {
+    std::cerr << "Unknown backend: " << backend << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<CLSPJoystick> joystick;
+  try {
+    joystick = std::make_unique<CLSPJoystick>("", type);
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::vector<uint8_t> blocks;
+  for (int i = 0; i < PRODUCERS; i++) {
+    int block = joystick->createEffect(CLSP_PERIODIC_SINE);
+    blocks.push_back(block > 0 ? block : 0x02 + i);
+  }
+
+  Run direct = produce(*joystick, blocks, false, seconds);
+
+  int ret = joystick->startParameterMailboxes();
+  if (ret < 0) {
+    std::cerr << "Unable to start the mailboxes: " << ret << std::endl;
+    return 1;
+  }
+
+  Run posted = produce(*joystick, blocks, true, seconds);
+  CLSPMailboxStats stats = joystick->getMailboxStats();
+
+  Run slewed = swing(*joystick, blocks, seconds);
+  CLSPMailboxStats slew_stats = joystick->getMailboxStats();
+  joystick->stopParameterMailboxes();
+
+  std::cout << std::fixed << std::setprecision(2);
+  print("direct   ", direct);
+  print("mailboxes", posted);
+  std::cout << "frames    " << stats.frames << " | active "
+            << stats.active_frames << " | overruns " << stats.overruns
+            << " | policy " << (stats.realtime ? "SCHED_FIFO" : "default")
+            << std::endl;
+  std::cout << "fields    posted " << stats.posted << " | coalesced "
+            << stats.coalesced << " | reports " << stats.sent << std::endl;
+  print("slews    ", slewed);
+  std::cout << "steps     " << slew_stats.slew_steps - stats.slew_steps
+            << " | slews " << slew_stats.slews - stats.slews
+            << " | interrupted " << slew_stats.interrupted - stats.interrupted
+            << std::endl;
+
+  return 0;
+}
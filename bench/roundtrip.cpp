@@ -0,0 +1,127 @@
+// Compares the report latency of the libusb, hidraw and simulated backends.
+//
+// The output latency runs from the call to the completion of a Set Device
+// Gain report on the interrupt endpoint. The feature round trip is a Create
+// New Effect SET_REPORT followed by the PID Block Load GET_REPORT, i.e. one
+// createEffect() call.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "clsp.hpp"
+#include "clsp_clock.hpp"
+
+namespace {
+
+// The kernel driver is bound again asynchronously after libusb releases the
+// stick
+const int OPEN_ATTEMPTS = 30;
+const auto OPEN_RETRY = std::chrono::milliseconds(100);
+
+struct Result {
+  std::vector<double> output_us;
+  std::vector<double> feature_us;
+  int errors = 0;
+};
+
+std::unique_ptr<CLSPJoystick> open(CLSPBackend backend) {
+  for (int attempt = 1;; attempt++) {
+    try {
+      return std::make_unique<CLSPJoystick>("", backend);
+    } catch (const std::runtime_error& e) {
+      if (attempt == OPEN_ATTEMPTS) {
+        std::cerr << e.what() << std::endl;
+        return nullptr;
+      }
+    }
+
+    std::this_thread::sleep_for(OPEN_RETRY);
+  }
+}
+
+Result run(CLSPJoystick& joystick, int count) {
+  Result result;
+
+  for (int i = 0; i < count; i++) {
+    // Alternating values, the shadow cache would drop a repeated report
+    uint64_t start = clspMonotonicNs();
+    CLSPCompletion sent = joystick.setGain(i % 2 == 0 ? 0xfe : 0xff);
+
+    if (sent.wait() < 0) {
+      result.errors++;
+    } else {
+      result.output_us.push_back((sent.completionTime() - start) / 1000.0);
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    uint64_t start = clspMonotonicNs();
+    int block = joystick.createEffect(CLSP_CONSTANT_FORCE);
+    uint64_t end = clspMonotonicNs();
+
+    if (block < 0) {
+      result.errors++;
+      continue;
+    }
+
+    result.feature_us.push_back((end - start) / 1000.0);
+    joystick.freeEffect(block).wait();
+  }
+
+  return result;
+}
+
+void print(const char* name, const std::vector<double>& values) {
+  std::cout << "  " << std::left << std::setw(16) << name << std::right
+            << std::fixed << std::setprecision(1);
+  std::cout << " p50 " << std::setw(8) << clspPercentile(values, 0.5)
+            << " us";
+  std::cout << " | p99 " << std::setw(8) << clspPercentile(values, 0.99)
+            << " us";
+  std::cout << " | max " << std::setw(8) << clspPercentile(values, 1.0)
+            << " us" << std::endl;
+}
+
+void bench(const char* name, CLSPBackend backend, int count) {
+  std::unique_ptr<CLSPJoystick> joystick = open(backend);
+  if (!joystick) {
+    std::cout << name << ": unavailable" << std::endl;
+    return;
+  }
+
+  Result result = run(*joystick, count);
+
+  std::cout << name << " (" << result.errors << " errors)" << std::endl;
+  print("output report", result.output_us);
+  print("feature report", result.feature_us);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* backend = argc > 1 ? argv[1] : "all";
+  int count = argc > 2 ? std::atoi(argv[2]) : 500;
+
+  // One after the other, libusb detaches the kernel driver hidraw goes through
+  if (std::strcmp(backend, "all") == 0 ||
+      std::strcmp(backend, "libusb") == 0) {
+    bench("libusb", CLSP_BACKEND_LIBUSB, count);
+  }
+  if (std::strcmp(backend, "all") == 0 ||
+      std::strcmp(backend, "hidraw") == 0) {
+    bench("hidraw", CLSP_BACKEND_HIDRAW, count);
+  }
+  // Baseline of the library overhead with the default simulated latency
+  if (std::strcmp(backend, "all") == 0 || std::strcmp(backend, "sim") == 0) {
+    bench("sim", CLSP_BACKEND_SIM, count);
+  }
+
+  return 0;
+}
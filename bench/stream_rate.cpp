@@ -0,0 +1,90 @@
+// Measures the achieved rate and jitter of the force stream while a producer
+// thread writes a sine force at a physics-like tick rate.
+//
+// The jitter is the standard deviation of the interval between two stream
+// ticks; the lateness is the wake-up time past each tick deadline. Given a
+// CPU, the stream runs with the full real-time profile: pinned on that CPU,
+// with the memory locked, and woken by the given timer.
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "clsp.hpp"
+
+int main(int argc, char* argv[]) {
+  int rate_hz = argc > 1 ? std::atoi(argv[1]) : 1000;
+  int seconds = argc > 2 ? std::atoi(argv[2]) : 10;
+  int cpu = argc > 3 ? std::atoi(argv[3]) : -1;
+  bool timerfd = argc > 4 && std::strcmp(argv[4], "timerfd") == 0;
+
+  CLSPJoystick joystick;
+
+  if (cpu >= 0) {
+    CLSPRealtimeProfile profile;
+    profile.cpus = {cpu};
+    profile.lock_memory = true;
+    profile.timer = timerfd ? CLSP_TIMER_TIMERFD : CLSP_TIMER_NANOSLEEP;
+
+    CLSPRealtimeStatus status = joystick.setRealtimeProfile(profile);
+    std::cout << "io thread  " << (status.realtime ? "SCHED_FIFO" : "default")
+              << " | affinity " << (status.affinity ? "set" : "refused")
+              << " | memory " << (status.memory_locked ? "locked" : "paged")
+              << std::endl;
+  }
+
+  int ret = joystick.startForceStream(rate_hz);
+  if (ret < 0) {
+    std::cerr << "Unable to start the force stream: " << ret << std::endl;
+    return 1;
+  }
+
+  // 240 Hz producer, 0.5 Hz sine
+  std::atomic<bool> done{false};
+  std::thread producer([&joystick, &done] {
+    auto next = std::chrono::steady_clock::now();
+    double t = 0.0;
+
+    while (!done) {
+      joystick.setStreamForce(0.5f * std::sin(2.0 * M_PI * 0.5 * t));
+
+      next += std::chrono::microseconds(1000000 / 240);
+      t += 1.0 / 240;
+      std::this_thread::sleep_until(next);
+    }
+  });
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+  done = true;
+  producer.join();
+
+  CLSPStreamStats stats = joystick.getStreamStats();
+  joystick.stopForceStream();
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "policy     " << (stats.realtime ? "SCHED_FIFO" : "default")
+            << " | affinity " << (stats.affinity ? "set" : "none")
+            << " | memory " << (stats.memory_locked ? "locked" : "paged")
+            << std::endl;
+  std::cout << "rate       " << stats.rate_hz << " Hz (target "
+            << stats.target_hz << " Hz)" << std::endl;
+  std::cout << "period     mean " << stats.period_mean_us << " us | jitter "
+            << stats.period_stddev_us << " us | min " << stats.period_min_us
+            << " us | max " << stats.period_max_us << " us" << std::endl;
+  std::cout << "lateness   mean " << stats.lateness_mean_us << " us | p50 "
+            << stats.lateness_p50_us << " us | p99 " << stats.lateness_p99_us
+            << " us | p99.9 " << stats.lateness_p999_us << " us | max "
+            << stats.lateness_max_us << " us" << std::endl;
+  std::cout << "ticks      " << stats.ticks << " | sent " << stats.sent
+            << " | unchanged " << stats.unchanged << " | busy " << stats.busy
+            << " | overruns " << stats.overruns << " | errors "
+            << stats.errors << std::endl;
+
+  return 0;
+}
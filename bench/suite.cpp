@@ -0,0 +1,494 @@
+// Transport benchmark suite: report encoding cost, submit-to-completion
+// latency and sustained rate per report ID, latency of the time-critical
+// reports behind a burst of parameter uploads, and duration of the
+// high-level effect calls, against a stick or the simulated device.
+//
+// The encoding cost is measured on reports the shadow cache drops, i.e. the
+// report is built and compared but never submitted. The latency runs from the
+// call to the completion of the report. The sustained rate keeps a window of
+// reports in flight for a fixed time; the scheduler merges the reports of the
+// same ID and block still queued, so the rate on the wire counts the reports
+// the scheduler sent, and the call rate is printed next to it. The high-level
+// calls are timed until they return and until their last report completes.
+//
+// With --json, every metric is also written to a file as one JSON object per
+// line, away from the messages CLSPJoystick prints.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clsp.hpp"
+#include "clsp_clock.hpp"
+#include "clsp_transport_sim.hpp"
+
+namespace {
+
+// The high-level calls upload a whole effect, a tenth of the iterations
+const int HIGH_LEVEL_DIVIDER = 10;
+
+// Parameter reports queued before each time-critical report, as many as the
+// effect bursts of a game
+const int PRIORITY_BURST = 16;
+
+const char* const CLASS_NAMES[CLSP_REPORT_CLASSES] = {
+    "device", "operation", "stream", "parameter"};
+
+struct Options {
+  std::string backend = "sim";
+  int count = 1000;
+  double seconds = 1.0;
+  std::string json;
+  CLSPSimConfig sim;
+};
+
+// Sends one report of a kind, i alternates the payload so that the shadow
+// cache never drops it
+typedef std::function<CLSPCompletion(int i)> ReportCall;
+
+struct ReportKind {
+  const char* name;
+  uint8_t report_id;
+  ReportCall call;
+};
+
+class Output {
+ public:
+  Output(const std::string& backend, std::ostream* json)
+      : backend(backend), json(json) {}
+
+  void section(const char* title) { std::cout << title << std::endl; }
+
+  void encode(const char* name, uint8_t report_id, double ns_per_call) {
+    label(name, report_id);
+    std::cout << std::setw(10) << ns_per_call << " ns/call" << std::endl;
+
+    if (begin("encode", name, report_id)) {
+      *this->json << ",\"ns_per_call\":" << ns_per_call << "}" << std::endl;
+    }
+  }
+
+  void latency(const char* bench, const char* name, int report_id,
+               const std::vector<double>& values, int errors) {
+    double p50 = clspPercentile(values, 0.5);
+    double p99 = clspPercentile(values, 0.99);
+    double p999 = clspPercentile(values, 0.999);
+    double max = clspPercentile(values, 1.0);
+
+    label(name, report_id);
+    std::cout << " p50 " << std::setw(8) << p50 << " us";
+    std::cout << " | p99 " << std::setw(8) << p99 << " us";
+    std::cout << " | p99.9 " << std::setw(8) << p999 << " us";
+    std::cout << " | max " << std::setw(8) << max << " us";
+    if (errors > 0) {
+      std::cout << " (" << errors << " errors)";
+    }
+    std::cout << std::endl;
+
+    if (begin(bench, name, report_id)) {
+      *this->json << ",\"count\":" << values.size()
+                  << ",\"errors\":" << errors << ",\"p50_us\":" << p50
+                  << ",\"p99_us\":" << p99 << ",\"p999_us\":" << p999
+                  << ",\"max_us\":" << max << "}" << std::endl;
+    }
+  }
+
+  void queueing(const char* name, const CLSPReportClassStats& stats) {
+    label(name, -1);
+    std::cout << " mean " << std::setw(8) << stats.delay_mean_us << " us";
+    std::cout << " | p99 " << std::setw(8) << stats.delay_p99_us << " us";
+    std::cout << " | max " << std::setw(8) << stats.delay_max_us << " us";
+    std::cout << " | " << stats.sent << " sent, " << stats.coalesced
+              << " coalesced" << std::endl;
+
+    if (begin("queueing", name, -1)) {
+      *this->json << ",\"written\":" << stats.written
+                  << ",\"coalesced\":" << stats.coalesced
+                  << ",\"sent\":" << stats.sent
+                  << ",\"mean_us\":" << stats.delay_mean_us
+                  << ",\"p50_us\":" << stats.delay_p50_us
+                  << ",\"p99_us\":" << stats.delay_p99_us
+                  << ",\"max_us\":" << stats.delay_max_us << "}"
+                  << std::endl;
+    }
+  }
+
+  void rate(const char* name, uint8_t report_id, uint64_t reports,
+            double reports_per_s, uint64_t calls, double calls_per_s,
+            int status) {
+    label(name, report_id);
+    std::cout << std::setw(10) << reports_per_s << " reports/s on the wire";
+    std::cout << " | " << std::setw(10) << calls_per_s << " calls/s";
+    if (status < 0) {
+      std::cout << " (error " << status << ")";
+    }
+    std::cout << std::endl;
+
+    if (begin("rate", name, report_id)) {
+      *this->json << ",\"reports\":" << reports
+                  << ",\"reports_per_s\":" << reports_per_s
+                  << ",\"calls\":" << calls
+                  << ",\"calls_per_s\":" << calls_per_s
+                  << ",\"status\":" << status << "}" << std::endl;
+    }
+  }
+
+ private:
+  std::string backend;
+  // One object per metric and line, NULL without --json
+  std::ostream* json;
+
+  bool begin(const char* bench, const char* name, int report_id) {
+    if (this->json == nullptr) {
+      return false;
+    }
+
+    *this->json << std::fixed << std::setprecision(3);
+    *this->json << "{\"backend\":\"" << this->backend << "\",\"bench\":\""
+                << bench << "\",\"name\":\"" << name
+                << "\",\"report_id\":" << report_id;
+
+    return true;
+  }
+
+  void label(const char* name, int report_id) {
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "  " << std::left << std::setw(28) << name << std::right;
+    if (report_id >= 0) {
+      std::cout << " 0x" << std::hex << std::setw(2) << std::setfill('0')
+                << report_id << std::dec << std::setfill(' ');
+    } else {
+      std::cout << "     ";
+    }
+  }
+};
+
+std::vector<ReportKind> reportKinds(CLSPJoystick& joystick, uint8_t block) {
+  return {
+      {"set effect", 0x01,
+       [&joystick, block](int i) {
+         return joystick.setGeneralSettings(CLSP_CONSTANT_FORCE, 3000 + i % 2,
+                                            0, 0, 127, 0xff, 0, 0, block);
+       }},
+      {"envelope", 0x02,
+       [&joystick, block](int i) {
+         return joystick.setEnvelopeSettings(0, 0, 300 + i % 2, 300, block);
+       }},
+      {"periodic", 0x04,
+       [&joystick, block](int i) {
+         return joystick.setPeriodicSettings(127, 0, 0, 100 + i % 2, block);
+       }},
+      {"constant force", 0x05,
+       [&joystick, block](int i) {
+         return joystick.setConstantForce(i % 2 == 0 ? 1000 : -1000, block);
+       }},
+      {"effect operation", 0x0a,
+       [&joystick, block](int i) {
+         return joystick.playEffect(i % 2 == 0, 1, block);
+       }},
+      {"device gain", 0x0d,
+       [&joystick](int i) {
+         return joystick.setGain(i % 2 == 0 ? 0xfe : 0xff);
+       }},
+  };
+}
+
+void benchEncode(const std::vector<ReportKind>& kinds,
+                 const Options& options, Output& output) {
+  output.section("Encoding (shadow hit, not submitted)");
+
+  for (const ReportKind& kind : kinds) {
+    // Same payload every time once the first report is sent. An odd index
+    // is a stop for the effect operation, only repeated stops are dropped.
+    kind.call(1).wait();
+
+    uint64_t start = clspMonotonicNs();
+    for (int i = 0; i < options.count; i++) {
+      kind.call(1);
+    }
+    uint64_t end = clspMonotonicNs();
+
+    output.encode(kind.name, kind.report_id,
+                  static_cast<double>(end - start) / options.count);
+  }
+}
+
+void benchLatency(CLSPJoystick& joystick, const std::vector<ReportKind>& kinds,
+                  const Options& options, Output& output) {
+  output.section("Submit to completion");
+
+  for (const ReportKind& kind : kinds) {
+    // The first report would repeat the last one sent
+    joystick.forceResend();
+
+    std::vector<double> values;
+    int errors = 0;
+
+    for (int i = 0; i < options.count; i++) {
+      uint64_t start = clspMonotonicNs();
+      CLSPCompletion sent = kind.call(i + 1);
+
+      if (sent.wait() < 0) {
+        errors++;
+      } else {
+        values.push_back((sent.completionTime() - start) / 1000.0);
+      }
+    }
+
+    output.latency("latency", kind.name, kind.report_id, values, errors);
+  }
+}
+
+void benchRate(CLSPJoystick& joystick, const std::vector<ReportKind>& kinds,
+               const Options& options, Output& output) {
+  output.section("Sustained rate");
+
+  auto duration = static_cast<uint64_t>(options.seconds * 1e9);
+
+  for (const ReportKind& kind : kinds) {
+    joystick.forceResend();
+
+    // The only writer of its class meanwhile, its sent counter is the wire
+    CLSPReportClass type = CLSPReportScheduler::classify(&kind.report_id);
+    uint64_t sent = joystick.getSchedulerStats().classes[type].sent;
+
+    // Only the transport bounds the reports in flight
+    CLSPSubmitWindow window(std::numeric_limits<size_t>::max());
+
+    uint64_t start = clspMonotonicNs();
+    for (int i = 1; clspMonotonicNs() - start < duration; i++) {
+      window.push(kind.call(i));
+    }
+    int status = window.drain();
+
+    uint64_t reports = joystick.getSchedulerStats().classes[type].sent - sent;
+
+    double elapsed_s = (window.lastCompletion() - start) / 1e9;
+    double rate = elapsed_s > 0.0 ? reports / elapsed_s : 0.0;
+    double call_rate = elapsed_s > 0.0 ? window.count() / elapsed_s : 0.0;
+
+    output.rate(kind.name, kind.report_id, reports, rate, window.count(),
+                call_rate, status);
+  }
+}
+
+void benchPriority(CLSPJoystick& joystick,
+                   const std::vector<ReportKind>& kinds, uint8_t burst_block,
+                   const Options& options, Output& output) {
+  output.section("Time-critical reports behind a parameter burst");
+
+  const int8_t samples[CLSPCustomForceDataReport::MAX_SAMPLES] = {};
+  int count = std::max(1, options.count / HIGH_LEVEL_DIVIDER);
+
+  std::vector<double> burst_values;
+
+  for (const ReportKind& kind : kinds) {
+    // Only the reports the scheduler moves ahead of the parameters
+    if (CLSPReportScheduler::classify(&kind.report_id) ==
+        CLSP_CLASS_PARAMETER) {
+      continue;
+    }
+
+    std::vector<double> values;
+    int errors = 0;
+
+    for (int i = 0; i < count; i++) {
+      joystick.forceResend();
+
+      // Custom force data is never merged, each report is a transfer
+      uint64_t start = clspMonotonicNs();
+      CLSPCompletion burst;
+      for (int chunk = 0; chunk < PRIORITY_BURST; chunk++) {
+        burst = joystick.setCustomForceData(
+            chunk * CLSPCustomForceDataReport::MAX_SAMPLES, samples,
+            CLSPCustomForceDataReport::MAX_SAMPLES, burst_block);
+      }
+
+      uint64_t called = clspMonotonicNs();
+      CLSPCompletion sent = kind.call(i + 1);
+
+      if (sent.wait() < 0) {
+        errors++;
+      } else {
+        values.push_back((sent.completionTime() - called) / 1000.0);
+      }
+
+      if (burst.wait() == 0) {
+        burst_values.push_back((burst.completionTime() - start) / 1000.0);
+      }
+    }
+
+    output.latency("priority", kind.name, kind.report_id, values, errors);
+  }
+
+  output.latency("priority", "parameter burst", -1, burst_values, 0);
+
+  // Since the joystick creation, the previous benchmarks included
+  CLSPSchedulerStats stats = joystick.getSchedulerStats();
+  for (int type = 0; type < CLSP_REPORT_CLASSES; type++) {
+    output.queueing(CLASS_NAMES[type], stats.classes[type]);
+  }
+}
+
+void benchHighLevel(CLSPJoystick& joystick, const Options& options,
+                    Output& output) {
+  output.section("High-level calls (return, then completion)");
+
+  struct Call {
+    const char* name;
+    std::function<CLSPCompletion()> call;
+  };
+
+  const Call calls[] = {
+      {"constantForceEffect", [&joystick] {
+         return joystick.constantForceEffect();
+       }},
+      {"ramp", [&joystick] { return joystick.ramp(); }},
+      {"periodicEffect", [&joystick] {
+         return joystick.periodicEffect(CLSP_PERIODIC_SINE);
+       }},
+      {"conditionalEffect", [&joystick] {
+         return joystick.conditionalEffect(CLSP_PERIODIC_COND_SPRING);
+       }},
+  };
+
+  int count = std::max(1, options.count / HIGH_LEVEL_DIVIDER);
+
+  for (const Call& call : calls) {
+    std::vector<double> returned;
+    std::vector<double> completed;
+    int errors = 0;
+
+    for (int i = 0; i < count; i++) {
+      // Full upload every time
+      joystick.forceResend();
+
+      uint64_t start = clspMonotonicNs();
+      CLSPCompletion started = call.call();
+      uint64_t end = clspMonotonicNs();
+
+      returned.push_back((end - start) / 1000.0);
+
+      if (started.wait() < 0) {
+        errors++;
+      } else {
+        completed.push_back((started.completionTime() - start) / 1000.0);
+      }
+    }
+
+    std::string name = call.name;
+    output.latency("call_return", (name + " return").c_str(), -1, returned,
+                   0);
+    output.latency("call_complete", (name + " complete").c_str(), -1,
+                   completed, errors);
+  }
+
+  joystick.deviceControl(false).wait();
+}
+
+std::unique_ptr<CLSPJoystick> open(const Options& options) {
+  if (options.backend == "sim") {
+    return std::make_unique<CLSPJoystick>(
+        std::make_unique<CLSPSimTransport>(options.sim), "");
+  }
+  if (options.backend == "hidraw") {
+    return std::make_unique<CLSPJoystick>("", CLSP_BACKEND_HIDRAW);
+  }
+
+  return std::make_unique<CLSPJoystick>("", CLSP_BACKEND_LIBUSB);
+}
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program
+            << " [--backend libusb|hidraw|sim] [--count N] [--seconds S]"
+               " [--latency US] [--control-latency US] [--json FILE]"
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+
+    if (std::strcmp(argv[i], "--json") == 0 && has_value) {
+      options.json = argv[++i];
+    } else if (std::strcmp(argv[i], "--backend") == 0 && has_value) {
+      options.backend = argv[++i];
+    } else if (std::strcmp(argv[i], "--count") == 0 && has_value) {
+      options.count = std::max(1, std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--seconds") == 0 && has_value) {
+      options.seconds = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "--latency") == 0 && has_value) {
+      options.sim.output_latency = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--control-latency") == 0 && has_value) {
+      options.sim.control_latency = std::atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (options.backend != "libusb" && options.backend != "hidraw" &&
+      options.backend != "sim") {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::unique_ptr<CLSPJoystick> joystick;
+  try {
+    joystick = open(options);
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  int block = joystick->createEffect(CLSP_CONSTANT_FORCE);
+  if (block < 0) {
+    // Firmware without block management
+    block = 0x01;
+  }
+
+  std::ofstream json;
+  if (!options.json.empty()) {
+    json.open(options.json);
+    if (!json) {
+      std::cerr << "Unable to write " << options.json << std::endl;
+      return 1;
+    }
+  }
+
+  Output output(options.backend, json.is_open() ? &json : nullptr);
+  std::vector<ReportKind> kinds = reportKinds(*joystick, block);
+
+  benchEncode(kinds, options, output);
+  benchLatency(*joystick, kinds, options, output);
+  benchRate(*joystick, kinds, options, output);
+
+  // Parameter bursts go to another block, the reports of a block keep their
+  // order
+  int burst_block = joystick->createEffect(CLSP_RAMP);
+
+  benchPriority(*joystick, kinds, burst_block < 0 ? block + 1 : burst_block,
+                options, output);
+
+  joystick->playEffect(false, 1, block).wait();
+  joystick->freeEffect(block).wait();
+  if (burst_block >= 0) {
+    joystick->freeEffect(burst_block).wait();
+  }
+
+  benchHighLevel(*joystick, options, output);
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+// Measures the force dropout when switching between two effects, with the
+// stop/upload/start sequence and with double-buffered blocks.
+//
+// The dropout of a switch is the time between the completion of the report
+// that stopped the previous effect and the completion of the report that
+// started the new one. The switch time runs from the call to that last
+// completion.
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "clsp.hpp"
+#include "clsp_clock.hpp"
+
+namespace {
+
+struct Result {
+  std::vector<double> gap_us;
+  std::vector<double> switch_us;
+};
+
+Result run(CLSPJoystick& joystick, CLSPSwitchMode mode, int switches) {
+  Result result;
+
+  joystick.setSwitchMode(mode);
+
+  for (int i = 0; i < switches; i++) {
+    // Re-upload every time, as before the shadow cache
+    joystick.forceResend();
+
+    uint64_t start = clspMonotonicNs();
+
+    CLSPCompletion started;
+    if (i % 2 == 0) {
+      started = joystick.periodicEffect(CLSP_PERIODIC_SINE);
+    } else {
+      started = joystick.conditionalEffect(CLSP_PERIODIC_COND_SPRING);
+    }
+
+    started.wait();
+
+    uint64_t start_done = started.completionTime();
+    uint64_t stop_done = joystick.getLastStop().completionTime();
+
+    result.switch_us.push_back((start_done - start) / 1000.0);
+
+    // The first switch has no previous effect to stop
+    if (i > 0 && stop_done != 0) {
+      result.gap_us.push_back((start_done - stop_done) / 1000.0);
+    }
+  }
+
+  return result;
+}
+
+void print(const char* name, const Result& result) {
+  std::cout << std::left << std::setw(20) << name << std::right << std::fixed
+            << std::setprecision(1);
+  std::cout << " gap p50 " << std::setw(8)
+            << clspPercentile(result.gap_us, 0.5) << " us";
+  std::cout << " | gap max " << std::setw(8)
+            << clspPercentile(result.gap_us, 1.0) << " us";
+  std::cout << " | switch p50 " << std::setw(8)
+            << clspPercentile(result.switch_us, 0.5) << " us";
+  std::cout << " | switch p99 " << std::setw(8)
+            << clspPercentile(result.switch_us, 0.99) << " us" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int switches = argc > 1 ? std::atoi(argv[1]) : 200;
+
+  CLSPJoystick joystick;
+
+  print("stop/upload/start",
+        run(joystick, CLSP_SWITCH_STOP_UPLOAD_START, switches));
+  print("double-buffered",
+        run(joystick, CLSP_SWITCH_DOUBLE_BUFFERED, switches));
+
+  return 0;
+}
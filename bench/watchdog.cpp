@@ -0,0 +1,115 @@
+// Measures how fast the force watchdog stops the effects when the host
+// stalls: a 240 Hz producer feeds the force stream, and every stall queues a
+// burst of parameter updates on the endpoint before going silent, so the
+// stop has to get past a full transfer pool.
+//
+// The reaction runs from the missed deadline to the submission of the stop,
+// the zeroing to its completion, i.e. until the stick got it.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "clsp.hpp"
+
+namespace {
+
+// Producer period, a 240 Hz simulation loop
+const auto PRODUCER_PERIOD = std::chrono::microseconds(4167);
+// Time fed between two stalls
+const auto FED_TIME = std::chrono::milliseconds(200);
+// Parameter updates queued right before a stall
+const int BURST_REPORTS = 32;
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* backend = argc > 1 ? argv[1] : "sim";
+  int stalls = argc > 2 ? std::atoi(argv[2]) : 20;
+  unsigned int deadline_ms = argc > 3 ? std::atoi(argv[3]) : 20;
+
+  CLSPBackend type = CLSP_BACKEND_SIM;
+  if (std::strcmp(backend, "libusb") == 0) {
+    type = CLSP_BACKEND_LIBUSB;
+  } else if (std::strcmp(backend, "hidraw") == 0) {
+    type = CLSP_BACKEND_HIDRAW;
+  } else if (std::strcmp(backend, "sim") != 0) {
+    std::cerr << "Unknown backend: " << backend << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<CLSPJoystick> joystick;
+  try {
+    joystick = std::make_unique<CLSPJoystick>("", type);
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  int ret = joystick->startForceStream(1000);
+  if (ret < 0) {
+    std::cerr << "Unable to start the force stream: " << ret << std::endl;
+    return 1;
+  }
+
+  ret = joystick->startWatchdog(deadline_ms);
+  if (ret < 0) {
+    std::cerr << "Unable to start the watchdog: " << ret << std::endl;
+    return 1;
+  }
+
+  // Effect block the burst updates, apart from the streamed one
+  int block = joystick->createEffect(CLSP_RAMP);
+  if (block < 0) {
+    block = 0x02;
+  }
+
+  // Long enough for the deadline and the queued reports to go through
+  auto stall_time = std::chrono::milliseconds(deadline_ms) * 2 +
+                    std::chrono::milliseconds(BURST_REPORTS * 2);
+
+  for (int stall = 0; stall < stalls; stall++) {
+    // The stream needs a restart once the watchdog stopped the effects
+    if (stall > 0) {
+      joystick->stopForceStream();
+      joystick->startForceStream(1000);
+    }
+
+    auto end = std::chrono::steady_clock::now() + FED_TIME;
+    for (int tick = 0; std::chrono::steady_clock::now() < end; tick++) {
+      joystick->setStreamForce(0.5f * std::sin(tick * 0.05f));
+      std::this_thread::sleep_for(PRODUCER_PERIOD);
+    }
+
+    // Distinct values, the shadow cache does not drop them
+    for (int i = 0; i < BURST_REPORTS; i++) {
+      joystick->setRampSettings(-i, i, block);
+    }
+
+    std::this_thread::sleep_for(stall_time);
+  }
+
+  CLSPWatchdogStats stats = joystick->getWatchdogStats();
+  joystick->stopWatchdog();
+  joystick->stopForceStream();
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "deadline   " << stats.deadline_ms << " ms | policy "
+            << (stats.realtime ? "SCHED_FIFO" : "default") << " | stop "
+            << (stats.priority_path ? "reserved slot" : "behind the writes")
+            << std::endl;
+  std::cout << "stalls     " << stalls << " | fired " << stats.fired
+            << " | failed " << stats.failed << std::endl;
+  std::cout << "reaction   mean " << stats.reaction_mean_us << " us | max "
+            << stats.reaction_max_us << " us" << std::endl;
+  std::cout << "zeroing    mean " << stats.zeroing_mean_us << " us | max "
+            << stats.zeroing_max_us << " us" << std::endl;
+
+  return 0;
+}
@@ -1,296 +1,1174 @@
 #include "clsp.hpp"
 
-CLSPJoystick::CLSPJoystick() {
-  if (libusb_init(NULL) < 0) {
-    throw std::runtime_error("Unable to init libusb context");
+#include <algorithm>
+#include <cstring>
+
+#include "clsp_clock.hpp"
+#include "clsp_transport_hidraw.hpp"
+#include "clsp_transport_libusb.hpp"
+#include "clsp_transport_sim.hpp"
+
+namespace {
+
+// FX endpoint reports carry a 7-byte frame after the 0x3f 0x11 header, the
+// first byte of the frame being a node index
+const int FX_FRAME_OFFSET = 4;
+const int FX_FRAME_SIZE = 7;
+const int FX_MAX_FRAMES = 6;
+
+struct FXInitPhase {
+  const char* name;
+  // Every node of the range receives the frames in order, its index
+  // replacing the first frame byte
+  uint8_t first_node;
+  uint8_t last_node;
+  int frame_count;
+  uint8_t frames[FX_MAX_FRAMES][FX_FRAME_SIZE];
+};
+
+// Init FX loop on the 2nd endpoint
+// May be unnecessary, see if the setGlobalFXGains has any effect
+// Could be for the CAN over USB pipeline
+const FXInitPhase FX_INIT_PHASES[] = {
+    {"fx header", 0x7e, 0x7e, 1, {{0x00, 0x86, 0x2f, 0x60, 0x21, 0x00, 0x03}}},
+    {"fx nodes", 0x01, 0x7f, 1, {{0x00, 0x86, 0x40, 0x00, 0x10, 0x00, 0x00}}},
+    {"fx node setup",
+     0x01,
+     0x02,
+     6,
+     {{0x00, 0x86, 0x40, 0x18, 0x30, 0x00, 0x00},
+      {0x00, 0x86, 0x40, 0x80, 0x21, 0x0a, 0x00},
+      {0x00, 0x86, 0x40, 0x80, 0x21, 0x0c, 0x00},
+      {0x00, 0x86, 0x40, 0x80, 0x21, 0x01, 0x00},
+      {0x00, 0x86, 0x40, 0x45, 0x30, 0x00, 0x00},
+      {0x00, 0x86, 0x40, 0x35, 0x30, 0x00, 0x00}}},
+};
+
+std::unique_ptr<CLSPTransport> makeTransport(CLSPBackend backend) {
+  if (backend == CLSP_BACKEND_HIDRAW) {
+    return std::make_unique<CLSPHidrawTransport>();
   }
-
-  this->usb_handle = libusb_open_device_with_vid_pid(NULL, 0x25bb, 0x00d3);
-  if (this->usb_handle == nullptr) {
-    throw std::runtime_error("Unable to open device");
+  if (backend == CLSP_BACKEND_SIM) {
+    return std::make_unique<CLSPSimTransport>(CLSPSimConfig());
   }
 
-  auto usb_device = libusb_get_device(this->usb_handle);
+  return std::make_unique<CLSPLibusbTransport>(nullptr);
+}
 
-  // N.B.: Needs to be supported by the OS
-  if (libusb_set_auto_detach_kernel_driver(this->usb_handle, true) < 0) {
-    throw std::runtime_error("Unable to auto detach kernel driver");
-  }
+// Set on the force stream thread: its reports repeat the last force the
+// host set rather than update it, they do not feed the watchdog
+thread_local bool stream_thread = false;
+
+// Set on the mailbox thread: its reports carry values the host posted, the
+// posts feed the watchdog, and the slew steps go on without the host
+thread_local bool mailbox_thread = false;
+
+}  // namespace
+
+CLSPJoystick::CLSPJoystick() : CLSPJoystick("", CLSP_BACKEND_LIBUSB) {}
+
+CLSPJoystick::CLSPJoystick(const std::string& device_id)
+    : CLSPJoystick(device_id, CLSP_BACKEND_LIBUSB) {}
+
+CLSPJoystick::CLSPJoystick(const std::string& device_id,
+                           std::shared_ptr<CLSPUsbContext> context)
+    : CLSPJoystick(std::make_unique<CLSPLibusbTransport>(std::move(context)),
+                   device_id) {}
+
+CLSPJoystick::CLSPJoystick(const std::string& device_id, CLSPBackend backend)
+    : CLSPJoystick(makeTransport(backend), device_id) {}
 
-  libusb_claim_interface(this->usb_handle, INTERFACE_MAIN);
-  libusb_claim_interface(this->usb_handle, INTERFACE_FX);
+CLSPJoystick::CLSPJoystick(std::unique_ptr<CLSPTransport> transport,
+                           const std::string& device_id)
+    : transport(std::move(transport)),
+      device_id(device_id),
+      scheduler(
+          [this](const unsigned char* report, int length) {
+            return writeWire(report, length, false);
+          },
+          SCHEDULER_DEPTH, SCHEDULER_CAPACITY) {
+  // Interrupt IN endpoint of the main interface in the records
+  this->transport->setInputHandler(
+      [this](const unsigned char* report, int length) {
+        recordReport(CLSP_RECORD_IN, INTERFACE_MAIN + 1, report, length,
+                     CLSPCompletion());
+      });
+
+  openDevice();
 
   std::cout << "Device opened and claimed" << std::endl;
   std::cout << "Initialisation ..." << std::endl;
 
   initSequence();
 
+  this->connected = true;
+
+  this->connection_thread = std::thread(&CLSPJoystick::connectionLoop, this);
+
+  this->hotplug_watched = this->transport->watchHotplug(
+      [this](bool attached) { onHotplug(attached); });
+  if (!this->hotplug_watched) {
+    std::cerr << "Hotplug unavailable, no automatic reconnection" << std::endl;
+  }
+
   std::cout << "Device ready !" << std::endl;
 }
 
 CLSPJoystick::~CLSPJoystick() {
-  std::cout << "Stopping all effects and resetting device" << std::endl;
+  this->transport->unwatchHotplug();
 
-  playEffect(false, 0);
-  deviceControl(true);
+  {
+    std::lock_guard<std::mutex> lock(this->connection_mutex);
+    this->connection_stopping = true;
+  }
+  this->connection_cv.notify_all();
+  this->connection_thread.join();
+
+  stopWatchdog();
+  stopParameterMailboxes();
+  stopForceStream();
+
+  if (this->connected) {
+    std::cout << "Stopping all effects and resetting device" << std::endl;
+
+    // Stops every resident effect block
+    deviceControl(false);
+    deviceControl(true).wait();
+  }
 
   std::cout << "Releasing device interface" << std::endl;
 
-  libusb_release_interface(this->usb_handle, INTERFACE_MAIN);
-  libusb_release_interface(this->usb_handle, INTERFACE_FX);
-  libusb_close(this->usb_handle);
-  libusb_exit(NULL);
+  closeDevice();
 }
 
-int CLSPJoystick::deviceControl(bool reset) {
-  unsigned char txBuff[2] = {};
+void CLSPJoystick::openDevice() {
+  CLSPDeviceInfo info = this->transport->open(this->device_id);
 
-  txBuff[0] = 0x0c;
+  // Re-attach the same stick, not the first one found
+  if (this->device_id.empty()) {
+    this->device_id = info.serial.empty() ? info.path : info.serial;
+  }
 
-  if (reset) {
-    txBuff[1] = 0x04;  // device reset
-  } else {
-    txBuff[1] = 0x03;  // stop all effects
+  loadReportLayout(info);
+
+  std::lock_guard<std::mutex> lock(this->connection_mutex);
+  this->device_info = info;
+}
+
+void CLSPJoystick::loadReportLayout(const CLSPDeviceInfo& info) {
+  auto built_in = std::make_shared<const CLSPReportMap>();
+
+  // Keyed by firmware version, an unknown version is never cached
+  std::string cache =
+      info.firmware == 0
+          ? ""
+          : CLSPReportLayout::cachePath(CLSPTransport::VENDOR_ID,
+                                        CLSPTransport::PRODUCT_ID,
+                                        info.firmware);
+
+  CLSPReportLayout layout;
+  if (cache.empty() || !CLSPReportLayout::load(cache, info.firmware, layout)) {
+    std::vector<uint8_t> descriptor;
+    int ret = this->transport->reportDescriptor(INTERFACE_MAIN, descriptor);
+
+    try {
+      if (ret < 0) {
+        throw std::runtime_error(std::string("Unable to read descriptor: ") +
+                                 libusb_error_name(ret));
+      }
+      layout = CLSPReportLayout::parse(descriptor.data(), descriptor.size());
+    } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << ", using the built-in report layout"
+                << std::endl;
+      this->report_remapped = false;
+      std::atomic_store(&this->report_map, built_in);
+      return;
+    }
+
+    if (!cache.empty()) {
+      layout.save(cache, info.firmware);
+    }
   }
 
-  return libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                   sizeof(txBuff), nullptr, TIMEOUT);
+  auto map = std::make_shared<const CLSPReportMap>(layout);
+
+  if (map->remappedCount() > 0) {
+    std::cout << "Report layout of firmware " << std::hex << info.firmware
+              << std::dec << " differs from the built-in one, "
+              << map->remappedCount() << " reports remapped" << std::endl;
+  }
+  if (map->missingFields() > 0) {
+    std::cerr << map->missingFields()
+              << " report fields missing from the descriptor" << std::endl;
+  }
+
+  std::atomic_store(&this->report_map, map);
+  this->report_remapped = map->remappedCount() > 0;
+}
+
+void CLSPJoystick::closeDevice() {
+  // The reports sent until the next re-attach fail right away
+  this->transport->close();
 }
 
-int CLSPJoystick::setGain(uint8_t gain = 255) {
-  unsigned char txBuff[2] = {};
+bool CLSPJoystick::reconnect() {
+  // Taken before the init resets them
+  CLSPEffectBlocks blocks;
+  CLSPShadowCache reports;
+  {
+    std::lock_guard<std::mutex> lock(this->effects_mutex);
+    blocks = this->effect_blocks;
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->report_mutex);
+    reports = this->shadow;
+  }
+
+  try {
+    openDevice();
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    closeDevice();
+    return false;
+  }
 
-  txBuff[0] = 0x0d;
-  txBuff[1] = gain;
+  if (initSequence() < 0) {
+    closeDevice();
+    return false;
+  }
 
-  return libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                   sizeof(txBuff), nullptr, TIMEOUT);
+  restoreEffects(blocks, reports);
+
+  this->connected = true;
+
+  return true;
+}
+
+void CLSPJoystick::restoreEffects(const CLSPEffectBlocks& blocks,
+                                  const CLSPShadowCache& reports) {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+
+  CLSPSubmitWindow window(SUBMIT_WINDOW);
+
+  // New index of each block, the device may not hand out the same ones
+  uint8_t remap[CLSPEffectBlocks::MAX_EFFECT_BLOCK + 1] = {};
+
+  for (int old_block = 1; old_block <= CLSPEffectBlocks::MAX_EFFECT_BLOCK;
+       old_block++) {
+    uint8_t type = blocks.type(old_block);
+
+    // The custom force samples are not kept on the host
+    if (type == 0 || type == CLSP_CUSTOM_FORCE_DATA) {
+      continue;
+    }
+
+    // The init loads its own constant force block
+    int block = old_block;
+    if (this->block_load_supported && this->effect_blocks.type(block) != type) {
+      block = allocateBlock(type, 0);
+      if (block < 0) {
+        continue;
+      }
+    }
+
+    this->effect_blocks.pin(block, blocks.isPinned(old_block));
+    remap[old_block] = block;
+
+    bool infinite = false;
+
+    // The shadow holds the reports in the built-in layout
+    reports.replay(old_block, [&](const unsigned char* report, int length) {
+      unsigned char copy[16] = {};
+      std::memcpy(copy, report, std::min<size_t>(length, sizeof(copy)));
+      copy[1] = block;
+
+      if (copy[0] == 0x01) {
+        infinite = (copy[3] | copy[4] << 8) == INFINITE_DURATION;
+      }
+
+      // Only the effects that cannot have ended are started again
+      if (copy[0] == 0x0a && (copy[2] == 0x03 || !infinite)) {
+        return;
+      }
+
+      window.push(sendReport(INTERFACE_MAIN, copy, length));
+    });
+  }
+
+  this->active_block = remap[this->active_block];
+  this->stream_block = remap[this->stream_block];
+
+  window.drain();
 }
 
-int CLSPJoystick::playEffect(bool play, int repetitions = 1) {
-  unsigned char txBuff[4] = {};
+void CLSPJoystick::connectionLoop() {
+  std::unique_lock<std::mutex> lock(this->connection_mutex);
+
+  while (true) {
+    this->connection_cv.wait(lock, [this] {
+      return this->connection_stopping || this->device_left ||
+             this->device_arrived;
+    });
+
+    if (this->connection_stopping) {
+      return;
+    }
+
+    bool left = this->device_left;
+    bool arrived = this->device_arrived;
+    this->device_left = false;
+    this->device_arrived = false;
+
+    lock.unlock();
+
+    if (left && this->connected) {
+      this->connected = false;
+      closeDevice();
+
+      std::cout << "Device disconnected" << std::endl;
+      notifyConnection(CLSP_DEVICE_DISCONNECTED);
+    }
+
+    // Another stick with the same IDs may have been attached
+    if (arrived && !this->connected && devicePresent()) {
+      std::cout << "Device attached, initialisation ..." << std::endl;
+
+      if (reconnect()) {
+        std::cout << "Device ready !" << std::endl;
+        notifyConnection(CLSP_DEVICE_CONNECTED);
+      } else {
+        notifyConnection(CLSP_DEVICE_RECONNECT_FAILED);
+      }
+    }
 
-  // Play effect
-  txBuff[0] = 0x0a;  // Report ID
-  txBuff[1] = 0x01;  // Effect block index
+    lock.lock();
+  }
+}
+
+bool CLSPJoystick::devicePresent() {
+  for (const auto& device : this->transport->listDevices()) {
+    if (device.serial == this->device_id || device.path == this->device_id) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void CLSPJoystick::notifyConnection(CLSPConnectionState state) {
+  CLSPConnectionCallback callback;
+  {
+    std::lock_guard<std::mutex> lock(this->connection_mutex);
+    callback = this->connection_callback;
+  }
 
-  if (play) {
-    txBuff[2] = 0x01;         // Effect start
-    txBuff[3] = repetitions;  // Loop count
-  } else {
-    txBuff[2] = 0x03;  // Effect stop
-    txBuff[3] = 0x00;
+  if (callback) {
+    callback(state);
   }
+}
+
+void CLSPJoystick::onHotplug(bool attached) {
+  {
+    std::lock_guard<std::mutex> lock(this->connection_mutex);
 
-  return libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                   sizeof(txBuff), nullptr, TIMEOUT);
+    if (attached) {
+      this->device_arrived = true;
+    } else {
+      this->device_left = true;
+    }
+  }
+  this->connection_cv.notify_all();
 }
 
-int CLSPJoystick::setMagnitudeSettings(uint8_t magnitude = 127) {
-  unsigned char txBuff[4] = {};
+CLSPCompletion CLSPJoystick::deviceControl(bool reset) {
+  uint8_t control = CLSPDeviceControlReport::STOP_ALL_EFFECTS;
 
-  // Magnitude command
-  txBuff[0] = 0x05;  // Report ID
-  txBuff[1] = 0x01;  // Effect block index
-  txBuff[2] = magnitude;
-  txBuff[3] = 0x00;
+  if (reset) {
+    control = CLSPDeviceControlReport::DEVICE_RESET;
 
-  return libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                   sizeof(txBuff), nullptr, TIMEOUT);
+    // The reset frees every effect block
+    std::lock_guard<std::mutex> lock(this->effects_mutex);
+    this->effect_blocks.clear();
+  }
+
+  return sendReport(INTERFACE_MAIN, CLSPDeviceControlReport(control));
 }
 
-int CLSPJoystick::setRampSettings(int8_t ramp_start = -128,
-                                  int8_t ramp_end = 127) {
-  unsigned char txBuff[4] = {};
+CLSPCompletion CLSPJoystick::setGain(uint8_t gain = 255) {
+  // Restored by the init after a re-attach
+  this->gain = gain;
+
+  return sendReport(INTERFACE_MAIN, CLSPDeviceGainReport(gain));
+}
 
-  // Magnitude command
-  txBuff[0] = 0x06;  // Report ID
-  txBuff[1] = 0x01;  // Effect block index
-  txBuff[2] = ramp_start;
-  txBuff[3] = ramp_end;
+CLSPCompletion CLSPJoystick::playEffect(bool play, int repetitions = 1,
+                                        uint8_t block = 0x01) {
+  if (!play) {
+    return sendReport(INTERFACE_MAIN,
+                      CLSPEffectOperationReport(
+                          block, CLSPEffectOperationReport::STOP, 0x00));
+  }
 
-  return libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                   sizeof(txBuff), nullptr, TIMEOUT);
+  return sendReport(
+      INTERFACE_MAIN,
+      CLSPEffectOperationReport(block, CLSPEffectOperationReport::START,
+                                repetitions));
 }
 
-int CLSPJoystick::setEnvelopeSettings(uint8_t attack = 0, uint8_t fade = 0,
-                                      uint16_t attack_time = 300,
-                                      uint16_t fade_time = 300) {
-  unsigned char txBuff[8] = {};
+CLSPCompletion CLSPJoystick::playEffectSolo(uint8_t block,
+                                            int repetitions = 1) {
+  // Play effect, stopping every other block
+  return sendReport(
+      INTERFACE_MAIN,
+      CLSPEffectOperationReport(block, CLSPEffectOperationReport::START_SOLO,
+                                repetitions));
+}
 
-  // Envelope command
-  txBuff[0] = 0x02;                       // Report ID
-  txBuff[1] = 0x01;                       // Effect block index
-  txBuff[2] = attack;                     // Attack level
-  txBuff[3] = fade;                       // Fade level
-  txBuff[4] = (attack_time >> 0 & 0xFF);  // Attack time LSB
-  txBuff[5] = (attack_time >> 8 & 0xFF);  // Attack time MSB
-  txBuff[6] = (fade_time >> 0 & 0xFF);    // Fade time LSB
-  txBuff[7] = (fade_time >> 8 & 0xFF);    // Fade time MSB
+CLSPCompletion CLSPJoystick::setMagnitudeSettings(uint8_t magnitude = 127,
+                                                  uint8_t block = 0x01) {
+  this->mailboxes.seed(block, CLSP_FIELD_CONSTANT_MAGNITUDE, magnitude);
 
-  return libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                   sizeof(txBuff), nullptr, TIMEOUT);
+  return sendReport(INTERFACE_MAIN,
+                    CLSPConstantForceReport(block, magnitude));
 }
 
-int CLSPJoystick::setConditionalSettings(uint8_t pos_coeff = 63,
-                                         uint8_t neg_coeff = 63,
-                                         uint8_t pos_sat = 127,
-                                         uint8_t neg_sat = 127,
-                                         uint8_t deadband = 0) {
-  int ret = 0;
-  unsigned char txBuff[9] = {};
+CLSPCompletion CLSPJoystick::setConstantForce(int16_t magnitude = 0,
+                                              uint8_t block = 0x01) {
+  if (magnitude > CLSPForceStream::MAX_MAGNITUDE) {
+    magnitude = CLSPForceStream::MAX_MAGNITUDE;
+  } else if (magnitude < -CLSPForceStream::MAX_MAGNITUDE) {
+    magnitude = -CLSPForceStream::MAX_MAGNITUDE;
+  }
 
-  // Conditional effect settings
-  txBuff[0] = 0x03;       // Report ID
-  txBuff[1] = 0x01;       // Effect block index
-  txBuff[2] = 0x00;       // Block offset
-  txBuff[3] = 0xff;       // Center Point offset
-  txBuff[4] = pos_coeff;  // Positive coefficient
-  txBuff[5] = neg_coeff;  // Negative coefficient
-  txBuff[6] = pos_sat;    // Positive saturation
-  txBuff[7] = neg_sat;    // Negative saturation
-  txBuff[8] = deadband;   // Dead band
+  this->mailboxes.seed(block, CLSP_FIELD_CONSTANT_MAGNITUDE, magnitude);
 
-  ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                  sizeof(txBuff), nullptr, TIMEOUT);
+  return sendReport(INTERFACE_MAIN,
+                    CLSPConstantForceReport(block, magnitude));
+}
 
-  txBuff[2] = 0x01;
+CLSPCompletion CLSPJoystick::setRampSettings(int8_t ramp_start = -128,
+                                             int8_t ramp_end = 127,
+                                             uint8_t block = 0x01) {
+  this->mailboxes.seed(block, CLSP_FIELD_RAMP_START, ramp_start);
+  this->mailboxes.seed(block, CLSP_FIELD_RAMP_END, ramp_end);
 
-  ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                  sizeof(txBuff), nullptr, TIMEOUT);
+  return sendReport(INTERFACE_MAIN,
+                    CLSPRampReport(block, ramp_start, ramp_end));
+}
 
-  return ret;
+CLSPCompletion CLSPJoystick::setEnvelopeSettings(uint8_t attack = 0,
+                                                 uint8_t fade = 0,
+                                                 uint16_t attack_time = 300,
+                                                 uint16_t fade_time = 300,
+                                                 uint8_t block = 0x01) {
+  this->mailboxes.seed(block, CLSP_FIELD_ENVELOPE_ATTACK_LEVEL, attack);
+  this->mailboxes.seed(block, CLSP_FIELD_ENVELOPE_FADE_LEVEL, fade);
+  this->mailboxes.seed(block, CLSP_FIELD_ENVELOPE_ATTACK_TIME, attack_time);
+  this->mailboxes.seed(block, CLSP_FIELD_ENVELOPE_FADE_TIME, fade_time);
+
+  return sendReport(INTERFACE_MAIN,
+                    CLSPEnvelopeReport(block, attack, fade, attack_time,
+                                       fade_time));
 }
 
-int CLSPJoystick::setPeriodicSettings(uint8_t magnitude = 127,
-                                      int8_t offset = 0xff,
-                                      uint8_t phase = 0x00,
-                                      uint8_t period = 100) {
-  unsigned char txBuff[7] = {};
+CLSPCompletion CLSPJoystick::setConditionalSettings(uint8_t pos_coeff = 63,
+                                                    uint8_t neg_coeff = 63,
+                                                    uint8_t pos_sat = 127,
+                                                    uint8_t neg_sat = 127,
+                                                    uint8_t deadband = 0,
+                                                    uint8_t block = 0x01) {
+  // Same condition on both axes
+  setAxisConditionSettings(0x00, pos_coeff, neg_coeff, pos_sat, neg_sat,
+                           deadband, block);
+
+  return setAxisConditionSettings(0x01, pos_coeff, neg_coeff, pos_sat,
+                                  neg_sat, deadband, block);
+}
 
-  // Periodic effect settings
-  txBuff[0] = 0x04;                  // Report ID
-  txBuff[1] = 0x01;                  // Effect block index
-  txBuff[2] = magnitude;             // Magnitude
-  txBuff[3] = offset;                // Wave offset
-  txBuff[4] = phase;                 // Wave phase
-  txBuff[5] = (period >> 0 & 0xFF);  // Wave period LSB
-  txBuff[6] = (period >> 8 & 0xFF);  // Wave period MSB
+CLSPCompletion CLSPJoystick::setAxisConditionSettings(
+    uint8_t axis, uint8_t pos_coeff, uint8_t neg_coeff, uint8_t pos_sat,
+    uint8_t neg_sat, uint8_t deadband, uint8_t block) {
+  // 0xff center point offset
+  return sendReport(INTERFACE_MAIN,
+                    CLSPConditionReport(block, axis, 0xff, pos_coeff,
+                                        neg_coeff, pos_sat, neg_sat,
+                                        deadband));
+}
 
-  return libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                   sizeof(txBuff), nullptr, TIMEOUT);
+CLSPCompletion CLSPJoystick::setPeriodicSettings(uint8_t magnitude = 127,
+                                                 int8_t offset = 0xff,
+                                                 uint8_t phase = 0x00,
+                                                 uint16_t period = 100,
+                                                 uint8_t block = 0x01) {
+  this->mailboxes.seed(block, CLSP_FIELD_PERIODIC_MAGNITUDE, magnitude);
+  this->mailboxes.seed(block, CLSP_FIELD_PERIODIC_OFFSET, offset);
+  this->mailboxes.seed(block, CLSP_FIELD_PERIODIC_PHASE, phase);
+  this->mailboxes.seed(block, CLSP_FIELD_PERIODIC_PERIOD, period);
+
+  return sendReport(INTERFACE_MAIN,
+                    CLSPPeriodicReport(block, magnitude, offset, phase,
+                                       period));
 }
 
-int CLSPJoystick::setGeneralSettings(
+CLSPCompletion CLSPJoystick::setGeneralSettings(
     uint8_t function_id, uint16_t duration = 3000,
     uint16_t trigger_interval = 0, uint16_t sample_period = 0,
     uint8_t gain = 127, uint8_t trigger_button = 0xff, int8_t direction = 0,
-    uint16_t start_delay = 0) {
-  unsigned char txBuff[16] = {};
+    uint16_t start_delay = 0, uint8_t block = 0x01) {
+  return sendReport(INTERFACE_MAIN,
+                    CLSPSetEffectReport(block, function_id, duration,
+                                        trigger_interval, sample_period, gain,
+                                        trigger_button, direction,
+                                        start_delay));
+}
 
-  // General command
-  txBuff[0] = 0x01;  // Report ID
-  txBuff[1] = 0x01;  // Effect block index
-  txBuff[2] = function_id;
-  txBuff[3] = (duration >> 0 & 0xFF);          // Effect duration LSB
-  txBuff[4] = (duration >> 8 & 0xFF);          // Effect duration MSB
-  txBuff[5] = (trigger_interval >> 0 & 0xFF);  // Trigger repeat interval LSB
-  txBuff[6] = (trigger_interval >> 8 & 0xFF);  // Trigger repeat interval MSB
-  txBuff[7] = (sample_period >> 0 & 0xFF);     // Sample period LSB
-  txBuff[8] = (sample_period >> 8 & 0xFF);     // Sample period MSB
-  txBuff[9] = gain;                            // Gain
-  txBuff[10] = trigger_button;                 // Trigger button
-  txBuff[11] = 0x04;       // Axes(b0-b1)/Direction(b2) enable flags
-  txBuff[12] = direction;  // Direction
-  txBuff[13] = 0x00;       // Axes/Direction Enable flags ?
-  txBuff[14] = (start_delay >> 0 & 0xFF);  // Start delay LSB
-  txBuff[15] = (start_delay >> 8 & 0xFF);  // Start delay MSB
+int CLSPJoystick::createEffect(uint8_t effect_type) {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+  return allocateBlock(effect_type, 0);
+}
 
-  return libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_MAIN, txBuff,
-                                   sizeof(txBuff), nullptr, TIMEOUT);
+CLSPCompletion CLSPJoystick::setCustomForceData(uint16_t offset,
+                                                const int8_t* data, int count,
+                                                uint8_t block = 0x01) {
+  count = std::max(0, std::min(count, CUSTOM_FORCE_CHUNK));
+
+  return sendReport(INTERFACE_MAIN,
+                    CLSPCustomForceDataReport(block, offset, data, count));
 }
 
-void CLSPJoystick::ramp() {
-  playEffect(false);
-  playEffect(false);
+CLSPCompletion CLSPJoystick::setCustomForceSettings(uint8_t sample_count,
+                                                    uint16_t sample_period,
+                                                    uint8_t block = 0x01) {
+  return sendReport(INTERFACE_MAIN,
+                    CLSPCustomForceReport(block, sample_count,
+                                          sample_period));
+}
 
-  setRampSettings();
+CLSPCompletion CLSPJoystick::downloadForceSample(int8_t x = 0, int8_t y = 0) {
+  return sendReport(INTERFACE_MAIN, CLSPForceSampleReport(x, y));
+}
 
-  setEnvelopeSettings();
+int CLSPJoystick::uploadCustomForce(const std::vector<int8_t>& samples,
+                                    uint8_t axes = 1,
+                                    uint16_t sample_period = 10) {
+  int size = samples.size();
+
+  if (axes < 1 || axes > 2 || size == 0 || size % axes != 0 ||
+      size > CUSTOM_FORCE_MAX_BYTES ||
+      size / axes > CUSTOM_FORCE_MAX_SAMPLES || sample_period > 32767) {
+    return LIBUSB_ERROR_INVALID_PARAM;
+  }
+
+  int block;
+  {
+    std::lock_guard<std::mutex> lock(this->effects_mutex);
+
+    // The byte count is only carried by Create New Effect
+    if (!this->block_load_supported) {
+      return LIBUSB_ERROR_NOT_SUPPORTED;
+    }
+
+    block = allocateBlock(CLSP_CUSTOM_FORCE_DATA, size);
+    if (block < 0) {
+      return block;
+    }
+  }
 
-  setGeneralSettings(CLSP_RAMP);
+  int sample_count = size / axes;
+  uint32_t duration = static_cast<uint32_t>(sample_count) * sample_period;
 
-  setRampSettings();
+  // Pipelined, the status of every report is checked
+  CLSPSubmitWindow window(SUBMIT_WINDOW);
 
-  playEffect(true);
+  for (int offset = 0; offset < size; offset += CUSTOM_FORCE_CHUNK) {
+    int count = std::min(CUSTOM_FORCE_CHUNK, size - offset);
+    window.push(
+        setCustomForceData(offset, samples.data() + offset, count, block));
+  }
+
+  window.push(setCustomForceSettings(sample_count, sample_period, block));
+
+  window.push(setGeneralSettings(CLSP_CUSTOM_FORCE_DATA,
+                                 std::min<uint32_t>(duration, 32767), 0,
+                                 sample_period, 255, 0xff, 0, 0, block));
+
+  int ret = window.drain();
+  if (ret < 0) {
+    freeEffect(block);
+    return ret;
+  }
+
+  return block;
 }
 
-void CLSPJoystick::constantForceEffect() {
-  playEffect(false);
-  playEffect(false);
+CLSPCompletion CLSPJoystick::freeEffect(uint8_t block) {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+  return releaseBlock(block);
+}
 
-  setMagnitudeSettings(0x80);
+int CLSPJoystick::startForceStream(int rate_hz = 1000) {
+  return startStream(nullptr, 0, rate_hz);
+}
 
-  setEnvelopeSettings();
+int CLSPJoystick::startConditionRenderer(
+    std::shared_ptr<const CLSPConditionCurve> curve, CLSPAxis axis,
+    int rate_hz = 1000) {
+  auto renderer =
+      std::make_shared<CLSPConditionRenderer>(std::move(curve), axis);
+
+  // Runs on the stream thread only, the input state is read without locking
+  CLSPForceStream::Source source = [this, renderer, sequence = uint64_t(0)](
+                                       uint64_t now, uint64_t& input) mutable {
+    CLSPInputSample sample = this->transport->input().read();
+    input = sample.timestamp_ns;
+
+    // Rendering a fresh input report is a force update
+    if (sample.sequence != sequence) {
+      sequence = sample.sequence;
+      this->watchdog.feed();
+    }
+
+    return renderer->render(sample, now);
+  };
+
+  return startStream(std::move(source),
+                     CLSPConditionRenderer::direction(axis), rate_hz);
+}
+
+int CLSPJoystick::startStream(CLSPForceStream::Source source,
+                              int8_t direction, int rate_hz) {
+  if (this->force_stream.running()) {
+    return -1;
+  }
+
+  int block;
+  {
+    std::lock_guard<std::mutex> lock(this->effects_mutex);
+
+    if (this->block_load_supported) {
+      block = allocateBlock(CLSP_CONSTANT_FORCE, 0);
+      if (block < 0) {
+        return block;
+      }
+      // Keeps the effect helpers off the streamed block
+      this->effect_blocks.pin(block, true);
+    } else {
+      block = 0x01;
+    }
+
+    this->stream_block = block;
+    this->stream_block_pinned = this->block_load_supported;
+  }
+
+  // Uploaded once, the stream only updates the magnitude afterwards
+  setConstantForce(0, block);
+
+  setEnvelopeSettings(0, 0, 0, 0, block);
+
+  setGeneralSettings(CLSP_CONSTANT_FORCE, INFINITE_DURATION, 0, 0, 255, 0xff,
+                     direction, 0, block);
+
+  int ret = playEffect(true, 1, block).wait();
+  if (ret < 0) {
+    stopForceStream();
+    return ret;
+  }
+
+  // The block may move when the device is re-attached
+  return this->force_stream.start(
+      [this](int16_t magnitude) {
+        stream_thread = true;
+        return setConstantForce(magnitude, this->stream_block);
+      },
+      std::move(source), rate_hz);
+}
+
+void CLSPJoystick::setStreamForce(float force) {
+  this->force_stream.setForce(force);
+  this->watchdog.feed();
+}
+
+void CLSPJoystick::stopForceStream() {
+  this->force_stream.stop();
+
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+
+  if (this->stream_block == 0) {
+    return;
+  }
 
-  setGeneralSettings(CLSP_CONSTANT_FORCE);
+  playEffect(false, 1, this->stream_block);
 
-  setMagnitudeSettings(0x80);
+  if (this->stream_block_pinned) {
+    releaseBlock(this->stream_block);
+  }
 
-  playEffect(true);
+  this->stream_block = 0;
+  this->stream_block_pinned = false;
 }
 
-void CLSPJoystick::periodicEffect(uint8_t effect_id) {
-  playEffect(false);
-  playEffect(false);
+CLSPStreamStats CLSPJoystick::getStreamStats() {
+  return this->force_stream.stats();
+}
 
-  setPeriodicSettings();
+CLSPRealtimeStatus CLSPJoystick::setRealtimeProfile(
+    const CLSPRealtimeProfile& profile) {
+  this->realtime_profile = profile;
+  this->force_stream.setProfile(profile);
+  this->scheduler.setRealtimeProfile(profile);
 
-  setEnvelopeSettings();
+  return this->transport->setRealtimeProfile(profile);
+}
 
-  setGeneralSettings(effect_id, 30000);
+int CLSPJoystick::startWatchdog(unsigned int deadline_ms = 20) {
+  // Bypasses the shadow cache and its lock, held by a stuck submission
+  int ret = this->watchdog.start(
+      [this] {
+        CLSPDeviceControlReport report(
+            CLSPDeviceControlReport::STOP_ALL_EFFECTS);
+
+        return writeWire(clspReportBytes(report), sizeof(report), true);
+      },
+      deadline_ms, this->realtime_profile);
+  if (ret < 0 || !this->transport->reservedReportsWait()) {
+    return ret;
+  }
 
-  setPeriodicSettings();
+  std::cerr << "No priority path on this backend, the watchdog stop waits "
+               "for the reports in progress"
+            << std::endl;
 
-  playEffect(true);
+  return 1;
 }
 
-void CLSPJoystick::conditionalEffect(uint8_t effect_id) {
-  playEffect(false);
-  playEffect(false);
+void CLSPJoystick::stopWatchdog() { this->watchdog.stop(); }
 
-  setConditionalSettings();
+void CLSPJoystick::heartbeat() { this->watchdog.feed(); }
 
-  setGeneralSettings(effect_id);
+CLSPWatchdogStats CLSPJoystick::getWatchdogStats() {
+  CLSPWatchdogStats stats = this->watchdog.stats();
+  stats.priority_path = !this->transport->reservedReportsWait();
 
-  setConditionalSettings();
+  return stats;
+}
+
+CLSPSchedulerStats CLSPJoystick::getSchedulerStats() {
+  return this->scheduler.stats();
+}
 
-  playEffect(true);
+int CLSPJoystick::startParameterMailboxes() {
+  return this->mailboxes.start(
+      [this](const unsigned char* report, int length) {
+        mailbox_thread = true;
+        return sendBuiltIn(INTERFACE_MAIN, report, length);
+      },
+      this->realtime_profile);
 }
 
-void CLSPJoystick::updateStatus() {
-  unsigned char rxBuff[7] = {};
+void CLSPJoystick::stopParameterMailboxes() { this->mailboxes.stop(); }
 
-  libusb_interrupt_transfer(this->usb_handle, IN_ENDPOINT_MAIN, rxBuff,
-                            sizeof(rxBuff), nullptr, TIMEOUT);
+bool CLSPJoystick::postParameter(uint8_t block, CLSPEffectField field,
+                                 int value) {
+  this->watchdog.feed();
+  return this->mailboxes.post(block, field, value);
+}
 
-  this->buttons = rxBuff[1];
-  this->hat_switch = rxBuff[2];
-  this->x = (rxBuff[4] << 8) | rxBuff[3];
-  this->y = (rxBuff[6] << 8) | rxBuff[5];
+bool CLSPJoystick::slewParameter(uint8_t block, CLSPEffectField field,
+                                 int target, unsigned int slew_ms) {
+  this->watchdog.feed();
+  return this->mailboxes.slew(block, field, target, slew_ms);
+}
+
+void CLSPJoystick::setSlewCadence(unsigned int cadence_ms) {
+  this->mailboxes.setSlewCadence(cadence_ms);
+}
+
+CLSPMailboxStats CLSPJoystick::getMailboxStats() {
+  return this->mailboxes.stats();
+}
+
+void CLSPJoystick::setConnectionCallback(CLSPConnectionCallback callback) {
+  std::lock_guard<std::mutex> lock(this->connection_mutex);
+  this->connection_callback = std::move(callback);
+}
+
+bool CLSPJoystick::isConnected() { return this->connected; }
+
+std::vector<CLSPDeviceInfo> CLSPJoystick::listDevices() {
+  return listDevices(CLSP_BACKEND_LIBUSB);
+}
+
+std::vector<CLSPDeviceInfo> CLSPJoystick::listDevices(CLSPBackend backend) {
+  return makeTransport(backend)->listDevices();
+}
+
+CLSPDeviceInfo CLSPJoystick::getDeviceInfo() {
+  std::lock_guard<std::mutex> lock(this->connection_mutex);
+  return this->device_info;
+}
+
+void CLSPJoystick::setSwitchMode(CLSPSwitchMode mode) {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+  this->switch_mode = mode;
+}
+
+CLSPCompletion CLSPJoystick::getLastStop() {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+  return this->last_stop;
+}
+
+int CLSPJoystick::getEffectBlock(uint8_t effect_type) {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+  return this->effect_blocks.find(effect_type, 0);
+}
+
+void CLSPJoystick::pinEffect(uint8_t block, bool pinned) {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+  this->effect_blocks.pin(block, pinned);
+}
+
+CLSPCompletion CLSPJoystick::ramp() {
+  uint8_t block = prepareEffect(CLSP_RAMP);
+
+  setRampSettings(-128, 127, block);
+
+  setEnvelopeSettings(0, 0, 300, 300, block);
+
+  setGeneralSettings(CLSP_RAMP, 3000, 0, 0, 127, 0xff, 0, 0, block);
+
+  setRampSettings(-128, 127, block);
+
+  return startEffect(block);
+}
+
+CLSPCompletion CLSPJoystick::constantForceEffect() {
+  uint8_t block = prepareEffect(CLSP_CONSTANT_FORCE);
+
+  setMagnitudeSettings(0x80, block);
+
+  setEnvelopeSettings(0, 0, 300, 300, block);
+
+  setGeneralSettings(CLSP_CONSTANT_FORCE, 3000, 0, 0, 127, 0xff, 0, 0, block);
+
+  setMagnitudeSettings(0x80, block);
+
+  return startEffect(block);
+}
+
+CLSPCompletion CLSPJoystick::periodicEffect(uint8_t effect_id) {
+  uint8_t block = prepareEffect(effect_id);
+
+  setPeriodicSettings(127, 0xff, 0x00, 100, block);
+
+  setEnvelopeSettings(0, 0, 300, 300, block);
+
+  setGeneralSettings(effect_id, 30000, 0, 0, 127, 0xff, 0, 0, block);
+
+  setPeriodicSettings(127, 0xff, 0x00, 100, block);
+
+  return startEffect(block);
+}
+
+CLSPCompletion CLSPJoystick::conditionalEffect(uint8_t effect_id) {
+  uint8_t block = prepareEffect(effect_id);
+
+  setConditionalSettings(63, 63, 127, 127, 0, block);
+
+  setGeneralSettings(effect_id, 3000, 0, 0, 127, 0xff, 0, 0, block);
+
+  setConditionalSettings(63, 63, 127, 127, 0, block);
+
+  return startEffect(block);
+}
+
+void CLSPJoystick::updateStatus() { updateStatus(0); }
+
+bool CLSPJoystick::updateStatus(unsigned int timeout) {
+  return this->transport->waitInput(this->transport->input().read().sequence,
+                                    timeout);
+}
+
+CLSPInputSample CLSPJoystick::getInputSample() {
+  return this->transport->input().read();
 }
 
 std::tuple<uint16_t, uint16_t> CLSPJoystick::getPosition() {
-  return {this->x, this->y};
+  auto sample = this->transport->input().read();
+  return {sample.x, sample.y};
+}
+
+std::bitset<8> CLSPJoystick::getButtons() {
+  return this->transport->input().read().buttons;
+}
+
+int CLSPJoystick::getHat() {
+  return this->transport->input().read().hat_switch;
+}
+
+std::vector<CLSPInitPhase> CLSPJoystick::getInitTimings() {
+  std::lock_guard<std::mutex> lock(this->connection_mutex);
+  return this->init_timings;
+}
+
+CLSPPoolStats CLSPJoystick::getPoolStats(int endpoint) {
+  return this->transport->poolStats(endpoint);
+}
+
+void CLSPJoystick::forceResend() {
+  std::lock_guard<std::mutex> lock(this->report_mutex);
+  this->shadow.clear();
+}
+
+uint64_t CLSPJoystick::getSuppressedReports() {
+  std::lock_guard<std::mutex> lock(this->report_mutex);
+  return this->shadow.suppressed();
 }
 
-std::bitset<8> CLSPJoystick::getButtons() { return this->buttons; }
+void CLSPJoystick::setRecorder(std::shared_ptr<CLSPRecorder> recorder) {
+  std::lock_guard<std::mutex> lock(this->recorder_mutex);
+
+  this->recorder.store(recorder.get());
+
+  // The records in progress may still use the previous recorder
+  while (this->recording.load() != 0) {
+    std::this_thread::yield();
+  }
+
+  this->recorder_owner = std::move(recorder);
+}
+
+uint8_t CLSPJoystick::prepareEffect(uint8_t effect_type) {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
+
+  bool double_buffered = this->block_load_supported &&
+                         this->switch_mode == CLSP_SWITCH_DOUBLE_BUFFERED;
+  uint8_t block = 0x01;
+
+  if (this->block_load_supported) {
+    // Double buffering never uploads into the block that is playing
+    uint8_t playing = double_buffered ? this->active_block : 0;
+
+    int found = this->effect_blocks.find(effect_type, playing);
+    if (found < 0) {
+      found = allocateBlock(effect_type, 0);
+    }
+    if (found < 0) {
+      // Device full: update the playing block in place
+      found = this->effect_blocks.find(effect_type, 0);
+    }
+    if (found > 0) {
+      block = found;
+    }
+  }
+
+  if (!double_buffered) {
+    // The playing effect is stopped during the whole upload
+    uint8_t playing = this->active_block != 0 ? this->active_block : block;
+
+    this->last_stop = playEffect(false, 0, playing);
+    playEffect(false, 0, playing);
+  }
+
+  return block;
+}
 
-int CLSPJoystick::getHat() { return this->hat_switch; }
+CLSPCompletion CLSPJoystick::startEffect(uint8_t block) {
+  std::lock_guard<std::mutex> lock(this->effects_mutex);
 
-int CLSPJoystick::setGlobalFXGains() {
+  this->active_block = block;
+
+  if (this->block_load_supported &&
+      this->switch_mode == CLSP_SWITCH_DOUBLE_BUFFERED) {
+    // The same report stops the previous effect and starts the new one
+    this->last_stop = playEffectSolo(block, 1);
+    return this->last_stop;
+  }
+
+  return playEffect(true, 1, block);
+}
+
+int CLSPJoystick::allocateBlock(uint8_t effect_type, uint16_t byte_count) {
+  CLSPCreateEffectFeature create_report(effect_type, byte_count);
+  CLSPBlockLoadFeature block_load;
+
+  // Laid out as the descriptor of the stick declares them
+  auto map = std::atomic_load(&this->report_map);
+
+  unsigned char create_bytes[MAX_REPORT_SIZE];
+  int create_length = map->encode(
+      CLSP_REPORT_FEATURE, clspReportBytes(create_report),
+      sizeof(create_report), create_bytes, sizeof(create_bytes));
+  if (create_length < 0) {
+    return create_length;
+  }
+
+  unsigned char load_bytes[MAX_REPORT_SIZE] = {CLSPBlockLoadFeature::ID};
+  int load_length = map->wireSize(CLSP_REPORT_FEATURE, CLSPBlockLoadFeature::ID,
+                                  sizeof(block_load));
+
+  // Second attempt after evicting a block if the device memory is full
+  for (int attempt = 0; attempt < 2; attempt++) {
+    CLSPCompletion created = this->transport->setFeature(
+        INTERFACE_MAIN, create_bytes, create_length);
+    recordReport(CLSP_RECORD_OUT, RECORD_ENDPOINT_CONTROL, create_bytes,
+                 create_length, created);
+
+    int ret = created.wait();
+    if (ret < 0) {
+      return ret;
+    }
+
+    // PID Block Load feature report : block index, status, RAM pool available
+    CLSPCompletion loaded = this->transport->getFeature(
+        INTERFACE_MAIN, load_bytes, load_length);
+
+    ret = loaded.wait();
+    recordReport(CLSP_RECORD_IN, RECORD_ENDPOINT_CONTROL, load_bytes,
+                 load_length, loaded);
+    if (ret < 0) {
+      return ret;
+    }
+
+    map->decode(CLSP_REPORT_FEATURE, load_bytes, load_length,
+                clspReportBytes(block_load), sizeof(block_load));
+
+    if (block_load.status == CLSPBlockLoadFeature::SUCCESS) {
+      this->effect_blocks.add(block_load.block, effect_type);
+      return block_load.block;
+    }
+
+    if (block_load.status != CLSPBlockLoadFeature::FULL) {
+      return LIBUSB_ERROR_IO;
+    }
+
+    int victim = this->effect_blocks.evictionCandidate(this->active_block);
+    if (victim < 0) {
+      return LIBUSB_ERROR_NO_MEM;
+    }
+
+    releaseBlock(victim).wait();
+  }
+
+  return LIBUSB_ERROR_NO_MEM;
+}
+
+CLSPCompletion CLSPJoystick::releaseBlock(uint8_t block) {
+  this->effect_blocks.remove(block);
+
+  return sendReport(INTERFACE_MAIN, CLSPBlockFreeReport(block));
+}
+
+CLSPCompletion CLSPJoystick::sendRemapped(int interface,
+                                          const unsigned char* report,
+                                          int length) {
+  unsigned char wire[MAX_REPORT_SIZE];
+
+  auto map = std::atomic_load(&this->report_map);
+  int ret = map->encode(CLSP_REPORT_OUTPUT, report, length, wire,
+                        sizeof(wire));
+  if (ret < 0) {
+    return CLSPCompletion::immediate(ret);
+  }
+
+  return sendReport(interface, wire, ret);
+}
+
+CLSPCompletion CLSPJoystick::sendBuiltIn(int interface,
+                                         const unsigned char* report,
+                                         int length) {
+  // The main interface lays its reports out for the device at the submission
+  if (interface == INTERFACE_MAIN ||
+      !this->report_remapped.load(std::memory_order_acquire)) {
+    return sendReport(interface, report, length);
+  }
+
+  return sendRemapped(interface, report, length);
+}
+
+CLSPCompletion CLSPJoystick::sendReport(int interface,
+                                        const unsigned char* report,
+                                        int length) {
+  // Interrupt OUT endpoint address of the interface in the records
+  uint8_t endpoint = interface + 1;
+
+  if (!stream_thread && !mailbox_thread) {
+    this->watchdog.feed();
+  }
+
+  if (interface != INTERFACE_MAIN) {
+    auto ret = this->transport->writeReport(interface, report, length);
+    recordReport(CLSP_RECORD_OUT, endpoint, report, length, ret);
+
+    return ret;
+  }
+
+  // Shadowed and classified in the built-in layout, encoded by writeWire().
+  // The shadow must follow the submission order.
+  std::unique_lock<std::mutex> lock(this->report_mutex, std::defer_lock);
+
+  // The stream thread skips its tick rather than wait for another sender
+  if (!stream_thread) {
+    lock.lock();
+  } else if (!lock.try_lock()) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_BUSY);
+  }
+
+  // A suppressed report completes with the transfer carrying its payload
+  CLSPCompletion sent;
+  if (!this->shadow.update(report, length, sent)) {
+    return sent;
+  }
+
+  // Checked at the next identical report, failed early or late
+  auto ret = stream_thread ? this->scheduler.tryWrite(report, length)
+                           : this->scheduler.write(report, length);
+  this->shadow.track(report, length, ret);
+
+  return ret;
+}
+
+CLSPCompletion CLSPJoystick::writeWire(const unsigned char* report,
+                                       int length, bool reserved) {
+  unsigned char wire[MAX_REPORT_SIZE];
+
+  if (this->report_remapped.load(std::memory_order_acquire)) {
+    auto map = std::atomic_load(&this->report_map);
+    length = map->encode(CLSP_REPORT_OUTPUT, report, length, wire,
+                         sizeof(wire));
+    if (length < 0) {
+      return CLSPCompletion::immediate(length);
+    }
+    report = wire;
+  }
+
+  auto ret = reserved ? this->transport->writeReservedReport(INTERFACE_MAIN,
+                                                             report, length)
+                      : this->transport->writeReport(INTERFACE_MAIN, report,
+                                                     length);
+  recordReport(CLSP_RECORD_OUT, INTERFACE_MAIN + 1, report, length, ret);
+
+  return ret;
+}
+
+void CLSPJoystick::recordReport(uint8_t direction, uint8_t endpoint,
+                                const unsigned char* report, int length,
+                                const CLSPCompletion& completion) {
+  // Announced before the load, so setRecorder() waits for this record
+  this->recording.fetch_add(1);
+
+  CLSPRecorder* recorder = this->recorder.load();
+  if (recorder != nullptr) {
+    // The OUT reports are recorded at the submission, before they complete
+    recorder->record(direction, endpoint, report, length,
+                     completion.ready() ? completion.status() : 0);
+  }
+
+  this->recording.fetch_sub(1, std::memory_order_release);
+}
+
+CLSPCompletion CLSPJoystick::setGlobalFXGains() {
   unsigned char txBuffFX[64] = {};
-  int ret = 0;
+  CLSPCompletion ret;
 
   txBuffFX[0] = 0x3f;
   txBuffFX[1] = 0x11;
@@ -302,114 +1180,104 @@ int CLSPJoystick::setGlobalFXGains() {
   txBuffFX[9] = 0x0a;
   txBuffFX[10] = 0x50;
 
-  ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                  sizeof(txBuffFX), nullptr, TIMEOUT);
+  ret = sendReport(INTERFACE_FX, txBuffFX, sizeof(txBuffFX));
 
   txBuffFX[4] = 0x02;
 
-  ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                  sizeof(txBuffFX), nullptr, TIMEOUT);
+  ret = sendReport(INTERFACE_FX, txBuffFX, sizeof(txBuffFX));
 
   txBuffFX[9] = 0x0c;
 
-  ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                  sizeof(txBuffFX), nullptr, TIMEOUT);
+  ret = sendReport(INTERFACE_FX, txBuffFX, sizeof(txBuffFX));
 
   txBuffFX[4] = 0x01;
 
-  ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                  sizeof(txBuffFX), nullptr, TIMEOUT);
+  ret = sendReport(INTERFACE_FX, txBuffFX, sizeof(txBuffFX));
 
   return ret;
 }
 
-int CLSPJoystick::initSequence() {
-  unsigned char txBuffFX[64] = {};
-
-  int ret = 0;
-
-  deviceControl(true);
+void CLSPJoystick::endInitPhase(const char* name, uint64_t start,
+                                uint64_t first_report,
+                                CLSPSubmitWindow& window,
+                                std::vector<CLSPInitPhase>& timings) {
+  window.drain();
 
-  deviceControl(false);
+  CLSPInitPhase phase;
+  phase.name = name;
+  phase.duration_ns = clspMonotonicNs() - start;
+  phase.reports = window.count() - first_report;
 
-  setGain(0xff);
+  timings.push_back(phase);
+}
 
-  // Set output report of interface 1 for effect class 1 (0x21)
-  unsigned char set_report[4] = {0x01, 0x01, 0x00, 0x00};
-  ret = libusb_control_transfer(this->usb_handle, 0x21, 0x09, 0x0301, 0,
-                                set_report, sizeof(set_report), TIMEOUT);
+int CLSPJoystick::initSequence() {
+  CLSPSubmitWindow window(SUBMIT_WINDOW);
+  std::vector<CLSPInitPhase> timings;
 
-  setMagnitudeSettings(0x80);
+  uint64_t start = clspMonotonicNs();
+  uint64_t first_report = window.count();
 
-  setEnvelopeSettings();
+  window.push(deviceControl(true));
 
-  setGeneralSettings(CLSP_CONSTANT_FORCE);
+  window.push(deviceControl(false));
 
-  setMagnitudeSettings(0x80);
+  window.push(setGain(this->gain));
 
-  // Init FX loop on the 2nd endpoint
-  // May be unnecessary, see if the setGlobalFXGains has any effect
-  // Could be for the CAN over USB pipeline
-  txBuffFX[0] = 0x3f;
-  txBuffFX[1] = 0x11;
-  txBuffFX[4] = 0x7e;
-  txBuffFX[5] = 0x86;
-  txBuffFX[6] = 0x2f;
-  txBuffFX[7] = 0x60;
-  txBuffFX[8] = 0x21;
-  txBuffFX[10] = 0x03;
+  // The control pipe is not ordered with the interrupt endpoint
+  endInitPhase("reset", start, first_report, window, timings);
 
-  ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                  sizeof(txBuffFX), nullptr, TIMEOUT);
+  start = clspMonotonicNs();
+  first_report = window.count();
 
-  txBuffFX[6] = 0x40;
-  txBuffFX[7] = 0x00;
-  txBuffFX[8] = 0x10;
-  txBuffFX[10] = 0x00;
+  // Create New Effect for a constant force, the device answers with the
+  // allocated block in the PID Block Load report
+  int block = createEffect(CLSP_CONSTANT_FORCE);
 
-  for (int i = 1; i < 128; i++) {
-    txBuffFX[4] = i;
-    ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                    sizeof(txBuffFX), nullptr, TIMEOUT);
+  // Firmwares without block management only use the first block
+  this->block_load_supported = block > 0;
+  if (!this->block_load_supported) {
+    block = 0x01;
   }
 
-  for (int i = 1; i < 3; i++) {
-    txBuffFX[4] = i;
+  window.push(setMagnitudeSettings(0x80, block));
 
-    txBuffFX[7] = 0x18;
-    txBuffFX[8] = 0x30;
+  window.push(setEnvelopeSettings(0, 0, 300, 300, block));
 
-    ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                    sizeof(txBuffFX), nullptr, TIMEOUT);
+  window.push(setGeneralSettings(CLSP_CONSTANT_FORCE, 3000, 0, 0, 127, 0xff,
+                                 0, 0, block));
 
-    txBuffFX[7] = 0x80;
-    txBuffFX[8] = 0x21;
-    txBuffFX[9] = 0x0a;
+  window.push(setMagnitudeSettings(0x80, block));
 
-    ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                    sizeof(txBuffFX), nullptr, TIMEOUT);
+  endInitPhase("effect upload", start, first_report, window, timings);
 
-    txBuffFX[9] = 0x0c;
-
-    ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                    sizeof(txBuffFX), nullptr, TIMEOUT);
+  // Init FX sequence on the 2nd endpoint
+  unsigned char txBuffFX[64] = {};
 
-    txBuffFX[9] = 0x01;
+  txBuffFX[0] = 0x3f;
+  txBuffFX[1] = 0x11;
 
-    ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                    sizeof(txBuffFX), nullptr, TIMEOUT);
+  for (const FXInitPhase& phase : FX_INIT_PHASES) {
+    start = clspMonotonicNs();
+    first_report = window.count();
 
-    txBuffFX[7] = 0x45;
-    txBuffFX[8] = 0x30;
-    txBuffFX[9] = 0x00;
+    for (int node = phase.first_node; node <= phase.last_node; node++) {
+      for (int i = 0; i < phase.frame_count; i++) {
+        std::memcpy(txBuffFX + FX_FRAME_OFFSET, phase.frames[i],
+                    FX_FRAME_SIZE);
+        txBuffFX[FX_FRAME_OFFSET] = node;
 
-    ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                    sizeof(txBuffFX), nullptr, TIMEOUT);
+        window.push(sendReport(INTERFACE_FX, txBuffFX, sizeof(txBuffFX)));
+      }
+    }
 
-    txBuffFX[7] = 0x35;
+    endInitPhase(phase.name, start, first_report, window, timings);
+  }
 
-    ret = libusb_interrupt_transfer(this->usb_handle, OUT_ENDPOINT_FX, txBuffFX,
-                                    sizeof(txBuffFX), nullptr, TIMEOUT);
+  {
+    std::lock_guard<std::mutex> lock(this->connection_mutex);
+    this->init_timings = timings;
   }
-  return ret;
-}
\ No newline at end of file
+
+  return window.status();
+}
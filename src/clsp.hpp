@@ -3,10 +3,34 @@
 
 #include <libusb-1.0/libusb.h>
 
+#include <atomic>
 #include <bitset>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <tuple>
+#include <vector>
+
+#include "clsp_condition.hpp"
+#include "clsp_context.hpp"
+#include "clsp_descriptor.hpp"
+#include "clsp_effects.hpp"
+#include "clsp_input.hpp"
+#include "clsp_mailbox.hpp"
+#include "clsp_realtime.hpp"
+#include "clsp_recorder.hpp"
+#include "clsp_reports.hpp"
+#include "clsp_scheduler.hpp"
+#include "clsp_shadow.hpp"
+#include "clsp_stream.hpp"
+#include "clsp_transfer.hpp"
+#include "clsp_transport.hpp"
+#include "clsp_watchdog.hpp"
 
 #define CLSP_CONSTANT_FORCE 0x01
 #define CLSP_RAMP 0x02
@@ -19,43 +43,176 @@
 #define CLSP_PERIODIC_COND_DAMPER 0x09
 #define CLSP_PERIODIC_COND_INERTIA 0x0a
 #define CLSP_PERIODIC_COND_FRICTION 0x0b
-//#define CLSP_CUSTOM_FORCE_DATA 0x0c
+#define CLSP_CUSTOM_FORCE_DATA 0x0c
+
+/**
+ * Time spent in one phase of the device initialisation
+ */
+struct CLSPInitPhase {
+  const char* name = "";
+  // From the first report of the phase to the completion of the last one, in
+  // ns
+  uint64_t duration_ns = 0;
+  // Reports sent on the interrupt endpoints during the phase
+  int reports = 0;
+};
+
+/**
+ * Connection state changes reported after construction
+ */
+enum CLSPConnectionState {
+  // Re-attached, initialised, gain and resident effects restored
+  CLSP_DEVICE_CONNECTED,
+  // Unplugged, the reports fail with LIBUSB_ERROR_NO_DEVICE until re-attached
+  CLSP_DEVICE_DISCONNECTED,
+  // Re-attached but could not be opened or initialised
+  CLSP_DEVICE_RECONNECT_FAILED,
+};
+
+typedef std::function<void(CLSPConnectionState)> CLSPConnectionCallback;
+
+/**
+ * How the effect helpers replace the effect playing
+ */
+enum CLSPSwitchMode {
+  // Stop the playing effect, upload the new one, start it
+  CLSP_SWITCH_STOP_UPLOAD_START,
+  // Upload into an idle block while the current effect keeps playing, then
+  // switch with a single Op Effect Start Solo report
+  CLSP_SWITCH_DOUBLE_BUFFERED,
+};
 
 class CLSPJoystick {
  public:
+  /**
+   * Opens the first CLS-P stick found, in the process-wide libusb context
+   */
   CLSPJoystick();
 
+  /**
+   * Opens a given CLS-P stick, in the process-wide libusb context
+   * @param device_id serial number or bus path (see listDevices()), empty
+   * for the first stick found
+   */
+  explicit CLSPJoystick(const std::string& device_id);
+
+  /**
+   * Opens a given CLS-P stick in a given libusb context. The sticks opened in
+   * the same context share its event thread.
+   * @param device_id serial number or bus path (see listDevices()), empty
+   * for the first stick found
+   * @param context libusb context, NULL for the process-wide one
+   */
+  CLSPJoystick(const std::string& device_id,
+               std::shared_ptr<CLSPUsbContext> context);
+
+  /**
+   * Opens a given CLS-P stick through a given backend. The libusb backend
+   * uses the process-wide context.
+   * @param device_id serial number or bus path (see listDevices()), empty
+   * for the first stick found
+   * @param backend CLSP_BACKEND_LIBUSB or CLSP_BACKEND_HIDRAW
+   */
+  CLSPJoystick(const std::string& device_id, CLSPBackend backend);
+
+  /**
+   * Opens a given CLS-P stick through a given transport
+   * @param transport transport, owned by the instance
+   * @param device_id serial number or bus path (see listDevices()), empty
+   * for the first stick found
+   */
+  CLSPJoystick(std::unique_ptr<CLSPTransport> transport,
+               const std::string& device_id);
+
   ~CLSPJoystick();
 
+  /**
+   * Lists the connected CLS-P sticks. Their serial number is only read if
+   * the udev rule grants access to them.
+   * @return serial number and bus path of each stick
+   */
+  static std::vector<CLSPDeviceInfo> listDevices();
+
+  /**
+   * Lists the connected CLS-P sticks as seen by a backend. The hidraw
+   * backend only lists the sticks bound to the kernel HID driver, i.e. not
+   * claimed through libusb.
+   * @param backend CLSP_BACKEND_LIBUSB or CLSP_BACKEND_HIDRAW
+   * @return serial number and bus path of each stick
+   */
+  static std::vector<CLSPDeviceInfo> listDevices(CLSPBackend backend);
+
+  /**
+   * Returns the serial number and bus path of the stick driven by this
+   * instance
+   * @return device identity, updated on re-attach
+   */
+  CLSPDeviceInfo getDeviceInfo();
+
+  /**
+   * Registers the function called when the device is unplugged or
+   * re-attached. It runs on an internal thread and must not block; the
+   * previous callback is replaced.
+   * @param callback connection state handler, empty to remove it
+   */
+  void setConnectionCallback(CLSPConnectionCallback callback);
+
+  /**
+   * Returns whether the device is attached and initialised. After a
+   * re-attach, the last gain and the resident effect blocks are restored;
+   * the effects of infinite duration that were playing are started again.
+   * Custom force data blocks are lost.
+   * @return connection state
+   */
+  bool isConnected();
+
   /**
    * Sends a message to the device control report 0x0c
    * @param reset bool value indicating the device needs to be reset. Setting it
    * to false disables the blocking autocenter spring.
-   * @return success
+   * @return completion handle
    */
-  int deviceControl(bool reset);
+  CLSPCompletion deviceControl(bool reset);
 
   /**
    * Sets the device gain
    * @param gain uint [0,255] : gain value
-   * @return success
+   * @return completion handle
    */
-  int setGain(uint8_t gain);
+  CLSPCompletion setGain(uint8_t gain);
 
   /**
    * Plays the current set effect
    * @param play bool value triggering the effect rendering
    * @param repetitions number of repetitions of the effect
-   * @return success
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
+   */
+  CLSPCompletion playEffect(bool play, int repetitions, uint8_t block);
+
+  /**
+   * Plays an effect block and stops every other one (Op Effect Start Solo)
+   * @param block uint [1,40] : effect block index
+   * @param repetitions number of repetitions of the effect
+   * @return completion handle
    */
-  int playEffect(bool play, int repetitions);
+  CLSPCompletion playEffectSolo(uint8_t block, int repetitions);
 
   /**
    * Sets the constant force effect magnitude parameter
    * @param magnitude uint [0,255] : force magnitude
-   * @return success
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
    */
-  int setMagnitudeSettings(uint8_t magnitude);
+  CLSPCompletion setMagnitudeSettings(uint8_t magnitude, uint8_t block);
+
+  /**
+   * Sets the constant force effect magnitude with its sign
+   * @param magnitude int [-255,255] : force magnitude, clamped
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
+   */
+  CLSPCompletion setConstantForce(int16_t magnitude, uint8_t block);
 
   /**
    * Sets the ramp effect parameters
@@ -63,9 +220,11 @@ class CLSPJoystick {
    * effect
    * @param ramp_end int [-128,127] : normalized magnitude at the end of the
    * effect
-   * @return success
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
    */
-  int setRampSettings(int8_t ramp_start, int8_t ramp_end);
+  CLSPCompletion setRampSettings(int8_t ramp_start, int8_t ramp_end,
+                                 uint8_t block);
 
   /**
    * Sets the effect envelope parameter
@@ -76,10 +235,12 @@ baseline
    * @param attack_time uint [0,32767] : transition time to reach the sustain
 level, in ms
    * @param fade_time uint [0,32767] : fade time to reach the fade level, in ms
-   * @return success
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
    */
-  int setEnvelopeSettings(uint8_t attack, uint8_t fade, uint16_t attack_time,
-                          uint16_t fade_time);
+  CLSPCompletion setEnvelopeSettings(uint8_t attack, uint8_t fade,
+                                     uint16_t attack_time, uint16_t fade_time,
+                                     uint8_t block);
 
   /**
    * Sets the conditional effects parameters
@@ -91,11 +252,31 @@ negative side of the neutral position
    * @param neg_sat uint [0,255] : normalized maximum negative force output
    * @param deadband uint [0,255] : region around the center point where the
 condition is not active
-   * @return success
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
+   */
+  CLSPCompletion setConditionalSettings(uint8_t pos_coeff, uint8_t neg_coeff,
+                                        uint8_t pos_sat, uint8_t neg_sat,
+                                        uint8_t deadband, uint8_t block);
+
+  /**
+   * Sets the conditional effects parameters of a single axis
+   * @param axis uint [0,1] : parameter block offset, 0 for X and 1 for Y
+   * @param pos_coeff uint [0,255] : normalized coefficient constant on the
+positive side of the neutral position
+   * @param neg_coeff uint [0,255] : normalized coefficient constant on the
+negative side of the neutral position
+   * @param pos_sat uint [0,255] : normalized maximum positive force output
+   * @param neg_sat uint [0,255] : normalized maximum negative force output
+   * @param deadband uint [0,255] : region around the center point where the
+condition is not active
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
    */
-  int setConditionalSettings(uint8_t pos_coeff, uint8_t neg_coeff,
-                             uint8_t pos_sat, uint8_t neg_sat,
-                             uint8_t deadband);
+  CLSPCompletion setAxisConditionSettings(uint8_t axis, uint8_t pos_coeff,
+                                          uint8_t neg_coeff, uint8_t pos_sat,
+                                          uint8_t neg_sat, uint8_t deadband,
+                                          uint8_t block);
 
   /**
    * Sets the periodic effects parameters
@@ -104,10 +285,12 @@ condition is not active
    * @param phase uint [0,255] : position in the wave that playback begins,
    * normalized between [0,360]
    * @param period uint [0,32767] : waveform period in ms
-   * @return success
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
    */
-  int setPeriodicSettings(uint8_t magnitude, int8_t offset, uint8_t phase,
-                          uint8_t period);
+  CLSPCompletion setPeriodicSettings(uint8_t magnitude, int8_t offset,
+                                     uint8_t phase, uint16_t period,
+                                     uint8_t block);
 
   /**
    * Sets the general effect parameters
@@ -126,89 +309,508 @@ to be used to trigger playback of this effect. A null value unties the effect
 from any button
    * @param direction int [-128,127] : effect direction (polar coordinates)
    * @param start_delay uint [0,32767] : start delay in ms
-   * @return success
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
+   */
+  CLSPCompletion setGeneralSettings(uint8_t function_id, uint16_t duration,
+                                    uint16_t trigger_interval,
+                                    uint16_t sample_period, uint8_t gain,
+                                    uint8_t trigger_button, int8_t direction,
+                                    uint16_t start_delay, uint8_t block);
+
+  /**
+   * Writes up to 12 bytes of custom force data into an effect block (Custom
+   * Force Data report 0x07)
+   * @param offset uint [0,10000] : byte offset of the first sample in the
+   * block data
+   * @param data int [-127,127] : samples, interleaved per axis
+   * @param count number of bytes to write, clamped to 12
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
+   */
+  CLSPCompletion setCustomForceData(uint16_t offset, const int8_t* data,
+                                    int count, uint8_t block);
+
+  /**
+   * Sets the custom force playback parameters (Set Custom Force report 0x0e)
+   * @param sample_count uint [0,255] : number of samples of the waveform
+   * @param sample_period uint [0,32767] : time between two samples, in ms
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
+   */
+  CLSPCompletion setCustomForceSettings(uint8_t sample_count,
+                                        uint16_t sample_period,
+                                        uint8_t block);
+
+  /**
+   * Sends one force sample for immediate rendering (Download Force Sample
+   * report 0x08)
+   * @param x int [-127,127] : normalized force on the X axis
+   * @param y int [-127,127] : normalized force on the Y axis
+   * @return completion handle
+   */
+  CLSPCompletion downloadForceSample(int8_t x, int8_t y);
+
+  /**
+   * Uploads a force waveform into a new custom force data block. The data
+   * reports are pipelined on the endpoint with a bounded window, and every
+   * completion is checked before the block is returned. Play it with
+   * playEffect() or playEffectSolo().
+   * @param samples int [-127,127] : waveform bytes, interleaved per axis, at
+   * most 511
+   * @param axes uint [1,2] : number of axes per sample
+   * @param sample_period uint [0,32767] : time between two samples, in ms
+   * @return effect block index [1,40], or a negative libusb error code. The
+   * block is freed if any report failed.
+   */
+  int uploadCustomForce(const std::vector<int8_t>& samples, uint8_t axes,
+                        uint16_t sample_period);
+
+  /**
+   * Allocates an effect block on the device (Create New Effect and PID Block
+   * Load reports). The least recently used block is freed if the device
+   * memory is full.
+   * @param effect_type uint [1,12] : ID of the effect to load
+   * @return effect block index [1,40], or a negative libusb error code
+   */
+  int createEffect(uint8_t effect_type);
+
+  /**
+   * Frees an effect block on the device (PID Block Free report)
+   * @param block uint [1,40] : effect block index
+   * @return completion handle
+   */
+  CLSPCompletion freeEffect(uint8_t block);
+
+  /**
+   * Returns the block holding an effect type on the device
+   * @param effect_type uint [1,12] : ID of the effect
+   * @return effect block index [1,40], -1 if the effect is not resident
+   */
+  int getEffectBlock(uint8_t effect_type);
+
+  /**
+   * Reserves an effect block for the caller: the effect helpers do not reuse
+   * it and it is not freed to make room for a new one. freeEffect() unpins
+   * it.
+   * @param block uint [1,40] : effect block index
+   * @param pinned false to make the block evictable again
+   */
+  void pinEffect(uint8_t block, bool pinned);
+
+  /**
+   * Selects how the effect helpers below switch effects. Without block
+   * management support from the firmware, the effects are always stopped
+   * during the upload.
+   * @param mode CLSP_SWITCH_DOUBLE_BUFFERED (default) or
+   * CLSP_SWITCH_STOP_UPLOAD_START
    */
-  int setGeneralSettings(uint8_t function_id, uint16_t duration,
-                         uint16_t trigger_interval, uint16_t sample_period,
-                         uint8_t gain, uint8_t trigger_button, int8_t direction,
-                         uint16_t start_delay);
+  void setSwitchMode(CLSPSwitchMode mode);
 
   /**
-   * Plays a constant force effect
+   * Returns the report that stopped the previous effect during the last
+   * switch. Its completion time minus the one of the report that started the
+   * new effect is the force dropout.
+   * @return completion handle
    */
-  void constantForceEffect();
+  CLSPCompletion getLastStop();
+
+  /**
+   * Plays a constant force effect. Like the other effects below, it stays
+   * resident in its own blocks: switching back to it only sends an effect
+   * operation report.
+   * @return completion handle of the last report of the sequence
+   */
+  CLSPCompletion constantForceEffect();
 
   /**
    * Plays a force ramp effect
+   * @return completion handle of the last report of the sequence
    */
-  void ramp();
+  CLSPCompletion ramp();
 
   /**
    * Plays a periodic effect
    * @param effect_id : ID of the waveform to play
+   * @return completion handle of the last report of the sequence
    */
-  void periodicEffect(uint8_t effect_id);
+  CLSPCompletion periodicEffect(uint8_t effect_id);
 
   /**
    * Plays a conditional effect
    * @param effect_id : ID of the effect to play
+   * @return completion handle of the last report of the sequence
+   */
+  CLSPCompletion conditionalEffect(uint8_t effect_id);
+
+  /**
+   * Plays a constant force block of infinite duration and starts a thread
+   * updating its magnitude at a fixed rate with setStreamForce() values. Only
+   * Set Constant Force reports are sent while the stream runs. The effect
+   * helpers above stop the streamed block when they start theirs with Start
+   * Solo, and a device reset frees it: restart the stream afterwards.
+   * @param rate_hz magnitude update rate, in Hz
+   * @return 0 on success, -1 if the stream already runs, or a negative libusb
+   * error code
+   */
+  int startForceStream(int rate_hz);
+
+  /**
+   * Renders a condition on the host: a force stream evaluates the curve at
+   * the latest input report at each tick and sends the result as its constant
+   * force, along the axis of the curve. Unlike setConditionalSettings(), the
+   * curve can be nonlinear and asymmetric, e.g. stick force gradients,
+   * breakout forces and detents. Stopped by stopForceStream(); the stream
+   * stats include the latency from each input report to the force report
+   * computed from it.
+   * @param curve tabulated force curve
+   * @param axis axis the curve applies to
+   * @param rate_hz force update rate, in Hz
+   * @return 0 on success, -1 if the stream already runs, or a negative libusb
+   * error code
+   * @throw std::runtime_error if the curve is NULL
+   */
+  int startConditionRenderer(std::shared_ptr<const CLSPConditionCurve> curve,
+                             CLSPAxis axis, int rate_hz);
+
+  /**
+   * Sets the force applied by the stream. Never blocks: the stream thread
+   * only sends the latest value. Ignored by the condition renderer.
+   * @param force float [-1,1] : normalized force, clamped
+   */
+  void setStreamForce(float force);
+
+  /**
+   * Stops the stream thread, or the condition renderer, and frees its effect
+   * block
+   */
+  void stopForceStream();
+
+  /**
+   * Returns the achieved rate and jitter of the force stream, with its missed
+   * deadlines and wake-up latency distribution
+   * @return stream timing counters
+   */
+  CLSPStreamStats getStreamStats();
+
+  /**
+   * Runs the threads driving the transfers with a real-time profile: the
+   * thread of the backend completing the transfers right away, shared with
+   * the other sticks of the same libusb context, and the force stream thread
+   * from its next start. getStreamStats() tells what the stream thread got.
+   * Not while another thread starts the stream.
+   * @param profile real-time profile
+   * @return parts of the profile granted to the backend thread
+   */
+  CLSPRealtimeStatus setRealtimeProfile(const CLSPRealtimeProfile& profile);
+
+  /**
+   * Starts a thread stopping all the effects (Device Control Stop All
+   * Effects) when the host stops updating the forces for longer than a
+   * deadline. Every report the application sends, setStreamForce(),
+   * postParameter() and slewParameter() call, input report rendered by the
+   * condition renderer and heartbeat() counts as an update; the force stream
+   * repeating the last force and the mailbox thread sending the posted
+   * values or the slew steps do not.
+   *
+   * The stop goes through a transfer slot reserved for it, so it never waits
+   * for the slots held by the queued reports: it reaches the stick after at
+   * most the reports already queued on the endpoint. The hidraw backend has
+   * no such path: the kernel serializes the writes, and the stop waits for
+   * the one in progress on another thread. The effects stay stopped once
+   * the updates resume; start them again, e.g. restart the force stream.
+   * @param deadline_ms longest time without update, in ms
+   * @return 0 on success, 1 if the watchdog runs without the priority path,
+   * -1 if the watchdog already runs or the deadline is 0
+   */
+  int startWatchdog(unsigned int deadline_ms);
+
+  /**
+   * Stops the watchdog thread
+   */
+  void stopWatchdog();
+
+  /**
+   * Feeds the watchdog without sending a report, e.g. from the simulation
+   * loop while the forces do not change. Lock-free.
+   */
+  void heartbeat();
+
+  /**
+   * Returns how often the watchdog fired and how fast it stopped the effects
+   * @return watchdog counters
+   */
+  CLSPWatchdogStats getWatchdogStats();
+
+  /**
+   * Returns the queueing of the reports of the main interface. They go out by
+   * priority class rather than call order: device control and gain, effect
+   * operations, streamed magnitude, then the effect parameters. A report
+   * still queued is replaced by a later one with the same ID and block.
+   * @return queue and per-class counters, e.g. the queueing delay
+   */
+  CLSPSchedulerStats getSchedulerStats();
+
+  /**
+   * Starts the thread draining the parameter mailboxes once per USB frame,
+   * with the real-time profile set by setRealtimeProfile()
+   * @return 0 on success, -1 if the thread already runs or its clock cannot
+   * be created
    */
-  void conditionalEffect(uint8_t effect_id);
+  int startParameterMailboxes();
 
   /**
-   * Updates the status of the device, i.e. position and buttons status
+   * Stops the mailbox thread. The fields written meanwhile go out at the
+   * next start.
+   */
+  void stopParameterMailboxes();
+
+  /**
+   * Writes an effect parameter without lock nor I/O, e.g. from a physics
+   * loop far faster than the USB frames. Only the latest value of a field
+   * reaches the stick: the mailbox thread sends one report per parameter
+   * block written within a frame, whatever the number of writes. The other
+   * fields of that report keep the value of the last direct call, e.g.
+   * setPeriodicSettings().
+   * @param block effect block index [1,40]
+   * @param field parameter
+   * @param value new value, clamped to the range of the field
+   * @return false if the block or the field is out of range
+   */
+  bool postParameter(uint8_t block, CLSPEffectField field, int value);
+
+  /**
+   * Moves an effect parameter to a target over a time, e.g. a magnitude
+   * change without the clunk of a jump. The mailbox thread sends the
+   * intermediate values, linearly from the last value sent for the field,
+   * one report every slew cadence until the target. A later postParameter(),
+   * slewParameter() or direct call of the field ends the slew. Lock-free.
+   * @param block effect block index [1,40]
+   * @param field parameter
+   * @param target value at the end of the slew, clamped to the range of the
+   * field
+   * @param slew_ms duration of the slew, in ms (0 = postParameter())
+   * @return false if the block or the field is out of range
+   */
+  bool slewParameter(uint8_t block, CLSPEffectField field, int target,
+                     unsigned int slew_ms);
+
+  /**
+   * Sets the time between two reports of a slew, 4 ms by default
+   * @param cadence_ms time between two steps in ms, 1 ms (a USB frame) at
+   * least
+   */
+  void setSlewCadence(unsigned int cadence_ms);
+
+  /**
+   * Returns how many writes the mailboxes coalesced
+   * @return mailbox counters since the last start
+   */
+  CLSPMailboxStats getMailboxStats();
+
+  /**
+   * Waits for the next input report, i.e. position and buttons status. The
+   * reports are decoded in the background, the getters below always return
+   * the freshest one without calling this.
    */
   void updateStatus();
 
   /**
-   * Returns the last queried position
+   * Waits for the next input report at most for a given time
+   * @param timeout maximum wait in ms (0 = inf)
+   * @return true if a newer report was decoded, false on timeout or while
+   * the device is disconnected
+   */
+  bool updateStatus(unsigned int timeout);
+
+  /**
+   * Returns the last decoded input report, with its sequence number and
+   * CLOCK_MONOTONIC timestamp
+   * @return input sample
+   */
+  CLSPInputSample getInputSample();
+
+  /**
+   * Returns the last decoded position
    * @return tuple of relative coordinates (x,y)
    */
   std::tuple<uint16_t, uint16_t> getPosition();
 
   /**
-   * Returns the last queried buttons status
+   * Returns the last decoded buttons status
    * @return biset state of the buttons. Button 4 is sticky.
    */
   std::bitset<8> getButtons();
 
   /**
-   * Returns the last queried hat switch status
+   * Returns the last decoded hat switch status
    * @return int representing the hat status :  0 -> center, 1 -> up, 3 ->
    * right, 5 -> down, 7 -> left
    */
   int getHat();
 
- private:
-  // USB xfer constants
-  const int INTERFACE_MAIN = 0;
-  const int INTERFACE_FX = 1;
-
-  const int OUT_ENDPOINT_MAIN = 0x01;
-  const int OUT_ENDPOINT_FX = 0x02;
-
-  const int IN_ENDPOINT_MAIN = 0x81;
-  const int IN_ENDPOINT_FX = 0x82;
+  /**
+   * Returns the time spent in each phase of the initialisation run by the
+   * constructor. The phases run one after the other.
+   * @return phases in execution order
+   */
+  std::vector<CLSPInitPhase> getInitTimings();
 
-  // Xfer timeout in ms (0 = inf)
-  const int TIMEOUT = 0;
+  /**
+   * Returns the usage counters of the transfer pool of an endpoint
+   * @param endpoint OUT_ENDPOINT_MAIN (0x01) or OUT_ENDPOINT_FX (0x02)
+   * @return pool size, usage and exhaustion counters, zeroed with the hidraw
+   * backend
+   */
+  CLSPPoolStats getPoolStats(int endpoint);
 
-  libusb_device_handle* usb_handle = nullptr;
+  /**
+   * Forgets the shadow copy of the reports written to the device, so the next
+   * report of each kind is sent even if its payload is unchanged
+   */
+  void forceResend();
 
-  bool detached_kernel_driver = false;
+  /**
+   * Returns the number of reports skipped because the device already held
+   * the same payload
+   * @return suppressed reports count
+   */
+  uint64_t getSuppressedReports();
 
-  // 1b per button, bit4 is sticky
-  std::bitset<8> buttons;
+  /**
+   * Records every report sent from now on, the feature reports read back
+   * and the input reports included. The reports dropped by the shadow cache
+   * are not recorded.
+   * @param recorder ring file recorder, NULL to stop recording
+   */
+  void setRecorder(std::shared_ptr<CLSPRecorder> recorder);
 
-  // 1 -> up, 3 -> right, 5 -> down, 7 -> left
-  int hat_switch;
+ private:
+  const int INTERFACE_MAIN = 0;
+  const int INTERFACE_FX = 1;
 
-  // Between 0 and 65535
-  uint16_t x;
-  uint16_t y;
+  // Reports in flight during the pipelined sequences
+  const size_t SUBMIT_WINDOW = 16;
+
+  std::unique_ptr<CLSPTransport> transport;
+
+  // Serial number or bus path, fixed by the first open
+  std::string device_id;
+  CLSPDeviceInfo device_info;
+
+  // Hotplug events, handled on the connection thread
+  bool hotplug_watched = false;
+  std::thread connection_thread;
+  std::mutex connection_mutex;
+  std::condition_variable connection_cv;
+  bool device_arrived = false;
+  bool device_left = false;
+  bool connection_stopping = false;
+  CLSPConnectionCallback connection_callback;
+  std::atomic<bool> connected{false};
+
+  // Last device gain, restored after a re-attach
+  uint8_t gain = 0xff;
+
+  // Last reports written on INTERFACE_MAIN
+  std::mutex report_mutex;
+  CLSPShadowCache shadow;
+
+  // Transfers in flight on the main OUT endpoint, and reports waiting at most
+  // in the scheduler before the writers block
+  static constexpr int SCHEDULER_DEPTH = 2;
+  static constexpr int SCHEDULER_CAPACITY = 64;
+
+  // Orders the reports of INTERFACE_MAIN by priority class
+  CLSPReportScheduler scheduler;
+
+  // Recorder of the transfers, kept alive by recorder_owner. setRecorder()
+  // only drops a recorder once no thread is recording into it.
+  std::atomic<CLSPRecorder*> recorder{nullptr};
+  std::atomic<int> recording{0};
+  std::mutex recorder_mutex;
+  std::shared_ptr<CLSPRecorder> recorder_owner;
+
+  // Endpoint of the feature reports in the records
+  const uint8_t RECORD_ENDPOINT_CONTROL = 0x00;
+
+  // Layout of the reports in the descriptor of the open stick, accessed with
+  // the std::atomic_load/store overloads of shared_ptr. Only loaded when
+  // report_remapped is set, the built-in layout needs no lookup.
+  std::shared_ptr<const CLSPReportMap> report_map =
+      std::make_shared<const CLSPReportMap>();
+  std::atomic<bool> report_remapped{false};
+
+  // Largest report of the main interface, whatever its layout
+  static constexpr int MAX_REPORT_SIZE = 64;
+
+  // Effect blocks allocated on the device
+  std::mutex effects_mutex;
+  CLSPEffectBlocks effect_blocks;
+  bool block_load_supported = false;
+  uint8_t active_block = 0;
+  CLSPSwitchMode switch_mode = CLSP_SWITCH_DOUBLE_BUFFERED;
+  CLSPCompletion last_stop;
+
+  // Custom force data limits from the report descriptor
+  const int CUSTOM_FORCE_CHUNK = 12;
+  const int CUSTOM_FORCE_MAX_BYTES = 511;
+  const int CUSTOM_FORCE_MAX_SAMPLES = 255;
+
+  // Null duration, the effect plays until stopped
+  const uint16_t INFINITE_DURATION = 0xffff;
+
+  // Host-computed force, see startForceStream()
+  CLSPForceStream force_stream;
+  CLSPRealtimeProfile realtime_profile;
+  CLSPWatchdog watchdog;
+  // Sends through the scheduler, declared after it
+  CLSPParameterMailboxes mailboxes;
+  std::atomic<uint8_t> stream_block{0};
+  bool stream_block_pinned = false;
+
+  // Phases of the last initSequence()
+  std::vector<CLSPInitPhase> init_timings;
+
+  void openDevice();
+  void loadReportLayout(const CLSPDeviceInfo& info);
+  void closeDevice();
+  bool reconnect();
+  void restoreEffects(const CLSPEffectBlocks& blocks,
+                      const CLSPShadowCache& reports);
+  void connectionLoop();
+  bool devicePresent();
+  void notifyConnection(CLSPConnectionState state);
+  void onHotplug(bool attached);
 
   int initSequence();
-  int setGlobalFXGains();
+  void endInitPhase(const char* name, uint64_t start, uint64_t first_report,
+                    CLSPSubmitWindow& window,
+                    std::vector<CLSPInitPhase>& timings);
+  CLSPCompletion setGlobalFXGains();
+
+  uint8_t prepareEffect(uint8_t effect_type);
+  CLSPCompletion startEffect(uint8_t block);
+  int allocateBlock(uint8_t effect_type, uint16_t byte_count);
+  int startStream(CLSPForceStream::Source source, int8_t direction,
+                  int rate_hz);
+  CLSPCompletion releaseBlock(uint8_t block);
+
+  CLSPCompletion sendReport(int interface, const unsigned char* report,
+                            int length);
+  template <typename Report>
+  CLSPCompletion sendReport(int interface, const Report& report) {
+    return sendBuiltIn(interface, clspReportBytes(report), sizeof(Report));
+  }
+  CLSPCompletion sendBuiltIn(int interface, const unsigned char* report,
+                             int length);
+  CLSPCompletion sendRemapped(int interface, const unsigned char* report,
+                              int length);
+  CLSPCompletion writeWire(const unsigned char* report, int length,
+                           bool reserved);
+  void recordReport(uint8_t direction, uint8_t endpoint,
+                    const unsigned char* report, int length,
+                    const CLSPCompletion& completion);
 };
 
 #endif
\ No newline at end of file
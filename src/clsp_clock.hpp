@@ -0,0 +1,18 @@
+#ifndef CLS_P_CLOCK_HPP
+#define CLS_P_CLOCK_HPP
+
+#include <cstdint>
+
+#include <time.h>
+
+/**
+ * @return CLOCK_MONOTONIC time, in ns
+ */
+inline uint64_t clspMonotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef CLS_P_CONDITION_HPP
+#define CLS_P_CONDITION_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "clsp_input.hpp"
+
+/**
+ * Stick axis
+ */
+enum CLSPAxis {
+  CLSP_AXIS_X,
+  CLSP_AXIS_Y,
+};
+
+/**
+ * Force versus position and velocity along one axis, tabulated once so that
+ * rendering a tick costs two loads. The curve is the sum of a position term,
+ * e.g. a nonlinear gradient, a breakout or detents, and a velocity term, e.g.
+ * damping or friction.
+ *
+ * Positions are normalized to [-1,1], 0 at the center of the travel and 1 at
+ * the largest axis value. Forces are normalized to [-1,1] and push towards the
+ * largest axis value when positive, so a centering spring returns a negative
+ * force for a positive position.
+ */
+class CLSPConditionCurve {
+ public:
+  // Entries of each table: one per axis value, one per velocity step
+  static constexpr int TABLE_SIZE = 65536;
+
+  // Force of a normalized position or velocity
+  typedef std::function<float(float)> Function;
+
+  /**
+   * Tabulates a curve
+   * @param position force versus position, empty for none
+   * @param velocity force versus velocity, in normalized position per second,
+   * empty for none
+   * @param velocity_range largest velocity tabulated, faster motions use the
+   * force at this velocity
+   * @throw std::runtime_error if the velocity range is not positive
+   */
+  CLSPConditionCurve(const Function& position, const Function& velocity,
+                     float velocity_range);
+
+  /**
+   * @param position raw axis value
+   * @param velocity normalized velocity, per second
+   * @return normalized force, not clamped
+   */
+  float evaluate(uint16_t position, float velocity) const {
+    return this->position_forces[position] +
+           this->velocity_forces[velocityIndex(velocity)];
+  }
+
+  /**
+   * @return largest velocity tabulated
+   */
+  float getVelocityRange() const { return this->velocity_range; }
+
+  /**
+   * @param value raw axis value
+   * @return normalized position
+   */
+  static float normalize(uint16_t value);
+
+ private:
+  float velocity_range;
+  float velocity_scale;
+  std::vector<float> position_forces;
+  std::vector<float> velocity_forces;
+
+  int velocityIndex(float velocity) const;
+};
+
+/**
+ * Renders a condition curve on the host from the input reports 1. Each call
+ * evaluates the curve at the latest sample; the velocity is the low-pass
+ * filtered difference of consecutive samples. Not thread-safe: call it from
+ * the thread sending the force only.
+ */
+class CLSPConditionRenderer {
+ public:
+  /**
+   * @param curve tabulated curve, shared with other renderers if needed
+   * @param axis axis the curve applies to
+   * @throw std::runtime_error if the curve is NULL
+   */
+  CLSPConditionRenderer(std::shared_ptr<const CLSPConditionCurve> curve,
+                        CLSPAxis axis);
+
+  /**
+   * @param sample latest input sample
+   * @param now CLOCK_MONOTONIC time, in ns
+   * @return normalized force, 0 until the first sample or once the samples
+   * stop coming
+   */
+  float render(const CLSPInputSample& sample, uint64_t now);
+
+  /**
+   * Forgets the previous samples, e.g. after a re-attach
+   */
+  void reset();
+
+  /**
+   * @return axis the curve applies to
+   */
+  CLSPAxis getAxis() const { return this->axis; }
+
+  /**
+   * @return filtered velocity at the last sample, normalized per second
+   */
+  float getVelocity() const { return this->velocity; }
+
+  /**
+   * @param axis stick axis
+   * @return Set Effect direction of a force pushing towards the largest values
+   * of the axis
+   */
+  static int8_t direction(CLSPAxis axis);
+
+ private:
+  std::shared_ptr<const CLSPConditionCurve> curve;
+  CLSPAxis axis;
+
+  // Last sample used, 0 before the first one
+  uint64_t sequence = 0;
+  uint64_t timestamp_ns = 0;
+  float position = 0.0f;
+  float velocity = 0.0f;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "clsp_context.hpp"
+
+#include <mutex>
+#include <stdexcept>
+
+CLSPUsbContext::CLSPUsbContext() {
+  if (libusb_init(&this->context) < 0) {
+    throw std::runtime_error("Unable to init libusb context");
+  }
+
+  this->event_thread = std::thread(&CLSPUsbContext::eventLoop, this);
+}
+
+CLSPUsbContext::~CLSPUsbContext() {
+  this->running = false;
+  libusb_interrupt_event_handler(this->context);
+  this->event_thread.join();
+
+  libusb_exit(this->context);
+}
+
+std::shared_ptr<CLSPUsbContext> CLSPUsbContext::shared() {
+  static std::mutex mutex;
+  static std::weak_ptr<CLSPUsbContext> instance;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto context = instance.lock();
+  if (!context) {
+    context = std::make_shared<CLSPUsbContext>();
+    instance = context;
+  }
+
+  return context;
+}
+
+std::vector<CLSPDeviceInfo> CLSPUsbContext::listDevices(uint16_t vendor_id,
+                                                        uint16_t product_id) {
+  std::vector<CLSPDeviceInfo> devices;
+  libusb_device** list;
+
+  ssize_t count = libusb_get_device_list(this->context, &list);
+  if (count < 0) {
+    return devices;
+  }
+
+  for (ssize_t i = 0; i < count; i++) {
+    struct libusb_device_descriptor descriptor;
+
+    if (libusb_get_device_descriptor(list[i], &descriptor) < 0 ||
+        descriptor.idVendor != vendor_id ||
+        descriptor.idProduct != product_id) {
+      continue;
+    }
+
+    // The serial number needs an open handle, e.g. a udev rule granting RW
+    libusb_device_handle* handle = nullptr;
+    if (libusb_open(list[i], &handle) < 0) {
+      handle = nullptr;
+    }
+
+    devices.push_back(describe(list[i], handle));
+
+    if (handle != nullptr) {
+      libusb_close(handle);
+    }
+  }
+
+  libusb_free_device_list(list, 1);
+
+  return devices;
+}
+
+libusb_device_handle* CLSPUsbContext::openDevice(uint16_t vendor_id,
+                                                 uint16_t product_id,
+                                                 const std::string& device_id,
+                                                 CLSPDeviceInfo* info) {
+  libusb_device_handle* found = nullptr;
+  libusb_device** list;
+
+  ssize_t count = libusb_get_device_list(this->context, &list);
+  if (count < 0) {
+    return nullptr;
+  }
+
+  for (ssize_t i = 0; i < count && found == nullptr; i++) {
+    struct libusb_device_descriptor descriptor;
+
+    if (libusb_get_device_descriptor(list[i], &descriptor) < 0 ||
+        descriptor.idVendor != vendor_id ||
+        descriptor.idProduct != product_id) {
+      continue;
+    }
+
+    libusb_device_handle* handle;
+    if (libusb_open(list[i], &handle) < 0) {
+      continue;
+    }
+
+    CLSPDeviceInfo device = describe(list[i], handle);
+
+    if (device_id.empty() || device_id == device.serial ||
+        device_id == device.path) {
+      found = handle;
+
+      if (info != nullptr) {
+        *info = device;
+      }
+    } else {
+      libusb_close(handle);
+    }
+  }
+
+  libusb_free_device_list(list, 1);
+
+  return found;
+}
+
+CLSPRealtimeStatus CLSPUsbContext::setRealtimeProfile(
+    const CLSPRealtimeProfile& profile) {
+  CLSPRealtimeStatus status =
+      clspApplyRealtime(this->event_thread.native_handle(), profile);
+
+  if (profile.prefault_stack) {
+    this->prefault_pending = true;
+    libusb_interrupt_event_handler(this->context);
+  }
+
+  return status;
+}
+
+void CLSPUsbContext::eventLoop() {
+  // Bounded wait so a missed interruption cannot keep the thread alive
+  struct timeval tv = {0, 100000};
+
+  while (this->running) {
+    if (this->prefault_pending.exchange(false)) {
+      clspPrefaultStack();
+    }
+
+    libusb_handle_events_timeout_completed(this->context, &tv, nullptr);
+  }
+}
+
+CLSPDeviceInfo CLSPUsbContext::describe(libusb_device* device,
+                                        libusb_device_handle* handle) {
+  CLSPDeviceInfo info;
+
+  info.bus = libusb_get_bus_number(device);
+  info.address = libusb_get_device_address(device);
+
+  // Same notation as /sys/bus/usb/devices
+  uint8_t ports[7];
+  int depth = libusb_get_port_numbers(device, ports, sizeof(ports));
+
+  info.path = std::to_string(info.bus);
+  for (int i = 0; i < depth; i++) {
+    info.path += (i == 0 ? "-" : ".") + std::to_string(ports[i]);
+  }
+
+  struct libusb_device_descriptor descriptor;
+  unsigned char serial[128];
+
+  if (libusb_get_device_descriptor(device, &descriptor) != LIBUSB_SUCCESS) {
+    return info;
+  }
+
+  info.firmware = descriptor.bcdDevice;
+
+  if (handle != nullptr && descriptor.iSerialNumber != 0 &&
+      libusb_get_string_descriptor_ascii(handle, descriptor.iSerialNumber,
+                                         serial, sizeof(serial)) > 0) {
+    info.serial = reinterpret_cast<char*>(serial);
+  }
+
+  return info;
+}
@@ -0,0 +1,104 @@
+#ifndef CLS_P_CONTEXT_HPP
+#define CLS_P_CONTEXT_HPP
+
+#include <libusb-1.0/libusb.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clsp_realtime.hpp"
+
+/**
+ * USB location and identity of a connected device
+ */
+struct CLSPDeviceInfo {
+  // Serial number string, empty if the device could not be opened
+  std::string serial;
+  // Bus number and port path as in sysfs, e.g. "1-4.2"
+  std::string path;
+  uint8_t bus = 0;
+  uint8_t address = 0;
+  // Firmware version (bcdDevice), 0 if unknown
+  uint16_t firmware = 0;
+};
+
+/**
+ * libusb context with the thread handling its events. Every device opened in
+ * the context, and its transfers and hotplug callbacks, are served by this
+ * single thread.
+ */
+class CLSPUsbContext {
+ public:
+  /**
+   * Initialises a libusb context and starts its event thread
+   */
+  CLSPUsbContext();
+
+  /**
+   * Stops the event thread and exits the context. Every handle opened in the
+   * context must be closed first.
+   */
+  ~CLSPUsbContext();
+
+  CLSPUsbContext(const CLSPUsbContext&) = delete;
+  CLSPUsbContext& operator=(const CLSPUsbContext&) = delete;
+
+  /**
+   * Returns the process-wide context, created on first use and destroyed with
+   * its last reference
+   * @return shared context
+   */
+  static std::shared_ptr<CLSPUsbContext> shared();
+
+  /**
+   * @return libusb context handle
+   */
+  libusb_context* get() const { return this->context; }
+
+  /**
+   * Lists the connected devices with the given IDs
+   * @param vendor_id USB vendor ID
+   * @param product_id USB product ID
+   * @return devices in enumeration order
+   */
+  std::vector<CLSPDeviceInfo> listDevices(uint16_t vendor_id,
+                                          uint16_t product_id);
+
+  /**
+   * Opens a device by serial number or bus path
+   * @param vendor_id USB vendor ID
+   * @param product_id USB product ID
+   * @param device_id serial number or bus path, empty for the first device
+   * @param info receives the identity of the opened device, may be NULL
+   * @return device handle, NULL if no connected device matches
+   */
+  libusb_device_handle* openDevice(uint16_t vendor_id, uint16_t product_id,
+                                   const std::string& device_id,
+                                   CLSPDeviceInfo* info);
+
+  /**
+   * Applies a real-time profile to the event thread, shared by every device
+   * of the context. Its stack is prefaulted at its next wake-up.
+   * @param profile real-time profile
+   * @return parts of the profile the system granted
+   */
+  CLSPRealtimeStatus setRealtimeProfile(const CLSPRealtimeProfile& profile);
+
+ private:
+  libusb_context* context = nullptr;
+
+  std::atomic<bool> running{true};
+  std::atomic<bool> prefault_pending{false};
+  std::thread event_thread;
+
+  void eventLoop();
+
+  static CLSPDeviceInfo describe(libusb_device* device,
+                                 libusb_device_handle* handle);
+};
+
+#endif
@@ -0,0 +1,843 @@
+#include "clsp_descriptor.hpp"
+
+#include <libusb-1.0/libusb.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include "clsp_reports.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Item types and tags of the short items, HID 1.11 section 6.2.2
+const int ITEM_MAIN = 0;
+const int ITEM_GLOBAL = 1;
+const int ITEM_LOCAL = 2;
+const uint8_t ITEM_LONG = 0xfe;
+
+const int MAIN_INPUT = 0x8;
+const int MAIN_OUTPUT = 0x9;
+const int MAIN_COLLECTION = 0xa;
+const int MAIN_FEATURE = 0xb;
+const int MAIN_END_COLLECTION = 0xc;
+
+const int GLOBAL_USAGE_PAGE = 0x0;
+const int GLOBAL_LOGICAL_MINIMUM = 0x1;
+const int GLOBAL_LOGICAL_MAXIMUM = 0x2;
+const int GLOBAL_REPORT_SIZE = 0x7;
+const int GLOBAL_REPORT_ID = 0x8;
+const int GLOBAL_REPORT_COUNT = 0x9;
+const int GLOBAL_PUSH = 0xa;
+const int GLOBAL_POP = 0xb;
+
+const int LOCAL_USAGE = 0x0;
+const int LOCAL_USAGE_MINIMUM = 0x1;
+const int LOCAL_USAGE_MAXIMUM = 0x2;
+
+// Input, Output and Feature item flags
+const uint32_t MAIN_CONSTANT = 0x01;
+const uint32_t MAIN_VARIABLE = 0x02;
+
+// Bounds against malformed descriptors
+const size_t MAX_USAGES = 1024;
+const size_t MAX_DEPTH = 32;
+const uint32_t MAX_REPORT_BITS = 0xffff;
+const int MAX_FIELD_BITS = 32;
+
+// PID page usages of the fields the structures carry
+const uint16_t PID_EFFECT_BLOCK_INDEX = 0x22;
+const uint16_t PID_PARAMETER_BLOCK_OFFSET = 0x23;
+const uint16_t PID_EFFECT_TYPE = 0x25;
+const uint16_t PID_DURATION = 0x50;
+const uint16_t PID_SAMPLE_PERIOD = 0x51;
+const uint16_t PID_GAIN = 0x52;
+const uint16_t PID_TRIGGER_BUTTON = 0x53;
+const uint16_t PID_TRIGGER_REPEAT_INTERVAL = 0x54;
+const uint16_t PID_AXES_ENABLE = 0x55;
+const uint16_t PID_DIRECTION_ENABLE = 0x56;
+const uint16_t PID_DIRECTION = 0x57;
+const uint16_t PID_ATTACK_LEVEL = 0x5b;
+const uint16_t PID_ATTACK_TIME = 0x5c;
+const uint16_t PID_FADE_LEVEL = 0x5d;
+const uint16_t PID_FADE_TIME = 0x5e;
+const uint16_t PID_CP_OFFSET = 0x60;
+const uint16_t PID_POSITIVE_COEFFICIENT = 0x61;
+const uint16_t PID_NEGATIVE_COEFFICIENT = 0x62;
+const uint16_t PID_POSITIVE_SATURATION = 0x63;
+const uint16_t PID_NEGATIVE_SATURATION = 0x64;
+const uint16_t PID_DEAD_BAND = 0x65;
+const uint16_t PID_DOWNLOAD_FORCE_SAMPLE = 0x66;
+const uint16_t PID_CUSTOM_FORCE_DATA = 0x69;
+const uint16_t PID_CUSTOM_FORCE_DATA_OFFSET = 0x6c;
+const uint16_t PID_SAMPLE_COUNT = 0x6d;
+const uint16_t PID_OFFSET = 0x6f;
+const uint16_t PID_MAGNITUDE = 0x70;
+const uint16_t PID_PHASE = 0x71;
+const uint16_t PID_PERIOD = 0x72;
+const uint16_t PID_RAMP_START = 0x75;
+const uint16_t PID_RAMP_END = 0x76;
+const uint16_t PID_EFFECT_OPERATION = 0x78;
+const uint16_t PID_LOOP_COUNT = 0x7c;
+const uint16_t PID_DEVICE_GAIN = 0x7e;
+const uint16_t PID_BLOCK_LOAD_STATUS = 0x8b;
+const uint16_t PID_DEVICE_CONTROL = 0x96;
+const uint16_t PID_START_DELAY = 0xa7;
+const uint16_t PID_RAM_POOL_AVAILABLE = 0xac;
+
+const uint16_t GD_X = 0x30;
+const uint16_t GD_Y = 0x31;
+const uint16_t GD_BYTE_COUNT = 0x3b;
+
+/**
+ * Field of a structure of clsp_reports.hpp
+ */
+struct BuiltField {
+  CLSPReportType type;
+  uint8_t report_id;
+  uint16_t usage_page;
+  uint16_t usage;
+  // 0 for any
+  uint16_t collection;
+  uint16_t bit_offset;
+  uint8_t bit_size;
+  uint8_t count;
+  bool is_signed;
+};
+
+/**
+ * Size of a structure of clsp_reports.hpp
+ */
+struct BuiltReport {
+  CLSPReportType type;
+  uint8_t report_id;
+  int size;
+};
+
+#define CLSP_BYTE(Report, field) (offsetof(Report, field) * 8)
+
+const BuiltField BUILT_FIELDS[] = {
+    // Set Effect
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPSetEffectReport, block), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_TYPE, 0, CLSP_BYTE(CLSPSetEffectReport, effect_type), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID, PID_DURATION,
+     0, CLSP_BYTE(CLSPSetEffectReport, duration), 16, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID,
+     PID_TRIGGER_REPEAT_INTERVAL, 0,
+     CLSP_BYTE(CLSPSetEffectReport, trigger_interval), 16, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID,
+     PID_SAMPLE_PERIOD, 0, CLSP_BYTE(CLSPSetEffectReport, sample_period), 16,
+     1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID, PID_GAIN, 0,
+     CLSP_BYTE(CLSPSetEffectReport, gain), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID,
+     PID_TRIGGER_BUTTON, 0, CLSP_BYTE(CLSPSetEffectReport, trigger_button), 8,
+     1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_GENERIC_DESKTOP,
+     GD_X, PID_AXES_ENABLE, CLSP_BYTE(CLSPSetEffectReport, enable_flags), 1, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_GENERIC_DESKTOP,
+     GD_Y, PID_AXES_ENABLE, CLSP_BYTE(CLSPSetEffectReport, enable_flags) + 1,
+     1, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID,
+     PID_DIRECTION_ENABLE, 0,
+     CLSP_BYTE(CLSPSetEffectReport, enable_flags) + 2, 1, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_ORDINAL, 1,
+     PID_DIRECTION, CLSP_BYTE(CLSPSetEffectReport, direction), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_ORDINAL, 2,
+     PID_DIRECTION, CLSP_BYTE(CLSPSetEffectReport, reserved), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, CLSP_PAGE_PID,
+     PID_START_DELAY, 0, CLSP_BYTE(CLSPSetEffectReport, start_delay), 16, 1,
+     false},
+
+    // Set Envelope
+    {CLSP_REPORT_OUTPUT, CLSPEnvelopeReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPEnvelopeReport, block), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPEnvelopeReport::ID, CLSP_PAGE_PID,
+     PID_ATTACK_LEVEL, 0, CLSP_BYTE(CLSPEnvelopeReport, attack_level), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPEnvelopeReport::ID, CLSP_PAGE_PID,
+     PID_FADE_LEVEL, 0, CLSP_BYTE(CLSPEnvelopeReport, fade_level), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPEnvelopeReport::ID, CLSP_PAGE_PID,
+     PID_ATTACK_TIME, 0, CLSP_BYTE(CLSPEnvelopeReport, attack_time), 16, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPEnvelopeReport::ID, CLSP_PAGE_PID, PID_FADE_TIME,
+     0, CLSP_BYTE(CLSPEnvelopeReport, fade_time), 16, 1, false},
+
+    // Set Condition
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPConditionReport, block), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, CLSP_PAGE_PID,
+     PID_PARAMETER_BLOCK_OFFSET, 0, CLSP_BYTE(CLSPConditionReport, axis), 4, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, CLSP_PAGE_PID, PID_CP_OFFSET,
+     0, CLSP_BYTE(CLSPConditionReport, center), 8, 1, true},
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, CLSP_PAGE_PID,
+     PID_POSITIVE_COEFFICIENT, 0,
+     CLSP_BYTE(CLSPConditionReport, positive_coefficient), 8, 1, true},
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, CLSP_PAGE_PID,
+     PID_NEGATIVE_COEFFICIENT, 0,
+     CLSP_BYTE(CLSPConditionReport, negative_coefficient), 8, 1, true},
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, CLSP_PAGE_PID,
+     PID_POSITIVE_SATURATION, 0,
+     CLSP_BYTE(CLSPConditionReport, positive_saturation), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, CLSP_PAGE_PID,
+     PID_NEGATIVE_SATURATION, 0,
+     CLSP_BYTE(CLSPConditionReport, negative_saturation), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, CLSP_PAGE_PID, PID_DEAD_BAND,
+     0, CLSP_BYTE(CLSPConditionReport, deadband), 8, 1, false},
+
+    // Set Periodic
+    {CLSP_REPORT_OUTPUT, CLSPPeriodicReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPPeriodicReport, block), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPPeriodicReport::ID, CLSP_PAGE_PID, PID_MAGNITUDE,
+     0, CLSP_BYTE(CLSPPeriodicReport, magnitude), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPPeriodicReport::ID, CLSP_PAGE_PID, PID_OFFSET, 0,
+     CLSP_BYTE(CLSPPeriodicReport, offset), 8, 1, true},
+    {CLSP_REPORT_OUTPUT, CLSPPeriodicReport::ID, CLSP_PAGE_PID, PID_PHASE, 0,
+     CLSP_BYTE(CLSPPeriodicReport, phase), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPPeriodicReport::ID, CLSP_PAGE_PID, PID_PERIOD, 0,
+     CLSP_BYTE(CLSPPeriodicReport, period), 16, 1, false},
+
+    // Set Constant Force
+    {CLSP_REPORT_OUTPUT, CLSPConstantForceReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPConstantForceReport, block), 8,
+     1, false},
+    {CLSP_REPORT_OUTPUT, CLSPConstantForceReport::ID, CLSP_PAGE_PID,
+     PID_MAGNITUDE, 0, CLSP_BYTE(CLSPConstantForceReport, magnitude), 16, 1,
+     true},
+
+    // Set Ramp Force
+    {CLSP_REPORT_OUTPUT, CLSPRampReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPRampReport, block), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPRampReport::ID, CLSP_PAGE_PID, PID_RAMP_START, 0,
+     CLSP_BYTE(CLSPRampReport, start), 8, 1, true},
+    {CLSP_REPORT_OUTPUT, CLSPRampReport::ID, CLSP_PAGE_PID, PID_RAMP_END, 0,
+     CLSP_BYTE(CLSPRampReport, end), 8, 1, true},
+
+    // Custom Force Data
+    {CLSP_REPORT_OUTPUT, CLSPCustomForceDataReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPCustomForceDataReport, block), 8,
+     1, false},
+    {CLSP_REPORT_OUTPUT, CLSPCustomForceDataReport::ID, CLSP_PAGE_PID,
+     PID_CUSTOM_FORCE_DATA_OFFSET, 0,
+     CLSP_BYTE(CLSPCustomForceDataReport, offset), 16, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPCustomForceDataReport::ID, CLSP_PAGE_PID,
+     PID_CUSTOM_FORCE_DATA, 0, CLSP_BYTE(CLSPCustomForceDataReport, samples),
+     8, CLSPCustomForceDataReport::MAX_SAMPLES, true},
+
+    // Download Force Sample
+    {CLSP_REPORT_OUTPUT, CLSPForceSampleReport::ID, CLSP_PAGE_GENERIC_DESKTOP,
+     GD_X, PID_DOWNLOAD_FORCE_SAMPLE, CLSP_BYTE(CLSPForceSampleReport, x), 8,
+     1, true},
+    {CLSP_REPORT_OUTPUT, CLSPForceSampleReport::ID, CLSP_PAGE_GENERIC_DESKTOP,
+     GD_Y, PID_DOWNLOAD_FORCE_SAMPLE, CLSP_BYTE(CLSPForceSampleReport, y), 8,
+     1, true},
+
+    // Effect Operation
+    {CLSP_REPORT_OUTPUT, CLSPEffectOperationReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPEffectOperationReport, block), 8,
+     1, false},
+    {CLSP_REPORT_OUTPUT, CLSPEffectOperationReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_OPERATION, 0,
+     CLSP_BYTE(CLSPEffectOperationReport, operation), 8, 1, false},
+    {CLSP_REPORT_OUTPUT, CLSPEffectOperationReport::ID, CLSP_PAGE_PID,
+     PID_LOOP_COUNT, 0, CLSP_BYTE(CLSPEffectOperationReport, loop_count), 8, 1,
+     false},
+
+    // PID Block Free
+    {CLSP_REPORT_OUTPUT, CLSPBlockFreeReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPBlockFreeReport, block), 8, 1,
+     false},
+
+    // PID Device Control
+    {CLSP_REPORT_OUTPUT, CLSPDeviceControlReport::ID, CLSP_PAGE_PID,
+     PID_DEVICE_CONTROL, 0, CLSP_BYTE(CLSPDeviceControlReport, control), 8, 1,
+     false},
+
+    // Device Gain
+    {CLSP_REPORT_OUTPUT, CLSPDeviceGainReport::ID, CLSP_PAGE_PID,
+     PID_DEVICE_GAIN, 0, CLSP_BYTE(CLSPDeviceGainReport, gain), 8, 1, false},
+
+    // Set Custom Force
+    {CLSP_REPORT_OUTPUT, CLSPCustomForceReport::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPCustomForceReport, block), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPCustomForceReport::ID, CLSP_PAGE_PID,
+     PID_SAMPLE_COUNT, 0, CLSP_BYTE(CLSPCustomForceReport, sample_count), 8, 1,
+     false},
+    {CLSP_REPORT_OUTPUT, CLSPCustomForceReport::ID, CLSP_PAGE_PID,
+     PID_SAMPLE_PERIOD, 0, CLSP_BYTE(CLSPCustomForceReport, sample_period), 16,
+     1, false},
+
+    // Create New Effect
+    {CLSP_REPORT_FEATURE, CLSPCreateEffectFeature::ID, CLSP_PAGE_PID,
+     PID_EFFECT_TYPE, 0, CLSP_BYTE(CLSPCreateEffectFeature, effect_type), 8, 1,
+     false},
+    {CLSP_REPORT_FEATURE, CLSPCreateEffectFeature::ID,
+     CLSP_PAGE_GENERIC_DESKTOP, GD_BYTE_COUNT, 0,
+     CLSP_BYTE(CLSPCreateEffectFeature, byte_count), 10, 1, false},
+
+    // PID Block Load
+    {CLSP_REPORT_FEATURE, CLSPBlockLoadFeature::ID, CLSP_PAGE_PID,
+     PID_EFFECT_BLOCK_INDEX, 0, CLSP_BYTE(CLSPBlockLoadFeature, block), 8, 1,
+     false},
+    {CLSP_REPORT_FEATURE, CLSPBlockLoadFeature::ID, CLSP_PAGE_PID,
+     PID_BLOCK_LOAD_STATUS, 0, CLSP_BYTE(CLSPBlockLoadFeature, status), 8, 1,
+     false},
+    {CLSP_REPORT_FEATURE, CLSPBlockLoadFeature::ID, CLSP_PAGE_PID,
+     PID_RAM_POOL_AVAILABLE, 0,
+     CLSP_BYTE(CLSPBlockLoadFeature, ram_pool_available), 16, 1, false},
+};
+
+#undef CLSP_BYTE
+
+const BuiltReport BUILT_REPORTS[] = {
+    {CLSP_REPORT_OUTPUT, CLSPSetEffectReport::ID, sizeof(CLSPSetEffectReport)},
+    {CLSP_REPORT_OUTPUT, CLSPEnvelopeReport::ID, sizeof(CLSPEnvelopeReport)},
+    {CLSP_REPORT_OUTPUT, CLSPConditionReport::ID, sizeof(CLSPConditionReport)},
+    {CLSP_REPORT_OUTPUT, CLSPPeriodicReport::ID, sizeof(CLSPPeriodicReport)},
+    {CLSP_REPORT_OUTPUT, CLSPConstantForceReport::ID,
+     sizeof(CLSPConstantForceReport)},
+    {CLSP_REPORT_OUTPUT, CLSPRampReport::ID, sizeof(CLSPRampReport)},
+    {CLSP_REPORT_OUTPUT, CLSPCustomForceDataReport::ID,
+     sizeof(CLSPCustomForceDataReport)},
+    {CLSP_REPORT_OUTPUT, CLSPForceSampleReport::ID,
+     sizeof(CLSPForceSampleReport)},
+    {CLSP_REPORT_OUTPUT, CLSPEffectOperationReport::ID,
+     sizeof(CLSPEffectOperationReport)},
+    {CLSP_REPORT_OUTPUT, CLSPBlockFreeReport::ID, sizeof(CLSPBlockFreeReport)},
+    {CLSP_REPORT_OUTPUT, CLSPDeviceControlReport::ID,
+     sizeof(CLSPDeviceControlReport)},
+    {CLSP_REPORT_OUTPUT, CLSPDeviceGainReport::ID,
+     sizeof(CLSPDeviceGainReport)},
+    {CLSP_REPORT_OUTPUT, CLSPCustomForceReport::ID,
+     sizeof(CLSPCustomForceReport)},
+    {CLSP_REPORT_FEATURE, CLSPCreateEffectFeature::ID,
+     sizeof(CLSPCreateEffectFeature)},
+    {CLSP_REPORT_FEATURE, CLSPBlockLoadFeature::ID,
+     sizeof(CLSPBlockLoadFeature)},
+};
+
+// Cache file, followed by the report sizes then the fields
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint16_t firmware;
+  uint16_t field_size;
+  uint32_t field_count;
+  uint32_t size_count;
+};
+
+const char CACHE_MAGIC[8] = {'C', 'L', 'S', 'P', 'L', 'A', 'Y', '1'};
+const uint32_t CACHE_VERSION = 1;
+
+/**
+ * Global items, saved by Push
+ */
+struct GlobalState {
+  uint16_t usage_page = 0;
+  int32_t logical_minimum = 0;
+  uint32_t logical_maximum = 0;
+  int logical_maximum_size = 0;
+  uint32_t report_size = 0;
+  uint32_t report_count = 0;
+  uint8_t report_id = 0;
+};
+
+uint32_t itemValue(const uint8_t* data, int size) {
+  uint32_t value = 0;
+  for (int i = 0; i < size; i++) {
+    value |= static_cast<uint32_t>(data[i]) << (8 * i);
+  }
+  return value;
+}
+
+int32_t signExtend(uint32_t value, int size) {
+  if (size > 0 && size < 4 && (value >> (8 * size - 1)) & 1) {
+    value |= ~0u << (8 * size);
+  }
+  return static_cast<int32_t>(value);
+}
+
+int reportIndex(int type, uint8_t report_id) { return type * 256 + report_id; }
+
+// HID fields are packed LSB first
+uint32_t readBits(const unsigned char* data, int length, int offset,
+                  int size) {
+  uint32_t value = 0;
+  for (int i = 0; i < size; i++) {
+    int bit = offset + i;
+    if (bit / 8 < length && (data[bit / 8] >> (bit % 8)) & 1) {
+      value |= 1u << i;
+    }
+  }
+  return value;
+}
+
+void writeBits(unsigned char* data, int length, int offset, int size,
+               uint32_t value) {
+  for (int i = 0; i < size; i++) {
+    int bit = offset + i;
+    if (bit / 8 >= length) {
+      return;
+    }
+    if ((value >> i) & 1) {
+      data[bit / 8] |= 1 << (bit % 8);
+    } else {
+      data[bit / 8] &= ~(1 << (bit % 8));
+    }
+  }
+}
+
+int32_t extend(uint32_t value, int size, bool is_signed) {
+  if (is_signed && size < 32 && (value >> (size - 1)) & 1) {
+    value |= ~0u << size;
+  }
+  return static_cast<int32_t>(value);
+}
+
+}  // namespace
+
+CLSPReportLayout::CLSPReportLayout()
+    : sizes(REPORT_TYPES * REPORT_IDS, 0) {}
+
+CLSPReportLayout CLSPReportLayout::parse(const uint8_t* descriptor,
+                                         size_t length) {
+  CLSPReportLayout layout;
+
+  GlobalState global;
+  std::vector<GlobalState> global_stack;
+  // Usages of the open collections, page in the upper 16b
+  std::vector<uint32_t> collections;
+  std::vector<uint32_t> usages;
+  uint32_t usage_minimum = 0;
+  bool report_ids = false;
+
+  size_t position = 0;
+  while (position < length) {
+    uint8_t prefix = descriptor[position];
+
+    if (prefix == ITEM_LONG) {
+      if (position + 1 >= length) {
+        throw std::runtime_error("Truncated report descriptor");
+      }
+      position += 3 + descriptor[position + 1];
+      continue;
+    }
+
+    int size = prefix & 0x03;
+    if (size == 3) {
+      size = 4;
+    }
+    int type = (prefix >> 2) & 0x03;
+    int tag = prefix >> 4;
+
+    if (position + 1 + size > length) {
+      throw std::runtime_error("Truncated report descriptor");
+    }
+
+    const uint8_t* data = descriptor + position + 1;
+    uint32_t value = itemValue(data, size);
+    position += 1 + size;
+
+    if (type == ITEM_GLOBAL) {
+      switch (tag) {
+        case GLOBAL_USAGE_PAGE:
+          global.usage_page = value;
+          break;
+        case GLOBAL_LOGICAL_MINIMUM:
+          global.logical_minimum = signExtend(value, size);
+          break;
+        case GLOBAL_LOGICAL_MAXIMUM:
+          global.logical_maximum = value;
+          global.logical_maximum_size = size;
+          break;
+        case GLOBAL_REPORT_SIZE:
+          global.report_size = value;
+          break;
+        case GLOBAL_REPORT_ID:
+          if (value == 0 || value > 0xff) {
+            throw std::runtime_error("Invalid report ID in report descriptor");
+          }
+          global.report_id = value;
+          report_ids = true;
+          break;
+        case GLOBAL_REPORT_COUNT:
+          global.report_count = value;
+          break;
+        case GLOBAL_PUSH:
+          if (global_stack.size() >= MAX_DEPTH) {
+            throw std::runtime_error("Report descriptor nested too deeply");
+          }
+          global_stack.push_back(global);
+          break;
+        case GLOBAL_POP:
+          if (global_stack.empty()) {
+            throw std::runtime_error("Unbalanced Pop in report descriptor");
+          }
+          global = global_stack.back();
+          global_stack.pop_back();
+          break;
+        default:
+          break;
+      }
+      continue;
+    }
+
+    if (type == ITEM_LOCAL) {
+      // A 4-byte usage carries its own page
+      uint32_t usage =
+          size == 4 ? value : (uint32_t(global.usage_page) << 16 | value);
+
+      if (tag == LOCAL_USAGE) {
+        usages.push_back(usage);
+      } else if (tag == LOCAL_USAGE_MINIMUM) {
+        usage_minimum = usage;
+      } else if (tag == LOCAL_USAGE_MAXIMUM) {
+        for (uint32_t u = usage_minimum; u <= usage && u >= usage_minimum;
+             u++) {
+          usages.push_back(u);
+          if (usages.size() > MAX_USAGES) {
+            break;
+          }
+        }
+      }
+
+      if (usages.size() > MAX_USAGES) {
+        throw std::runtime_error("Too many usages in report descriptor");
+      }
+      continue;
+    }
+
+    if (type != ITEM_MAIN) {
+      continue;
+    }
+
+    if (tag == MAIN_COLLECTION) {
+      if (collections.size() >= MAX_DEPTH) {
+        throw std::runtime_error("Report descriptor nested too deeply");
+      }
+      collections.push_back(usages.empty() ? 0 : usages.front());
+    } else if (tag == MAIN_END_COLLECTION) {
+      if (collections.empty()) {
+        throw std::runtime_error("Unbalanced End Collection in descriptor");
+      }
+      collections.pop_back();
+    } else if (tag == MAIN_INPUT || tag == MAIN_OUTPUT ||
+               tag == MAIN_FEATURE) {
+      int report_type = tag == MAIN_INPUT    ? CLSP_REPORT_INPUT
+                        : tag == MAIN_OUTPUT ? CLSP_REPORT_OUTPUT
+                                             : CLSP_REPORT_FEATURE;
+      uint16_t& bits =
+          layout.sizes[reportIndex(report_type, global.report_id)];
+      if (bits == 0 && report_ids) {
+        bits = 8;
+      }
+
+      uint32_t total = global.report_size * global.report_count;
+      if (bits + total > MAX_REPORT_BITS) {
+        throw std::runtime_error("Report too large in report descriptor");
+      }
+
+      // Logical Maximum is signed unless the range starts at 0 or above
+      int32_t maximum =
+          signExtend(global.logical_maximum, global.logical_maximum_size);
+      if (global.logical_minimum >= 0 && maximum < global.logical_minimum) {
+        maximum = global.logical_maximum;
+      }
+
+      CLSPReportField field = {};
+      field.type = report_type;
+      field.report_id = global.report_id;
+      field.bit_size = std::min<uint32_t>(global.report_size, 0xff);
+      field.logical_minimum = global.logical_minimum;
+      field.logical_maximum = maximum;
+
+      uint32_t parent = collections.empty() ? 0 : collections.back();
+
+      if ((value & MAIN_CONSTANT) || usages.empty() ||
+          global.report_size == 0) {
+        // Padding
+      } else if (!(value & MAIN_VARIABLE) && usages.size() > 1) {
+        // Selector array, named after the collection listing the selectors
+        field.usage_page = parent >> 16;
+        field.usage = parent & 0xffff;
+        field.collection =
+            collections.size() > 1 ? collections[collections.size() - 2] : 0;
+        field.bit_offset = bits;
+        field.count = std::min<uint32_t>(global.report_count, 0xff);
+        field.array = 1;
+        layout.fields.push_back(field);
+      } else {
+        // One field per usage, the last usage covering the remaining values
+        field.collection = parent & 0xffff;
+        uint32_t count = global.report_count;
+        for (size_t i = 0; i < usages.size() && count > 0; i++) {
+          uint32_t values = i + 1 == usages.size() ? count : 1;
+          field.usage_page = usages[i] >> 16;
+          field.usage = usages[i] & 0xffff;
+          field.bit_offset =
+              bits + (global.report_count - count) * global.report_size;
+          field.count = std::min<uint32_t>(values, 0xff);
+          layout.fields.push_back(field);
+          count -= values;
+        }
+      }
+
+      bits += total;
+    }
+
+    usages.clear();
+    usage_minimum = 0;
+  }
+
+  if (!collections.empty()) {
+    throw std::runtime_error("Unterminated collection in report descriptor");
+  }
+
+  return layout;
+}
+
+const CLSPReportField* CLSPReportLayout::find(CLSPReportType type,
+                                              uint8_t report_id,
+                                              uint16_t usage_page,
+                                              uint16_t usage,
+                                              uint16_t collection) const {
+  for (const CLSPReportField& field : this->fields) {
+    if (field.type == type && field.report_id == report_id &&
+        field.usage_page == usage_page && field.usage == usage &&
+        (collection == 0 || field.collection == collection)) {
+      return &field;
+    }
+  }
+
+  return nullptr;
+}
+
+int CLSPReportLayout::reportSize(CLSPReportType type,
+                                 uint8_t report_id) const {
+  return (this->sizes[reportIndex(type, report_id)] + 7) / 8;
+}
+
+bool CLSPReportLayout::save(const std::string& path,
+                            uint16_t firmware) const {
+  std::error_code error;
+  fs::create_directories(fs::path(path).parent_path(), error);
+
+  // Renamed once complete, a concurrent load never sees a partial file
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+    CacheHeader header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.firmware = firmware;
+    header.field_size = sizeof(CLSPReportField);
+    header.field_count = this->fields.size();
+    header.size_count = this->sizes.size();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(this->sizes.data()),
+               this->sizes.size() * sizeof(uint16_t));
+    file.write(reinterpret_cast<const char*>(this->fields.data()),
+               this->fields.size() * sizeof(CLSPReportField));
+
+    if (!file) {
+      fs::remove(temporary, error);
+      return false;
+    }
+  }
+
+  fs::rename(temporary, path, error);
+  return !error;
+}
+
+bool CLSPReportLayout::load(const std::string& path, uint16_t firmware,
+                            CLSPReportLayout& layout) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  CacheHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+      header.version != CACHE_VERSION || header.firmware != firmware ||
+      header.field_size != sizeof(CLSPReportField) ||
+      header.size_count != REPORT_TYPES * REPORT_IDS ||
+      header.field_count > MAX_REPORT_BITS) {
+    return false;
+  }
+
+  CLSPReportLayout loaded;
+  loaded.fields.resize(header.field_count);
+
+  if (!file.read(reinterpret_cast<char*>(loaded.sizes.data()),
+                 loaded.sizes.size() * sizeof(uint16_t)) ||
+      !file.read(reinterpret_cast<char*>(loaded.fields.data()),
+                 loaded.fields.size() * sizeof(CLSPReportField))) {
+    return false;
+  }
+
+  layout = std::move(loaded);
+  return true;
+}
+
+std::string CLSPReportLayout::cachePath(uint16_t vendor_id,
+                                        uint16_t product_id,
+                                        uint16_t firmware) {
+  fs::path directory;
+
+  if (const char* cache = std::getenv("XDG_CACHE_HOME"); cache && *cache) {
+    directory = cache;
+  } else if (const char* home = std::getenv("HOME"); home && *home) {
+    directory = fs::path(home) / ".cache";
+  } else {
+    return "";
+  }
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "descriptor-%04x-%04x-%04x.bin",
+                vendor_id, product_id, firmware);
+
+  return (directory / "clsp" / name).string();
+}
+
+CLSPReportMap::CLSPReportMap() : reports(SLOTS) {}
+
+CLSPReportMap::CLSPReportMap(const CLSPReportLayout& layout)
+    : reports(SLOTS) {
+  for (const BuiltReport& built : BUILT_REPORTS) {
+    Report& report = this->reports[slot(built.type, built.report_id)];
+
+    report.size = layout.reportSize(built.type, built.report_id);
+    if (report.size == 0) {
+      // Not declared, sent as built
+      continue;
+    }
+
+    report.remapped = report.size != built.size;
+
+    for (const BuiltField& field : BUILT_FIELDS) {
+      if (field.type != built.type || field.report_id != built.report_id) {
+        continue;
+      }
+
+      const CLSPReportField* live =
+          layout.find(built.type, built.report_id, field.usage_page,
+                      field.usage, field.collection);
+      if (live == nullptr || live->bit_size == 0 ||
+          live->bit_size > MAX_FIELD_BITS) {
+        this->missing_fields++;
+        report.remapped = true;
+        continue;
+      }
+
+      if (live->bit_offset != field.bit_offset ||
+          live->bit_size != field.bit_size || live->count < field.count) {
+        report.remapped = true;
+      }
+
+      for (int i = 0; i < std::min<int>(field.count, live->count); i++) {
+        Move move;
+        move.built_offset = field.bit_offset + i * field.bit_size;
+        move.built_size = field.bit_size;
+        move.is_signed = field.is_signed;
+        move.live_offset = live->bit_offset + i * live->bit_size;
+        move.live_size = live->bit_size;
+        // The index of a selector is kept as is
+        move.clamp = !live->array &&
+                     live->logical_minimum < live->logical_maximum;
+        move.minimum = live->logical_minimum;
+        move.maximum = live->logical_maximum;
+        report.moves.push_back(move);
+      }
+    }
+  }
+}
+
+int CLSPReportMap::remappedCount() const {
+  return std::count_if(this->reports.begin(), this->reports.end(),
+                       [](const Report& report) { return report.remapped; });
+}
+
+int CLSPReportMap::encode(CLSPReportType type, const unsigned char* report,
+                          int length, unsigned char* out,
+                          int capacity) const {
+  if (length < 1) {
+    return LIBUSB_ERROR_INVALID_PARAM;
+  }
+
+  const Report& map = this->reports[slot(type, report[0])];
+  if (!map.remapped) {
+    if (length > capacity) {
+      return LIBUSB_ERROR_OVERFLOW;
+    }
+    std::memcpy(out, report, length);
+    return length;
+  }
+
+  if (map.size > capacity) {
+    return LIBUSB_ERROR_OVERFLOW;
+  }
+
+  std::memset(out, 0, map.size);
+  out[0] = report[0];
+
+  for (const Move& move : map.moves) {
+    int32_t value = extend(
+        readBits(report, length, move.built_offset, move.built_size),
+        move.built_size, move.is_signed);
+    if (move.clamp) {
+      value = std::max(move.minimum, std::min(value, move.maximum));
+    }
+    writeBits(out, map.size, move.live_offset, move.live_size, value);
+  }
+
+  return map.size;
+}
+
+void CLSPReportMap::decode(CLSPReportType type, const unsigned char* live,
+                           int live_length, unsigned char* report,
+                           int length) const {
+  if (live_length < 1 || length < 1) {
+    return;
+  }
+
+  const Report& map = this->reports[slot(type, live[0])];
+  if (!map.remapped) {
+    std::memcpy(report, live, std::min(length, live_length));
+    return;
+  }
+
+  std::memset(report, 0, length);
+  report[0] = live[0];
+
+  for (const Move& move : map.moves) {
+    uint32_t value =
+        readBits(live, live_length, move.live_offset, move.live_size);
+    writeBits(report, length, move.built_offset, move.built_size, value);
+  }
+}
+
+int CLSPReportMap::wireSize(CLSPReportType type, uint8_t report_id,
+                            int built_size) const {
+  const Report& map = this->reports[slot(type, report_id)];
+  return map.remapped ? map.size : built_size;
+}
@@ -0,0 +1,239 @@
+#ifndef CLS_P_DESCRIPTOR_HPP
+#define CLS_P_DESCRIPTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// HID usage pages of the stick descriptor
+#define CLSP_PAGE_GENERIC_DESKTOP 0x01
+#define CLSP_PAGE_ORDINAL 0x0a
+#define CLSP_PAGE_PID 0x0f
+
+/**
+ * Type of a HID report
+ */
+enum CLSPReportType {
+  CLSP_REPORT_INPUT,
+  CLSP_REPORT_OUTPUT,
+  CLSP_REPORT_FEATURE,
+};
+
+/**
+ * Position of one field of a report, as declared by the report descriptor
+ */
+struct CLSPReportField {
+  uint8_t type;
+  uint8_t report_id;
+  uint16_t usage_page;
+  // For a selector array, the usage of the collection listing the selectors,
+  // e.g. PID Effect Type
+  uint16_t usage;
+  // Usage of the enclosing collection, e.g. PID Direction for its instances
+  uint16_t collection;
+  // From the start of the report, report ID byte included
+  uint16_t bit_offset;
+  uint8_t bit_size;
+  // Consecutive values of the same usage, e.g. a byte buffer
+  uint8_t count;
+  // Selector array: the value is the 1-based index of the selector
+  uint8_t array;
+  uint8_t reserved[3];
+  int32_t logical_minimum;
+  int32_t logical_maximum;
+};
+
+/**
+ * Flat table of the fields of every report of a HID report descriptor,
+ * ordered as declared.
+ */
+class CLSPReportLayout {
+ public:
+  CLSPReportLayout();
+
+  /**
+   * Parses a report descriptor
+   * @param descriptor descriptor bytes
+   * @param length descriptor size
+   * @return fields of every report
+   * @throw std::runtime_error if the descriptor is malformed
+   */
+  static CLSPReportLayout parse(const uint8_t* descriptor, size_t length);
+
+  /**
+   * Finds a field
+   * @param type report type
+   * @param report_id report ID
+   * @param usage_page usage page of the field
+   * @param usage usage of the field
+   * @param collection usage of its enclosing collection, 0 for any
+   * @return first matching field, NULL if none
+   */
+  const CLSPReportField* find(CLSPReportType type, uint8_t report_id,
+                              uint16_t usage_page, uint16_t usage,
+                              uint16_t collection) const;
+
+  /**
+   * @param type report type
+   * @param report_id report ID
+   * @return report size in bytes, report ID included, 0 if not declared
+   */
+  int reportSize(CLSPReportType type, uint8_t report_id) const;
+
+  /**
+   * @return fields of every report
+   */
+  const std::vector<CLSPReportField>& getFields() const {
+    return this->fields;
+  }
+
+  /**
+   * @return true if no report is declared
+   */
+  bool empty() const { return this->fields.empty(); }
+
+  /**
+   * Writes the layout to a cache file
+   * @param path cache file, its directory is created if needed
+   * @param firmware firmware version (bcdDevice) the layout was read from
+   * @return false if the file cannot be written
+   */
+  bool save(const std::string& path, uint16_t firmware) const;
+
+  /**
+   * Reads a layout written by save()
+   * @param path cache file
+   * @param firmware expected firmware version
+   * @param layout receives the layout
+   * @return false if the file is missing, stale or corrupted
+   */
+  static bool load(const std::string& path, uint16_t firmware,
+                   CLSPReportLayout& layout);
+
+  /**
+   * @param vendor_id USB vendor ID
+   * @param product_id USB product ID
+   * @param firmware firmware version (bcdDevice)
+   * @return cache file of the layout, under $XDG_CACHE_HOME or ~/.cache,
+   * empty if neither is set
+   */
+  static std::string cachePath(uint16_t vendor_id, uint16_t product_id,
+                               uint16_t firmware);
+
+ private:
+  static const int REPORT_TYPES = 3;
+  static const int REPORT_IDS = 256;
+
+  std::vector<CLSPReportField> fields;
+  // Report sizes in bits, report ID included, padding included
+  std::vector<uint16_t> sizes;
+};
+
+/**
+ * Re-encodes the reports built from the structures of clsp_reports.hpp into
+ * the layout of the live descriptor.
+ *
+ * A report whose fields sit where the structures put them is sent as is;
+ * only the reports moved by the firmware go through the offset table.
+ */
+class CLSPReportMap {
+ public:
+  /**
+   * Built-in layout: every report is sent as is
+   */
+  CLSPReportMap();
+
+  /**
+   * Matches the structures against a descriptor layout. A report missing
+   * from the descriptor is sent as is, a field missing from a report is
+   * dropped.
+   * @param layout layout of the live descriptor
+   */
+  explicit CLSPReportMap(const CLSPReportLayout& layout);
+
+  /**
+   * @param type CLSP_REPORT_OUTPUT or CLSP_REPORT_FEATURE
+   * @param report_id report ID
+   * @return true if the report is sent as built
+   */
+  bool identity(CLSPReportType type, uint8_t report_id) const {
+    return !this->reports[slot(type, report_id)].remapped;
+  }
+
+  /**
+   * @return number of reports laid out differently by the descriptor
+   */
+  int remappedCount() const;
+
+  /**
+   * @return number of built-in fields the descriptor does not declare
+   */
+  int missingFields() const { return this->missing_fields; }
+
+  /**
+   * Lays a built report out as the descriptor declares it
+   * @param type CLSP_REPORT_OUTPUT or CLSP_REPORT_FEATURE
+   * @param report built report, starting with the report ID
+   * @param length built report size
+   * @param out receives the report, unused bits zeroed
+   * @param capacity size of out
+   * @return size of the report in out, LIBUSB_ERROR_OVERFLOW if larger than
+   * capacity
+   */
+  int encode(CLSPReportType type, const unsigned char* report, int length,
+             unsigned char* out, int capacity) const;
+
+  /**
+   * Lays a report read from the device out as its structure
+   * @param type CLSP_REPORT_FEATURE
+   * @param live report read, starting with the report ID
+   * @param live_length size of the report read
+   * @param report receives the report as built, unused bytes zeroed
+   * @param length built report size
+   */
+  void decode(CLSPReportType type, const unsigned char* live, int live_length,
+              unsigned char* report, int length) const;
+
+  /**
+   * @param type CLSP_REPORT_OUTPUT or CLSP_REPORT_FEATURE
+   * @param report_id report ID
+   * @param built_size size of the built report
+   * @return size of the report on the wire
+   */
+  int wireSize(CLSPReportType type, uint8_t report_id, int built_size) const;
+
+ private:
+  /**
+   * One field copied from the built report to the live one
+   */
+  struct Move {
+    uint16_t built_offset;
+    uint8_t built_size;
+    bool is_signed;
+    uint16_t live_offset;
+    uint8_t live_size;
+    bool clamp;
+    int32_t minimum;
+    int32_t maximum;
+  };
+
+  struct Report {
+    bool remapped = false;
+    // Size of the live report in bytes, report ID included
+    int size = 0;
+    std::vector<Move> moves;
+  };
+
+  // Output and feature reports, by ID
+  static const int SLOTS = 2 * 256;
+
+  std::vector<Report> reports;
+  int missing_fields = 0;
+
+  static int slot(CLSPReportType type, uint8_t report_id) {
+    return (type == CLSP_REPORT_OUTPUT ? 0 : 256) + report_id;
+  }
+};
+
+#endif
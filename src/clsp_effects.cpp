@@ -0,0 +1,93 @@
+#include "clsp_effects.hpp"
+
+#include <cstring>
+
+CLSPEffectBlocks::CLSPEffectBlocks() { clear(); }
+
+void CLSPEffectBlocks::add(uint8_t block, uint8_t effect_type) {
+  if (block < 1 || block > MAX_EFFECT_BLOCK) {
+    return;
+  }
+
+  this->types[block] = effect_type;
+  this->last_used[block] = ++this->clock;
+}
+
+void CLSPEffectBlocks::remove(uint8_t block) {
+  if (block < 1 || block > MAX_EFFECT_BLOCK) {
+    return;
+  }
+
+  this->types[block] = 0;
+  this->pinned[block] = false;
+}
+
+void CLSPEffectBlocks::clear() {
+  std::memset(this->types, 0, sizeof(this->types));
+  std::memset(this->last_used, 0, sizeof(this->last_used));
+  std::memset(this->pinned, 0, sizeof(this->pinned));
+}
+
+void CLSPEffectBlocks::pin(uint8_t block, bool pinned) {
+  if (block < 1 || block > MAX_EFFECT_BLOCK) {
+    return;
+  }
+
+  this->pinned[block] = pinned;
+}
+
+bool CLSPEffectBlocks::isPinned(uint8_t block) const {
+  if (block < 1 || block > MAX_EFFECT_BLOCK) {
+    return false;
+  }
+
+  return this->pinned[block];
+}
+
+int CLSPEffectBlocks::find(uint8_t effect_type, uint8_t exclude) {
+  for (int block = 1; block <= MAX_EFFECT_BLOCK; block++) {
+    if (this->types[block] == effect_type && block != exclude &&
+        !this->pinned[block]) {
+      this->last_used[block] = ++this->clock;
+      return block;
+    }
+  }
+
+  return -1;
+}
+
+uint8_t CLSPEffectBlocks::type(uint8_t block) const {
+  if (block < 1 || block > MAX_EFFECT_BLOCK) {
+    return 0;
+  }
+
+  return this->types[block];
+}
+
+int CLSPEffectBlocks::evictionCandidate(uint8_t keep) const {
+  int candidate = -1;
+
+  for (int block = 1; block <= MAX_EFFECT_BLOCK; block++) {
+    if (this->types[block] == 0 || block == keep || this->pinned[block]) {
+      continue;
+    }
+
+    if (candidate < 0 || this->last_used[block] < this->last_used[candidate]) {
+      candidate = block;
+    }
+  }
+
+  return candidate;
+}
+
+int CLSPEffectBlocks::count() const {
+  int count = 0;
+
+  for (int block = 1; block <= MAX_EFFECT_BLOCK; block++) {
+    if (this->types[block] != 0) {
+      count++;
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,86 @@
+#ifndef CLS_P_EFFECTS_HPP
+#define CLS_P_EFFECTS_HPP
+
+#include <cstdint>
+
+/**
+ * Host-side table of the effect blocks allocated on the device through the
+ * Create New Effect / PID Block Load reports. Keeps the resident blocks of
+ * each effect type and a least recently used order for eviction.
+ *
+ * Not thread-safe: the caller serializes the accesses.
+ */
+class CLSPEffectBlocks {
+ public:
+  static const int MAX_EFFECT_BLOCK = 40;
+
+  CLSPEffectBlocks();
+
+  /**
+   * Registers a block returned by the device
+   * @param block effect block index [1,40]
+   * @param effect_type CLSP_* effect ID loaded in the block
+   */
+  void add(uint8_t block, uint8_t effect_type);
+
+  /**
+   * Forgets a freed block
+   * @param block effect block index [1,40]
+   */
+  void remove(uint8_t block);
+
+  /**
+   * Forgets every block, e.g. after a device reset
+   */
+  void clear();
+
+  /**
+   * Reserves a block for a caller that drives it directly, e.g. the force
+   * stream. A pinned block is neither reused by find() nor evicted.
+   * @param block effect block index [1,40]
+   * @param pinned true to reserve the block, false to release it
+   */
+  void pin(uint8_t block, bool pinned);
+
+  /**
+   * @param block effect block index [1,40]
+   * @return true if the block is reserved by pin()
+   */
+  bool isPinned(uint8_t block) const;
+
+  /**
+   * Looks up a resident block of an effect type and marks it as used
+   * @param effect_type CLSP_* effect ID
+   * @param exclude block to skip, e.g. the one playing (0 = none)
+   * @return block index, -1 if no other block holds this effect type
+   */
+  int find(uint8_t effect_type, uint8_t exclude);
+
+  /**
+   * @param block effect block index [1,40]
+   * @return CLSP_* effect ID loaded in the block, 0 if the block is free
+   */
+  uint8_t type(uint8_t block) const;
+
+  /**
+   * Picks the block to free when the device memory is full
+   * @param keep block that must not be evicted, e.g. the one playing
+   * @return least recently used block, -1 if none can be evicted
+   */
+  int evictionCandidate(uint8_t keep) const;
+
+  /**
+   * @return number of blocks allocated on the device
+   */
+  int count() const;
+
+ private:
+  // Indexed by block, 0 = free
+  uint8_t types[MAX_EFFECT_BLOCK + 1];
+  uint64_t last_used[MAX_EFFECT_BLOCK + 1];
+  bool pinned[MAX_EFFECT_BLOCK + 1];
+
+  uint64_t clock = 0;
+};
+
+#endif
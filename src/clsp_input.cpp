@@ -0,0 +1,293 @@
+#include "clsp_input.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+#include "clsp_clock.hpp"
+
+namespace {
+
+const uint8_t REPORT_INPUT = 0x01;
+const int REPORT_INPUT_SIZE = 7;
+
+// Consecutive failed transfers before the reader gives up
+const int MAX_FAILURES = 10;
+// Delay before queuing a failed transfer again, doubled at each failure
+const unsigned int BACKOFF_MIN_MS = 1;
+const unsigned int BACKOFF_MAX_MS = 500;
+
+}  // namespace
+
+bool clspDecodeInput(const unsigned char* report, int length,
+                     CLSPInputSample& sample) {
+  // Input report 2 (PID state) shares the endpoint
+  if (length < REPORT_INPUT_SIZE || report[0] != REPORT_INPUT) {
+    return false;
+  }
+
+  sample.buttons = report[1];
+  sample.hat_switch = report[2];
+  sample.x = (report[4] << 8) | report[3];
+  sample.y = (report[6] << 8) | report[5];
+
+  return true;
+}
+
+void CLSPInputState::publish(const CLSPInputSample& sample) {
+  uint64_t seq = this->seq.load(std::memory_order_relaxed);
+
+  uint64_t packed = static_cast<uint64_t>(sample.buttons.to_ulong() & 0xff) |
+                    static_cast<uint64_t>(sample.hat_switch & 0xff) << 8 |
+                    static_cast<uint64_t>(sample.x) << 16 |
+                    static_cast<uint64_t>(sample.y) << 32;
+
+  // Odd sequence while the words are being written
+  this->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  this->words[0].store(sample.sequence, std::memory_order_relaxed);
+  this->words[1].store(sample.timestamp_ns, std::memory_order_relaxed);
+  this->words[2].store(packed, std::memory_order_relaxed);
+
+  this->seq.store(seq + 2, std::memory_order_release);
+}
+
+CLSPInputSample CLSPInputState::read() const {
+  uint64_t words[3];
+  uint64_t before, after;
+
+  do {
+    before = this->seq.load(std::memory_order_acquire);
+
+    words[0] = this->words[0].load(std::memory_order_relaxed);
+    words[1] = this->words[1].load(std::memory_order_relaxed);
+    words[2] = this->words[2].load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = this->seq.load(std::memory_order_relaxed);
+  } while ((before & 1) || before != after);
+
+  CLSPInputSample sample;
+  sample.sequence = words[0];
+  sample.timestamp_ns = words[1];
+  sample.buttons = words[2] & 0xff;
+  sample.hat_switch = words[2] >> 8 & 0xff;
+  sample.x = words[2] >> 16 & 0xffff;
+  sample.y = words[2] >> 32 & 0xffff;
+
+  return sample;
+}
+
+CLSPInputReader::CLSPInputReader(libusb_device_handle* handle,
+                                 unsigned char endpoint, CLSPInputState& state)
+    : state(state) {
+  this->transfer = libusb_alloc_transfer(0);
+  if (this->transfer == nullptr) {
+    throw std::runtime_error("Unable to allocate input transfer");
+  }
+
+  libusb_fill_interrupt_transfer(this->transfer, handle, endpoint,
+                                 this->buffer, sizeof(this->buffer),
+                                 &CLSPInputReader::onTransferComplete, this, 0);
+
+  this->recovery_thread = std::thread(&CLSPInputReader::recover, this);
+}
+
+CLSPInputReader::~CLSPInputReader() {
+  stop();
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->closing = true;
+  }
+  this->cv.notify_all();
+  this->recovery_thread.join();
+
+  libusb_free_transfer(this->transfer);
+}
+
+int CLSPInputReader::start() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (this->running) {
+    return LIBUSB_SUCCESS;
+  }
+
+  int ret = libusb_submit_transfer(this->transfer);
+  this->running = ret == LIBUSB_SUCCESS;
+
+  return ret;
+}
+
+void CLSPInputReader::setHandler(Handler handler) {
+  this->handler = std::move(handler);
+}
+
+void CLSPInputReader::stop() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  this->stopping = true;
+
+  if (this->running) {
+    // Fails with LIBUSB_ERROR_NOT_FOUND while the recovery thread holds it
+    libusb_cancel_transfer(this->transfer);
+    this->cv.notify_all();
+    this->cv.wait(lock, [this] { return !this->running; });
+  }
+}
+
+int CLSPInputReader::restart(libusb_device_handle* handle) {
+  stop();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  this->transfer->dev_handle = handle;
+  this->stopping = false;
+  this->failures = 0;
+
+  int ret = libusb_submit_transfer(this->transfer);
+  this->running = ret == LIBUSB_SUCCESS;
+
+  return ret;
+}
+
+bool CLSPInputReader::waitNewer(uint64_t sequence, unsigned int timeout) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  auto done = [this, sequence] {
+    return this->state.read().sequence > sequence || !this->running;
+  };
+
+  if (timeout == 0) {
+    this->cv.wait(lock, done);
+  } else {
+    this->cv.wait_for(lock, std::chrono::milliseconds(timeout), done);
+  }
+
+  return this->state.read().sequence > sequence;
+}
+
+bool CLSPInputReader::isRunning() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  return this->running;
+}
+
+void CLSPInputReader::decode(const unsigned char* report, int length) {
+  if (this->handler) {
+    this->handler(report, length);
+  }
+
+  CLSPInputSample sample;
+  if (!clspDecodeInput(report, length, sample)) {
+    return;
+  }
+
+  sample.sequence = ++this->sequence;
+  sample.timestamp_ns = clspMonotonicNs();
+
+  this->state.publish(sample);
+
+  // Empty critical section, orders the wake-up after the waiters' check
+  { std::lock_guard<std::mutex> lock(this->mutex); }
+  this->cv.notify_all();
+}
+
+void CLSPInputReader::stopped() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->running = false;
+  }
+  this->cv.notify_all();
+}
+
+void CLSPInputReader::failed(libusb_transfer_status status) {
+  this->error_count++;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    if (!this->stopping && ++this->failures <= MAX_FAILURES) {
+      // Cleared and queued again off the event thread
+      this->recovering = true;
+      this->stalled = status == LIBUSB_TRANSFER_STALL;
+    } else {
+      if (!this->stopping) {
+        std::cerr << "Input endpoint failing, input reader stopped"
+                  << std::endl;
+      }
+      this->running = false;
+    }
+  }
+  this->cv.notify_all();
+}
+
+void CLSPInputReader::recover() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  while (true) {
+    this->cv.wait(lock, [this] { return this->recovering || this->closing; });
+    if (this->closing) {
+      return;
+    }
+
+    // A synchronous request, it would wait on the event thread forever
+    if (this->stalled) {
+      lock.unlock();
+      libusb_clear_halt(this->transfer->dev_handle, this->transfer->endpoint);
+      lock.lock();
+    }
+
+    unsigned int delay = std::min(BACKOFF_MIN_MS << (this->failures - 1),
+                                  BACKOFF_MAX_MS);
+    this->cv.wait_for(lock, std::chrono::milliseconds(delay),
+                      [this] { return this->stopping || this->closing; });
+
+    this->recovering = false;
+
+    if (!this->stopping && !this->closing &&
+        libusb_submit_transfer(this->transfer) == LIBUSB_SUCCESS) {
+      continue;
+    }
+
+    this->running = false;
+    this->cv.notify_all();
+  }
+}
+
+void LIBUSB_CALL
+CLSPInputReader::onTransferComplete(libusb_transfer* transfer) {
+  auto reader = static_cast<CLSPInputReader*>(transfer->user_data);
+
+  switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      reader->decode(transfer->buffer, transfer->actual_length);
+      break;
+    case LIBUSB_TRANSFER_CANCELLED:
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      reader->stopped();
+      return;
+    default:
+      // Resubmitting at once would spin on a stalled or failing endpoint
+      reader->failed(transfer->status);
+      return;
+  }
+
+  {
+    // Resubmit under the lock, so the destructor cannot miss the transfer
+    std::lock_guard<std::mutex> lock(reader->mutex);
+
+    reader->failures = 0;
+
+    if (!reader->stopping) {
+      if (libusb_submit_transfer(transfer) == LIBUSB_SUCCESS) {
+        return;
+      }
+      reader->error_count++;
+    }
+  }
+
+  reader->stopped();
+}
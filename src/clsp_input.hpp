@@ -0,0 +1,176 @@
+#ifndef CLS_P_INPUT_HPP
+#define CLS_P_INPUT_HPP
+
+#include <libusb-1.0/libusb.h>
+
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * Decoded input report 1
+ */
+struct CLSPInputSample {
+  // Number of reports decoded before this one, 0 until the first report
+  uint64_t sequence = 0;
+  // CLOCK_MONOTONIC time of the report completion, in ns
+  uint64_t timestamp_ns = 0;
+  // 1b per button, bit4 is sticky
+  std::bitset<8> buttons;
+  // 1 -> up, 3 -> right, 5 -> down, 7 -> left
+  int hat_switch = 0;
+  // Between 0 and 65535
+  uint16_t x = 0;
+  uint16_t y = 0;
+};
+
+/**
+ * Latest input sample, published by a single writer through a seqlock. Reads
+ * never block the writer nor take a lock; they only retry if a report is
+ * published while they copy it.
+ */
+class CLSPInputState {
+ public:
+  /**
+   * Publishes a new sample. Only one thread may publish.
+   */
+  void publish(const CLSPInputSample& sample);
+
+  /**
+   * @return copy of the latest published sample
+   */
+  CLSPInputSample read() const;
+
+ private:
+  std::atomic<uint64_t> seq{0};
+
+  // sequence, timestamp, packed buttons/hat/x/y
+  std::atomic<uint64_t> words[3] = {};
+};
+
+/**
+ * Decodes the buttons, hat switch and position of an input report 1
+ * @param report report bytes, starting with the report ID
+ * @param length report size
+ * @param sample receives the decoded fields, its sequence and timestamp are
+ * left untouched
+ * @return false if the report is not an input report 1
+ */
+bool clspDecodeInput(const unsigned char* report, int length,
+                     CLSPInputSample& sample);
+
+/**
+ * Keeps an interrupt IN transfer queued on the main endpoint and decodes each
+ * input report 1 into a CLSPInputState. The completions run on the libusb
+ * event thread, so no other thread has to poll the device.
+ *
+ * A failed transfer is queued again by a recovery thread, after clearing the
+ * halt of a stalled endpoint and a delay doubling with each consecutive
+ * failure. The reader stops after too many consecutive failures.
+ */
+class CLSPInputReader {
+ public:
+  /**
+   * @param handle device handle
+   * @param endpoint IN endpoint address
+   * @param state where the decoded samples are published
+   */
+  CLSPInputReader(libusb_device_handle* handle, unsigned char endpoint,
+                  CLSPInputState& state);
+
+  /**
+   * Cancels the queued transfer, waits for its completion and stops the
+   * recovery thread
+   */
+  ~CLSPInputReader();
+
+  CLSPInputReader(const CLSPInputReader&) = delete;
+  CLSPInputReader& operator=(const CLSPInputReader&) = delete;
+
+  // Called with each report read, on the libusb event thread
+  typedef std::function<void(const unsigned char*, int)> Handler;
+
+  /**
+   * Sets the handler called with every report read, before it is decoded.
+   * Only while the reader is stopped.
+   * @param handler report handler, empty for none
+   */
+  void setHandler(Handler handler);
+
+  /**
+   * Queues the first transfer
+   * @return libusb error code, 0 on success
+   */
+  int start();
+
+  /**
+   * Cancels the queued transfer and waits for its completion. The published
+   * sample is kept.
+   */
+  void stop();
+
+  /**
+   * Moves the reader to another handle of the device, e.g. after a
+   * re-attach, and queues the first transfer
+   * @param handle device handle
+   * @return libusb error code, 0 on success
+   */
+  int restart(libusb_device_handle* handle);
+
+  /**
+   * Blocks until a sample newer than the given sequence is published, the
+   * reader stops or the timeout expires
+   * @param sequence last sequence seen by the caller
+   * @param timeout maximum wait in ms (0 = inf)
+   * @return true if a newer sample is available
+   */
+  bool waitNewer(uint64_t sequence, unsigned int timeout);
+
+  /**
+   * @return number of failed IN transfers since the reader creation
+   */
+  uint64_t errors() const { return this->error_count; }
+
+  /**
+   * @return false once the reader is stopped, by stop() or by repeated
+   * transfer failures
+   */
+  bool isRunning();
+
+ private:
+  // Larger than any input report of the interface
+  static const int BUFFER_SIZE = 64;
+
+  CLSPInputState& state;
+  Handler handler;
+  libusb_transfer* transfer;
+  unsigned char buffer[BUFFER_SIZE] = {};
+
+  uint64_t sequence = 0;
+  std::atomic<uint64_t> error_count{0};
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool running = false;
+  bool stopping = false;
+
+  // Failed transfer waiting for the recovery thread to queue it again
+  bool recovering = false;
+  bool stalled = false;
+  int failures = 0;
+  bool closing = false;
+  std::thread recovery_thread;
+
+  void decode(const unsigned char* report, int length);
+  void stopped();
+  void failed(libusb_transfer_status status);
+  void recover();
+
+  static void LIBUSB_CALL onTransferComplete(libusb_transfer* transfer);
+};
+
+#endif
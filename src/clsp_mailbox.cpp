@@ -0,0 +1,332 @@
+#include "clsp_mailbox.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "clsp_clock.hpp"
+#include "clsp_reports.hpp"
+
+namespace {
+
+// Fields of a report, consecutive in CLSPEffectField
+struct ReportFields {
+  CLSPEffectField first;
+  int count;
+};
+
+const ReportFields REPORT_FIELDS[] = {
+    {CLSP_FIELD_CONSTANT_MAGNITUDE, 1},
+    {CLSP_FIELD_PERIODIC_MAGNITUDE, 4},
+    {CLSP_FIELD_RAMP_START, 2},
+    {CLSP_FIELD_ENVELOPE_ATTACK_LEVEL, 4},
+};
+
+const int MAX_REPORT_FIELDS = 4;
+const uint64_t NS_PER_MS = 1000000;
+// Largest of the reports above
+const int MAX_REPORT_BYTES = sizeof(CLSPEnvelopeReport);
+
+int32_t clampField(int32_t value, int32_t min, int32_t max) {
+  return std::min(std::max(value, min), max);
+}
+
+template <typename Report>
+int copyReport(const Report& report, unsigned char* bytes) {
+  static_assert(sizeof(Report) <= MAX_REPORT_BYTES, "report too large");
+  std::memcpy(bytes, clspReportBytes(report), sizeof(Report));
+  return sizeof(Report);
+}
+
+// Builds the report of a field group from the values of its fields
+int buildReport(CLSPEffectField first, uint8_t block, const int32_t* values,
+                unsigned char* bytes) {
+  switch (first) {
+    case CLSP_FIELD_CONSTANT_MAGNITUDE:
+      return copyReport(
+          CLSPConstantForceReport(block, clampField(values[0], -255, 255)),
+          bytes);
+
+    case CLSP_FIELD_PERIODIC_MAGNITUDE:
+      return copyReport(
+          CLSPPeriodicReport(block, clampField(values[0], 0, 255),
+                             clampField(values[1], -128, 127),
+                             clampField(values[2], 0, 255),
+                             clampField(values[3], 0, 0xffff)),
+          bytes);
+
+    case CLSP_FIELD_RAMP_START:
+      return copyReport(CLSPRampReport(block, clampField(values[0], -128, 127),
+                                       clampField(values[1], -128, 127)),
+                        bytes);
+
+    case CLSP_FIELD_ENVELOPE_ATTACK_LEVEL:
+      return copyReport(
+          CLSPEnvelopeReport(block, clampField(values[0], 0, 255),
+                             clampField(values[1], 0, 255),
+                             clampField(values[2], 0, 0xffff),
+                             clampField(values[3], 0, 0xffff)),
+          bytes);
+
+    default:
+      return 0;
+  }
+}
+
+}  // namespace
+
+CLSPParameterMailboxes::~CLSPParameterMailboxes() { stop(); }
+
+int CLSPParameterMailboxes::start(Sender sender,
+                                  const CLSPRealtimeProfile& profile) {
+  if (running() || !sender) {
+    return -1;
+  }
+
+  std::unique_ptr<CLSPPeriodicTimer> timer;
+  try {
+    timer = std::make_unique<CLSPPeriodicTimer>(FRAME_NS, profile.timer);
+  } catch (const std::runtime_error&) {
+    return -1;
+  }
+
+  this->sender = std::move(sender);
+  this->stopping = false;
+
+  CLSPMailboxStats stats;
+  {
+    std::lock_guard<std::mutex> lock(this->stats_mutex);
+    this->published = stats;
+    this->timer = std::move(timer);
+  }
+
+  this->thread = std::thread(&CLSPParameterMailboxes::run, this, stats,
+                             profile.prefault_stack);
+
+  CLSPRealtimeProfile mailbox_profile = profile;
+  // The memory is locked by the stream or the backend thread if requested
+  mailbox_profile.lock_memory = false;
+
+  CLSPRealtimeStatus status =
+      clspApplyRealtime(this->thread.native_handle(), mailbox_profile);
+
+  std::lock_guard<std::mutex> lock(this->stats_mutex);
+  this->published.realtime = status.realtime;
+
+  return 0;
+}
+
+void CLSPParameterMailboxes::stop() {
+  if (!running()) {
+    return;
+  }
+
+  this->stopping = true;
+  this->thread.join();
+}
+
+bool CLSPParameterMailboxes::post(uint8_t block, CLSPEffectField field,
+                                  int32_t value) {
+  return request(block, field, value, 0);
+}
+
+bool CLSPParameterMailboxes::slew(uint8_t block, CLSPEffectField field,
+                                  int32_t target, unsigned int slew_ms) {
+  return request(block, field, target, slew_ms);
+}
+
+void CLSPParameterMailboxes::setSlewCadence(unsigned int cadence_ms) {
+  this->slew_cadence_ns.store(std::max(cadence_ms, 1u) * FRAME_NS,
+                              std::memory_order_relaxed);
+}
+
+void CLSPParameterMailboxes::seed(uint8_t block, CLSPEffectField field,
+                                  int32_t value) {
+  if (block < 1 || block > MAX_BLOCK || field < 0 ||
+      field >= CLSP_EFFECT_FIELDS) {
+    return;
+  }
+
+  this->fields[block - 1][field].value.store(value,
+                                             std::memory_order_release);
+}
+
+CLSPMailboxStats CLSPParameterMailboxes::stats() {
+  std::lock_guard<std::mutex> lock(this->stats_mutex);
+  CLSPMailboxStats stats = this->published;
+
+  if (this->timer) {
+    stats.overruns = this->timer->stats().missed;
+  }
+
+  return stats;
+}
+
+void CLSPParameterMailboxes::run(CLSPMailboxStats stats,
+                                 bool prefault_stack) {
+  if (prefault_stack) {
+    clspPrefaultStack();
+  }
+
+  // Not replaced before the thread is joined
+  CLSPPeriodicTimer& timer = *this->timer;
+
+  while (!this->stopping.load(std::memory_order_relaxed)) {
+    timer.wait();
+
+    // The slews step on the period grid, whatever the wake-up lateness
+    uint64_t now = timer.deadline();
+    stats.frames++;
+
+    uint64_t blocks =
+        this->dirty.exchange(0, std::memory_order_acquire) | this->slewing;
+    if (blocks != 0) {
+      stats.active_frames++;
+
+      for (int index = 0; index < MAX_BLOCK; index++) {
+        if ((blocks & (1ull << index)) != 0) {
+          drain(index, now, stats);
+        }
+      }
+    }
+
+    // The reader copies the stats rarely, skip the update rather than wait
+    std::unique_lock<std::mutex> lock(this->stats_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      continue;
+    }
+
+    stats.realtime = this->published.realtime;
+    this->published = stats;
+  }
+}
+
+void CLSPParameterMailboxes::drain(int index, uint64_t now,
+                                   CLSPMailboxStats& stats) {
+  uint8_t block = index + 1;
+  uint64_t cadence_ns = this->slew_cadence_ns.load(std::memory_order_relaxed);
+  bool slewing = false;
+
+  for (const ReportFields& report : REPORT_FIELDS) {
+    bool written = false;
+    bool stepped = false;
+    int32_t held[MAX_REPORT_FIELDS];
+    int32_t values[MAX_REPORT_FIELDS];
+
+    for (int i = 0; i < report.count; i++) {
+      int field = report.first + i;
+      Field& mailbox = this->fields[index][field];
+      Slew& slew = this->slews[index][field];
+
+      held[i] = mailbox.value.load(std::memory_order_acquire);
+      int32_t value = held[i];
+
+      // A direct call replaced the last step
+      if (slew.active && value != slew.sent) {
+        slew.active = false;
+        stats.interrupted++;
+      }
+
+      uint32_t writes = mailbox.writes.load(std::memory_order_acquire);
+      uint32_t count = writes - this->drained[index][field];
+
+      if (count > 0) {
+        stats.posted += count;
+        stats.coalesced += count - 1;
+        this->drained[index][field] = writes;
+
+        if (slew.active) {
+          slew.active = false;
+          stats.interrupted++;
+        }
+
+        uint64_t packed = mailbox.request.load(std::memory_order_relaxed);
+        int32_t target = static_cast<int32_t>(static_cast<uint32_t>(packed));
+        uint64_t duration_ns = (packed >> 32) * NS_PER_MS;
+
+        if (duration_ns == 0) {
+          value = target;
+          written = true;
+        } else {
+          // Steps ahead by a cadence, so the first one already moves
+          slew.active = true;
+          slew.from = value;
+          slew.to = target;
+          slew.start_ns = now - cadence_ns;
+          slew.duration_ns = duration_ns;
+          slew.next_ns = now;
+          stats.slews++;
+        }
+      }
+
+      if (slew.active && now >= slew.next_ns) {
+        uint64_t elapsed = now - slew.start_ns;
+
+        if (elapsed >= slew.duration_ns) {
+          value = slew.to;
+          slew.active = false;
+        } else {
+          int64_t range = static_cast<int64_t>(slew.to) - slew.from;
+          value = slew.from + static_cast<int32_t>(
+                                  range * static_cast<int64_t>(elapsed) /
+                                  static_cast<int64_t>(slew.duration_ns));
+          slew.next_ns = now + cadence_ns;
+        }
+
+        slew.sent = value;
+        written = true;
+        stepped = true;
+      }
+
+      slewing = slewing || slew.active;
+      values[i] = value;
+    }
+
+    // Only the reports of the fields written since the last frame or with a
+    // slew step due
+    if (!written) {
+      continue;
+    }
+
+    // A direct call racing with the drain keeps its value, the slew of the
+    // field ends at the next frame
+    for (int i = 0; i < report.count; i++) {
+      this->fields[index][report.first + i].value.compare_exchange_strong(
+          held[i], values[i], std::memory_order_acq_rel);
+    }
+
+    unsigned char bytes[MAX_REPORT_BYTES];
+    int length = buildReport(report.first, block, values, bytes);
+
+    this->sender(bytes, length);
+    stats.sent++;
+    if (stepped) {
+      stats.slew_steps++;
+    }
+  }
+
+  if (slewing) {
+    this->slewing |= 1ull << index;
+  } else {
+    this->slewing &= ~(1ull << index);
+  }
+}
+
+bool CLSPParameterMailboxes::request(uint8_t block, CLSPEffectField field,
+                                     int32_t value, unsigned int slew_ms) {
+  if (block < 1 || block > MAX_BLOCK || field < 0 ||
+      field >= CLSP_EFFECT_FIELDS) {
+    return false;
+  }
+
+  Field& mailbox = this->fields[block - 1][field];
+
+  // The drain reads the count first, so it sees this request or a later one
+  uint64_t packed = static_cast<uint64_t>(slew_ms) << 32 |
+                    static_cast<uint32_t>(value);
+  mailbox.request.store(packed, std::memory_order_relaxed);
+  mailbox.writes.fetch_add(1, std::memory_order_release);
+  this->dirty.fetch_or(1ull << (block - 1), std::memory_order_release);
+
+  return true;
+}
@@ -0,0 +1,220 @@
+#ifndef CLS_P_MAILBOX_HPP
+#define CLS_P_MAILBOX_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "clsp_realtime.hpp"
+#include "clsp_transfer.hpp"
+
+/**
+ * Effect parameter held by a mailbox, with the report carrying it
+ */
+enum CLSPEffectField {
+  // Set Constant Force (0x05) magnitude [-255,255]
+  CLSP_FIELD_CONSTANT_MAGNITUDE,
+  // Set Periodic (0x04) magnitude [0,255], offset [-128,127], phase [0,255]
+  // and period in ms
+  CLSP_FIELD_PERIODIC_MAGNITUDE,
+  CLSP_FIELD_PERIODIC_OFFSET,
+  CLSP_FIELD_PERIODIC_PHASE,
+  CLSP_FIELD_PERIODIC_PERIOD,
+  // Set Ramp Force (0x06) start and end [-128,127]
+  CLSP_FIELD_RAMP_START,
+  CLSP_FIELD_RAMP_END,
+  // Set Envelope (0x02) levels [0,255] and times in ms
+  CLSP_FIELD_ENVELOPE_ATTACK_LEVEL,
+  CLSP_FIELD_ENVELOPE_FADE_LEVEL,
+  CLSP_FIELD_ENVELOPE_ATTACK_TIME,
+  CLSP_FIELD_ENVELOPE_FADE_TIME,
+  CLSP_EFFECT_FIELDS,
+};
+
+/**
+ * Field updates drained by the mailbox thread since its start
+ */
+struct CLSPMailboxStats {
+  // Field writes drained
+  uint64_t posted = 0;
+  // Writes replaced by a later one of the same field within a frame, never
+  // sent on their own
+  uint64_t coalesced = 0;
+  // Frames run, and the ones with at least a field written
+  uint64_t frames = 0;
+  uint64_t active_frames = 0;
+  // Reports handed to the sender, the shadow cache still drops the ones
+  // whose fields were written back to the values the device holds
+  uint64_t sent = 0;
+  // Slews started, and the ones cut short by a later write of the field or
+  // a direct call
+  uint64_t slews = 0;
+  uint64_t interrupted = 0;
+  // Reports sent by the slews in progress, their last step included
+  uint64_t slew_steps = 0;
+  // Deadlines missed because a frame woke up more than a period late
+  uint64_t overruns = 0;
+  // True if the thread got the SCHED_FIFO policy
+  bool realtime = false;
+};
+
+/**
+ * Latest-value mailboxes for the parameters of every effect block. Any
+ * thread writes a field without lock nor I/O; the mailbox thread drains them
+ * once per USB frame and sends one report per effect parameter block whose
+ * fields changed since the last frame, whatever the number of writes.
+ *
+ * A field may also slew to its target: the mailbox thread then moves it
+ * linearly from the value the device holds, one step every slew cadence,
+ * so a magnitude change needs one call instead of a report per step.
+ *
+ * A report carries every field of its parameter block: the fields not
+ * written through the mailboxes keep the value of the last direct call, see
+ * seed().
+ */
+class CLSPParameterMailboxes {
+ public:
+  // Submits a report in the built-in layout
+  typedef std::function<CLSPCompletion(const unsigned char*, int)> Sender;
+
+  // Effect blocks [1,40]
+  static constexpr int MAX_BLOCK = 40;
+
+  // Full-speed USB frame
+  static constexpr uint64_t FRAME_NS = 1000000;
+
+  // Time between two steps of a slew by default
+  static constexpr unsigned int DEFAULT_SLEW_CADENCE_MS = 4;
+
+  CLSPParameterMailboxes() = default;
+
+  /**
+   * Stops the thread
+   */
+  ~CLSPParameterMailboxes();
+
+  CLSPParameterMailboxes(const CLSPParameterMailboxes&) = delete;
+  CLSPParameterMailboxes& operator=(const CLSPParameterMailboxes&) = delete;
+
+  /**
+   * Starts the mailbox thread, with the real-time profile if allowed
+   * @param sender called on the mailbox thread to submit a report
+   * @param profile real-time profile of the thread
+   * @return 0 on success, -1 if the thread runs or its clock cannot be
+   * created
+   */
+  int start(Sender sender, const CLSPRealtimeProfile& profile);
+
+  /**
+   * Stops the mailbox thread, waiting for the frame in progress
+   */
+  void stop();
+
+  /**
+   * @return true while the mailbox thread runs
+   */
+  bool running() const { return this->thread.joinable(); }
+
+  /**
+   * Writes a field, sent by the next frame. Lock-free, callable from any
+   * thread, also when the thread is stopped.
+   * @param block effect block index [1,40]
+   * @param field parameter
+   * @param value new value, clamped to the field range when sent
+   * @return false if the block or the field is out of range
+   */
+  bool post(uint8_t block, CLSPEffectField field, int32_t value);
+
+  /**
+   * Moves a field to a target over a time, sent by the next frame and then
+   * one step every slew cadence until the target. The slew starts from the
+   * last value sent for the field; a later post(), slew() or direct call of
+   * the field ends it. Lock-free, callable from any thread.
+   * @param block effect block index [1,40]
+   * @param field parameter
+   * @param target value at the end of the slew, clamped to the field range
+   * when sent
+   * @param slew_ms duration of the slew, in ms (0 = a post())
+   * @return false if the block or the field is out of range
+   */
+  bool slew(uint8_t block, CLSPEffectField field, int32_t target,
+            unsigned int slew_ms);
+
+  /**
+   * Sets the time between two steps of the slews, the last step always falls
+   * on the end of the slew. Lock-free.
+   * @param cadence_ms time between two steps in ms, rounded up to the USB
+   * frame (1 ms)
+   */
+  void setSlewCadence(unsigned int cadence_ms);
+
+  /**
+   * Records the value of a field sent by a direct call, so a later write of
+   * another field of the same report keeps it. Not sent. Ends a slew of the
+   * field. Lock-free.
+   * @param block effect block index [1,40]
+   * @param field parameter
+   * @param value value sent
+   */
+  void seed(uint8_t block, CLSPEffectField field, int32_t value);
+
+  /**
+   * @return drain counters since the last start, refreshed every frame
+   */
+  CLSPMailboxStats stats();
+
+ private:
+  struct Field {
+    // Last write: target in the low 32 bits, slew time in ms in the high ones
+    std::atomic<uint64_t> request{0};
+    // Incremented after each write, the drain compares it to its last copy
+    std::atomic<uint32_t> writes{0};
+    // Value the device holds, stored by seed() and by the drain
+    std::atomic<int32_t> value{0};
+  };
+
+  // Slew of a field in progress, mailbox thread only
+  struct Slew {
+    bool active = false;
+    int32_t from = 0;
+    int32_t to = 0;
+    uint64_t start_ns = 0;
+    uint64_t duration_ns = 0;
+    // Frame time of the next step
+    uint64_t next_ns = 0;
+    // Value of the last step, a different field value means a direct call
+    int32_t sent = 0;
+  };
+
+  // [block - 1][field]
+  Field fields[MAX_BLOCK][CLSP_EFFECT_FIELDS];
+  // Bit per block with a field written since the last drain
+  std::atomic<uint64_t> dirty{0};
+  // Write counts of the last drain, kept across the restarts so the writes
+  // made while stopped go out at the next start. Mailbox thread only.
+  uint32_t drained[MAX_BLOCK][CLSP_EFFECT_FIELDS] = {};
+  // Slews in progress, and bit per block with one. Mailbox thread only.
+  Slew slews[MAX_BLOCK][CLSP_EFFECT_FIELDS];
+  uint64_t slewing = 0;
+  std::atomic<uint64_t> slew_cadence_ns{DEFAULT_SLEW_CADENCE_MS * FRAME_NS};
+
+  Sender sender;
+  std::atomic<bool> stopping{false};
+  std::thread thread;
+
+  // Copy of the counters of the mailbox thread, updated when not contended
+  std::mutex stats_mutex;
+  CLSPMailboxStats published;
+  // Clock of the frames, kept after a stop for its stats
+  std::unique_ptr<CLSPPeriodicTimer> timer;
+
+  void run(CLSPMailboxStats stats, bool prefault_stack);
+  void drain(int index, uint64_t now, CLSPMailboxStats& stats);
+  bool request(uint8_t block, CLSPEffectField field, int32_t value,
+               unsigned int slew_ms);
+};
+
+#endif
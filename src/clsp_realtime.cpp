@@ -0,0 +1,234 @@
+#include "clsp_realtime.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "clsp_clock.hpp"
+
+namespace {
+
+// Stack touched by clspPrefaultStack(), far more than the loops use
+const size_t PREFAULT_STACK_SIZE = 128 * 1024;
+
+struct timespec toTimespec(uint64_t ns) {
+  struct timespec ts;
+  ts.tv_sec = ns / 1000000000ull;
+  ts.tv_nsec = ns % 1000000000ull;
+
+  return ts;
+}
+
+void storeMax(std::atomic<uint64_t>& max, uint64_t value) {
+  if (value > max.load(std::memory_order_relaxed)) {
+    max.store(value, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace
+
+CLSPRealtimeStatus clspApplyRealtime(std::thread::native_handle_type thread,
+                                     const CLSPRealtimeProfile& profile) {
+  CLSPRealtimeStatus status;
+
+  if (profile.priority > 0) {
+    struct sched_param param = {};
+    param.sched_priority = profile.priority;
+    status.realtime =
+        pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+  }
+
+  if (!profile.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : profile.cpus) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+    status.affinity =
+        pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+  }
+
+  if (profile.lock_memory) {
+    status.memory_locked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+  }
+
+  return status;
+}
+
+void clspPrefaultStack() {
+  unsigned char stack[PREFAULT_STACK_SIZE];
+  // Volatile stores, the compiler cannot drop them
+  volatile unsigned char* touch = stack;
+  size_t page = sysconf(_SC_PAGESIZE);
+
+  for (size_t i = 0; i < PREFAULT_STACK_SIZE; i += page) {
+    touch[i] = 0;
+  }
+}
+
+CLSPLatencyHistogram::CLSPLatencyHistogram(uint64_t bin_ns, int bins)
+    : bin_ns(bin_ns), bins(bins) {
+  reset();
+}
+
+void CLSPLatencyHistogram::record(uint64_t latency_ns) {
+  size_t bin = std::min<uint64_t>(latency_ns / this->bin_ns,
+                                  this->bins.size() - 1);
+
+  // Single writer, no read-modify-write needed
+  this->bins[bin].store(
+      this->bins[bin].load(std::memory_order_relaxed) + 1,
+      std::memory_order_relaxed);
+}
+
+void CLSPLatencyHistogram::reset() {
+  for (auto& bin : this->bins) {
+    bin.store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t CLSPLatencyHistogram::count() const {
+  uint64_t total = 0;
+  for (const auto& bin : this->bins) {
+    total += bin.load(std::memory_order_relaxed);
+  }
+
+  return total;
+}
+
+double CLSPLatencyHistogram::percentile(double fraction) const {
+  uint64_t total = count();
+  if (total == 0) {
+    return 0.0;
+  }
+
+  uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(fraction * total)));
+  uint64_t seen = 0;
+
+  size_t i = 0;
+  for (; i < this->bins.size() - 1; i++) {
+    seen += this->bins[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      break;
+    }
+  }
+
+  return (i + 1) * this->bin_ns / 1000.0;
+}
+
+double clspPercentile(std::vector<double> values, double fraction) {
+  if (values.empty()) {
+    return 0.0;
+  }
+
+  std::sort(values.begin(), values.end());
+  size_t index = static_cast<size_t>(fraction * (values.size() - 1) + 0.5);
+
+  return values[index];
+}
+
+CLSPPeriodicTimer::CLSPPeriodicTimer(uint64_t period_ns, CLSPTimerType type)
+    : period_ns(period_ns),
+      type(type),
+      next_ns(clspMonotonicNs()),
+      lateness(LATENESS_BIN_NS, LATENESS_BINS) {
+  if (type != CLSP_TIMER_TIMERFD) {
+    return;
+  }
+
+  this->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (this->fd < 0) {
+    throw std::runtime_error("Unable to create the timerfd");
+  }
+
+  struct itimerspec spec;
+  spec.it_value = toTimespec(this->next_ns + period_ns);
+  spec.it_interval = toTimespec(period_ns);
+
+  if (timerfd_settime(this->fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+    close(this->fd);
+    throw std::runtime_error("Unable to arm the timerfd");
+  }
+}
+
+CLSPPeriodicTimer::~CLSPPeriodicTimer() {
+  if (this->fd >= 0) {
+    close(this->fd);
+  }
+}
+
+uint64_t CLSPPeriodicTimer::wait() {
+  // First deadline not reached yet, the lateness is counted from it
+  uint64_t deadline = this->next_ns + this->period_ns;
+  uint64_t now;
+
+  if (this->type == CLSP_TIMER_TIMERFD) {
+    uint64_t expirations = 0;
+    while (read(this->fd, &expirations, sizeof(expirations)) < 0 &&
+           errno == EINTR) {
+    }
+    now = clspMonotonicNs();
+
+    // The kernel keeps the grid, each expiration is a deadline
+    this->next_ns += std::max<uint64_t>(expirations, 1) * this->period_ns;
+  } else {
+    struct timespec ts = toTimespec(deadline);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+           EINTR) {
+    }
+    now = clspMonotonicNs();
+
+    this->next_ns = deadline;
+    if (now > deadline) {
+      this->next_ns += (now - deadline) / this->period_ns * this->period_ns;
+    }
+  }
+
+  uint64_t late = now > deadline ? now - deadline : 0;
+  uint64_t skipped = (this->next_ns - deadline) / this->period_ns;
+
+  this->lateness.record(late);
+  this->wakeups.store(this->wakeups.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+  this->missed.store(this->missed.load(std::memory_order_relaxed) + skipped,
+                     std::memory_order_relaxed);
+  this->lateness_sum.store(
+      this->lateness_sum.load(std::memory_order_relaxed) + late,
+      std::memory_order_relaxed);
+  storeMax(this->lateness_max, late);
+
+  return now;
+}
+
+CLSPWakeupStats CLSPPeriodicTimer::stats() const {
+  CLSPWakeupStats stats;
+
+  stats.wakeups = this->wakeups.load(std::memory_order_relaxed);
+  stats.missed = this->missed.load(std::memory_order_relaxed);
+
+  if (stats.wakeups == 0) {
+    return stats;
+  }
+
+  stats.lateness_mean_us =
+      this->lateness_sum.load(std::memory_order_relaxed) / 1000.0 /
+      stats.wakeups;
+  stats.lateness_p50_us = this->lateness.percentile(0.50);
+  stats.lateness_p99_us = this->lateness.percentile(0.99);
+  stats.lateness_p999_us = this->lateness.percentile(0.999);
+  stats.lateness_max_us =
+      this->lateness_max.load(std::memory_order_relaxed) / 1000.0;
+
+  return stats;
+}
@@ -0,0 +1,186 @@
+#ifndef CLS_P_REALTIME_HPP
+#define CLS_P_REALTIME_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/**
+ * Clock of a periodic loop
+ */
+enum CLSPTimerType {
+  // clock_nanosleep(TIMER_ABSTIME) on the next deadline
+  CLSP_TIMER_NANOSLEEP,
+  // Periodic timerfd, the kernel keeps the period and counts the expirations
+  CLSP_TIMER_TIMERFD,
+};
+
+/**
+ * Scheduling of a thread driving the transfers, for a box shared with other
+ * heavy processes
+ */
+struct CLSPRealtimeProfile {
+  // SCHED_FIFO priority [1,99], 0 for the default policy
+  int priority = 80;
+  // CPUs the thread may run on, empty for any, e.g. a core isolated with
+  // isolcpus
+  std::vector<int> cpus;
+  // Locks the current and future pages of the whole process in RAM with
+  // mlockall(). Needs a large enough RLIMIT_MEMLOCK or CAP_IPC_LOCK.
+  bool lock_memory = false;
+  // Touches the top of the thread stack before its loop, so the loop never
+  // page-faults on it
+  bool prefault_stack = true;
+  // Clock of the periodic loops
+  CLSPTimerType timer = CLSP_TIMER_NANOSLEEP;
+};
+
+/**
+ * Parts of a profile the system granted
+ */
+struct CLSPRealtimeStatus {
+  // SCHED_FIFO policy, needs CAP_SYS_NICE or an rtprio limit
+  bool realtime = false;
+  // CPU affinity set
+  bool affinity = false;
+  // Pages of the process locked
+  bool memory_locked = false;
+};
+
+/**
+ * Applies the policy, priority and affinity of a profile to a thread, and
+ * locks the memory of the process if requested. The stack is prefaulted by
+ * the thread itself, see clspPrefaultStack().
+ * @param thread thread handle
+ * @param profile profile to apply
+ * @return parts of the profile applied, the others are left unchanged
+ */
+CLSPRealtimeStatus clspApplyRealtime(std::thread::native_handle_type thread,
+                                     const CLSPRealtimeProfile& profile);
+
+/**
+ * Touches the next pages of the stack of the calling thread
+ */
+void clspPrefaultStack();
+
+/**
+ * Latency histogram with fixed-width bins, written by a single thread and
+ * read by any other without lock
+ */
+class CLSPLatencyHistogram {
+ public:
+  /**
+   * @param bin_ns width of a bin, in ns
+   * @param bins number of bins, the last one counts the larger latencies
+   */
+  CLSPLatencyHistogram(uint64_t bin_ns, int bins);
+
+  /**
+   * Counts a latency. Only one thread may record.
+   * @param latency_ns latency, in ns
+   */
+  void record(uint64_t latency_ns);
+
+  /**
+   * Empties the histogram, not while a thread records
+   */
+  void reset();
+
+  /**
+   * @return latencies recorded
+   */
+  uint64_t count() const;
+
+  /**
+   * @param fraction rank of the percentile [0,1]
+   * @return upper bound of the bin holding the percentile, in us, 0 if empty
+   */
+  double percentile(double fraction) const;
+
+ private:
+  uint64_t bin_ns;
+  std::vector<std::atomic<uint32_t>> bins;
+};
+
+/**
+ * Exact percentile of a set of samples, for the results kept in full
+ * @param values samples, in any order
+ * @param fraction rank of the percentile [0,1]
+ * @return nearest-rank sample, 0 if empty
+ */
+double clspPercentile(std::vector<double> values, double fraction);
+
+/**
+ * Wake-up timing of a periodic loop
+ */
+struct CLSPWakeupStats {
+  uint64_t wakeups = 0;
+  // Deadlines skipped because a wake-up came more than a period late
+  uint64_t missed = 0;
+  // Wake-up time past the deadline, in us. The percentiles are rounded up to
+  // 1 us.
+  double lateness_mean_us = 0.0;
+  double lateness_p50_us = 0.0;
+  double lateness_p99_us = 0.0;
+  double lateness_p999_us = 0.0;
+  double lateness_max_us = 0.0;
+};
+
+/**
+ * Wakes a loop up on a fixed period grid of CLOCK_MONOTONIC. A late wake-up
+ * realigns on the grid rather than bursting to catch up on the deadlines
+ * already past.
+ */
+class CLSPPeriodicTimer {
+ public:
+  /**
+   * Starts the period grid now
+   * @param period_ns period, in ns
+   * @param type clock of the loop
+   * @throw std::runtime_error if the timerfd cannot be created
+   */
+  CLSPPeriodicTimer(uint64_t period_ns, CLSPTimerType type);
+
+  /**
+   * Closes the timerfd
+   */
+  ~CLSPPeriodicTimer();
+
+  CLSPPeriodicTimer(const CLSPPeriodicTimer&) = delete;
+  CLSPPeriodicTimer& operator=(const CLSPPeriodicTimer&) = delete;
+
+  /**
+   * Sleeps until the next deadline. Only one thread may wait.
+   * @return CLOCK_MONOTONIC time of the wake-up, in ns
+   */
+  uint64_t wait();
+
+  /**
+   * @return CLOCK_MONOTONIC time of the last deadline reached, in ns
+   */
+  uint64_t deadline() const { return this->next_ns; }
+
+  /**
+   * @return wake-up timing since the creation, callable from any thread
+   */
+  CLSPWakeupStats stats() const;
+
+ private:
+  // Lateness histogram: 1 us bins up to 10 ms
+  static constexpr uint64_t LATENESS_BIN_NS = 1000;
+  static constexpr int LATENESS_BINS = 10000;
+
+  uint64_t period_ns;
+  CLSPTimerType type;
+  int fd = -1;
+  uint64_t next_ns;
+
+  std::atomic<uint64_t> wakeups{0};
+  std::atomic<uint64_t> missed{0};
+  std::atomic<uint64_t> lateness_sum{0};
+  std::atomic<uint64_t> lateness_max{0};
+  CLSPLatencyHistogram lateness;
+};
+
+#endif
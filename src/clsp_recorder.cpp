@@ -0,0 +1,156 @@
+#include "clsp_recorder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "clsp_clock.hpp"
+
+namespace {
+
+const char MAGIC[8] = {'C', 'L', 'S', 'P', 'R', 'E', 'C', '1'};
+const uint32_t VERSION = 1;
+
+}  // namespace
+
+CLSPRecorder::CLSPRecorder(const std::string& path, size_t capacity)
+    : capacity(std::max<size_t>(capacity, 1)) {
+  this->size = sizeof(Header) + this->capacity * sizeof(CLSPRecord);
+
+  this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+  if (this->fd < 0) {
+    throw std::runtime_error("Unable to create record file");
+  }
+
+  // Allocates the blocks now, a full disk fails here and not on a page fault
+  if (posix_fallocate(this->fd, 0, this->size) != 0) {
+    ::close(this->fd);
+    throw std::runtime_error("Unable to size record file");
+  }
+
+  // MAP_POPULATE faults every page in, the records never wait on the disk
+  void* memory = mmap(nullptr, this->size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, this->fd, 0);
+  if (memory == MAP_FAILED) {
+    ::close(this->fd);
+    throw std::runtime_error("Unable to map record file");
+  }
+
+  this->header = static_cast<Header*>(memory);
+  this->records = reinterpret_cast<CLSPRecord*>(this->header + 1);
+
+  std::memcpy(this->header->magic, MAGIC, sizeof(MAGIC));
+  this->header->version = VERSION;
+  this->header->record_size = sizeof(CLSPRecord);
+  this->header->capacity = this->capacity;
+  this->header->written.store(0, std::memory_order_release);
+}
+
+CLSPRecorder::~CLSPRecorder() {
+  flush();
+
+  munmap(this->header, this->size);
+  ::close(this->fd);
+}
+
+void CLSPRecorder::record(uint8_t direction, uint8_t endpoint,
+                          const unsigned char* data, int length, int status) {
+  uint64_t index =
+      this->header->written.fetch_add(1, std::memory_order_relaxed);
+  CLSPRecord& record = this->records[index % this->capacity];
+
+  // Readers skip the record until its sequence is set again
+  record.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  int kept = std::max(0, std::min<int>(length, sizeof(record.data)));
+
+  record.timestamp_ns = clspMonotonicNs();
+  record.status = status;
+  record.direction = direction;
+  record.endpoint = endpoint;
+  record.length = kept;
+  std::memcpy(record.data, data, kept);
+
+  record.sequence.store(index + 1, std::memory_order_release);
+}
+
+void CLSPRecorder::flush() { msync(this->header, this->size, MS_SYNC); }
+
+uint64_t CLSPRecorder::count() const {
+  return this->header->written.load(std::memory_order_relaxed);
+}
+
+std::vector<CLSPRecordEntry> CLSPRecorder::load(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open record file");
+  }
+
+  struct stat status;
+  if (fstat(fd, &status) < 0 ||
+      static_cast<size_t>(status.st_size) < sizeof(Header)) {
+    ::close(fd);
+    throw std::runtime_error("Not a record file");
+  }
+
+  size_t size = status.st_size;
+  void* memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (memory == MAP_FAILED) {
+    throw std::runtime_error("Unable to map record file");
+  }
+
+  auto header = static_cast<const Header*>(memory);
+  auto records = reinterpret_cast<const CLSPRecord*>(header + 1);
+
+  if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header->version != VERSION ||
+      header->record_size != sizeof(CLSPRecord) || header->capacity == 0 ||
+      sizeof(Header) + header->capacity * sizeof(CLSPRecord) > size) {
+    munmap(memory, size);
+    throw std::runtime_error("Not a record file");
+  }
+
+  uint64_t written = header->written.load(std::memory_order_acquire);
+  uint64_t first =
+      written > header->capacity ? written - header->capacity : 0;
+
+  std::vector<CLSPRecordEntry> entries;
+  entries.reserve(written - first);
+
+  for (uint64_t index = first; index < written; index++) {
+    const CLSPRecord& record = records[index % header->capacity];
+
+    if (record.sequence.load(std::memory_order_acquire) != index + 1) {
+      continue;
+    }
+
+    CLSPRecordEntry entry;
+    entry.timestamp_ns = record.timestamp_ns;
+    entry.sequence = index;
+    entry.status = record.status;
+    entry.direction = record.direction;
+    entry.endpoint = record.endpoint;
+    entry.data.assign(record.data, record.data + record.length);
+
+    // Overwritten while it was copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (record.sequence.load(std::memory_order_relaxed) != index + 1) {
+      continue;
+    }
+
+    entries.push_back(std::move(entry));
+  }
+
+  munmap(memory, size);
+
+  return entries;
+}
@@ -0,0 +1,129 @@
+#ifndef CLS_P_RECORDER_HPP
+#define CLS_P_RECORDER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Direction of a recorded transfer, as in the endpoint address
+#define CLSP_RECORD_OUT 0x00
+#define CLSP_RECORD_IN 0x80
+
+/**
+ * One transfer of the ring file. The endpoint is 0x00 for the feature
+ * reports (SET_REPORT out, GET_REPORT in), 0x01 and 0x02 for the output
+ * reports of interfaces 0 and 1, whatever the backend.
+ */
+struct CLSPRecord {
+  // CLOCK_MONOTONIC time of the submission, or of the completion for an IN
+  // transfer, in ns
+  uint64_t timestamp_ns;
+  // Index of the record since the file creation plus one, 0 while the
+  // record is being written
+  std::atomic<uint64_t> sequence;
+  // libusb error code known when recorded, 0 on success
+  int32_t status;
+  uint8_t direction;
+  uint8_t endpoint;
+  // Report bytes kept, the report ID first
+  uint8_t length;
+  uint8_t reserved;
+  uint8_t data[64];
+};
+
+/**
+ * Copy of a record read back from a ring file
+ */
+struct CLSPRecordEntry {
+  uint64_t timestamp_ns = 0;
+  uint64_t sequence = 0;
+  int status = 0;
+  uint8_t direction = CLSP_RECORD_OUT;
+  uint8_t endpoint = 0;
+  std::vector<uint8_t> data;
+};
+
+/**
+ * Records the transfers of a stick into a fixed-size ring file mapped in
+ * memory. The file is sized and its pages are faulted in at creation, so a
+ * record is a few stores into the mapping: no allocation, lock nor syscall.
+ * Once the ring is full the oldest records are overwritten; the kernel
+ * writes the pages back on its own, also if the process crashes.
+ *
+ * Any number of threads may record at the same time.
+ */
+class CLSPRecorder {
+ public:
+  /**
+   * Creates or truncates the ring file and maps it
+   * @param path ring file
+   * @param capacity number of records kept, e.g. 65536 (5.5 MiB)
+   * @throw std::runtime_error if the file cannot be created or mapped
+   */
+  CLSPRecorder(const std::string& path, size_t capacity);
+
+  /**
+   * Flushes and unmaps the ring file
+   */
+  ~CLSPRecorder();
+
+  CLSPRecorder(const CLSPRecorder&) = delete;
+  CLSPRecorder& operator=(const CLSPRecorder&) = delete;
+
+  /**
+   * Adds a transfer to the ring. The bytes past the record size are dropped.
+   * @param direction CLSP_RECORD_OUT or CLSP_RECORD_IN
+   * @param endpoint endpoint address without the direction bit
+   * @param data report bytes, starting with the report ID
+   * @param length report size
+   * @param status libusb error code known when recorded, 0 on success
+   */
+  void record(uint8_t direction, uint8_t endpoint, const unsigned char* data,
+              int length, int status);
+
+  /**
+   * Writes the mapped pages back to the file, waiting for the disk
+   */
+  void flush();
+
+  /**
+   * @return records written since the file creation, overwritten included
+   */
+  uint64_t count() const;
+
+  /**
+   * Reads the records of a ring file, oldest first. Records being written
+   * at the time of the call are skipped.
+   * @param path ring file
+   * @return records still in the ring
+   * @throw std::runtime_error if the file is not a ring file
+   */
+  static std::vector<CLSPRecordEntry> load(const std::string& path);
+
+ private:
+  /**
+   * Start of the ring file, followed by the records
+   */
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;
+    // Records written, the next one goes to written % capacity
+    std::atomic<uint64_t> written;
+    uint8_t reserved[32];
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "the ring counters are shared through the mapping");
+
+  int fd = -1;
+  size_t size = 0;
+  Header* header = nullptr;
+  CLSPRecord* records = nullptr;
+  uint64_t capacity;
+};
+
+#endif
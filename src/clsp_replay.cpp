@@ -0,0 +1,450 @@
+#include "clsp_replay.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+#include <time.h>
+
+#include "clsp_clock.hpp"
+#include "clsp_realtime.hpp"
+
+namespace {
+
+const uint32_t PCAP_MAGIC_US = 0xa1b2c3d4;
+const uint32_t PCAP_MAGIC_NS = 0xa1b23c4d;
+const size_t PCAP_HEADER_SIZE = 24;
+const size_t PCAP_RECORD_HEADER_SIZE = 16;
+
+// usbmon link types and the size of their per-packet header
+const uint32_t LINKTYPE_USB_LINUX = 189;
+const uint32_t LINKTYPE_USB_LINUX_MMAPPED = 220;
+const size_t USBMON_HEADER_SIZE = 48;
+const size_t USBMON_MMAPPED_HEADER_SIZE = 64;
+// Size of each isochronous descriptor after the mmapped header
+const size_t USBMON_ISO_DESCRIPTOR_SIZE = 16;
+
+const uint8_t USBMON_SUBMIT = 'S';
+const uint8_t USBMON_COMPLETE = 'C';
+const uint8_t USBMON_INTERRUPT = 1;
+const uint8_t USBMON_CONTROL = 2;
+
+// HID class requests
+const uint8_t REQUEST_TYPE_SET = 0x21;
+const uint8_t REQUEST_TYPE_GET = 0xa1;
+const uint8_t REQUEST_SET_REPORT = 0x09;
+const uint8_t REQUEST_GET_REPORT = 0x01;
+const uint8_t REPORT_TYPE_OUTPUT = 0x02;
+const uint8_t REPORT_TYPE_FEATURE = 0x03;
+
+const uint8_t ENDPOINT_CONTROL = 0x00;
+const uint8_t ENDPOINT_DIRECTION = 0x80;
+
+/**
+ * Transfer of a usbmon capture with the device it belongs to
+ */
+struct UsbmonTransfer {
+  CLSPRecordEntry entry;
+  uint16_t bus;
+  uint8_t address;
+};
+
+uint16_t read16(const uint8_t* bytes) { return bytes[0] | bytes[1] << 8; }
+
+uint32_t read32(const uint8_t* bytes) {
+  return bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
+         static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+// Same mapping as the libusb backend for the URB status
+int errnoToError(int32_t status) {
+  switch (-status) {
+    case 0:
+      return LIBUSB_SUCCESS;
+    case EPIPE:
+      return LIBUSB_ERROR_PIPE;
+    case ENODEV:
+    case ESHUTDOWN:
+      return LIBUSB_ERROR_NO_DEVICE;
+    case ETIMEDOUT:
+      return LIBUSB_ERROR_TIMEOUT;
+    case ENOENT:
+    case ECONNRESET:
+      return LIBUSB_ERROR_INTERRUPTED;
+    case EOVERFLOW:
+      return LIBUSB_ERROR_OVERFLOW;
+    default:
+      return LIBUSB_ERROR_IO;
+  }
+}
+
+std::vector<UsbmonTransfer> parseUsbmon(const std::vector<uint8_t>& file) {
+  uint32_t magic = read32(file.data());
+  uint32_t link_type = read32(file.data() + 20);
+
+  if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS) {
+    throw std::runtime_error("Unsupported capture format");
+  }
+  if (link_type != LINKTYPE_USB_LINUX &&
+      link_type != LINKTYPE_USB_LINUX_MMAPPED) {
+    throw std::runtime_error("Not a usbmon capture");
+  }
+
+  bool mmapped = link_type == LINKTYPE_USB_LINUX_MMAPPED;
+  size_t header_size =
+      mmapped ? USBMON_MMAPPED_HEADER_SIZE : USBMON_HEADER_SIZE;
+  uint64_t fraction_ns = magic == PCAP_MAGIC_NS ? 1 : 1000;
+
+  std::vector<UsbmonTransfer> transfers;
+  // Submissions waiting for their completion, by URB id
+  std::map<uint64_t, size_t> submitted;
+  std::map<uint64_t, UsbmonTransfer> reads;
+
+  size_t offset = PCAP_HEADER_SIZE;
+
+  while (offset + PCAP_RECORD_HEADER_SIZE <= file.size()) {
+    const uint8_t* record = file.data() + offset;
+    uint64_t timestamp_ns = read32(record) * 1000000000ull +
+                            read32(record + 4) * fraction_ns;
+    uint32_t captured = read32(record + 8);
+
+    offset += PCAP_RECORD_HEADER_SIZE;
+    if (offset + captured > file.size()) {
+      break;
+    }
+
+    const uint8_t* packet = file.data() + offset;
+    offset += captured;
+
+    if (captured < header_size) {
+      continue;
+    }
+
+    uint64_t id;
+    std::memcpy(&id, packet, sizeof(id));
+    uint8_t type = packet[8];
+    uint8_t transfer_type = packet[9];
+    uint8_t endpoint = packet[10];
+    uint8_t address = packet[11];
+    uint16_t bus = read16(packet + 12);
+    bool has_setup = packet[14] == 0;
+    auto status = static_cast<int32_t>(read32(packet + 28));
+    uint32_t data_length = read32(packet + 36);
+    const uint8_t* setup = packet + 40;
+
+    size_t data_offset = header_size;
+    if (mmapped) {
+      data_offset += read32(packet + 60) * USBMON_ISO_DESCRIPTOR_SIZE;
+    }
+    if (data_offset > captured) {
+      continue;
+    }
+
+    data_length =
+        std::min<uint32_t>(data_length, captured - data_offset);
+    const uint8_t* data = packet + data_offset;
+
+    UsbmonTransfer transfer;
+    transfer.bus = bus;
+    transfer.address = address;
+    transfer.entry.timestamp_ns = timestamp_ns;
+
+    if (type == USBMON_SUBMIT && transfer_type == USBMON_INTERRUPT &&
+        (endpoint & ENDPOINT_DIRECTION) == 0) {
+      transfer.entry.direction = CLSP_RECORD_OUT;
+      transfer.entry.endpoint = endpoint;
+      transfer.entry.data.assign(data, data + data_length);
+
+      submitted[id] = transfers.size();
+      transfers.push_back(transfer);
+    } else if (type == USBMON_SUBMIT && transfer_type == USBMON_CONTROL &&
+               has_setup) {
+      uint8_t report_type = setup[3];
+      uint16_t interface = read16(setup + 4);
+
+      if (setup[0] == REQUEST_TYPE_SET && setup[1] == REQUEST_SET_REPORT &&
+          (report_type == REPORT_TYPE_FEATURE ||
+           report_type == REPORT_TYPE_OUTPUT)) {
+        // Output reports sent on the control pipe go to the interrupt
+        // endpoint of their interface on replay
+        transfer.entry.direction = CLSP_RECORD_OUT;
+        transfer.entry.endpoint = report_type == REPORT_TYPE_FEATURE
+                                      ? ENDPOINT_CONTROL
+                                      : interface + 1;
+        transfer.entry.data.assign(data, data + data_length);
+
+        submitted[id] = transfers.size();
+        transfers.push_back(transfer);
+      } else if (setup[0] == REQUEST_TYPE_GET &&
+                 setup[1] == REQUEST_GET_REPORT &&
+                 report_type == REPORT_TYPE_FEATURE) {
+        // Kept once answered, the report ID comes from the setup packet
+        transfer.entry.direction = CLSP_RECORD_IN;
+        transfer.entry.endpoint = ENDPOINT_CONTROL;
+        transfer.entry.data.assign(read16(setup + 6), 0);
+        if (!transfer.entry.data.empty()) {
+          transfer.entry.data[0] = setup[2];
+        }
+
+        reads[id] = transfer;
+      }
+    } else if (type == USBMON_COMPLETE) {
+      auto read = reads.find(id);
+      if (read != reads.end()) {
+        UsbmonTransfer answered = read->second;
+        answered.entry.timestamp_ns = timestamp_ns;
+        answered.entry.status = errnoToError(status);
+        if (data_length > 0) {
+          answered.entry.data.assign(data, data + data_length);
+        }
+
+        transfers.push_back(answered);
+        reads.erase(read);
+        continue;
+      }
+
+      auto write = submitted.find(id);
+      if (write != submitted.end()) {
+        transfers[write->second].entry.status = errnoToError(status);
+        submitted.erase(write);
+      }
+    }
+  }
+
+  return transfers;
+}
+
+std::vector<CLSPRecordEntry> selectDevice(
+    const std::vector<UsbmonTransfer>& transfers, int bus, int address) {
+  if (bus < 0 || address < 0) {
+    // The stick streams its reports on interrupt OUT endpoint 1
+    std::map<std::pair<int, int>, int> counts;
+    for (const UsbmonTransfer& transfer : transfers) {
+      if ((bus < 0 || transfer.bus == bus) && transfer.entry.endpoint == 1) {
+        counts[{transfer.bus, transfer.address}]++;
+      }
+    }
+
+    auto busiest = std::max_element(
+        counts.begin(), counts.end(),
+        [](const auto& a, const auto& b) { return a.second < b.second; });
+    if (busiest == counts.end()) {
+      return {};
+    }
+
+    bus = busiest->first.first;
+    address = busiest->first.second;
+  }
+
+  std::vector<CLSPRecordEntry> entries;
+  for (const UsbmonTransfer& transfer : transfers) {
+    if (transfer.bus == bus && transfer.address == address) {
+      entries.push_back(transfer.entry);
+      entries.back().sequence = entries.size() - 1;
+    }
+  }
+
+  return entries;
+}
+
+void sleepUntil(uint64_t deadline_ns) {
+  struct timespec ts;
+  ts.tv_sec = deadline_ns / 1000000000ull;
+  ts.tv_nsec = deadline_ns % 1000000000ull;
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+         EINTR) {
+  }
+}
+
+/**
+ * OUT transfer in flight during a replay
+ */
+struct InFlight {
+  size_t index;
+  int expected_status;
+  uint64_t submitted_ns;
+  CLSPCompletion completion;
+};
+
+}  // namespace
+
+std::vector<CLSPRecordEntry> clspLoadCapture(const std::string& path,
+                                             int bus = -1,
+                                             int address = -1) {
+  std::ifstream stream(path, std::ios::binary);
+  if (!stream) {
+    throw std::runtime_error("Unable to open capture file");
+  }
+
+  std::vector<uint8_t> file((std::istreambuf_iterator<char>(stream)),
+                            std::istreambuf_iterator<char>());
+
+  if (file.size() < PCAP_HEADER_SIZE) {
+    throw std::runtime_error("Unsupported capture format");
+  }
+
+  // Ring file of CLSPRecorder
+  if (std::memcmp(file.data(), "CLSPREC", 7) == 0) {
+    return CLSPRecorder::load(path);
+  }
+
+  return selectDevice(parseUsbmon(file), bus, address);
+}
+
+CLSPReplayResult clspReplay(CLSPTransport& transport,
+                            const std::vector<CLSPRecordEntry>& entries,
+                            bool realtime, CLSPRecorder* recorder = nullptr) {
+  CLSPReplayResult result;
+
+  if (entries.empty()) {
+    return result;
+  }
+
+  std::vector<double> drift_us;
+  std::vector<double> latency_us;
+  std::deque<InFlight> in_flight;
+
+  auto complete = [&result, &latency_us](const InFlight& transfer) {
+    int status = transfer.completion.wait();
+
+    // Unknown once the slot was handed out many times since
+    uint64_t completed = transfer.completion.completionTime();
+    if (completed >= transfer.submitted_ns) {
+      latency_us.push_back((completed - transfer.submitted_ns) / 1000.0);
+    }
+
+    if (status != transfer.expected_status) {
+      CLSPReplayDifference difference;
+      difference.index = transfer.index;
+      difference.expected_status = transfer.expected_status;
+      difference.actual_status = status;
+      result.differences.push_back(difference);
+    }
+  };
+
+  uint64_t captured_start = entries.front().timestamp_ns;
+  uint64_t start = clspMonotonicNs();
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    const CLSPRecordEntry& entry = entries[i];
+    if (entry.data.empty()) {
+      continue;
+    }
+
+    // Input reports come from the stick, there is nothing to replay
+    if (entry.direction == CLSP_RECORD_IN &&
+        entry.endpoint != ENDPOINT_CONTROL) {
+      continue;
+    }
+
+    uint64_t scheduled = start + (entry.timestamp_ns - captured_start);
+    if (realtime) {
+      sleepUntil(scheduled);
+    }
+
+    uint64_t now = clspMonotonicNs();
+    if (realtime) {
+      drift_us.push_back((static_cast<int64_t>(now - scheduled)) / 1000.0);
+    }
+
+    if (entry.direction == CLSP_RECORD_IN) {
+      // The control pipe is not ordered with the interrupt endpoints, the
+      // reads wait for the reports sent before them as on the capture
+      while (!in_flight.empty()) {
+        complete(in_flight.front());
+        in_flight.pop_front();
+      }
+
+      std::vector<uint8_t> answer(entry.data.size(), 0);
+      answer[0] = entry.data[0];
+
+      CLSPCompletion read = transport.getFeature(
+          0, answer.data(), static_cast<int>(answer.size()));
+      int status = read.wait();
+
+      latency_us.push_back((read.completionTime() - now) / 1000.0);
+      result.reads++;
+
+      if (recorder != nullptr) {
+        recorder->record(CLSP_RECORD_IN, entry.endpoint, answer.data(),
+                         static_cast<int>(answer.size()), status);
+      }
+
+      if (status != entry.status || (status == 0 && answer != entry.data)) {
+        CLSPReplayDifference difference;
+        difference.index = i;
+        difference.expected_status = entry.status;
+        difference.actual_status = status;
+        difference.expected = entry.data;
+        difference.actual = answer;
+        result.differences.push_back(difference);
+      }
+
+      continue;
+    }
+
+    const unsigned char* report = entry.data.data();
+    int length = static_cast<int>(entry.data.size());
+
+    InFlight transfer;
+    transfer.index = i;
+    transfer.expected_status = entry.status;
+    transfer.submitted_ns = now;
+    transfer.completion =
+        entry.endpoint == ENDPOINT_CONTROL
+            ? transport.setFeature(0, report, length)
+            : transport.writeReport(entry.endpoint - 1, report, length);
+    result.reports++;
+
+    if (recorder != nullptr) {
+      recorder->record(CLSP_RECORD_OUT, entry.endpoint, report, length,
+                       transfer.completion.ready()
+                           ? transfer.completion.status()
+                           : 0);
+    }
+
+    in_flight.push_back(transfer);
+
+    // The transport bounds the transfers in flight, only reap the completed
+    while (!in_flight.empty() && in_flight.front().completion.ready()) {
+      complete(in_flight.front());
+      in_flight.pop_front();
+    }
+  }
+
+  while (!in_flight.empty()) {
+    complete(in_flight.front());
+    in_flight.pop_front();
+  }
+
+  result.captured_s = (entries.back().timestamp_ns - captured_start) / 1e9;
+  result.replayed_s = (clspMonotonicNs() - start) / 1e9;
+
+  if (!drift_us.empty()) {
+    double sum = 0.0;
+    for (double drift : drift_us) {
+      sum += drift;
+    }
+    result.drift_mean_us = sum / drift_us.size();
+    result.drift_p99_us = clspPercentile(drift_us, 0.99);
+    result.drift_max_us = clspPercentile(drift_us, 1.0);
+  }
+
+  result.latency_p50_us = clspPercentile(latency_us, 0.5);
+  result.latency_p99_us = clspPercentile(latency_us, 0.99);
+  result.latency_max_us = clspPercentile(latency_us, 1.0);
+
+  std::sort(result.differences.begin(), result.differences.end(),
+            [](const CLSPReplayDifference& a, const CLSPReplayDifference& b) {
+              return a.index < b.index;
+            });
+
+  return result;
+}
@@ -0,0 +1,79 @@
+#ifndef CLS_P_REPLAY_HPP
+#define CLS_P_REPLAY_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "clsp_recorder.hpp"
+#include "clsp_transport.hpp"
+
+/**
+ * Reads the transfers of a capture, oldest first. Supports the ring files of
+ * CLSPRecorder and the little-endian pcap captures of Linux usbmon
+ * (LINKTYPE_USB_LINUX and LINKTYPE_USB_LINUX_MMAPPED), e.g. of the Windows
+ * driver running in a virtual machine.
+ *
+ * From usbmon, the interrupt OUT reports, the SET_REPORT requests and the
+ * answers to the feature GET_REPORT requests are kept, with the status of
+ * their completion. The timestamps keep their relative timing only.
+ * @param path capture file
+ * @param bus bus number of the stick in a usbmon capture, -1 for the device
+ * sending the most interrupt OUT reports
+ * @param address device address of the stick in a usbmon capture, -1 for any
+ * @return transfers of the stick
+ * @throw std::runtime_error if the file cannot be read or has another format
+ */
+std::vector<CLSPRecordEntry> clspLoadCapture(const std::string& path,
+                                             int bus, int address);
+
+/**
+ * Transfer whose status or answer differs from the capture
+ */
+struct CLSPReplayDifference {
+  // Index of the transfer in the capture
+  size_t index = 0;
+  int expected_status = 0;
+  int actual_status = 0;
+  // Report read back, empty for an OUT transfer
+  std::vector<uint8_t> expected;
+  std::vector<uint8_t> actual;
+};
+
+/**
+ * Timing and outcome of a replay
+ */
+struct CLSPReplayResult {
+  // OUT reports re-issued, feature reports read back
+  uint64_t reports = 0;
+  uint64_t reads = 0;
+  // Submission time past the captured schedule, in us
+  double drift_mean_us = 0.0;
+  double drift_p99_us = 0.0;
+  double drift_max_us = 0.0;
+  // Submission to completion of each transfer, in us
+  double latency_p50_us = 0.0;
+  double latency_p99_us = 0.0;
+  double latency_max_us = 0.0;
+  // From the first to the last transfer, in s
+  double captured_s = 0.0;
+  double replayed_s = 0.0;
+  std::vector<CLSPReplayDifference> differences;
+};
+
+/**
+ * Re-issues the transfers of a capture on a stick. The OUT reports are sent
+ * again; each feature report read back is read again and compared with the
+ * captured answer. The input reports are skipped. The stick must be opened.
+ * @param transport opened transport
+ * @param entries transfers of a capture
+ * @param realtime true to keep the captured timing, false to send each
+ * transfer as soon as the previous one is submitted
+ * @param recorder records the replayed transfers, may be NULL
+ * @return timing drift and differences
+ */
+CLSPReplayResult clspReplay(CLSPTransport& transport,
+                            const std::vector<CLSPRecordEntry>& entries,
+                            bool realtime, CLSPRecorder* recorder);
+
+#endif
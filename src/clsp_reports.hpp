@@ -0,0 +1,415 @@
+#ifndef CLS_P_REPORTS_HPP
+#define CLS_P_REPORTS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * PID reports of the stick, laid out as in its report descriptor.
+ *
+ * Every field is one byte wide, 16b fields being split into their LSB and MSB,
+ * so the structures have no padding and the same layout on any host: a report
+ * is sent as its object representation, without per-field encoding. The
+ * constructors are constexpr, so constant reports are built at compile time.
+ */
+
+/**
+ * Little-endian 16b field
+ */
+struct CLSPLe16 {
+  uint8_t lsb = 0;
+  uint8_t msb = 0;
+
+  constexpr CLSPLe16() = default;
+  constexpr CLSPLe16(uint16_t value)
+      : lsb(value & 0xff), msb((value >> 8) & 0xff) {}
+
+  constexpr uint16_t value() const { return lsb | msb << 8; }
+};
+
+/**
+ * Set Effect output report (0x01)
+ */
+struct CLSPSetEffectReport {
+  static constexpr uint8_t ID = 0x01;
+  // Axes(b0-b1)/Direction(b2) enable flags
+  static constexpr uint8_t DIRECTION_ENABLE = 0x04;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  uint8_t effect_type = 0;
+  CLSPLe16 duration;
+  CLSPLe16 trigger_interval;
+  CLSPLe16 sample_period;
+  uint8_t gain = 0;
+  uint8_t trigger_button = 0;
+  uint8_t enable_flags = DIRECTION_ENABLE;
+  int8_t direction = 0;
+  // Second instance of the PID Direction, unused by the polar direction
+  uint8_t reserved = 0;
+  CLSPLe16 start_delay;
+
+  constexpr CLSPSetEffectReport(uint8_t block, uint8_t effect_type,
+                                uint16_t duration, uint16_t trigger_interval,
+                                uint16_t sample_period, uint8_t gain,
+                                uint8_t trigger_button, int8_t direction,
+                                uint16_t start_delay)
+      : block(block),
+        effect_type(effect_type),
+        duration(duration),
+        trigger_interval(trigger_interval),
+        sample_period(sample_period),
+        gain(gain),
+        trigger_button(trigger_button),
+        direction(direction),
+        start_delay(start_delay) {}
+};
+
+/**
+ * Set Envelope output report (0x02)
+ */
+struct CLSPEnvelopeReport {
+  static constexpr uint8_t ID = 0x02;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  uint8_t attack_level = 0;
+  uint8_t fade_level = 0;
+  CLSPLe16 attack_time;
+  CLSPLe16 fade_time;
+
+  constexpr CLSPEnvelopeReport(uint8_t block, uint8_t attack_level,
+                               uint8_t fade_level, uint16_t attack_time,
+                               uint16_t fade_time)
+      : block(block),
+        attack_level(attack_level),
+        fade_level(fade_level),
+        attack_time(attack_time),
+        fade_time(fade_time) {}
+};
+
+/**
+ * Set Condition output report (0x03), one per axis
+ */
+struct CLSPConditionReport {
+  static constexpr uint8_t ID = 0x03;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  // Parameter block offset, i.e. the axis
+  uint8_t axis = 0;
+  uint8_t center = 0;
+  uint8_t positive_coefficient = 0;
+  uint8_t negative_coefficient = 0;
+  uint8_t positive_saturation = 0;
+  uint8_t negative_saturation = 0;
+  uint8_t deadband = 0;
+
+  constexpr CLSPConditionReport(uint8_t block, uint8_t axis, uint8_t center,
+                                uint8_t positive_coefficient,
+                                uint8_t negative_coefficient,
+                                uint8_t positive_saturation,
+                                uint8_t negative_saturation, uint8_t deadband)
+      : block(block),
+        axis(axis),
+        center(center),
+        positive_coefficient(positive_coefficient),
+        negative_coefficient(negative_coefficient),
+        positive_saturation(positive_saturation),
+        negative_saturation(negative_saturation),
+        deadband(deadband) {}
+};
+
+/**
+ * Set Periodic output report (0x04)
+ */
+struct CLSPPeriodicReport {
+  static constexpr uint8_t ID = 0x04;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  uint8_t magnitude = 0;
+  int8_t offset = 0;
+  uint8_t phase = 0;
+  // Waveform period in ms
+  CLSPLe16 period;
+
+  constexpr CLSPPeriodicReport(uint8_t block, uint8_t magnitude, int8_t offset,
+                               uint8_t phase, uint16_t period)
+      : block(block),
+        magnitude(magnitude),
+        offset(offset),
+        phase(phase),
+        period(period) {}
+};
+
+/**
+ * Set Constant Force output report (0x05), 16b signed magnitude
+ */
+struct CLSPConstantForceReport {
+  static constexpr uint8_t ID = 0x05;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  CLSPLe16 magnitude;
+
+  constexpr CLSPConstantForceReport(uint8_t block, int16_t magnitude)
+      : block(block), magnitude(static_cast<uint16_t>(magnitude)) {}
+};
+
+/**
+ * Set Ramp Force output report (0x06)
+ */
+struct CLSPRampReport {
+  static constexpr uint8_t ID = 0x06;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  int8_t start = 0;
+  int8_t end = 0;
+
+  constexpr CLSPRampReport(uint8_t block, int8_t start, int8_t end)
+      : block(block), start(start), end(end) {}
+};
+
+/**
+ * Custom Force Data output report (0x07), unused samples are zero
+ */
+struct CLSPCustomForceDataReport {
+  static constexpr uint8_t ID = 0x07;
+  static constexpr int MAX_SAMPLES = 12;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  // Byte offset of the first sample
+  CLSPLe16 offset;
+  int8_t samples[MAX_SAMPLES] = {};
+
+  constexpr CLSPCustomForceDataReport(uint8_t block, uint16_t offset,
+                                      const int8_t* data, int count)
+      : block(block), offset(offset) {
+    for (int i = 0; i < count && i < MAX_SAMPLES; i++) {
+      samples[i] = data[i];
+    }
+  }
+};
+
+/**
+ * Download Force Sample output report (0x08)
+ */
+struct CLSPForceSampleReport {
+  static constexpr uint8_t ID = 0x08;
+
+  uint8_t report_id = ID;
+  int8_t x = 0;
+  int8_t y = 0;
+
+  constexpr CLSPForceSampleReport(int8_t x, int8_t y) : x(x), y(y) {}
+};
+
+/**
+ * Effect Operation output report (0x0a)
+ */
+struct CLSPEffectOperationReport {
+  static constexpr uint8_t ID = 0x0a;
+  static constexpr uint8_t START = 0x01;
+  static constexpr uint8_t START_SOLO = 0x02;
+  static constexpr uint8_t STOP = 0x03;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  uint8_t operation = 0;
+  uint8_t loop_count = 0;
+
+  constexpr CLSPEffectOperationReport(uint8_t block, uint8_t operation,
+                                      uint8_t loop_count)
+      : block(block), operation(operation), loop_count(loop_count) {}
+};
+
+/**
+ * PID Block Free output report (0x0b)
+ */
+struct CLSPBlockFreeReport {
+  static constexpr uint8_t ID = 0x0b;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+
+  constexpr explicit CLSPBlockFreeReport(uint8_t block) : block(block) {}
+};
+
+/**
+ * PID Device Control output report (0x0c)
+ */
+struct CLSPDeviceControlReport {
+  static constexpr uint8_t ID = 0x0c;
+  static constexpr uint8_t ENABLE_ACTUATORS = 0x01;
+  static constexpr uint8_t DISABLE_ACTUATORS = 0x02;
+  static constexpr uint8_t STOP_ALL_EFFECTS = 0x03;
+  static constexpr uint8_t DEVICE_RESET = 0x04;
+  static constexpr uint8_t DEVICE_PAUSE = 0x05;
+  static constexpr uint8_t DEVICE_CONTINUE = 0x06;
+
+  uint8_t report_id = ID;
+  uint8_t control = 0;
+
+  constexpr explicit CLSPDeviceControlReport(uint8_t control)
+      : control(control) {}
+};
+
+/**
+ * Device Gain output report (0x0d)
+ */
+struct CLSPDeviceGainReport {
+  static constexpr uint8_t ID = 0x0d;
+
+  uint8_t report_id = ID;
+  uint8_t gain = 0;
+
+  constexpr explicit CLSPDeviceGainReport(uint8_t gain) : gain(gain) {}
+};
+
+/**
+ * Set Custom Force output report (0x0e)
+ */
+struct CLSPCustomForceReport {
+  static constexpr uint8_t ID = 0x0e;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  uint8_t sample_count = 0;
+  CLSPLe16 sample_period;
+
+  constexpr CLSPCustomForceReport(uint8_t block, uint8_t sample_count,
+                                  uint16_t sample_period)
+      : block(block),
+        sample_count(sample_count),
+        sample_period(sample_period) {}
+};
+
+/**
+ * Create New Effect feature report (0x01)
+ */
+struct CLSPCreateEffectFeature {
+  static constexpr uint8_t ID = 0x01;
+
+  uint8_t report_id = ID;
+  uint8_t effect_type = 0;
+  // Custom force data only, 10b
+  CLSPLe16 byte_count;
+
+  constexpr CLSPCreateEffectFeature(uint8_t effect_type, uint16_t byte_count)
+      : effect_type(effect_type), byte_count(byte_count & 0x03ff) {}
+};
+
+/**
+ * PID Block Load feature report (0x02), read back after Create New Effect
+ */
+struct CLSPBlockLoadFeature {
+  static constexpr uint8_t ID = 0x02;
+  static constexpr uint8_t SUCCESS = 0x01;
+  static constexpr uint8_t FULL = 0x02;
+  static constexpr uint8_t LOAD_ERROR = 0x03;
+
+  uint8_t report_id = ID;
+  uint8_t block = 0;
+  uint8_t status = 0;
+  CLSPLe16 ram_pool_available;
+
+  constexpr CLSPBlockLoadFeature() = default;
+};
+
+/**
+ * @return bytes of a report, starting with its ID
+ */
+template <typename Report>
+const unsigned char* clspReportBytes(const Report& report) {
+  static_assert(std::is_trivially_copyable<Report>::value &&
+                    std::is_standard_layout<Report>::value,
+                "a report is sent as its object representation");
+  return reinterpret_cast<const unsigned char*>(&report);
+}
+
+template <typename Report>
+unsigned char* clspReportBytes(Report& report) {
+  static_assert(std::is_trivially_copyable<Report>::value &&
+                    std::is_standard_layout<Report>::value,
+                "a report is read as its object representation");
+  return reinterpret_cast<unsigned char*>(&report);
+}
+
+// Sizes and offsets of the report descriptor
+#define CLSP_CHECK_REPORT_SIZE(Report, size) \
+  static_assert(sizeof(Report) == (size), #Report " size")
+#define CLSP_CHECK_REPORT_FIELD(Report, field, offset)      \
+  static_assert(offsetof(Report, field) == (offset), \
+                #Report "::" #field " offset")
+
+static_assert(sizeof(CLSPLe16) == 2 && alignof(CLSPLe16) == 1,
+              "16b fields have no alignment");
+
+CLSP_CHECK_REPORT_SIZE(CLSPSetEffectReport, 16);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, effect_type, 2);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, duration, 3);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, trigger_interval, 5);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, sample_period, 7);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, gain, 9);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, trigger_button, 10);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, enable_flags, 11);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, direction, 12);
+CLSP_CHECK_REPORT_FIELD(CLSPSetEffectReport, start_delay, 14);
+
+CLSP_CHECK_REPORT_SIZE(CLSPEnvelopeReport, 8);
+CLSP_CHECK_REPORT_FIELD(CLSPEnvelopeReport, attack_time, 4);
+CLSP_CHECK_REPORT_FIELD(CLSPEnvelopeReport, fade_time, 6);
+
+CLSP_CHECK_REPORT_SIZE(CLSPConditionReport, 9);
+CLSP_CHECK_REPORT_FIELD(CLSPConditionReport, axis, 2);
+CLSP_CHECK_REPORT_FIELD(CLSPConditionReport, positive_coefficient, 4);
+CLSP_CHECK_REPORT_FIELD(CLSPConditionReport, deadband, 8);
+
+CLSP_CHECK_REPORT_SIZE(CLSPPeriodicReport, 7);
+CLSP_CHECK_REPORT_FIELD(CLSPPeriodicReport, phase, 4);
+CLSP_CHECK_REPORT_FIELD(CLSPPeriodicReport, period, 5);
+
+CLSP_CHECK_REPORT_SIZE(CLSPConstantForceReport, 4);
+CLSP_CHECK_REPORT_FIELD(CLSPConstantForceReport, magnitude, 2);
+
+CLSP_CHECK_REPORT_SIZE(CLSPRampReport, 4);
+CLSP_CHECK_REPORT_FIELD(CLSPRampReport, end, 3);
+
+CLSP_CHECK_REPORT_SIZE(CLSPCustomForceDataReport, 16);
+CLSP_CHECK_REPORT_FIELD(CLSPCustomForceDataReport, offset, 2);
+CLSP_CHECK_REPORT_FIELD(CLSPCustomForceDataReport, samples, 4);
+
+CLSP_CHECK_REPORT_SIZE(CLSPForceSampleReport, 3);
+
+CLSP_CHECK_REPORT_SIZE(CLSPEffectOperationReport, 4);
+CLSP_CHECK_REPORT_FIELD(CLSPEffectOperationReport, operation, 2);
+CLSP_CHECK_REPORT_FIELD(CLSPEffectOperationReport, loop_count, 3);
+
+CLSP_CHECK_REPORT_SIZE(CLSPBlockFreeReport, 2);
+CLSP_CHECK_REPORT_SIZE(CLSPDeviceControlReport, 2);
+CLSP_CHECK_REPORT_SIZE(CLSPDeviceGainReport, 2);
+
+CLSP_CHECK_REPORT_SIZE(CLSPCustomForceReport, 5);
+CLSP_CHECK_REPORT_FIELD(CLSPCustomForceReport, sample_period, 3);
+
+CLSP_CHECK_REPORT_SIZE(CLSPCreateEffectFeature, 4);
+CLSP_CHECK_REPORT_FIELD(CLSPCreateEffectFeature, byte_count, 2);
+
+CLSP_CHECK_REPORT_SIZE(CLSPBlockLoadFeature, 5);
+CLSP_CHECK_REPORT_FIELD(CLSPBlockLoadFeature, ram_pool_available, 3);
+
+#undef CLSP_CHECK_REPORT_SIZE
+#undef CLSP_CHECK_REPORT_FIELD
+
+// Reports built at compile time
+static_assert(CLSPSetEffectReport(1, 1, 0x1234, 0, 0, 0, 0, 0, 0)
+                      .duration.msb == 0x12,
+              "16b fields are little-endian");
+static_assert(CLSPConstantForceReport(1, -1).magnitude.value() == 0xffff,
+              "the magnitude is two's complement");
+
+#endif
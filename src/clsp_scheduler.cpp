@@ -0,0 +1,533 @@
+#include "clsp_scheduler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "clsp_clock.hpp"
+
+namespace {
+
+const uint8_t REPORT_SET_CONDITION = 0x03;
+const uint8_t REPORT_SET_CONSTANT_FORCE = 0x05;
+const uint8_t REPORT_CUSTOM_FORCE_DATA = 0x07;
+const uint8_t REPORT_DOWNLOAD_FORCE_SAMPLE = 0x08;
+const uint8_t REPORT_EFFECT_OPERATION = 0x0a;
+const uint8_t REPORT_BLOCK_FREE = 0x0b;
+const uint8_t REPORT_DEVICE_CONTROL = 0x0c;
+const uint8_t REPORT_DEVICE_GAIN = 0x0d;
+const uint8_t REPORT_SET_CUSTOM_FORCE = 0x0e;
+
+const uint8_t OP_EFFECT_START_SOLO = 0x02;
+
+const uint8_t DC_DEVICE_RESET = 0x04;
+
+// Longest wait of the scheduler thread before checking for a stop
+const auto STOP_POLL = std::chrono::milliseconds(10);
+
+// Effect block of a report, 0 if it applies to none
+uint8_t blockOf(const unsigned char* report, int length) {
+  if (length < 2) {
+    return 0;
+  }
+
+  switch (report[0]) {
+    case REPORT_DOWNLOAD_FORCE_SAMPLE:
+    case REPORT_DEVICE_CONTROL:
+    case REPORT_DEVICE_GAIN:
+      return 0;
+  }
+
+  // The other PID output reports carry the block after their ID
+  return report[0] <= REPORT_SET_CUSTOM_FORCE ? report[1] : 0;
+}
+
+bool isOperation(const unsigned char* report) {
+  return report[0] == REPORT_EFFECT_OPERATION ||
+         report[0] == REPORT_BLOCK_FREE;
+}
+
+bool isReset(const unsigned char* report, int length) {
+  return report[0] == REPORT_DEVICE_CONTROL && length > 1 &&
+         report[1] == DC_DEVICE_RESET;
+}
+
+// Device controls and force samples play or stop the effects along with the
+// effect operations
+bool playsEffects(const unsigned char* report) {
+  return report[0] == REPORT_DEVICE_CONTROL ||
+         report[0] == REPORT_DOWNLOAD_FORCE_SAMPLE;
+}
+
+// true if two reports must reach the device in their write order
+bool ordered(const unsigned char* a, int a_length, const unsigned char* b,
+             int b_length) {
+  // A reset clears the whole device state
+  if (isReset(a, a_length) || isReset(b, b_length)) {
+    return true;
+  }
+
+  if ((playsEffects(a) && isOperation(b)) ||
+      (isOperation(a) && playsEffects(b))) {
+    return true;
+  }
+
+  uint8_t block = blockOf(a, a_length);
+  return block != 0 && block == blockOf(b, b_length);
+}
+
+// true if a later report replaces a queued one: the parameter reports and
+// the device gain hold a state, and so does an effect operation unless it
+// also stops the other blocks
+bool supersedes(const unsigned char* queued, int queued_length,
+                const unsigned char* report, int length) {
+  if (queued[0] != report[0] || queued_length != length) {
+    return false;
+  }
+
+  switch (report[0]) {
+    case REPORT_CUSTOM_FORCE_DATA:
+    case REPORT_DOWNLOAD_FORCE_SAMPLE:
+    case REPORT_BLOCK_FREE:
+    case REPORT_DEVICE_CONTROL:
+      return false;
+
+    case REPORT_EFFECT_OPERATION:
+      if (length > 2 && queued[2] == OP_EFFECT_START_SOLO) {
+        return false;
+      }
+      break;
+
+    case REPORT_SET_CONDITION:
+      // One report per axis, i.e. per parameter block offset
+      if (length > 2 && queued[2] != report[2]) {
+        return false;
+      }
+      break;
+  }
+
+  return blockOf(queued, queued_length) == blockOf(report, length);
+}
+
+}  // namespace
+
+CLSPReportScheduler::CLSPReportScheduler(Sender sender, int depth,
+                                         int capacity)
+    : sender(std::move(sender)),
+      depth(std::max(depth, 1)),
+      capacity(std::max(capacity, 1)),
+      reports(new CLSPScheduledReport[this->capacity]),
+      in_flight(new CLSPScheduledReport*[this->depth]) {
+  for (int i = 0; i < this->capacity; i++) {
+    this->reports[i].scheduler = this;
+    recycle(&this->reports[i]);
+  }
+
+  for (auto& delay : this->delays) {
+    delay = std::make_unique<CLSPLatencyHistogram>(DELAY_BIN_NS, DELAY_BINS);
+  }
+
+  this->thread = std::thread(&CLSPReportScheduler::run, this);
+}
+
+CLSPReportScheduler::~CLSPReportScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+
+    uint64_t now = clspMonotonicNs();
+    for (auto& head : this->heads) {
+      while (head != nullptr) {
+        CLSPScheduledReport* report = head;
+        head = report->next;
+
+        report->submitted = true;
+        report->completion = CLSPCompletion(LIBUSB_ERROR_INTERRUPTED, now);
+        complete(report);
+      }
+    }
+    this->queued = 0;
+  }
+
+  this->work_cv.notify_all();
+  this->submitted_cv.notify_all();
+
+  this->thread.join();
+}
+
+CLSPCompletion CLSPReportScheduler::write(const unsigned char* report,
+                                          int length) {
+  return queue(report, length, true);
+}
+
+CLSPCompletion CLSPReportScheduler::tryWrite(const unsigned char* report,
+                                             int length) {
+  return queue(report, length, false);
+}
+
+CLSPCompletion CLSPReportScheduler::queue(const unsigned char* report,
+                                          int length, bool wait) {
+  if (length < 1 || length > CLSPScheduledReport::MAX_REPORT_SIZE) {
+    return CLSPCompletion(LIBUSB_ERROR_INVALID_PARAM, clspMonotonicNs());
+  }
+
+  std::unique_lock<std::mutex> lock(this->mutex, std::defer_lock);
+  if (wait) {
+    lock.lock();
+  } else if (!lock.try_lock()) {
+    return CLSPCompletion(LIBUSB_ERROR_BUSY, clspMonotonicNs());
+  }
+
+  CLSPReportClass type = classify(report);
+
+  // Merged into the queued report, sent in its place in the queue
+  CLSPScheduledReport* queued_report = findSuperseded(report, length);
+  if (queued_report != nullptr) {
+    std::memcpy(queued_report->bytes, report, length);
+    this->counters[type].written++;
+    this->counters[type].coalesced++;
+
+    return CLSPCompletion(queued_report, queued_report->generation);
+  }
+
+  if (!wait && this->free_head == nullptr) {
+    return CLSPCompletion(LIBUSB_ERROR_BUSY, clspMonotonicNs());
+  }
+
+  this->counters[type].written++;
+
+  this->submitted_cv.wait(lock, [this] {
+    return this->free_head != nullptr || this->stopping;
+  });
+  if (this->stopping) {
+    return CLSPCompletion(LIBUSB_ERROR_INTERRUPTED, clspMonotonicNs());
+  }
+
+  queued_report = this->free_head;
+  this->free_head = queued_report->next;
+  if (this->free_head == nullptr) {
+    this->free_tail = nullptr;
+  }
+
+  queued_report->next = nullptr;
+  queued_report->generation++;
+  queued_report->submitted = false;
+  queued_report->completion = CLSPCompletion();
+  queued_report->type = type;
+  queued_report->sequence = this->next_sequence++;
+  queued_report->written_ns = clspMonotonicNs();
+  queued_report->length = length;
+  std::memcpy(queued_report->bytes, report, length);
+
+  if (this->tails[type] != nullptr) {
+    this->tails[type]->next = queued_report;
+  } else {
+    this->heads[type] = queued_report;
+  }
+  this->tails[type] = queued_report;
+
+  this->queued++;
+  this->high_water = std::max(this->high_water, this->queued);
+
+  CLSPCompletion completion(queued_report, queued_report->generation);
+
+  // A real-time writer leaves the submissions to the scheduler thread
+  if (!wait) {
+    lock.unlock();
+    this->work_cv.notify_one();
+
+    return completion;
+  }
+
+  dispatch(lock);
+
+  return completion;
+}
+
+CLSPReportClass CLSPReportScheduler::classify(const unsigned char* report) {
+  switch (report[0]) {
+    case REPORT_DEVICE_CONTROL:
+    case REPORT_DEVICE_GAIN:
+      return CLSP_CLASS_DEVICE;
+
+    case REPORT_EFFECT_OPERATION:
+    case REPORT_BLOCK_FREE:
+      return CLSP_CLASS_OPERATION;
+
+    case REPORT_SET_CONSTANT_FORCE:
+      return CLSP_CLASS_STREAM;
+  }
+
+  return CLSP_CLASS_PARAMETER;
+}
+
+CLSPRealtimeStatus CLSPReportScheduler::setRealtimeProfile(
+    const CLSPRealtimeProfile& profile) {
+  CLSPRealtimeProfile scheduler_profile = profile;
+  // The memory is locked by the stream or the backend thread if requested
+  scheduler_profile.lock_memory = false;
+
+  return clspApplyRealtime(this->thread.native_handle(), scheduler_profile);
+}
+
+CLSPSchedulerStats CLSPReportScheduler::stats() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  CLSPSchedulerStats stats;
+  stats.depth = this->depth;
+  stats.queued = this->queued;
+  stats.high_water = this->high_water;
+
+  for (int i = 0; i < CLSP_REPORT_CLASSES; i++) {
+    CLSPReportClassStats& type = stats.classes[i];
+    type = this->counters[i];
+
+    if (type.sent > 0) {
+      type.delay_mean_us = this->delay_sums[i] / type.sent;
+      type.delay_p50_us = this->delays[i]->percentile(0.50);
+      type.delay_p99_us = this->delays[i]->percentile(0.99);
+    }
+  }
+
+  return stats;
+}
+
+bool CLSPReportScheduler::findSubmission(const CLSPScheduledReport* report,
+                                         uint32_t generation,
+                                         CLSPCompletion& completion) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return resolve(report, generation, completion);
+}
+
+bool CLSPReportScheduler::tryFindSubmission(const CLSPScheduledReport* report,
+                                            uint32_t generation,
+                                            CLSPCompletion& completion) {
+  std::unique_lock<std::mutex> lock(this->mutex, std::try_to_lock);
+  return lock.owns_lock() && resolve(report, generation, completion);
+}
+
+CLSPCompletion CLSPReportScheduler::waitSubmission(
+    const CLSPScheduledReport* report, uint32_t generation) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  CLSPCompletion completion;
+  this->submitted_cv.wait(lock, [&] {
+    return resolve(report, generation, completion);
+  });
+
+  return completion;
+}
+
+bool CLSPReportScheduler::waitSubmissionFor(
+    const CLSPScheduledReport* report, uint32_t generation,
+    std::chrono::milliseconds timeout, CLSPCompletion& completion) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  return this->submitted_cv.wait_for(lock, timeout, [&] {
+    return resolve(report, generation, completion);
+  });
+}
+
+void CLSPReportScheduler::run() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  while (true) {
+    this->work_cv.wait(lock, [this] {
+      return this->stopping || (this->queued > 0 && !this->dispatching);
+    });
+    if (this->stopping) {
+      break;
+    }
+
+    retire();
+
+    // The endpoint is full, the next report goes out on a completion
+    if (this->in_flight_count >= this->depth) {
+      CLSPCompletion oldest =
+          this->in_flight[this->in_flight_head]->completion;
+
+      lock.unlock();
+      oldest.waitFor(STOP_POLL);
+      lock.lock();
+      continue;
+    }
+
+    dispatch(lock);
+  }
+}
+
+void CLSPReportScheduler::dispatch(std::unique_lock<std::mutex>& lock) {
+  // The submitting thread also takes the reports queued meanwhile
+  if (this->dispatching) {
+    return;
+  }
+  this->dispatching = true;
+
+  while (!this->stopping) {
+    retire();
+    if (this->in_flight_count >= this->depth) {
+      break;
+    }
+
+    CLSPScheduledReport* report = pick();
+    if (report == nullptr) {
+      break;
+    }
+
+    // Out of the queues, no write merges into it while it is submitted
+    this->heads[report->type] = report->next;
+    if (report->next == nullptr) {
+      this->tails[report->type] = nullptr;
+    }
+    this->queued--;
+
+    lock.unlock();
+    CLSPCompletion completion = this->sender(report->bytes, report->length);
+    uint64_t now = clspMonotonicNs();
+    lock.lock();
+
+    report->completion = completion;
+    report->submitted = true;
+
+    uint64_t delay = now > report->written_ns ? now - report->written_ns : 0;
+    CLSPReportClassStats& type = this->counters[report->type];
+    type.sent++;
+    type.delay_max_us = std::max(type.delay_max_us, delay / 1000.0);
+    this->delay_sums[report->type] += delay / 1000.0;
+    this->delays[report->type]->record(delay);
+
+    // Kept until the transfer completes, so its outcome goes to the history
+    if (completion.ready()) {
+      complete(report);
+    } else {
+      int tail = (this->in_flight_head + this->in_flight_count) % this->depth;
+      this->in_flight[tail] = report;
+      this->in_flight_count++;
+    }
+
+    this->submitted_cv.notify_all();
+  }
+
+  this->dispatching = false;
+
+  if (this->queued > 0) {
+    this->work_cv.notify_one();
+  }
+}
+
+void CLSPReportScheduler::retire() {
+  bool retired = false;
+
+  while (this->in_flight_count > 0 &&
+         this->in_flight[this->in_flight_head]->completion.ready()) {
+    complete(this->in_flight[this->in_flight_head]);
+    this->in_flight[this->in_flight_head] = nullptr;
+    this->in_flight_head = (this->in_flight_head + 1) % this->depth;
+    this->in_flight_count--;
+    retired = true;
+  }
+
+  // Room for the writers waiting for a free report
+  if (retired) {
+    this->submitted_cv.notify_all();
+  }
+}
+
+CLSPScheduledReport* CLSPReportScheduler::pick() {
+  for (int type = 0; type < CLSP_REPORT_CLASSES; type++) {
+    CLSPScheduledReport* head = this->heads[type];
+    if (head == nullptr) {
+      continue;
+    }
+
+    // An earlier report of another class it must follow holds it back
+    bool held = false;
+    for (int other = 0; other < CLSP_REPORT_CLASSES && !held; other++) {
+      if (other == type) {
+        continue;
+      }
+
+      for (auto report = this->heads[other];
+           report != nullptr && report->sequence < head->sequence;
+           report = report->next) {
+        if (ordered(report->bytes, report->length, head->bytes,
+                    head->length)) {
+          held = true;
+          break;
+        }
+      }
+    }
+
+    if (!held) {
+      return head;
+    }
+  }
+
+  // Not reached while reports are queued: the oldest one is never held back
+  return nullptr;
+}
+
+CLSPScheduledReport* CLSPReportScheduler::findSuperseded(
+    const unsigned char* report, int length) {
+  CLSPScheduledReport* found = nullptr;
+
+  for (auto queued_report = this->heads[classify(report)];
+       queued_report != nullptr; queued_report = queued_report->next) {
+    if (supersedes(queued_report->bytes, queued_report->length, report,
+                   length)) {
+      found = queued_report;
+    }
+  }
+
+  if (found == nullptr) {
+    return nullptr;
+  }
+
+  // The new payload would overtake the later reports it must follow
+  for (auto head : this->heads) {
+    for (auto queued_report = head; queued_report != nullptr;
+         queued_report = queued_report->next) {
+      if (queued_report->sequence > found->sequence &&
+          ordered(queued_report->bytes, queued_report->length, report,
+                  length)) {
+        return nullptr;
+      }
+    }
+  }
+
+  return found;
+}
+
+void CLSPReportScheduler::recycle(CLSPScheduledReport* report) {
+  report->next = nullptr;
+
+  if (this->free_tail != nullptr) {
+    this->free_tail->next = report;
+  } else {
+    this->free_head = report;
+  }
+  this->free_tail = report;
+}
+
+void CLSPReportScheduler::complete(CLSPScheduledReport* report) {
+  report->history.record(report->generation, report->completion.status(),
+                         report->completion.completionTime());
+  recycle(report);
+}
+
+bool CLSPReportScheduler::resolve(const CLSPScheduledReport* report,
+                                  uint32_t generation,
+                                  CLSPCompletion& completion) const {
+  // The report was handed out again, as a recycled transfer slot
+  if (report->generation != generation) {
+    completion = CLSPCompletion(report->history.status(generation),
+                                report->history.completionTime(generation));
+    return true;
+  }
+
+  if (!report->submitted) {
+    return false;
+  }
+
+  completion = report->completion;
+  return true;
+}
@@ -0,0 +1,262 @@
+#ifndef CLS_P_SCHEDULER_HPP
+#define CLS_P_SCHEDULER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "clsp_realtime.hpp"
+#include "clsp_transfer.hpp"
+
+class CLSPReportScheduler;
+
+/**
+ * Priority class of an output report, the first ones go out first
+ */
+enum CLSPReportClass {
+  // Device Control and Device Gain, e.g. stop all effects
+  CLSP_CLASS_DEVICE,
+  // Effect Operation and Block Free
+  CLSP_CLASS_OPERATION,
+  // Set Constant Force, the streamed magnitude
+  CLSP_CLASS_STREAM,
+  // Effect parameters and custom force data
+  CLSP_CLASS_PARAMETER,
+  CLSP_REPORT_CLASSES,
+};
+
+/**
+ * Reports of a priority class since the scheduler creation
+ */
+struct CLSPReportClassStats {
+  // Reports written
+  uint64_t written = 0;
+  // Reports merged into a queued report of the same ID and block, i.e. sent
+  // without a transfer of their own
+  uint64_t coalesced = 0;
+  // Transfers submitted
+  uint64_t sent = 0;
+  // Time from the first write of a report to its submission, in us. The
+  // percentiles are rounded up to 10 us.
+  double delay_mean_us = 0.0;
+  double delay_p50_us = 0.0;
+  double delay_p99_us = 0.0;
+  double delay_max_us = 0.0;
+};
+
+/**
+ * Queue of a report scheduler
+ */
+struct CLSPSchedulerStats {
+  // Transfers kept in flight on the endpoint
+  int depth = 0;
+  // Reports waiting for their submission, and the highest count
+  int queued = 0;
+  int high_water = 0;
+  CLSPReportClassStats classes[CLSP_REPORT_CLASSES];
+};
+
+/**
+ * Report waiting in a scheduler, recycled by it once its transfer completed
+ */
+struct CLSPScheduledReport {
+  static constexpr int MAX_REPORT_SIZE = 64;
+
+  CLSPReportScheduler* scheduler = nullptr;
+  // Next report of the same class queue, or of the free list
+  CLSPScheduledReport* next = nullptr;
+
+  // Generation handed out by the last write, the handles of the previous
+  // ones read their transfer outcome from the history
+  uint32_t generation = 0;
+  bool submitted = false;
+  CLSPCompletion completion;
+  CLSPCompletionHistory history;
+
+  CLSPReportClass type = CLSP_CLASS_PARAMETER;
+  // Write order, kept by a coalesced report
+  uint64_t sequence = 0;
+  // CLOCK_MONOTONIC time of the first write, in ns
+  uint64_t written_ns = 0;
+
+  int length = 0;
+  unsigned char bytes[MAX_REPORT_SIZE];
+};
+
+/**
+ * Orders the output reports of an interrupt endpoint by priority class
+ * instead of call order, so a burst of parameter uploads cannot delay a stop
+ * or a magnitude update by more than the transfers already in flight.
+ *
+ * Only a few transfers are kept in flight on the endpoint; the other reports
+ * wait in one FIFO per class. A report still waiting is overwritten by a
+ * later report with the same ID, block and parameter block offset, both
+ * writers getting the handle of the merged transfer. The reports of an effect
+ * block keep their order across the classes, and so do the device controls
+ * and the effect operations, so the reordering never changes the state of
+ * the device. The reports are classified in the built-in layout of
+ * clsp_reports.hpp, the sender lays them out for the device.
+ *
+ * The submissions happen on the writing thread while the endpoint has room,
+ * on a scheduler thread once the transfers in flight complete otherwise.
+ */
+class CLSPReportScheduler {
+ public:
+  // Submits a report on the endpoint
+  typedef std::function<CLSPCompletion(const unsigned char*, int)> Sender;
+
+  /**
+   * Starts the scheduler thread
+   * @param sender submits the reports
+   * @param depth transfers kept in flight on the endpoint
+   * @param capacity reports waiting at most, the writers wait beyond
+   */
+  CLSPReportScheduler(Sender sender, int depth, int capacity);
+
+  /**
+   * Stops the thread. The reports still waiting fail with
+   * LIBUSB_ERROR_INTERRUPTED.
+   */
+  ~CLSPReportScheduler();
+
+  CLSPReportScheduler(const CLSPReportScheduler&) = delete;
+  CLSPReportScheduler& operator=(const CLSPReportScheduler&) = delete;
+
+  /**
+   * Queues a report, waiting for room if the queue is full
+   * @param report report bytes, starting with the report ID
+   * @param length report size
+   * @return completion handle, valid until as many reports as the queue
+   * holds have been written after it
+   */
+  CLSPCompletion write(const unsigned char* report, int length);
+
+  /**
+   * Queues a report unless that means waiting, for the real-time threads.
+   * The report is always submitted by another thread, never by the caller.
+   * @param report report bytes, starting with the report ID
+   * @param length report size
+   * @return completion handle as write(), or one failed at once with
+   * LIBUSB_ERROR_BUSY if the queue is locked or full
+   */
+  CLSPCompletion tryWrite(const unsigned char* report, int length);
+
+  /**
+   * @param report report bytes, starting with the report ID
+   * @return priority class of the report
+   */
+  static CLSPReportClass classify(const unsigned char* report);
+
+  /**
+   * Applies a real-time profile to the scheduler thread
+   * @param profile real-time profile
+   * @return parts of the profile the system granted
+   */
+  CLSPRealtimeStatus setRealtimeProfile(const CLSPRealtimeProfile& profile);
+
+  /**
+   * @return queue and per-class counters since the creation
+   */
+  CLSPSchedulerStats stats();
+
+  /**
+   * Returns the submission of a report if it happened, without waiting
+   * @param report queued report
+   * @param generation generation of the handle
+   * @param completion receives the completion handle of the transfer
+   * @return false while the report waits
+   */
+  bool findSubmission(const CLSPScheduledReport* report, uint32_t generation,
+                      CLSPCompletion& completion);
+
+  /**
+   * Returns the submission of a report if it happened and the lock is free,
+   * without waiting
+   * @param report queued report
+   * @param generation generation of the handle
+   * @param completion receives the completion handle of the transfer
+   * @return false while the report waits or another thread holds the lock
+   */
+  bool tryFindSubmission(const CLSPScheduledReport* report,
+                         uint32_t generation, CLSPCompletion& completion);
+
+  /**
+   * Blocks until a report is submitted
+   * @param report queued report
+   * @param generation generation of the handle
+   * @return completion handle of the transfer
+   */
+  CLSPCompletion waitSubmission(const CLSPScheduledReport* report,
+                                uint32_t generation);
+
+  /**
+   * Blocks until a report is submitted or the timeout expires
+   * @param report queued report
+   * @param generation generation of the handle
+   * @param timeout maximum time to wait
+   * @param completion receives the completion handle of the transfer
+   * @return true if the report was submitted
+   */
+  bool waitSubmissionFor(const CLSPScheduledReport* report,
+                         uint32_t generation,
+                         std::chrono::milliseconds timeout,
+                         CLSPCompletion& completion);
+
+ private:
+  // Delay histograms: 10 us bins up to 100 ms
+  static constexpr uint64_t DELAY_BIN_NS = 10000;
+  static constexpr int DELAY_BINS = 10000;
+
+  Sender sender;
+  int depth;
+  int capacity;
+
+  std::unique_ptr<CLSPScheduledReport[]> reports;
+
+  // Guards the queues, the reports and the counters
+  std::mutex mutex;
+  // Signals the submissions and the room in the queue
+  std::condition_variable submitted_cv;
+  // Wakes the scheduler thread up
+  std::condition_variable work_cv;
+  bool stopping = false;
+  // A thread is submitting, the others only queue
+  bool dispatching = false;
+  std::thread thread;
+
+  // FIFO per class, and free list in recycling order
+  CLSPScheduledReport* heads[CLSP_REPORT_CLASSES] = {};
+  CLSPScheduledReport* tails[CLSP_REPORT_CLASSES] = {};
+  CLSPScheduledReport* free_head = nullptr;
+  CLSPScheduledReport* free_tail = nullptr;
+  int queued = 0;
+  int high_water = 0;
+  uint64_t next_sequence = 0;
+
+  // Reports whose transfer is in flight, oldest first
+  std::unique_ptr<CLSPScheduledReport*[]> in_flight;
+  int in_flight_head = 0;
+  int in_flight_count = 0;
+
+  CLSPReportClassStats counters[CLSP_REPORT_CLASSES];
+  double delay_sums[CLSP_REPORT_CLASSES] = {};
+  std::unique_ptr<CLSPLatencyHistogram> delays[CLSP_REPORT_CLASSES];
+
+  CLSPCompletion queue(const unsigned char* report, int length, bool wait);
+  void run();
+  void dispatch(std::unique_lock<std::mutex>& lock);
+  void retire();
+  CLSPScheduledReport* pick();
+  CLSPScheduledReport* findSuperseded(const unsigned char* report,
+                                      int length);
+  void recycle(CLSPScheduledReport* report);
+  void complete(CLSPScheduledReport* report);
+  bool resolve(const CLSPScheduledReport* report, uint32_t generation,
+               CLSPCompletion& completion) const;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "clsp_shadow.hpp"
+
+#include <cstring>
+
+namespace {
+
+const uint8_t REPORT_SET_EFFECT = 0x01;
+const uint8_t REPORT_SET_ENVELOPE = 0x02;
+const uint8_t REPORT_SET_CONDITION = 0x03;
+const uint8_t REPORT_SET_PERIODIC = 0x04;
+const uint8_t REPORT_SET_CONSTANT_FORCE = 0x05;
+const uint8_t REPORT_SET_RAMP = 0x06;
+const uint8_t REPORT_CUSTOM_FORCE_DATA = 0x07;
+const uint8_t REPORT_DOWNLOAD_FORCE_SAMPLE = 0x08;
+const uint8_t REPORT_EFFECT_OPERATION = 0x0a;
+const uint8_t REPORT_BLOCK_FREE = 0x0b;
+const uint8_t REPORT_DEVICE_CONTROL = 0x0c;
+const uint8_t REPORT_DEVICE_GAIN = 0x0d;
+const uint8_t REPORT_SET_CUSTOM_FORCE = 0x0e;
+
+// Block parameters first, the Set Effect report refers to them
+const uint8_t REPLAY_ORDER[] = {
+    REPORT_SET_ENVELOPE,       REPORT_SET_CONDITION,    REPORT_SET_PERIODIC,
+    REPORT_SET_CONSTANT_FORCE, REPORT_SET_RAMP,         REPORT_SET_CUSTOM_FORCE,
+    REPORT_SET_EFFECT,         REPORT_EFFECT_OPERATION,
+};
+
+const uint8_t OP_EFFECT_START_SOLO = 0x02;
+const uint8_t OP_EFFECT_STOP = 0x03;
+
+const uint8_t DC_STOP_ALL_EFFECTS = 0x03;
+const uint8_t DC_DEVICE_RESET = 0x04;
+
+}  // namespace
+
+CLSPShadowCache::CLSPShadowCache() { clear(); }
+
+bool CLSPShadowCache::update(const unsigned char* report, int length,
+                             CLSPCompletion& sent) {
+  if (length < 1) {
+    return true;
+  }
+
+  switch (report[0]) {
+    case REPORT_EFFECT_OPERATION:
+      if (!updateOperation(report, length)) {
+        sent = find(report, length)->sent;
+        return false;
+      }
+      return true;
+
+    case REPORT_BLOCK_FREE:
+      if (length > 1) {
+        invalidateBlock(report[1]);
+      }
+      return true;
+
+    case REPORT_DEVICE_CONTROL:
+      if (length > 1 && report[1] == DC_DEVICE_RESET) {
+        clear();
+      } else if (length > 1 && report[1] == DC_STOP_ALL_EFFECTS) {
+        markAllStopped();
+      }
+      return true;
+
+    case REPORT_CUSTOM_FORCE_DATA:
+    case REPORT_DOWNLOAD_FORCE_SAMPLE:
+      return true;
+  }
+
+  Entry* entry = find(report, length);
+  if (entry == nullptr) {
+    return true;
+  }
+
+  if (entry->valid && entry->length == length &&
+      std::memcmp(entry->bytes, report, length) == 0 && delivered(*entry)) {
+    this->suppressed_count++;
+    sent = entry->sent;
+    return false;
+  }
+
+  entry->valid = true;
+  entry->length = length;
+  std::memcpy(entry->bytes, report, length);
+  entry->sent = CLSPCompletion();
+
+  return true;
+}
+
+void CLSPShadowCache::track(const unsigned char* report, int length,
+                            const CLSPCompletion& completion) {
+  Entry* entry = find(report, length);
+  if (entry != nullptr) {
+    entry->sent = completion;
+  }
+}
+
+void CLSPShadowCache::clear() {
+  for (auto& id : this->entries) {
+    for (auto& block : id) {
+      for (Entry& entry : block) {
+        entry = Entry();
+      }
+    }
+  }
+}
+
+void CLSPShadowCache::replay(
+    uint8_t block,
+    const std::function<void(const unsigned char*, int)>& visit) const {
+  if (block < 1 || block > MAX_EFFECT_BLOCK) {
+    return;
+  }
+
+  for (uint8_t id : REPLAY_ORDER) {
+    for (int parameter_block = 0; parameter_block < MAX_PARAMETER_BLOCK;
+         parameter_block++) {
+      const Entry& entry = this->entries[id - 1][block][parameter_block];
+
+      if (entry.valid) {
+        visit(entry.bytes, entry.length);
+      }
+    }
+  }
+}
+
+CLSPShadowCache::Entry* CLSPShadowCache::find(const unsigned char* report,
+                                              int length) {
+  if (length < 1 || length > MAX_REPORT_SIZE || report[0] < 1 ||
+      report[0] > MAX_REPORT_ID) {
+    return nullptr;
+  }
+
+  uint8_t block = 0;
+  uint8_t parameter_block = 0;
+
+  // The device gain is the only report not addressed to an effect block
+  if (report[0] != REPORT_DEVICE_GAIN) {
+    if (length < 2 || report[1] > MAX_EFFECT_BLOCK) {
+      return nullptr;
+    }
+    block = report[1];
+  }
+
+  if (report[0] == REPORT_SET_CONDITION) {
+    if (length < 3 || (report[2] & 0x0f) >= MAX_PARAMETER_BLOCK) {
+      return nullptr;
+    }
+    parameter_block = report[2] & 0x0f;
+  }
+
+  return &this->entries[report[0] - 1][block][parameter_block];
+}
+
+bool CLSPShadowCache::updateOperation(const unsigned char* report,
+                                      int length) {
+  Entry* entry = find(report, length);
+  if (entry == nullptr || length < 3) {
+    return true;
+  }
+
+  uint8_t operation = report[2];
+
+  // Stopping a stopped effect is the only idempotent operation
+  if (operation == OP_EFFECT_STOP && entry->valid &&
+      entry->bytes[2] == OP_EFFECT_STOP && delivered(*entry)) {
+    this->suppressed_count++;
+    return false;
+  }
+
+  if (operation == OP_EFFECT_START_SOLO) {
+    markAllStopped();
+  }
+
+  entry->valid = true;
+  entry->length = length;
+  std::memcpy(entry->bytes, report, length);
+  entry->sent = CLSPCompletion();
+
+  return true;
+}
+
+bool CLSPShadowCache::delivered(const Entry& entry) {
+  // Sent again while queued or unknown, the scheduler merges it into the
+  // queued report; its lock is never waited for here
+  CLSPCompletion transfer;
+  if (!entry.sent.tryResolve(transfer)) {
+    return false;
+  }
+
+  // Still in flight, the same payload is already on its way
+  if (!transfer.ready()) {
+    return true;
+  }
+
+  return transfer.status() >= 0;
+}
+
+void CLSPShadowCache::invalidateBlock(uint8_t block) {
+  if (block > MAX_EFFECT_BLOCK) {
+    return;
+  }
+
+  for (int id = 0; id < MAX_REPORT_ID; id++) {
+    for (int parameter_block = 0; parameter_block < MAX_PARAMETER_BLOCK;
+         parameter_block++) {
+      this->entries[id][block][parameter_block].valid = false;
+    }
+  }
+}
+
+void CLSPShadowCache::markAllStopped() {
+  for (int block = 1; block <= MAX_EFFECT_BLOCK; block++) {
+    Entry& entry = this->entries[REPORT_EFFECT_OPERATION - 1][block][0];
+
+    entry.valid = true;
+    entry.length = 4;
+    entry.bytes[0] = REPORT_EFFECT_OPERATION;
+    entry.bytes[1] = block;
+    entry.bytes[2] = OP_EFFECT_STOP;
+    entry.bytes[3] = 0x00;
+    entry.sent = CLSPCompletion();
+  }
+}
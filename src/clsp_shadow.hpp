@@ -0,0 +1,99 @@
+#ifndef CLS_P_SHADOW_HPP
+#define CLS_P_SHADOW_HPP
+
+#include <cstdint>
+#include <functional>
+
+#include "clsp_transfer.hpp"
+
+/**
+ * Shadow copy of the last PID output reports written to the device, per report
+ * ID and effect block. Used to suppress transfers that would not change the
+ * device state.
+ *
+ * Parameter reports (0x01-0x06, 0x0d, 0x0e) are suppressed when their payload
+ * is unchanged. Effect operations (0x0a) are only suppressed for a repeated
+ * stop; starts are always sent since they restart the effect. Block free
+ * (0x0b) and device control (0x0c) are always sent and invalidate the entries
+ * they affect. Custom force data and samples (0x07, 0x08) are data streams and
+ * are never cached. A report whose transfer failed is sent again, whenever
+ * the failure happened.
+ *
+ * The reports are read in the built-in layout of clsp_reports.hpp, before
+ * they are laid out for the device.
+ *
+ * Not thread-safe: the caller serializes updates with the submissions.
+ */
+class CLSPShadowCache {
+ public:
+  CLSPShadowCache();
+
+  /**
+   * Records a report about to be sent
+   * @param report report bytes, starting with the report ID
+   * @param length report size
+   * @param sent receives the completion of the transfer carrying the same
+   * payload when the report is suppressed
+   * @return true if the report must be sent, false if the device holds or is
+   * about to hold the same payload
+   */
+  bool update(const unsigned char* report, int length, CLSPCompletion& sent);
+
+  /**
+   * Records the transfer of a report update() let through, so its payload is
+   * sent again if the transfer fails
+   * @param report report bytes, starting with the report ID
+   * @param length report size
+   * @param completion completion handle of the transfer
+   */
+  void track(const unsigned char* report, int length,
+             const CLSPCompletion& completion);
+
+  /**
+   * Forgets every shadow entry, the next report of each kind is sent
+   */
+  void clear();
+
+  /**
+   * Visits the cached reports of an effect block in an order the device
+   * accepts when the block is uploaded again: parameter reports, then Set
+   * Effect, then the last effect operation
+   * @param block effect block index [1,40]
+   * @param visit called with each report and its size
+   */
+  void replay(uint8_t block,
+              const std::function<void(const unsigned char*, int)>& visit)
+      const;
+
+  /**
+   * @return number of reports suppressed since the cache creation
+   */
+  uint64_t suppressed() const { return this->suppressed_count; }
+
+ private:
+  static const int MAX_REPORT_ID = 0x0e;
+  static const int MAX_EFFECT_BLOCK = 40;
+  static const int MAX_PARAMETER_BLOCK = 2;
+  static const int MAX_REPORT_SIZE = 16;
+
+  struct Entry {
+    bool valid = false;
+    uint8_t length = 0;
+    unsigned char bytes[MAX_REPORT_SIZE] = {};
+    // Transfer of the payload, pending or completed
+    CLSPCompletion sent;
+  };
+
+  // [report ID - 1][effect block][parameter block offset]
+  Entry entries[MAX_REPORT_ID][MAX_EFFECT_BLOCK + 1][MAX_PARAMETER_BLOCK];
+
+  uint64_t suppressed_count = 0;
+
+  Entry* find(const unsigned char* report, int length);
+  static bool delivered(const Entry& entry);
+  bool updateOperation(const unsigned char* report, int length);
+  void invalidateBlock(uint8_t block);
+  void markAllStopped();
+};
+
+#endif
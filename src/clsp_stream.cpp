@@ -0,0 +1,243 @@
+#include "clsp_stream.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "clsp_clock.hpp"
+
+namespace {
+
+// No magnitude submitted yet, or the last one failed
+const int MAGNITUDE_NONE = std::numeric_limits<int>::min();
+
+}  // namespace
+
+CLSPForceStream::~CLSPForceStream() { stop(); }
+
+int CLSPForceStream::start(Sender sender, int rate_hz) {
+  return start(std::move(sender), nullptr, rate_hz);
+}
+
+int CLSPForceStream::start(Sender sender, Source source, int rate_hz) {
+  if (running() || rate_hz <= 0 || !sender) {
+    return -1;
+  }
+
+  uint64_t period_ns = 1000000000ull / rate_hz;
+
+  std::unique_ptr<CLSPPeriodicTimer> timer;
+  try {
+    timer =
+        std::make_unique<CLSPPeriodicTimer>(period_ns, this->profile.timer);
+  } catch (const std::runtime_error&) {
+    return -1;
+  }
+
+  this->sender = std::move(sender);
+  this->source = std::move(source);
+  this->stopping = false;
+
+  CLSPStreamStats stats;
+  stats.target_hz = rate_hz;
+
+  {
+    std::lock_guard<std::mutex> lock(this->stats_mutex);
+    this->published = stats;
+    this->timer = std::move(timer);
+  }
+
+  this->latency.reset();
+
+  this->thread = std::thread(&CLSPForceStream::run, this, stats,
+                             this->profile.prefault_stack);
+
+  // Runs with the default policy if the system refuses
+  CLSPRealtimeStatus status =
+      clspApplyRealtime(this->thread.native_handle(), this->profile);
+
+  std::lock_guard<std::mutex> lock(this->stats_mutex);
+  this->published.realtime = status.realtime;
+  this->published.affinity = status.affinity;
+  this->published.memory_locked = status.memory_locked;
+
+  return 0;
+}
+
+void CLSPForceStream::stop() {
+  if (!running()) {
+    return;
+  }
+
+  this->stopping = true;
+  this->thread.join();
+}
+
+void CLSPForceStream::setProfile(const CLSPRealtimeProfile& profile) {
+  this->profile = profile;
+}
+
+void CLSPForceStream::setForce(float force) {
+  this->force.store(force, std::memory_order_relaxed);
+}
+
+CLSPStreamStats CLSPForceStream::stats() {
+  std::lock_guard<std::mutex> lock(this->stats_mutex);
+  CLSPStreamStats stats = this->published;
+
+  if (this->timer) {
+    CLSPWakeupStats wakeups = this->timer->stats();
+    stats.overruns = wakeups.missed;
+    stats.lateness_mean_us = wakeups.lateness_mean_us;
+    stats.lateness_p50_us = wakeups.lateness_p50_us;
+    stats.lateness_p99_us = wakeups.lateness_p99_us;
+    stats.lateness_p999_us = wakeups.lateness_p999_us;
+    stats.lateness_max_us = wakeups.lateness_max_us;
+  }
+
+  stats.latency_p50_us = this->latency.percentile(0.50);
+  stats.latency_p99_us = this->latency.percentile(0.99);
+
+  return stats;
+}
+
+int16_t CLSPForceStream::toMagnitude(float force) {
+  if (std::isnan(force)) {
+    return 0;
+  }
+
+  force = std::fmax(-1.0f, std::fmin(1.0f, force));
+
+  return static_cast<int16_t>(std::lrint(force * MAX_MAGNITUDE));
+}
+
+void CLSPForceStream::run(CLSPStreamStats stats, bool prefault_stack) {
+  CLSPCompletion last;
+  int last_magnitude = MAGNITUDE_NONE;
+  // Input report the report in flight was computed from, 0 if none
+  uint64_t last_input = 0;
+
+  // Running sums of the tick intervals, in ns
+  double period_sum = 0.0;
+  double period_sq_sum = 0.0;
+  uint64_t period_min = 0;
+  uint64_t period_max = 0;
+  // Input report to submission and completion, in ns
+  double input_age_sum = 0.0;
+  uint64_t input_age_max = 0;
+  uint64_t latency_max = 0;
+
+  if (prefault_stack) {
+    clspPrefaultStack();
+  }
+
+  // Not replaced before the thread is joined
+  CLSPPeriodicTimer& timer = *this->timer;
+
+  uint64_t start = clspMonotonicNs();
+  uint64_t previous = 0;
+
+  while (!this->stopping.load(std::memory_order_relaxed)) {
+    uint64_t now = timer.wait();
+
+    stats.ticks++;
+
+    if (previous != 0) {
+      uint64_t period = now - previous;
+      period_sum += period;
+      period_sq_sum += static_cast<double>(period) * period;
+      period_min = period_min == 0 ? period : std::min(period_min, period);
+      period_max = std::max(period_max, period);
+    }
+    previous = now;
+
+    // Latest value wins: never queue behind a report still in flight. The
+    // transfer is read without waiting for the scheduler lock.
+    CLSPCompletion transfer;
+    if (!last.tryResolve(transfer) || !transfer.ready()) {
+      stats.busy++;
+    } else {
+      int status = transfer.status();
+      if (status < 0) {
+        stats.errors++;
+        last_magnitude = MAGNITUDE_NONE;
+      }
+
+      uint64_t completed = transfer.completionTime();
+      if (status == 0 && last_input != 0 && completed >= last_input) {
+        uint64_t latency = completed - last_input;
+        this->latency.record(latency);
+        latency_max = std::max(latency_max, latency);
+      }
+
+      // Only reported once
+      last = CLSPCompletion();
+      last_input = 0;
+
+      uint64_t input = 0;
+      float force = this->source
+                        ? this->source(now, input)
+                        : this->force.load(std::memory_order_relaxed);
+
+      int magnitude = toMagnitude(force);
+      CLSPCompletion sent;
+      if (magnitude != last_magnitude) {
+        sent = this->sender(magnitude);
+      }
+
+      if (magnitude == last_magnitude) {
+        stats.unchanged++;
+      } else if (sent.ready() && sent.status() == LIBUSB_ERROR_BUSY) {
+        // Sent at the next tick, with the force of that tick
+        stats.busy++;
+      } else {
+        last = sent;
+        last_magnitude = magnitude;
+        stats.sent++;
+
+        if (input != 0) {
+          uint64_t submitted = clspMonotonicNs();
+          uint64_t age = submitted > input ? submitted - input : 0;
+          stats.input_reports++;
+          input_age_sum += age;
+          input_age_max = std::max(input_age_max, age);
+          last_input = input;
+        }
+      }
+    }
+
+    // The reader copies the stats rarely, skip the update rather than wait
+    std::unique_lock<std::mutex> lock(this->stats_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      continue;
+    }
+
+    uint64_t intervals = stats.ticks - 1;
+
+    stats.realtime = this->published.realtime;
+    stats.affinity = this->published.affinity;
+    stats.memory_locked = this->published.memory_locked;
+    stats.rate_hz = now > start ? stats.ticks * 1e9 / (now - start) : 0.0;
+
+    if (stats.input_reports > 0) {
+      stats.input_age_mean_us = input_age_sum / stats.input_reports / 1000.0;
+      stats.input_age_max_us = input_age_max / 1000.0;
+      stats.latency_max_us = latency_max / 1000.0;
+    }
+
+    if (intervals > 0) {
+      double mean = period_sum / intervals;
+      double variance = period_sq_sum / intervals - mean * mean;
+
+      stats.period_mean_us = mean / 1000.0;
+      stats.period_stddev_us = std::sqrt(std::fmax(variance, 0.0)) / 1000.0;
+      stats.period_min_us = period_min / 1000.0;
+      stats.period_max_us = period_max / 1000.0;
+    }
+
+    this->published = stats;
+  }
+
+  last.wait();
+}
@@ -0,0 +1,170 @@
+#ifndef CLS_P_STREAM_HPP
+#define CLS_P_STREAM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "clsp_realtime.hpp"
+#include "clsp_transfer.hpp"
+
+/**
+ * Timing of a force stream since its start
+ */
+struct CLSPStreamStats {
+  // Requested and achieved tick rates, in Hz
+  double target_hz = 0.0;
+  double rate_hz = 0.0;
+  // Ticks run, reports submitted, ticks with an unchanged force
+  uint64_t ticks = 0;
+  uint64_t sent = 0;
+  uint64_t unchanged = 0;
+  // Ticks skipped because the previous report was still in flight, or the
+  // endpoint could not take a report without waiting
+  uint64_t busy = 0;
+  // Deadlines missed because a tick woke up more than a period late
+  uint64_t overruns = 0;
+  // Reports completed with an error
+  uint64_t errors = 0;
+  // Interval between consecutive ticks, in us. The deviation is the jitter.
+  double period_mean_us = 0.0;
+  double period_stddev_us = 0.0;
+  double period_min_us = 0.0;
+  double period_max_us = 0.0;
+  // Wake-up time past the tick deadline, in us. The percentiles are rounded
+  // up to 1 us.
+  double lateness_mean_us = 0.0;
+  double lateness_p50_us = 0.0;
+  double lateness_p99_us = 0.0;
+  double lateness_p999_us = 0.0;
+  double lateness_max_us = 0.0;
+  // Reports computed from an input report by a source, see
+  // CLSPForceStream::start()
+  uint64_t input_reports = 0;
+  // Input report completion to the submission of the force computed from it,
+  // in us
+  double input_age_mean_us = 0.0;
+  double input_age_max_us = 0.0;
+  // Input report completion to the completion of the force report computed
+  // from it, in us. The percentiles are rounded up to 10 us.
+  double latency_p50_us = 0.0;
+  double latency_p99_us = 0.0;
+  double latency_max_us = 0.0;
+  // Parts of the real-time profile the system granted to the thread, see
+  // CLSPForceStream::setProfile()
+  bool realtime = false;
+  bool affinity = false;
+  bool memory_locked = false;
+};
+
+/**
+ * Sends a force magnitude to the device at a fixed rate from its own thread.
+ * The producer only stores the latest force in a mailbox; each tick reads it
+ * and submits it if it changed since the last report, so a slow producer
+ * never queues stale values and a fast one never blocks.
+ */
+class CLSPForceStream {
+ public:
+  // Submits a Set Constant Force report with the given magnitude, or fails
+  // at once with LIBUSB_ERROR_BUSY rather than wait for the endpoint
+  typedef std::function<CLSPCompletion(int16_t)> Sender;
+
+  // Computes the normalized force of a tick from the CLOCK_MONOTONIC time of
+  // the tick, in ns. Sets its second argument to the CLOCK_MONOTONIC time of
+  // the input report the force was computed from, or leaves it 0.
+  typedef std::function<float(uint64_t, uint64_t&)> Source;
+
+  static const int MAX_MAGNITUDE = 255;
+
+  CLSPForceStream() = default;
+
+  /**
+   * Stops the thread
+   */
+  ~CLSPForceStream();
+
+  CLSPForceStream(const CLSPForceStream&) = delete;
+  CLSPForceStream& operator=(const CLSPForceStream&) = delete;
+
+  /**
+   * Starts the stream thread, with the real-time profile if allowed
+   * @param sender called on the stream thread to submit a magnitude
+   * @param rate_hz tick rate, in Hz
+   * @return 0 on success, -1 if the stream is running or the rate is invalid
+   */
+  int start(Sender sender, int rate_hz);
+
+  /**
+   * Starts the stream thread with a force computed at each tick instead of
+   * the setForce() value
+   * @param sender called on the stream thread to submit a magnitude
+   * @param source called on the stream thread at each tick
+   * @param rate_hz tick rate, in Hz
+   * @return 0 on success, -1 if the stream is running or the rate is invalid
+   */
+  int start(Sender sender, Source source, int rate_hz);
+
+  /**
+   * Sets the scheduling of the stream thread, applied at the next start. By
+   * default the thread only gets the SCHED_FIFO policy. Not thread-safe
+   * with start().
+   * @param profile real-time profile
+   */
+  void setProfile(const CLSPRealtimeProfile& profile);
+
+  /**
+   * Stops the stream thread, waiting for the tick in progress
+   */
+  void stop();
+
+  /**
+   * @return true while the stream thread runs
+   */
+  bool running() const { return this->thread.joinable(); }
+
+  /**
+   * Stores the force sent by the next tick, unless a source computes it.
+   * Lock-free, callable from any thread, also when the stream is stopped.
+   * @param force normalized force [-1,1], clamped
+   */
+  void setForce(float force);
+
+  /**
+   * @return timing counters since the last start, refreshed every tick
+   */
+  CLSPStreamStats stats();
+
+  /**
+   * @param force normalized force [-1,1], clamped, NaN is 0
+   * @return Set Constant Force magnitude [-255,255]
+   */
+  static int16_t toMagnitude(float force);
+
+ private:
+  // Latency histogram of the reports computed from an input report
+  static constexpr uint64_t LATENCY_BIN_NS = 10000;
+  static constexpr int LATENCY_BINS = 2048;
+
+  Sender sender;
+  Source source;
+  CLSPRealtimeProfile profile;
+
+  std::atomic<float> force{0.0f};
+  std::atomic<bool> stopping{false};
+  std::thread thread;
+
+  // Copy of the counters of the stream thread, updated when not contended
+  std::mutex stats_mutex;
+  CLSPStreamStats published;
+
+  // Clock of the ticks, kept after a stop for its stats
+  std::unique_ptr<CLSPPeriodicTimer> timer;
+  CLSPLatencyHistogram latency{LATENCY_BIN_NS, LATENCY_BINS};
+
+  void run(CLSPStreamStats stats, bool prefault_stack);
+};
+
+#endif
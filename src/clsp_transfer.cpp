@@ -0,0 +1,663 @@
+#include "clsp_transfer.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "clsp_clock.hpp"
+#include "clsp_scheduler.hpp"
+
+namespace {
+
+// Buffers are aligned on a cache line
+const int BUFFER_ALIGNMENT = 64;
+
+// Wrap-safe "generation a is at or after generation b"
+bool reached(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) >= 0;
+}
+
+}  // namespace
+
+CLSPCompletion CLSPCompletion::immediate(int status) {
+  return CLSPCompletion(status, clspMonotonicNs());
+}
+
+int CLSPCompletion::wait() const {
+  if (this->scheduled != nullptr) {
+    return this->scheduled->scheduler
+        ->waitSubmission(this->scheduled, this->generation)
+        .wait();
+  }
+
+  if (this->slot == nullptr) {
+    return this->immediate_status;
+  }
+
+  this->slot->pool->waitCompleted(this->slot, this->generation);
+
+  return status();
+}
+
+bool CLSPCompletion::waitFor(std::chrono::milliseconds timeout) const {
+  if (this->scheduled != nullptr) {
+    auto start = std::chrono::steady_clock::now();
+
+    CLSPCompletion submitted;
+    if (!this->scheduled->scheduler->waitSubmissionFor(
+            this->scheduled, this->generation, timeout, submitted)) {
+      return false;
+    }
+
+    // The rest of the timeout for the transfer itself
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    return submitted.waitFor(
+        std::max(timeout - waited, std::chrono::milliseconds(0)));
+  }
+
+  if (this->slot == nullptr) {
+    return true;
+  }
+
+  return this->slot->pool->waitCompletedFor(this->slot, this->generation,
+                                            timeout);
+}
+
+bool CLSPCompletion::ready() const {
+  if (this->scheduled != nullptr) {
+    CLSPCompletion submitted;
+    return this->scheduled->scheduler->findSubmission(
+               this->scheduled, this->generation, submitted) &&
+           submitted.ready();
+  }
+
+  if (this->slot == nullptr) {
+    return true;
+  }
+
+  return reached(this->slot->completed, this->generation);
+}
+
+int CLSPCompletion::status() const {
+  if (this->scheduled != nullptr) {
+    CLSPCompletion submitted;
+    if (!this->scheduled->scheduler->findSubmission(
+            this->scheduled, this->generation, submitted)) {
+      return LIBUSB_SUCCESS;
+    }
+    return submitted.status();
+  }
+
+  if (this->slot == nullptr) {
+    return this->immediate_status;
+  }
+
+  if (!reached(this->slot->completed, this->generation)) {
+    return LIBUSB_SUCCESS;
+  }
+
+  int status = this->slot->status;
+
+  // The status belongs to a later transfer once the slot is handed out again
+  if (this->slot->generation != this->generation) {
+    return this->slot->pool->pastStatus(this->slot, this->generation);
+  }
+
+  return status;
+}
+
+uint64_t CLSPCompletion::completionTime() const {
+  if (this->scheduled != nullptr) {
+    CLSPCompletion submitted;
+    if (!this->scheduled->scheduler->findSubmission(
+            this->scheduled, this->generation, submitted)) {
+      return 0;
+    }
+    return submitted.completionTime();
+  }
+
+  if (this->slot == nullptr) {
+    return this->immediate_ns;
+  }
+
+  if (!reached(this->slot->completed, this->generation)) {
+    return 0;
+  }
+
+  uint64_t time = this->slot->completed_ns;
+
+  if (this->slot->generation != this->generation) {
+    return this->slot->pool->pastCompletionTime(this->slot, this->generation);
+  }
+
+  return time;
+}
+
+bool CLSPCompletion::tryResolve(CLSPCompletion& transfer) const {
+  if (this->scheduled != nullptr) {
+    return this->scheduled->scheduler->tryFindSubmission(
+        this->scheduled, this->generation, transfer);
+  }
+
+  transfer = *this;
+  return true;
+}
+
+void CLSPCompletionHistory::record(uint32_t generation, int status,
+                                   uint64_t completed_ns) {
+  Use& use = this->recent[generation % RECENT];
+  use.valid = true;
+  use.generation = generation;
+  use.status = status;
+  use.completed_ns = completed_ns;
+
+  if (status == LIBUSB_SUCCESS) {
+    return;
+  }
+
+  Use& failure = this->failures[this->next_failure];
+  if (failure.valid) {
+    this->failure_dropped = true;
+    this->dropped_generation = failure.generation;
+  }
+
+  failure = use;
+  this->next_failure = (this->next_failure + 1) % FAILURES;
+}
+
+int CLSPCompletionHistory::status(uint32_t generation) const {
+  const Use& use = this->recent[generation % RECENT];
+  if (use.valid && use.generation == generation) {
+    return use.status;
+  }
+
+  for (const Use& failure : this->failures) {
+    if (failure.valid && failure.generation == generation) {
+      return failure.status;
+    }
+  }
+
+  // Every failure since the dropped one is kept, the others succeeded
+  if (this->failure_dropped && reached(this->dropped_generation, generation)) {
+    return LIBUSB_ERROR_NOT_FOUND;
+  }
+
+  return LIBUSB_SUCCESS;
+}
+
+uint64_t CLSPCompletionHistory::completionTime(uint32_t generation) const {
+  const Use& use = this->recent[generation % RECENT];
+  if (use.valid && use.generation == generation) {
+    return use.completed_ns;
+  }
+
+  return 0;
+}
+
+CLSPSubmitWindow::CLSPSubmitWindow(size_t size)
+    : size(std::max<size_t>(size, 1)) {}
+
+void CLSPSubmitWindow::push(const CLSPCompletion& completion) {
+  // The completed transfers leave the window without waiting
+  while (!this->pending.empty() && this->pending.front().ready()) {
+    waitOldest();
+  }
+
+  while (this->pending.size() >= this->size) {
+    waitOldest();
+  }
+
+  this->pending.push_back(completion);
+  this->pushed++;
+}
+
+int CLSPSubmitWindow::drain() {
+  while (!this->pending.empty()) {
+    waitOldest();
+  }
+
+  return this->first_error;
+}
+
+void CLSPSubmitWindow::waitOldest() {
+  const CLSPCompletion& oldest = this->pending.front();
+
+  int status = oldest.wait();
+  if (status < 0 && this->first_error == LIBUSB_SUCCESS) {
+    this->first_error = status;
+  }
+
+  this->last_ns = std::max(this->last_ns, oldest.completionTime());
+
+  this->pending.pop_front();
+}
+
+CLSPTransferPool::CLSPTransferPool(libusb_device_handle* handle, int slots,
+                                   int buffer_size)
+    : handle(handle),
+      buffer_size(buffer_size),
+      size(slots),
+      slots(new CLSPTransferSlot[slots + 1]),
+      reserved(&this->slots[slots]),
+      free_slots(new CLSPTransferSlot*[slots]) {
+  this->stride = (buffer_size + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT *
+                 BUFFER_ALIGNMENT;
+
+  allocateBuffers();
+
+  for (int i = 0; i <= slots; i++) {
+    auto slot = &this->slots[i];
+
+    slot->pool = this;
+    slot->transfer = libusb_alloc_transfer(0);
+
+    if (slot->transfer == nullptr) {
+      throw std::runtime_error("Unable to allocate transfer");
+    }
+
+    if (slot != this->reserved) {
+      this->free_slots[i] = slot;
+    }
+  }
+
+  this->free_count = slots;
+}
+
+CLSPTransferPool::~CLSPTransferPool() {
+  for (int i = 0; i <= this->size; i++) {
+    libusb_free_transfer(this->slots[i].transfer);
+  }
+
+  freeBuffers();
+}
+
+void CLSPTransferPool::allocateBuffers() {
+  size_t length = static_cast<size_t>(this->stride) * (this->size + 1);
+
+  // One mapping for the whole pool, the kernel maps at least a page per call
+  this->memory = this->handle != nullptr
+                     ? libusb_dev_mem_alloc(this->handle, length)
+                     : nullptr;
+  this->dev_mem = this->memory != nullptr;
+
+  if (!this->dev_mem) {
+    this->memory = static_cast<unsigned char*>(
+        std::aligned_alloc(BUFFER_ALIGNMENT, length));
+  }
+
+  if (this->memory == nullptr) {
+    throw std::runtime_error("Unable to allocate transfer buffers");
+  }
+
+  std::memset(this->memory, 0, length);
+
+  for (int i = 0; i <= this->size; i++) {
+    this->slots[i].buffer = this->memory + i * this->stride;
+  }
+}
+
+void CLSPTransferPool::freeBuffers() {
+  if (this->dev_mem) {
+    libusb_dev_mem_free(this->handle, this->memory,
+                        static_cast<size_t>(this->stride) * (this->size + 1));
+  } else {
+    std::free(this->memory);
+  }
+
+  this->memory = nullptr;
+}
+
+CLSPTransferSlot* CLSPTransferPool::acquire() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  if (this->free_count == 0) {
+    this->exhausted++;
+    this->cv.wait(lock, [this] { return this->free_count > 0; });
+  }
+
+  auto slot = this->free_slots[this->free_head];
+
+  this->free_head = (this->free_head + 1) % this->size;
+  this->free_count--;
+
+  this->acquired++;
+  this->high_water = std::max(this->high_water, this->size - this->free_count);
+
+  slot->in_flight = true;
+  slot->generation++;
+
+  return slot;
+}
+
+CLSPTransferSlot* CLSPTransferPool::acquireReserved() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (this->reserved->in_flight) {
+    return nullptr;
+  }
+
+  this->reserved->in_flight = true;
+  this->reserved->generation++;
+
+  return this->reserved;
+}
+
+void CLSPTransferPool::release(CLSPTransferSlot* slot) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    if (slot != this->reserved) {
+      int tail = (this->free_head + this->free_count) % this->size;
+
+      this->free_slots[tail] = slot;
+      this->free_count++;
+    }
+
+    slot->in_flight = false;
+  }
+
+  this->cv.notify_all();
+}
+
+void CLSPTransferPool::complete(CLSPTransferSlot* slot, int status) {
+  uint64_t now = clspMonotonicNs();
+  uint32_t generation = slot->generation;
+
+  {
+    // Before the release, the handles read it once the slot is handed out
+    std::lock_guard<std::mutex> lock(this->mutex);
+    slot->history.record(generation, status, now);
+  }
+
+  slot->status = status;
+  slot->completed_ns = now;
+  slot->completed = generation;
+
+  release(slot);
+}
+
+int CLSPTransferPool::pastStatus(const CLSPTransferSlot* slot,
+                                 uint32_t generation) const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return slot->history.status(generation);
+}
+
+uint64_t CLSPTransferPool::pastCompletionTime(const CLSPTransferSlot* slot,
+                                              uint32_t generation) const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return slot->history.completionTime(generation);
+}
+
+CLSPCompletion CLSPTransferPool::track(CLSPTransferSlot* slot) const {
+  return CLSPCompletion(slot, slot->generation);
+}
+
+void CLSPTransferPool::waitCompleted(const CLSPTransferSlot* slot,
+                                     uint32_t generation) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->cv.wait(lock, [slot, generation] {
+    return reached(slot->completed, generation);
+  });
+}
+
+bool CLSPTransferPool::waitCompletedFor(const CLSPTransferSlot* slot,
+                                        uint32_t generation,
+                                        std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  return this->cv.wait_for(lock, timeout, [slot, generation] {
+    return reached(slot->completed, generation);
+  });
+}
+
+void CLSPTransferPool::cancelAll() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  for (int i = 0; i <= this->size; i++) {
+    if (this->slots[i].in_flight) {
+      libusb_cancel_transfer(this->slots[i].transfer);
+    }
+  }
+
+  this->cv.wait(lock, [this] {
+    return this->free_count == this->size && !this->reserved->in_flight;
+  });
+}
+
+void CLSPTransferPool::rebind(libusb_device_handle* handle) {
+  cancelAll();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  // The mapping belongs to the old handle, free it before the handle closes
+  freeBuffers();
+  this->handle = handle;
+  allocateBuffers();
+}
+
+CLSPPoolStats CLSPTransferPool::stats() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  CLSPPoolStats stats;
+  stats.size = this->size;
+  stats.in_use = this->size - this->free_count;
+  stats.high_water = this->high_water;
+  stats.acquired = this->acquired;
+  stats.exhausted = this->exhausted;
+  stats.dev_mem = this->dev_mem;
+
+  return stats;
+}
+
+CLSPTransferEngine::CLSPTransferEngine(
+    std::shared_ptr<CLSPUsbContext> context)
+    : context(std::move(context)) {}
+
+CLSPTransferEngine::~CLSPTransferEngine() { cancelAll(); }
+
+void CLSPTransferEngine::addPool(libusb_device_handle* handle,
+                                 unsigned char endpoint, int slots,
+                                 int buffer_size) {
+  this->pools[endpoint] =
+      std::make_unique<CLSPTransferPool>(handle, slots, buffer_size);
+}
+
+CLSPCompletion CLSPTransferEngine::submitInterrupt(unsigned char endpoint,
+                                                   const unsigned char* data,
+                                                   int length,
+                                                   unsigned int timeout) {
+  return submitInterrupt(endpoint, data, length, timeout, false);
+}
+
+CLSPCompletion CLSPTransferEngine::submitReservedInterrupt(
+    unsigned char endpoint, const unsigned char* data, int length,
+    unsigned int timeout) {
+  return submitInterrupt(endpoint, data, length, timeout, true);
+}
+
+CLSPCompletion CLSPTransferEngine::submitInterrupt(unsigned char endpoint,
+                                                   const unsigned char* data,
+                                                   int length,
+                                                   unsigned int timeout,
+                                                   bool reserved) {
+  std::shared_lock<std::shared_mutex> lock(this->rebind_mutex);
+
+  auto pool = findPool(endpoint);
+  if (pool == nullptr) {
+    return CLSPCompletion(LIBUSB_ERROR_INVALID_PARAM, clspMonotonicNs());
+  }
+  if (pool->deviceHandle() == nullptr) {
+    return CLSPCompletion(LIBUSB_ERROR_NO_DEVICE, clspMonotonicNs());
+  }
+  if (length > pool->bufferSize()) {
+    return CLSPCompletion(LIBUSB_ERROR_OVERFLOW, clspMonotonicNs());
+  }
+
+  auto slot = reserved ? pool->acquireReserved() : pool->acquire();
+  if (slot == nullptr) {
+    return CLSPCompletion(LIBUSB_ERROR_BUSY, clspMonotonicNs());
+  }
+
+  slot->read_data = nullptr;
+  std::memcpy(slot->buffer, data, length);
+
+  libusb_fill_interrupt_transfer(slot->transfer, pool->deviceHandle(),
+                                 endpoint, slot->buffer, length,
+                                 &CLSPTransferEngine::onTransferComplete, slot,
+                                 timeout);
+
+  return submit(slot);
+}
+
+CLSPCompletion CLSPTransferEngine::submitControl(uint8_t request_type,
+                                                 uint8_t request,
+                                                 uint16_t value,
+                                                 uint16_t index,
+                                                 const unsigned char* data,
+                                                 uint16_t length,
+                                                 unsigned int timeout) {
+  std::shared_lock<std::shared_mutex> lock(this->rebind_mutex);
+
+  auto pool = findPool(0x00);
+  if (pool == nullptr) {
+    return CLSPCompletion(LIBUSB_ERROR_INVALID_PARAM, clspMonotonicNs());
+  }
+  if (pool->deviceHandle() == nullptr) {
+    return CLSPCompletion(LIBUSB_ERROR_NO_DEVICE, clspMonotonicNs());
+  }
+  if (LIBUSB_CONTROL_SETUP_SIZE + length > pool->bufferSize()) {
+    return CLSPCompletion(LIBUSB_ERROR_OVERFLOW, clspMonotonicNs());
+  }
+
+  auto slot = pool->acquire();
+
+  slot->read_data = nullptr;
+  libusb_fill_control_setup(slot->buffer, request_type, request, value, index,
+                            length);
+  std::memcpy(slot->buffer + LIBUSB_CONTROL_SETUP_SIZE, data, length);
+
+  libusb_fill_control_transfer(slot->transfer, pool->deviceHandle(),
+                               slot->buffer,
+                               &CLSPTransferEngine::onTransferComplete, slot,
+                               timeout);
+
+  return submit(slot);
+}
+
+CLSPCompletion CLSPTransferEngine::submitControlRead(
+    uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+    unsigned char* data, uint16_t length, unsigned int timeout) {
+  std::shared_lock<std::shared_mutex> lock(this->rebind_mutex);
+
+  auto pool = findPool(0x00);
+  if (pool == nullptr) {
+    return CLSPCompletion(LIBUSB_ERROR_INVALID_PARAM, clspMonotonicNs());
+  }
+  if (pool->deviceHandle() == nullptr) {
+    return CLSPCompletion(LIBUSB_ERROR_NO_DEVICE, clspMonotonicNs());
+  }
+  if (LIBUSB_CONTROL_SETUP_SIZE + length > pool->bufferSize()) {
+    return CLSPCompletion(LIBUSB_ERROR_OVERFLOW, clspMonotonicNs());
+  }
+
+  auto slot = pool->acquire();
+
+  slot->read_data = data;
+  libusb_fill_control_setup(slot->buffer, request_type, request, value, index,
+                            length);
+
+  libusb_fill_control_transfer(slot->transfer, pool->deviceHandle(),
+                               slot->buffer,
+                               &CLSPTransferEngine::onTransferComplete, slot,
+                               timeout);
+
+  return submit(slot);
+}
+
+CLSPCompletion CLSPTransferEngine::submit(CLSPTransferSlot* slot) {
+  uint32_t generation = slot->generation;
+
+  int ret = libusb_submit_transfer(slot->transfer);
+  if (ret < 0) {
+    // Never reached the event loop, recycle it right away
+    uint64_t now = clspMonotonicNs();
+
+    slot->status = ret;
+    slot->completed_ns = now;
+    slot->completed = generation;
+    slot->pool->release(slot);
+
+    return CLSPCompletion(ret, now);
+  }
+
+  return CLSPCompletion(slot, generation);
+}
+
+void CLSPTransferEngine::cancelAll() {
+  for (auto& pool : this->pools) {
+    pool.second->cancelAll();
+  }
+}
+
+void CLSPTransferEngine::rebind(libusb_device_handle* handle) {
+  // Unblocks the submissions waiting for a slot before taking the lock
+  cancelAll();
+
+  std::unique_lock<std::shared_mutex> lock(this->rebind_mutex);
+
+  for (auto& pool : this->pools) {
+    pool.second->rebind(handle);
+  }
+}
+
+CLSPPoolStats CLSPTransferEngine::poolStats(unsigned char endpoint) const {
+  auto pool = findPool(endpoint);
+  if (pool == nullptr) {
+    return CLSPPoolStats();
+  }
+
+  return pool->stats();
+}
+
+CLSPTransferPool* CLSPTransferEngine::findPool(unsigned char endpoint) const {
+  auto it = this->pools.find(endpoint);
+  if (it == this->pools.end()) {
+    return nullptr;
+  }
+
+  return it->second.get();
+}
+
+void LIBUSB_CALL
+CLSPTransferEngine::onTransferComplete(libusb_transfer* transfer) {
+  auto slot = static_cast<CLSPTransferSlot*>(transfer->user_data);
+
+  if (slot->read_data != nullptr &&
+      transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    std::memcpy(slot->read_data, libusb_control_transfer_get_data(transfer),
+                transfer->actual_length);
+  }
+
+  slot->pool->complete(slot, statusToError(transfer));
+}
+
+int CLSPTransferEngine::statusToError(libusb_transfer* transfer) {
+  // Same mapping as the libusb synchronous API
+  switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      return LIBUSB_SUCCESS;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:
+      return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      return LIBUSB_ERROR_OVERFLOW;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_CANCELLED:
+      return LIBUSB_ERROR_INTERRUPTED;
+    default:
+      return LIBUSB_ERROR_IO;
+  }
+}
@@ -0,0 +1,511 @@
+#ifndef CLS_P_TRANSFER_HPP
+#define CLS_P_TRANSFER_HPP
+
+#include <libusb-1.0/libusb.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+#include "clsp_context.hpp"
+
+class CLSPTransferPool;
+struct CLSPScheduledReport;
+
+/**
+ * Outcome of the past uses of a recycled transfer or report, so a handle
+ * still reads the status of its own transfer once the slot is handed out
+ * again. Guarded by the lock of its owner.
+ */
+class CLSPCompletionHistory {
+ public:
+  // Uses kept with their completion time, and failures kept beyond them
+  static constexpr int RECENT = 16;
+  static constexpr int FAILURES = 8;
+
+  /**
+   * Records the completion of a use
+   * @param generation generation of the use
+   * @param status libusb error code, 0 on success
+   * @param completed_ns CLOCK_MONOTONIC completion time, in ns
+   */
+  void record(uint32_t generation, int status, uint64_t completed_ns);
+
+  /**
+   * @param generation generation of a completed use
+   * @return libusb error code of the use, LIBUSB_ERROR_NOT_FOUND if it may
+   * have been one of the failures no longer kept
+   */
+  int status(uint32_t generation) const;
+
+  /**
+   * @param generation generation of a completed use
+   * @return CLOCK_MONOTONIC completion time of the use in ns, 0 once RECENT
+   * later uses completed
+   */
+  uint64_t completionTime(uint32_t generation) const;
+
+ private:
+  struct Use {
+    bool valid = false;
+    uint32_t generation = 0;
+    int status = LIBUSB_SUCCESS;
+    uint64_t completed_ns = 0;
+  };
+
+  // Indexed by generation modulo RECENT
+  Use recent[RECENT];
+  // Ring of the last failures, and the last failure dropped from it
+  Use failures[FAILURES];
+  int next_failure = 0;
+  bool failure_dropped = false;
+  uint32_t dropped_generation = 0;
+};
+
+/**
+ * Pre-allocated transfer and its DMA buffer, recycled by its pool
+ */
+struct CLSPTransferSlot {
+  CLSPTransferPool* pool = nullptr;
+  libusb_transfer* transfer = nullptr;
+  unsigned char* buffer = nullptr;
+
+  // Generation handed out by the last acquire, and last one completed
+  std::atomic<uint32_t> generation{0};
+  std::atomic<uint32_t> completed{0};
+  std::atomic<int> status{LIBUSB_SUCCESS};
+
+  // CLOCK_MONOTONIC time of the last completion, in ns
+  std::atomic<uint64_t> completed_ns{0};
+
+  // Completions of the previous uses, guarded by the pool mutex
+  CLSPCompletionHistory history;
+
+  // Caller buffer receiving the payload of a control IN transfer
+  unsigned char* read_data = nullptr;
+
+  bool in_flight = false;
+};
+
+/**
+ * Pool exhaustion and usage counters
+ */
+struct CLSPPoolStats {
+  // Number of slots in the pool, the reserved one excluded
+  int size = 0;
+  // Slots currently handed out
+  int in_use = 0;
+  // Highest simultaneous use since the pool creation
+  int high_water = 0;
+  // Slots handed out since the pool creation
+  uint64_t acquired = 0;
+  // Acquisitions that found the pool empty and had to wait
+  uint64_t exhausted = 0;
+  // true if the buffers live in kernel DMA memory (libusb_dev_mem_alloc)
+  bool dev_mem = false;
+};
+
+/**
+ * Completion handle of an asynchronous transfer. A default constructed handle
+ * is already completed with a success status.
+ *
+ * The handle refers to a pooled slot, which keeps the outcome of its past
+ * uses: the handle reads the status of its own transfer after the slot is
+ * handed out again. A report still waiting in a CLSPReportScheduler is
+ * pending until its submission, then follows its transfer.
+ */
+class CLSPCompletion {
+ public:
+  CLSPCompletion() = default;
+
+  /**
+   * Returns a handle completed at the time of the call, for the transports
+   * that send reports synchronously
+   * @param status libusb error code, 0 on success
+   * @return completed handle
+   */
+  static CLSPCompletion immediate(int status);
+
+  /**
+   * Blocks until the transfer completes
+   * @return libusb error code, 0 on success
+   */
+  int wait() const;
+
+  /**
+   * Blocks until the transfer completes or the timeout expires
+   * @param timeout maximum time to wait
+   * @return true if the transfer completed
+   */
+  bool waitFor(std::chrono::milliseconds timeout) const;
+
+  /**
+   * @return true if the transfer has completed
+   */
+  bool ready() const;
+
+  /**
+   * @return libusb error code of a completed transfer, 0 on success or while
+   * the transfer is still pending. LIBUSB_ERROR_NOT_FOUND only if the slot
+   * failed so many times since that this status may be lost, see
+   * CLSPCompletionHistory.
+   */
+  int status() const;
+
+  /**
+   * @return CLOCK_MONOTONIC time at which the transfer completed, in ns. 0
+   * while the transfer is pending, for a default constructed handle, or once
+   * the slot has been handed out CLSPCompletionHistory::RECENT more times.
+   */
+  uint64_t completionTime() const;
+
+  /**
+   * Follows a report waiting in a CLSPReportScheduler to its transfer without
+   * waiting for the scheduler lock, for the real-time threads
+   * @param transfer receives the handle of the transfer, or a copy of this
+   * handle if it is not scheduled
+   * @return false while the report waits or the scheduler lock is held
+   */
+  bool tryResolve(CLSPCompletion& transfer) const;
+
+ private:
+  friend class CLSPTransferEngine;
+  friend class CLSPTransferPool;
+  friend class CLSPReportScheduler;
+
+  CLSPCompletion(CLSPTransferSlot* slot, uint32_t generation)
+      : slot(slot), generation(generation) {}
+
+  CLSPCompletion(int status, uint64_t time)
+      : immediate_status(status), immediate_ns(time) {}
+
+  CLSPCompletion(CLSPScheduledReport* scheduled, uint32_t generation)
+      : generation(generation), scheduled(scheduled) {}
+
+  CLSPTransferSlot* slot = nullptr;
+  uint32_t generation = 0;
+  int immediate_status = LIBUSB_SUCCESS;
+  uint64_t immediate_ns = 0;
+  CLSPScheduledReport* scheduled = nullptr;
+};
+
+/**
+ * Bounded set of transfers in flight. Adding a transfer past the window size
+ * first waits for the oldest one.
+ */
+class CLSPSubmitWindow {
+ public:
+  /**
+   * @param size maximum number of transfers in flight
+   */
+  explicit CLSPSubmitWindow(size_t size);
+
+  /**
+   * Adds a submitted transfer, waiting for the oldest ones if the window is
+   * full
+   * @param completion completion handle of the transfer
+   */
+  void push(const CLSPCompletion& completion);
+
+  /**
+   * Waits for every transfer in the window
+   * @return first libusb error code of the transfers, 0 on success
+   */
+  int drain();
+
+  /**
+   * @return first libusb error code of the transfers waited for, 0 on success
+   */
+  int status() const { return this->first_error; }
+
+  /**
+   * @return number of transfers added since the window creation
+   */
+  uint64_t count() const { return this->pushed; }
+
+  /**
+   * @return latest CLOCK_MONOTONIC completion time of the transfers waited
+   * for, in ns
+   */
+  uint64_t lastCompletion() const { return this->last_ns; }
+
+ private:
+  size_t size;
+  std::deque<CLSPCompletion> pending;
+
+  int first_error = LIBUSB_SUCCESS;
+  uint64_t pushed = 0;
+  uint64_t last_ns = 0;
+
+  void waitOldest();
+};
+
+/**
+ * Fixed-size set of transfers and buffers for one endpoint. Nothing is
+ * allocated after construction: slots are handed out in FIFO order and
+ * recycled from the completion callback. One more slot is kept out of the
+ * FIFO for the urgent reports, so they never wait for the others.
+ */
+class CLSPTransferPool {
+ public:
+  /**
+   * Allocates the transfers and buffers of the pool. The buffers come from
+   * libusb_dev_mem_alloc when the kernel supports it, from aligned heap
+   * memory otherwise.
+   * @param handle device handle the buffers are mapped for
+   * @param slots number of transfers in the pool
+   * @param buffer_size size of each buffer, in bytes
+   */
+  CLSPTransferPool(libusb_device_handle* handle, int slots, int buffer_size);
+
+  ~CLSPTransferPool();
+
+  CLSPTransferPool(const CLSPTransferPool&) = delete;
+  CLSPTransferPool& operator=(const CLSPTransferPool&) = delete;
+
+  /**
+   * Hands out a free slot, waiting for a completion if the pool is exhausted
+   * @return slot, marked in flight
+   */
+  CLSPTransferSlot* acquire();
+
+  /**
+   * Hands out the reserved slot, never waits
+   * @return slot, marked in flight, NULL while its previous use is in flight
+   */
+  CLSPTransferSlot* acquireReserved();
+
+  /**
+   * Returns a slot to the pool and wakes the completion waiters
+   * @param slot slot handed out by acquire() or acquireReserved()
+   */
+  void release(CLSPTransferSlot* slot);
+
+  /**
+   * Records the completion of a slot and recycles it. Also used by the
+   * transports that carry the transfer out themselves instead of libusb.
+   * @param slot slot handed out by acquire()
+   * @param status libusb error code, 0 on success
+   */
+  void complete(CLSPTransferSlot* slot, int status);
+
+  /**
+   * @param slot slot handed out by acquire(), not completed yet
+   * @return completion handle of the current use of the slot
+   */
+  CLSPCompletion track(CLSPTransferSlot* slot) const;
+
+  /**
+   * @param slot slot handed out again since the given generation completed
+   * @param generation completed generation
+   * @return libusb error code of the generation
+   */
+  int pastStatus(const CLSPTransferSlot* slot, uint32_t generation) const;
+
+  /**
+   * @param slot slot handed out again since the given generation completed
+   * @param generation completed generation
+   * @return CLOCK_MONOTONIC completion time of the generation in ns, 0 if no
+   * longer known
+   */
+  uint64_t pastCompletionTime(const CLSPTransferSlot* slot,
+                              uint32_t generation) const;
+
+  /**
+   * Blocks until the given generation of a slot has completed
+   */
+  void waitCompleted(const CLSPTransferSlot* slot, uint32_t generation);
+
+  /**
+   * Blocks until the given generation of a slot has completed or the timeout
+   * expires
+   * @return true if the generation completed
+   */
+  bool waitCompletedFor(const CLSPTransferSlot* slot, uint32_t generation,
+                        std::chrono::milliseconds timeout);
+
+  /**
+   * Cancels the transfers in flight and waits until they are all released
+   */
+  void cancelAll();
+
+  /**
+   * Cancels the transfers in flight and moves the buffers to another device
+   * handle, e.g. after a re-attach. The slots and their completion handles
+   * stay valid.
+   * @param handle new device handle, NULL while the device is detached
+   */
+  void rebind(libusb_device_handle* handle);
+
+  CLSPPoolStats stats() const;
+
+  int bufferSize() const { return this->buffer_size; }
+
+  libusb_device_handle* deviceHandle() const { return this->handle; }
+
+ private:
+  libusb_device_handle* handle;
+
+  int buffer_size;
+  int stride;
+  unsigned char* memory = nullptr;
+  bool dev_mem = false;
+
+  // Slots of the FIFO, the reserved one comes after them
+  int size;
+  std::unique_ptr<CLSPTransferSlot[]> slots;
+  CLSPTransferSlot* reserved;
+
+  // FIFO of free slots, so handles stay valid as long as possible
+  std::unique_ptr<CLSPTransferSlot*[]> free_slots;
+  int free_head = 0;
+  int free_count = 0;
+
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+
+  void allocateBuffers();
+  void freeBuffers();
+
+  uint64_t acquired = 0;
+  uint64_t exhausted = 0;
+  int high_water = 0;
+};
+
+/**
+ * Submits libusb transfers asynchronously. Their completions run on the event
+ * thread of the context the device was opened in. Transfers queued on the
+ * same endpoint complete in submission order.
+ */
+class CLSPTransferEngine {
+ public:
+  /**
+   * @param context context the device handles belong to, kept alive as long
+   * as the engine
+   */
+  explicit CLSPTransferEngine(std::shared_ptr<CLSPUsbContext> context);
+
+  /**
+   * Cancels the transfers still in flight
+   */
+  ~CLSPTransferEngine();
+
+  CLSPTransferEngine(const CLSPTransferEngine&) = delete;
+  CLSPTransferEngine& operator=(const CLSPTransferEngine&) = delete;
+
+  /**
+   * Creates the transfer pool of an endpoint. Must be called before any
+   * transfer is submitted on it; endpoint 0 holds the control transfers.
+   * @param handle device handle
+   * @param endpoint endpoint address
+   * @param slots number of transfers in the pool
+   * @param buffer_size largest report sent on the endpoint, in bytes
+   */
+  void addPool(libusb_device_handle* handle, unsigned char endpoint, int slots,
+               int buffer_size);
+
+  /**
+   * Queues an interrupt OUT transfer. The payload is copied, the caller's
+   * buffer can be reused as soon as the call returns.
+   * @param endpoint OUT endpoint address
+   * @param data report bytes
+   * @param length report size
+   * @param timeout transfer timeout in ms (0 = inf)
+   * @return completion handle
+   */
+  CLSPCompletion submitInterrupt(unsigned char endpoint,
+                                 const unsigned char* data, int length,
+                                 unsigned int timeout);
+
+  /**
+   * Queues an interrupt OUT transfer in the reserved slot of the endpoint
+   * pool: it never waits for the slots held by the other transfers, only for
+   * the transfers already queued on the endpoint to be carried out.
+   * @param endpoint OUT endpoint address
+   * @param data report bytes
+   * @param length report size
+   * @param timeout transfer timeout in ms (0 = inf)
+   * @return completion handle, LIBUSB_ERROR_BUSY while the previous transfer
+   * of the reserved slot is in flight
+   */
+  CLSPCompletion submitReservedInterrupt(unsigned char endpoint,
+                                         const unsigned char* data,
+                                         int length, unsigned int timeout);
+
+  /**
+   * Queues a control OUT transfer on the endpoint 0 pool
+   * @param request_type bmRequestType field of the setup packet
+   * @param request bRequest field of the setup packet
+   * @param value wValue field of the setup packet
+   * @param index wIndex field of the setup packet
+   * @param data payload bytes
+   * @param length payload size
+   * @param timeout transfer timeout in ms (0 = inf)
+   * @return completion handle
+   */
+  CLSPCompletion submitControl(uint8_t request_type, uint8_t request,
+                               uint16_t value, uint16_t index,
+                               const unsigned char* data, uint16_t length,
+                               unsigned int timeout);
+
+  /**
+   * Queues a control IN transfer on the endpoint 0 pool
+   * @param request_type bmRequestType field of the setup packet
+   * @param request bRequest field of the setup packet
+   * @param value wValue field of the setup packet
+   * @param index wIndex field of the setup packet
+   * @param data receives the payload on completion, must stay valid until
+   * then
+   * @param length payload size
+   * @param timeout transfer timeout in ms (0 = inf)
+   * @return completion handle
+   */
+  CLSPCompletion submitControlRead(uint8_t request_type, uint8_t request,
+                                   uint16_t value, uint16_t index,
+                                   unsigned char* data, uint16_t length,
+                                   unsigned int timeout);
+
+  /**
+   * Cancels every transfer in flight and waits for their completion
+   */
+  void cancelAll();
+
+  /**
+   * Cancels every transfer in flight and points all the pools at another
+   * device handle. While the handle is NULL, the submissions fail right away
+   * with LIBUSB_ERROR_NO_DEVICE.
+   * @param handle new device handle, NULL while the device is detached
+   */
+  void rebind(libusb_device_handle* handle);
+
+  /**
+   * @param endpoint endpoint address of the pool
+   * @return usage counters of the pool, zeroed if the pool does not exist
+   */
+  CLSPPoolStats poolStats(unsigned char endpoint) const;
+
+ private:
+  std::shared_ptr<CLSPUsbContext> context;
+
+  std::map<unsigned char, std::unique_ptr<CLSPTransferPool>> pools;
+
+  // Held shared by the submissions, exclusively while the pools are rebound
+  std::shared_mutex rebind_mutex;
+
+  CLSPTransferPool* findPool(unsigned char endpoint) const;
+  CLSPCompletion submitInterrupt(unsigned char endpoint,
+                                 const unsigned char* data, int length,
+                                 unsigned int timeout, bool reserved);
+  CLSPCompletion submit(CLSPTransferSlot* slot);
+
+  static void LIBUSB_CALL onTransferComplete(libusb_transfer* transfer);
+  static int statusToError(libusb_transfer* transfer);
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef CLS_P_TRANSPORT_HPP
+#define CLS_P_TRANSPORT_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "clsp_context.hpp"
+#include "clsp_input.hpp"
+#include "clsp_realtime.hpp"
+#include "clsp_transfer.hpp"
+
+/**
+ * How a CLSPJoystick talks to the stick
+ */
+enum CLSPBackend {
+  // libusb: detaches the kernel driver, asynchronous pooled transfers
+  CLSP_BACKEND_LIBUSB,
+  // /dev/hidrawN: keeps the kernel driver bound, synchronous reports
+  CLSP_BACKEND_HIDRAW,
+  // In-process simulated stick, no device needed
+  CLSP_BACKEND_SIM,
+};
+
+/**
+ * Report-level access to the two HID interfaces of a stick: interface 0
+ * carries the joystick and PID reports, interface 1 the FX reports.
+ *
+ * The status codes are libusb error codes whatever the backend.
+ */
+class CLSPTransport {
+ public:
+  // Runs on a transport thread: true when a stick with the CLS-P IDs is
+  // attached, false when the open one is unplugged. Must not block.
+  typedef std::function<void(bool)> HotplugHandler;
+
+  // Runs on the thread reading the input reports, with each report read from
+  // interface 0 before it is decoded. Must not block.
+  typedef std::function<void(const unsigned char*, int)> InputHandler;
+
+  static const uint16_t VENDOR_ID = 0x25bb;
+  static const uint16_t PRODUCT_ID = 0x00d3;
+
+  virtual ~CLSPTransport() = default;
+
+  /**
+   * Opens a stick and starts decoding its input reports. Also re-opens it
+   * after a re-attach.
+   * @param device_id serial number or bus path, empty for the first stick
+   * @return identity of the opened stick
+   * @throw std::runtime_error if the stick cannot be opened
+   */
+  virtual CLSPDeviceInfo open(const std::string& device_id) = 0;
+
+  /**
+   * Stops the input and closes the stick. The reports fail with
+   * LIBUSB_ERROR_NO_DEVICE until the next open.
+   */
+  virtual void close() = 0;
+
+  /**
+   * Sends an output report
+   * @param interface HID interface number
+   * @param report report bytes, starting with the report ID
+   * @param length report size
+   * @return completion handle
+   */
+  virtual CLSPCompletion writeReport(int interface,
+                                     const unsigned char* report,
+                                     int length) = 0;
+
+  /**
+   * Sends an output report on the interrupt endpoint through a transfer slot
+   * reserved for it: never waits for a free slot, even while the other
+   * reports exhaust the pool. It still reaches the device after the reports
+   * already queued on the endpoint.
+   * @param interface HID interface number
+   * @param report report bytes, starting with the report ID
+   * @param length report size
+   * @return completion handle, LIBUSB_ERROR_BUSY while the previous reserved
+   * report is in flight
+   */
+  virtual CLSPCompletion writeReservedReport(int interface,
+                                             const unsigned char* report,
+                                             int length) = 0;
+
+  /**
+   * @return true if writeReservedReport() may wait for the writes of the other
+   * threads, i.e. the reserved path does not hold on this backend
+   */
+  virtual bool reservedReportsWait() const = 0;
+
+  /**
+   * Sends a feature report (SET_REPORT)
+   * @param interface HID interface number
+   * @param report report bytes, starting with the report ID
+   * @param length report size
+   * @return completion handle
+   */
+  virtual CLSPCompletion setFeature(int interface, const unsigned char* report,
+                                    int length) = 0;
+
+  /**
+   * Reads a feature report (GET_REPORT)
+   * @param interface HID interface number
+   * @param report holds the report ID in its first byte, receives the report.
+   * Must stay valid until the completion.
+   * @param length report size
+   * @return completion handle
+   */
+  virtual CLSPCompletion getFeature(int interface, unsigned char* report,
+                                    int length) = 0;
+
+  /**
+   * Reads the HID report descriptor of an interface of the open stick
+   * @param interface HID interface number
+   * @param descriptor receives the descriptor bytes
+   * @return 0 on success, libusb error code otherwise
+   */
+  virtual int reportDescriptor(int interface,
+                               std::vector<uint8_t>& descriptor) = 0;
+
+  /**
+   * @return latest decoded input report 1
+   */
+  virtual const CLSPInputState& input() const = 0;
+
+  /**
+   * Sets the handler called with every input report read, e.g. to record
+   * them. Only while the stick is closed, before the first open().
+   * @param handler input handler, empty for none
+   */
+  virtual void setInputHandler(InputHandler handler) = 0;
+
+  /**
+   * Blocks until an input sample newer than the given sequence is decoded,
+   * the input stops or the timeout expires
+   * @param sequence last sequence seen by the caller
+   * @param timeout maximum wait in ms (0 = inf)
+   * @return true if a newer sample is available
+   */
+  virtual bool waitInput(uint64_t sequence, unsigned int timeout) = 0;
+
+  /**
+   * @return connected sticks, as seen by the backend
+   */
+  virtual std::vector<CLSPDeviceInfo> listDevices() = 0;
+
+  /**
+   * Starts reporting attach and detach events
+   * @param handler event handler
+   * @return false if the backend cannot detect them
+   */
+  virtual bool watchHotplug(HotplugHandler handler) = 0;
+
+  /**
+   * Stops reporting attach and detach events, waiting for a handler call in
+   * progress
+   */
+  virtual void unwatchHotplug() = 0;
+
+  /**
+   * @param endpoint endpoint address, 0 for the control pipe
+   * @return usage counters of the transfer pool of an endpoint, zeroed if the
+   * backend has none
+   */
+  virtual CLSPPoolStats poolStats(int endpoint) = 0;
+
+  /**
+   * Applies a real-time profile to the thread of the backend completing the
+   * transfers and decoding the input reports. Its stack is prefaulted at its
+   * next wake-up.
+   * @param profile real-time profile
+   * @return parts of the profile the system granted
+   */
+  virtual CLSPRealtimeStatus setRealtimeProfile(
+      const CLSPRealtimeProfile& profile) = 0;
+};
+
+#endif
@@ -0,0 +1,560 @@
+#include "clsp_transport_hidraw.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "clsp_clock.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char* HIDRAW_CLASS = "/sys/class/hidraw";
+const char* DEV_DIR = "/dev";
+
+// USB, in the HID_ID of the uevent
+const unsigned int BUS_TYPE_USB = 0x0003;
+
+// epoll_event.data of each watched descriptor
+const uint32_t EVENT_WAKE = 0;
+const uint32_t EVENT_DEVICES = 1;
+const uint32_t EVENT_INPUT = 2;
+
+/**
+ * hidraw node of one interface of a stick
+ */
+struct HidrawNode {
+  CLSPDeviceInfo info;
+  int interface = -1;
+  // e.g. /dev/hidraw3
+  std::string node;
+};
+
+std::string readLine(const fs::path& file) {
+  std::ifstream stream(file);
+  std::string line;
+  std::getline(stream, line);
+  return line;
+}
+
+// The sysfs attributes are readable without access to the device node
+std::vector<HidrawNode> scanNodes() {
+  std::vector<HidrawNode> nodes;
+  std::error_code error;
+
+  for (const auto& entry : fs::directory_iterator(HIDRAW_CLASS, error)) {
+    fs::path hid_device = entry.path() / "device";
+
+    HidrawNode node;
+    unsigned int bus = 0, vendor = 0, product = 0;
+    bool matches = false;
+
+    std::ifstream uevent(hid_device / "uevent");
+    std::string line;
+    while (std::getline(uevent, line)) {
+      if (line.compare(0, 7, "HID_ID=") == 0) {
+        matches = std::sscanf(line.c_str() + 7, "%x:%x:%x", &bus, &vendor,
+                              &product) == 3 &&
+                  bus == BUS_TYPE_USB &&
+                  vendor == CLSPTransport::VENDOR_ID &&
+                  product == CLSPTransport::PRODUCT_ID;
+      } else if (line.compare(0, 9, "HID_UNIQ=") == 0) {
+        // Serial number string of the USB device
+        node.info.serial = line.substr(9);
+      }
+    }
+
+    if (!matches) {
+      continue;
+    }
+
+    // .../usb1/1-4/1-4.2/1-4.2:1.0/0003:25BB:00D3.0001
+    fs::path usb_interface = fs::canonical(hid_device, error).parent_path();
+    if (error) {
+      continue;
+    }
+
+    // <bus path>:<configuration>.<interface>
+    std::string name = usb_interface.filename();
+    size_t colon = name.find(':');
+    size_t dot = name.rfind('.');
+    if (colon == std::string::npos || dot == std::string::npos ||
+        dot < colon) {
+      continue;
+    }
+
+    fs::path usb_device = usb_interface.parent_path();
+
+    node.info.path = name.substr(0, colon);
+    node.info.bus = std::atoi(readLine(usb_device / "busnum").c_str());
+    node.info.address = std::atoi(readLine(usb_device / "devnum").c_str());
+    node.info.firmware =
+        std::strtoul(readLine(usb_device / "bcdDevice").c_str(), nullptr, 16);
+    node.interface = std::atoi(name.c_str() + dot + 1);
+    node.node = std::string(DEV_DIR) + "/" +
+                entry.path().filename().string();
+
+    nodes.push_back(node);
+  }
+
+  return nodes;
+}
+
+int errnoToError(int error) {
+  switch (error) {
+    case ENODEV:
+    case ESHUTDOWN:
+      return LIBUSB_ERROR_NO_DEVICE;
+    case EPIPE:
+      return LIBUSB_ERROR_PIPE;
+    case ETIMEDOUT:
+      return LIBUSB_ERROR_TIMEOUT;
+    case EACCES:
+    case EPERM:
+      return LIBUSB_ERROR_ACCESS;
+    case EBUSY:
+      return LIBUSB_ERROR_BUSY;
+    case EINVAL:
+      return LIBUSB_ERROR_INVALID_PARAM;
+    case ENOMEM:
+      return LIBUSB_ERROR_NO_MEM;
+    default:
+      return LIBUSB_ERROR_IO;
+  }
+}
+
+CLSPCompletion completed(ssize_t ret, int length) {
+  if (ret < 0) {
+    return CLSPCompletion::immediate(errnoToError(errno));
+  }
+
+  return CLSPCompletion::immediate(ret == length ? LIBUSB_SUCCESS
+                                                 : LIBUSB_ERROR_IO);
+}
+
+bool watch(int epoll_fd, int fd, uint32_t tag) {
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u32 = tag;
+
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+}  // namespace
+
+CLSPHidrawTransport::CLSPHidrawTransport() {
+  this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (this->epoll_fd < 0 || this->wake_fd < 0 ||
+      !watch(this->epoll_fd, this->wake_fd, EVENT_WAKE)) {
+    if (this->epoll_fd >= 0) {
+      ::close(this->epoll_fd);
+    }
+    if (this->wake_fd >= 0) {
+      ::close(this->wake_fd);
+    }
+    throw std::runtime_error("Unable to create the hidraw event descriptors");
+  }
+
+  // udev creates the node, then sets its permissions
+  this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (this->inotify_fd >= 0 &&
+      (inotify_add_watch(this->inotify_fd, DEV_DIR, IN_CREATE | IN_ATTRIB) <
+           0 ||
+       !watch(this->epoll_fd, this->inotify_fd, EVENT_DEVICES))) {
+    ::close(this->inotify_fd);
+    this->inotify_fd = -1;
+  }
+
+  this->thread = std::thread(&CLSPHidrawTransport::run, this);
+}
+
+CLSPHidrawTransport::~CLSPHidrawTransport() {
+  this->stopping = true;
+
+  eventfd_write(this->wake_fd, 1);
+  this->thread.join();
+
+  close();
+
+  if (this->inotify_fd >= 0) {
+    ::close(this->inotify_fd);
+  }
+  ::close(this->wake_fd);
+  ::close(this->epoll_fd);
+}
+
+CLSPDeviceInfo CLSPHidrawTransport::open(const std::string& device_id) {
+  close();
+
+  std::vector<HidrawNode> nodes = scanNodes();
+
+  for (const HidrawNode& main : nodes) {
+    if (main.interface != 0 ||
+        !(device_id.empty() || device_id == main.info.serial ||
+          device_id == main.info.path)) {
+      continue;
+    }
+
+    const HidrawNode* fx = nullptr;
+    for (const HidrawNode& node : nodes) {
+      if (node.interface == 1 && node.info.path == main.info.path) {
+        fx = &node;
+      }
+    }
+
+    // Not created yet right after a re-attach
+    if (fx == nullptr) {
+      continue;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(this->fd_mutex);
+
+    this->fds[0] = ::open(main.node.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    this->fds[1] = ::open(fx->node.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    if (this->fds[0] < 0 || this->fds[1] < 0 ||
+        !watch(this->epoll_fd, this->fds[0], EVENT_INPUT)) {
+      lock.unlock();
+      close();
+      throw std::runtime_error("Unable to open the hidraw nodes of device");
+    }
+
+    {
+      std::lock_guard<std::mutex> input_lock(this->input_mutex);
+      this->reading = true;
+    }
+
+    return main.info;
+  }
+
+  throw std::runtime_error("Unable to open device");
+}
+
+void CLSPHidrawTransport::close() {
+  {
+    std::unique_lock<std::shared_mutex> lock(this->fd_mutex);
+
+    for (int& fd : this->fds) {
+      if (fd >= 0) {
+        // Also removes it from the epoll set
+        ::close(fd);
+        fd = -1;
+      }
+    }
+  }
+
+  inputStopped(false);
+}
+
+CLSPCompletion CLSPHidrawTransport::writeReport(int interface,
+                                                const unsigned char* report,
+                                                int length) {
+  if (interface < 0 || interface >= INTERFACE_COUNT) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_INVALID_PARAM);
+  }
+
+  std::shared_lock<std::shared_mutex> lock(this->fd_mutex);
+
+  int fd = this->fds[interface];
+  if (fd < 0) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_NO_DEVICE);
+  }
+
+  // Returns once the report is on the interrupt endpoint
+  return completed(::write(fd, report, length), length);
+}
+
+CLSPCompletion CLSPHidrawTransport::writeReservedReport(
+    int interface, const unsigned char* report, int length) {
+  // No priority path: the write waits for the one in progress on another
+  // thread, see reservedReportsWait()
+  return writeReport(interface, report, length);
+}
+
+CLSPCompletion CLSPHidrawTransport::setFeature(int interface,
+                                               const unsigned char* report,
+                                               int length) {
+  if (interface < 0 || interface >= INTERFACE_COUNT) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_INVALID_PARAM);
+  }
+
+  std::shared_lock<std::shared_mutex> lock(this->fd_mutex);
+
+  int fd = this->fds[interface];
+  if (fd < 0) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_NO_DEVICE);
+  }
+
+  return completed(
+      ioctl(fd, HIDIOCSFEATURE(length), const_cast<unsigned char*>(report)),
+      length);
+}
+
+CLSPCompletion CLSPHidrawTransport::getFeature(int interface,
+                                               unsigned char* report,
+                                               int length) {
+  if (interface < 0 || interface >= INTERFACE_COUNT) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_INVALID_PARAM);
+  }
+
+  std::shared_lock<std::shared_mutex> lock(this->fd_mutex);
+
+  int fd = this->fds[interface];
+  if (fd < 0) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_NO_DEVICE);
+  }
+
+  // The device may answer with a shorter report
+  ssize_t ret = ioctl(fd, HIDIOCGFEATURE(length), report);
+
+  return completed(ret, ret < 0 ? length : ret);
+}
+
+int CLSPHidrawTransport::reportDescriptor(int interface,
+                                          std::vector<uint8_t>& descriptor) {
+  if (interface < 0 || interface >= INTERFACE_COUNT) {
+    return LIBUSB_ERROR_INVALID_PARAM;
+  }
+
+  std::shared_lock<std::shared_mutex> lock(this->fd_mutex);
+
+  int fd = this->fds[interface];
+  if (fd < 0) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+
+  // Kept by the kernel since the enumeration, no transfer
+  struct hidraw_report_descriptor report_descriptor;
+  int size = 0;
+
+  if (ioctl(fd, HIDIOCGRDESCSIZE, &size) < 0) {
+    return errnoToError(errno);
+  }
+  if (size > HID_MAX_DESCRIPTOR_SIZE) {
+    return LIBUSB_ERROR_OVERFLOW;
+  }
+
+  report_descriptor.size = size;
+  if (ioctl(fd, HIDIOCGRDESC, &report_descriptor) < 0) {
+    return errnoToError(errno);
+  }
+
+  descriptor.assign(report_descriptor.value, report_descriptor.value + size);
+
+  return LIBUSB_SUCCESS;
+}
+
+void CLSPHidrawTransport::setInputHandler(InputHandler handler) {
+  this->input_handler = std::move(handler);
+}
+
+bool CLSPHidrawTransport::waitInput(uint64_t sequence,
+                                    unsigned int timeout) {
+  std::unique_lock<std::mutex> lock(this->input_mutex);
+
+  auto done = [this, sequence] {
+    return this->input_state.read().sequence > sequence || !this->reading;
+  };
+
+  if (timeout == 0) {
+    this->input_cv.wait(lock, done);
+  } else {
+    this->input_cv.wait_for(lock, std::chrono::milliseconds(timeout), done);
+  }
+
+  return this->input_state.read().sequence > sequence;
+}
+
+std::vector<CLSPDeviceInfo> CLSPHidrawTransport::listDevices() {
+  std::vector<CLSPDeviceInfo> devices;
+
+  for (const HidrawNode& node : scanNodes()) {
+    if (node.interface == 0) {
+      devices.push_back(node.info);
+    }
+  }
+
+  return devices;
+}
+
+bool CLSPHidrawTransport::watchHotplug(HotplugHandler handler) {
+  if (this->inotify_fd < 0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(this->hotplug_mutex);
+  this->hotplug_handler = std::move(handler);
+
+  return true;
+}
+
+void CLSPHidrawTransport::unwatchHotplug() {
+  std::lock_guard<std::mutex> lock(this->hotplug_mutex);
+  this->hotplug_handler = nullptr;
+}
+
+CLSPPoolStats CLSPHidrawTransport::poolStats(int /* endpoint */) {
+  // The kernel queues the reports
+  return CLSPPoolStats();
+}
+
+CLSPRealtimeStatus CLSPHidrawTransport::setRealtimeProfile(
+    const CLSPRealtimeProfile& profile) {
+  // The reports are written by the callers, only the input reads run on the
+  // epoll thread
+  CLSPRealtimeStatus status =
+      clspApplyRealtime(this->thread.native_handle(), profile);
+
+  if (profile.prefault_stack) {
+    this->prefault_pending = true;
+    eventfd_write(this->wake_fd, 1);
+  }
+
+  return status;
+}
+
+void CLSPHidrawTransport::run() {
+  struct epoll_event events[4];
+
+  while (!this->stopping) {
+    if (this->prefault_pending.exchange(false)) {
+      clspPrefaultStack();
+    }
+
+    int count = epoll_wait(this->epoll_fd, events, 4, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+
+    for (int i = 0; i < count; i++) {
+      switch (events[i].data.u32) {
+        case EVENT_WAKE: {
+          eventfd_t value;
+          eventfd_read(this->wake_fd, &value);
+          break;
+        }
+        case EVENT_DEVICES:
+          readDeviceEvents();
+          break;
+        case EVENT_INPUT:
+          readInput();
+          break;
+      }
+    }
+  }
+}
+
+void CLSPHidrawTransport::readInput() {
+  bool detached = false;
+
+  {
+    std::shared_lock<std::shared_mutex> lock(this->fd_mutex);
+
+    // Closed after the event was queued
+    int fd = this->fds[0];
+    if (fd < 0) {
+      return;
+    }
+
+    unsigned char buffer[BUFFER_SIZE];
+
+    while (true) {
+      ssize_t length = ::read(fd, buffer, sizeof(buffer));
+
+      if (length <= 0) {
+        // The node fails every read once the stick is unplugged
+        detached = length < 0 && errno != EAGAIN && errno != EINTR;
+        break;
+      }
+
+      if (this->input_handler) {
+        this->input_handler(buffer, length);
+      }
+
+      CLSPInputSample sample;
+      if (!clspDecodeInput(buffer, length, sample)) {
+        continue;
+      }
+
+      sample.sequence = ++this->sequence;
+      sample.timestamp_ns = clspMonotonicNs();
+
+      this->input_state.publish(sample);
+
+      // Empty critical section, orders the wake-up after the waiters' check
+      { std::lock_guard<std::mutex> input_lock(this->input_mutex); }
+      this->input_cv.notify_all();
+    }
+
+    if (detached) {
+      // Level-triggered, would wake the loop until closed
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+  }
+
+  if (detached) {
+    inputStopped(true);
+  }
+}
+
+void CLSPHidrawTransport::inputStopped(bool detached) {
+  {
+    std::lock_guard<std::mutex> lock(this->input_mutex);
+    this->reading = false;
+  }
+  this->input_cv.notify_all();
+
+  if (detached) {
+    notifyHotplug(false);
+  }
+}
+
+void CLSPHidrawTransport::readDeviceEvents() {
+  alignas(struct inotify_event) char buffer[4096];
+  bool attached = false;
+
+  ssize_t length;
+  while ((length = ::read(this->inotify_fd, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t offset = 0; offset < length;) {
+      auto event = reinterpret_cast<struct inotify_event*>(buffer + offset);
+
+      // Any hidraw node, the handler checks which stick it belongs to
+      if (event->len > 0 && std::strncmp(event->name, "hidraw", 6) == 0) {
+        attached = true;
+      }
+
+      offset += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  if (attached) {
+    notifyHotplug(true);
+  }
+}
+
+void CLSPHidrawTransport::notifyHotplug(bool attached) {
+  std::lock_guard<std::mutex> lock(this->hotplug_mutex);
+
+  if (this->hotplug_handler) {
+    this->hotplug_handler(attached);
+  }
+}
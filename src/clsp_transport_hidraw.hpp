@@ -0,0 +1,109 @@
+#ifndef CLS_P_TRANSPORT_HIDRAW_HPP
+#define CLS_P_TRANSPORT_HIDRAW_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+#include "clsp_transport.hpp"
+
+/**
+ * Transport writing to the /dev/hidrawN nodes of both interfaces. The kernel
+ * HID driver stays bound, so the stick keeps its joystick event device.
+ *
+ * The reports are sent synchronously: write() for the output reports,
+ * HIDIOCSFEATURE/HIDIOCGFEATURE for the feature reports, and the returned
+ * handles are already completed. The kernel serializes the writes, so a
+ * reserved report waits for a write in progress on another thread. A single
+ * epoll thread reads the input reports and watches /dev for re-attached
+ * sticks.
+ */
+class CLSPHidrawTransport : public CLSPTransport {
+ public:
+  /**
+   * Starts the epoll thread
+   * @throw std::runtime_error if the epoll or wake-up descriptors cannot be
+   * created
+   */
+  CLSPHidrawTransport();
+
+  /**
+   * Stops the epoll thread and closes the stick
+   */
+  ~CLSPHidrawTransport() override;
+
+  CLSPHidrawTransport(const CLSPHidrawTransport&) = delete;
+  CLSPHidrawTransport& operator=(const CLSPHidrawTransport&) = delete;
+
+  CLSPDeviceInfo open(const std::string& device_id) override;
+  void close() override;
+
+  CLSPCompletion writeReport(int interface, const unsigned char* report,
+                             int length) override;
+  CLSPCompletion writeReservedReport(int interface,
+                                     const unsigned char* report,
+                                     int length) override;
+  // The kernel serializes the writes of all the threads
+  bool reservedReportsWait() const override { return true; }
+  CLSPCompletion setFeature(int interface, const unsigned char* report,
+                            int length) override;
+  CLSPCompletion getFeature(int interface, unsigned char* report,
+                            int length) override;
+  int reportDescriptor(int interface,
+                       std::vector<uint8_t>& descriptor) override;
+
+  const CLSPInputState& input() const override { return this->input_state; }
+  void setInputHandler(InputHandler handler) override;
+  bool waitInput(uint64_t sequence, unsigned int timeout) override;
+
+  std::vector<CLSPDeviceInfo> listDevices() override;
+
+  bool watchHotplug(HotplugHandler handler) override;
+  void unwatchHotplug() override;
+
+  CLSPPoolStats poolStats(int endpoint) override;
+
+  CLSPRealtimeStatus setRealtimeProfile(
+      const CLSPRealtimeProfile& profile) override;
+
+ private:
+  static const int INTERFACE_COUNT = 2;
+
+  // Larger than any input report of the interface
+  static const int BUFFER_SIZE = 64;
+
+  // One descriptor per interface, -1 while closed. Held shared by the
+  // reports and the input reads, exclusively while (re)opened or closed.
+  std::shared_mutex fd_mutex;
+  int fds[INTERFACE_COUNT] = {-1, -1};
+
+  int epoll_fd = -1;
+  int wake_fd = -1;
+  int inotify_fd = -1;
+
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> prefault_pending{false};
+
+  // Held while a hotplug handler runs
+  std::mutex hotplug_mutex;
+  HotplugHandler hotplug_handler;
+
+  // Latest input report 1, decoded on the epoll thread
+  CLSPInputState input_state;
+  InputHandler input_handler;
+  uint64_t sequence = 0;
+  std::mutex input_mutex;
+  std::condition_variable input_cv;
+  bool reading = false;
+
+  void run();
+  void readInput();
+  void inputStopped(bool detached);
+  void readDeviceEvents();
+  void notifyHotplug(bool attached);
+};
+
+#endif
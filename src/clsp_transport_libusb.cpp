@@ -0,0 +1,207 @@
+#include "clsp_transport_libusb.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+CLSPLibusbTransport::CLSPLibusbTransport(
+    std::shared_ptr<CLSPUsbContext> context)
+    : usb_context(context ? std::move(context) : CLSPUsbContext::shared()) {
+  this->transfers = std::make_unique<CLSPTransferEngine>(this->usb_context);
+  this->input_reader = std::make_unique<CLSPInputReader>(
+      nullptr, IN_ENDPOINT_MAIN, this->input_state);
+}
+
+CLSPLibusbTransport::~CLSPLibusbTransport() {
+  unwatchHotplug();
+
+  close();
+
+  this->input_reader.reset();
+  this->transfers.reset();
+}
+
+CLSPDeviceInfo CLSPLibusbTransport::open(const std::string& device_id) {
+  CLSPDeviceInfo info;
+
+  this->usb_handle = this->usb_context->openDevice(VENDOR_ID, PRODUCT_ID,
+                                                   device_id, &info);
+  if (this->usb_handle == nullptr) {
+    throw std::runtime_error("Unable to open device");
+  }
+
+  this->usb_device = libusb_get_device(this->usb_handle);
+
+  // N.B.: Needs to be supported by the OS
+  if (libusb_set_auto_detach_kernel_driver(this->usb_handle, true) < 0) {
+    throw std::runtime_error("Unable to auto detach kernel driver");
+  }
+
+  // Fails if another instance drives the same stick
+  if (libusb_claim_interface(this->usb_handle, INTERFACE_MAIN) < 0 ||
+      libusb_claim_interface(this->usb_handle, INTERFACE_FX) < 0) {
+    throw std::runtime_error("Unable to claim device interfaces");
+  }
+
+  if (!this->pools_created) {
+    this->transfers->addPool(this->usb_handle, OUT_ENDPOINT_MAIN,
+                             POOL_SIZE_MAIN, REPORT_SIZE_MAIN);
+    this->transfers->addPool(this->usb_handle, OUT_ENDPOINT_FX, POOL_SIZE_FX,
+                             REPORT_SIZE_FX);
+    this->transfers->addPool(this->usb_handle, CONTROL_ENDPOINT,
+                             POOL_SIZE_CONTROL,
+                             LIBUSB_CONTROL_SETUP_SIZE + REPORT_SIZE_FX);
+    this->pools_created = true;
+  } else {
+    this->transfers->rebind(this->usb_handle);
+  }
+
+  if (this->input_reader->restart(this->usb_handle) < 0) {
+    throw std::runtime_error("Unable to start input reader");
+  }
+
+  return info;
+}
+
+void CLSPLibusbTransport::close() {
+  this->input_reader->stop();
+
+  // Fails the transfers still queued, the reports sent until the next
+  // re-attach fail right away
+  this->transfers->rebind(nullptr);
+
+  if (this->usb_handle == nullptr) {
+    return;
+  }
+
+  libusb_release_interface(this->usb_handle, INTERFACE_MAIN);
+  libusb_release_interface(this->usb_handle, INTERFACE_FX);
+  libusb_close(this->usb_handle);
+
+  this->usb_handle = nullptr;
+  this->usb_device = nullptr;
+}
+
+CLSPCompletion CLSPLibusbTransport::writeReport(int interface,
+                                                const unsigned char* report,
+                                                int length) {
+  int endpoint =
+      interface == INTERFACE_FX ? OUT_ENDPOINT_FX : OUT_ENDPOINT_MAIN;
+
+  return this->transfers->submitInterrupt(endpoint, report, length, TIMEOUT);
+}
+
+CLSPCompletion CLSPLibusbTransport::writeReservedReport(
+    int interface, const unsigned char* report, int length) {
+  int endpoint =
+      interface == INTERFACE_FX ? OUT_ENDPOINT_FX : OUT_ENDPOINT_MAIN;
+
+  return this->transfers->submitReservedInterrupt(endpoint, report, length,
+                                                  TIMEOUT);
+}
+
+CLSPCompletion CLSPLibusbTransport::setFeature(int interface,
+                                               const unsigned char* report,
+                                               int length) {
+  // SET_REPORT, feature report type
+  return this->transfers->submitControl(0x21, 0x09, 0x0300 | report[0],
+                                        interface, report, length, TIMEOUT);
+}
+
+CLSPCompletion CLSPLibusbTransport::getFeature(int interface,
+                                               unsigned char* report,
+                                               int length) {
+  // GET_REPORT, feature report type
+  return this->transfers->submitControlRead(0xa1, 0x01, 0x0300 | report[0],
+                                            interface, report, length,
+                                            TIMEOUT);
+}
+
+int CLSPLibusbTransport::reportDescriptor(int interface,
+                                          std::vector<uint8_t>& descriptor) {
+  if (this->usb_handle == nullptr) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+
+  descriptor.resize(DESCRIPTOR_SIZE);
+
+  // Too large for the control pool, read once per open
+  int ret = libusb_control_transfer(
+      this->usb_handle, LIBUSB_ENDPOINT_IN | LIBUSB_RECIPIENT_INTERFACE,
+      LIBUSB_REQUEST_GET_DESCRIPTOR, LIBUSB_DT_REPORT << 8, interface,
+      descriptor.data(), descriptor.size(), DESCRIPTOR_TIMEOUT);
+
+  descriptor.resize(std::max(ret, 0));
+
+  return std::min(ret, 0);
+}
+
+void CLSPLibusbTransport::setInputHandler(InputHandler handler) {
+  this->input_reader->setHandler(std::move(handler));
+}
+
+bool CLSPLibusbTransport::waitInput(uint64_t sequence,
+                                    unsigned int timeout) {
+  return this->input_reader->waitNewer(sequence, timeout);
+}
+
+std::vector<CLSPDeviceInfo> CLSPLibusbTransport::listDevices() {
+  return this->usb_context->listDevices(VENDOR_ID, PRODUCT_ID);
+}
+
+bool CLSPLibusbTransport::watchHotplug(HotplugHandler handler) {
+  if (this->hotplug_registered ||
+      !libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+    return false;
+  }
+
+  this->hotplug_handler = std::move(handler);
+
+  int events =
+      LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT;
+  this->hotplug_registered =
+      libusb_hotplug_register_callback(
+          this->usb_context->get(), static_cast<libusb_hotplug_event>(events),
+          LIBUSB_HOTPLUG_NO_FLAGS, VENDOR_ID, PRODUCT_ID,
+          LIBUSB_HOTPLUG_MATCH_ANY, &CLSPLibusbTransport::onHotplug, this,
+          &this->hotplug_handle) == LIBUSB_SUCCESS;
+
+  return this->hotplug_registered;
+}
+
+void CLSPLibusbTransport::unwatchHotplug() {
+  if (!this->hotplug_registered) {
+    return;
+  }
+
+  // Serialised with the callbacks by libusb
+  libusb_hotplug_deregister_callback(this->usb_context->get(),
+                                     this->hotplug_handle);
+  this->hotplug_registered = false;
+}
+
+CLSPPoolStats CLSPLibusbTransport::poolStats(int endpoint) {
+  return this->transfers->poolStats(endpoint);
+}
+
+CLSPRealtimeStatus CLSPLibusbTransport::setRealtimeProfile(
+    const CLSPRealtimeProfile& profile) {
+  // The transfers complete on the event thread of the context
+  return this->usb_context->setRealtimeProfile(profile);
+}
+
+int LIBUSB_CALL CLSPLibusbTransport::onHotplug(libusb_context* /* context */,
+                                               libusb_device* device,
+                                               libusb_hotplug_event event,
+                                               void* user_data) {
+  auto transport = static_cast<CLSPLibusbTransport*>(user_data);
+
+  if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+    transport->hotplug_handler(true);
+  } else if (device == transport->usb_device) {
+    // Another stick with the same IDs may come and go
+    transport->hotplug_handler(false);
+  }
+
+  // Stay registered
+  return 0;
+}
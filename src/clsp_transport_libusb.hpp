@@ -0,0 +1,110 @@
+#ifndef CLS_P_TRANSPORT_LIBUSB_HPP
+#define CLS_P_TRANSPORT_LIBUSB_HPP
+
+#include <libusb-1.0/libusb.h>
+
+#include <atomic>
+#include <memory>
+
+#include "clsp_transport.hpp"
+
+/**
+ * Transport claiming both interfaces through libusb. The kernel driver is
+ * detached while the stick is open; the reports are pooled asynchronous
+ * transfers completed on the event thread of the libusb context.
+ */
+class CLSPLibusbTransport : public CLSPTransport {
+ public:
+  /**
+   * @param context libusb context, NULL for the process-wide one
+   */
+  explicit CLSPLibusbTransport(std::shared_ptr<CLSPUsbContext> context);
+
+  ~CLSPLibusbTransport() override;
+
+  CLSPLibusbTransport(const CLSPLibusbTransport&) = delete;
+  CLSPLibusbTransport& operator=(const CLSPLibusbTransport&) = delete;
+
+  CLSPDeviceInfo open(const std::string& device_id) override;
+  void close() override;
+
+  CLSPCompletion writeReport(int interface, const unsigned char* report,
+                             int length) override;
+  CLSPCompletion writeReservedReport(int interface,
+                                     const unsigned char* report,
+                                     int length) override;
+  bool reservedReportsWait() const override { return false; }
+  CLSPCompletion setFeature(int interface, const unsigned char* report,
+                            int length) override;
+  CLSPCompletion getFeature(int interface, unsigned char* report,
+                            int length) override;
+  int reportDescriptor(int interface,
+                       std::vector<uint8_t>& descriptor) override;
+
+  const CLSPInputState& input() const override { return this->input_state; }
+  void setInputHandler(InputHandler handler) override;
+  bool waitInput(uint64_t sequence, unsigned int timeout) override;
+
+  std::vector<CLSPDeviceInfo> listDevices() override;
+
+  bool watchHotplug(HotplugHandler handler) override;
+  void unwatchHotplug() override;
+
+  CLSPPoolStats poolStats(int endpoint) override;
+
+  CLSPRealtimeStatus setRealtimeProfile(
+      const CLSPRealtimeProfile& profile) override;
+
+ private:
+  const int INTERFACE_MAIN = 0;
+  const int INTERFACE_FX = 1;
+
+  const int OUT_ENDPOINT_MAIN = 0x01;
+  const int OUT_ENDPOINT_FX = 0x02;
+
+  const int IN_ENDPOINT_MAIN = 0x81;
+
+  const int CONTROL_ENDPOINT = 0x00;
+
+  // Largest report sent on each endpoint, in bytes
+  const int REPORT_SIZE_MAIN = 16;
+  const int REPORT_SIZE_FX = 64;
+
+  // Pre-allocated transfers per endpoint
+  const int POOL_SIZE_MAIN = 32;
+  const int POOL_SIZE_FX = 32;
+  const int POOL_SIZE_CONTROL = 4;
+
+  // Xfer timeout in ms (0 = inf)
+  const int TIMEOUT = 0;
+
+  // Report descriptor read, synchronous, in ms
+  const int DESCRIPTOR_TIMEOUT = 1000;
+  // Largest report descriptor accepted, as HID_MAX_DESCRIPTOR_SIZE
+  const int DESCRIPTOR_SIZE = 4096;
+
+  // Shared with the other transports of the same context
+  std::shared_ptr<CLSPUsbContext> usb_context;
+
+  libusb_device_handle* usb_handle = nullptr;
+  std::atomic<libusb_device*> usb_device{nullptr};
+  bool pools_created = false;
+
+  std::unique_ptr<CLSPTransferEngine> transfers;
+
+  // Latest input report 1, decoded on the event thread
+  CLSPInputState input_state;
+  std::unique_ptr<CLSPInputReader> input_reader;
+
+  // Hotplug events, delivered on the event thread
+  libusb_hotplug_callback_handle hotplug_handle = 0;
+  bool hotplug_registered = false;
+  HotplugHandler hotplug_handler;
+
+  static int LIBUSB_CALL onHotplug(libusb_context* context,
+                                   libusb_device* device,
+                                   libusb_hotplug_event event,
+                                   void* user_data);
+};
+
+#endif
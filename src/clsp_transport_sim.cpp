@@ -0,0 +1,948 @@
+#include "clsp_transport_sim.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "clsp_clock.hpp"
+
+namespace {
+
+// Output reports, interface 0
+const uint8_t REPORT_SET_EFFECT = 0x01;
+const uint8_t REPORT_ENVELOPE = 0x02;
+const uint8_t REPORT_CONDITION = 0x03;
+const uint8_t REPORT_PERIODIC = 0x04;
+const uint8_t REPORT_CONSTANT = 0x05;
+const uint8_t REPORT_RAMP = 0x06;
+const uint8_t REPORT_CUSTOM_DATA = 0x07;
+const uint8_t REPORT_FORCE_SAMPLE = 0x08;
+const uint8_t REPORT_EFFECT_OPERATION = 0x0a;
+const uint8_t REPORT_BLOCK_FREE = 0x0b;
+const uint8_t REPORT_DEVICE_CONTROL = 0x0c;
+const uint8_t REPORT_DEVICE_GAIN = 0x0d;
+const uint8_t REPORT_CUSTOM_FORCE = 0x0e;
+
+// Feature reports, interface 0
+const uint8_t FEATURE_CREATE_EFFECT = 0x01;
+const uint8_t FEATURE_BLOCK_LOAD = 0x02;
+const uint8_t FEATURE_PID_POOL = 0x03;
+
+// Input report 1
+const uint8_t REPORT_INPUT = 0x01;
+const int REPORT_INPUT_SIZE = 7;
+
+// Effect Operation array
+const uint8_t OP_START = 0x01;
+const uint8_t OP_START_SOLO = 0x02;
+const uint8_t OP_STOP = 0x03;
+
+// Device Control array
+const uint8_t CONTROL_ENABLE_ACTUATORS = 0x01;
+const uint8_t CONTROL_DISABLE_ACTUATORS = 0x02;
+const uint8_t CONTROL_STOP_ALL = 0x03;
+const uint8_t CONTROL_RESET = 0x04;
+const uint8_t CONTROL_PAUSE = 0x05;
+const uint8_t CONTROL_CONTINUE = 0x06;
+
+// Block Load status array
+const uint8_t BLOCK_LOAD_SUCCESS = 0x01;
+const uint8_t BLOCK_LOAD_FULL = 0x02;
+const uint8_t BLOCK_LOAD_ERROR = 0x03;
+
+// Effect types of the Set Effect and Create New Effect reports
+const uint8_t FIRST_EFFECT_TYPE = 0x01;
+const uint8_t LAST_EFFECT_TYPE = 0x0c;
+
+const uint8_t INFINITE_LOOPS = 0xff;
+const uint16_t INFINITE_DURATION = 0xffff;
+
+// RAM taken by the parameter blocks of an effect, besides its custom data
+const int BLOCK_BYTES = 32;
+
+// Same sizes as the libusb pools
+const int REPORT_SIZE_MAIN = 16;
+const int REPORT_SIZE_FX = 64;
+const int POOL_SIZE_MAIN = 32;
+const int POOL_SIZE_FX = 32;
+const int POOL_SIZE_CONTROL = 4;
+
+// The stick draws a circle of half the axis range every 4 s
+const double CIRCLE_HZ = 0.25;
+const double CIRCLE_RADIUS = 16384.0;
+const double AXIS_CENTER = 32768.0;
+
+// Report descriptor of interface 0, as in doc/report descriptor
+const uint8_t REPORT_DESCRIPTOR[] = {
+    0x05, 0x01, 0x09, 0x04, 0xa1, 0x01, 0x85, 0x01, 0x05, 0x09, 0x19, 0x01,
+    0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x36, 0x00, 0x00, 0x46, 0x01, 0x00,
+    0x75, 0x01, 0x95, 0x05, 0x81, 0x02, 0x75, 0x03, 0x95, 0x01, 0x81, 0x03,
+    0x05, 0x01, 0x09, 0x39, 0x15, 0x01, 0x25, 0x08, 0x36, 0x00, 0x00, 0x46,
+    0x3b, 0x01, 0x66, 0x14, 0x00, 0x55, 0x00, 0x75, 0x04, 0x95, 0x01, 0x81,
+    0x42, 0x75, 0x04, 0x95, 0x01, 0x81, 0x03, 0x05, 0x01, 0x15, 0x00, 0x26,
+    0xff, 0xff, 0x36, 0x00, 0x00, 0x46, 0xff, 0xff, 0x65, 0x00, 0x09, 0x30,
+    0x75, 0x10, 0x95, 0x01, 0x81, 0x02, 0x09, 0x31, 0x75, 0x10, 0x95, 0x01,
+    0x81, 0x02, 0x05, 0x0f, 0x09, 0x92, 0xa1, 0x02, 0x85, 0x02, 0x09, 0x9f,
+    0x09, 0xa0, 0x09, 0xa4, 0x09, 0xa5, 0x09, 0xa6, 0x15, 0x00, 0x25, 0x01,
+    0x35, 0x00, 0x45, 0x01, 0x75, 0x01, 0x95, 0x05, 0x81, 0x02, 0x95, 0x03,
+    0x81, 0x03, 0x09, 0x94, 0x15, 0x00, 0x25, 0x01, 0x35, 0x00, 0x45, 0x01,
+    0x75, 0x01, 0x95, 0x01, 0x81, 0x02, 0x09, 0x22, 0x15, 0x01, 0x25, 0x28,
+    0x35, 0x01, 0x45, 0x28, 0x75, 0x07, 0x95, 0x01, 0x81, 0x02, 0xc0, 0x09,
+    0x21, 0xa1, 0x02, 0x85, 0x01, 0x09, 0x22, 0x15, 0x01, 0x25, 0x28, 0x35,
+    0x01, 0x45, 0x28, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0x09, 0x25, 0xa1,
+    0x02, 0x09, 0x26, 0x09, 0x27, 0x09, 0x30, 0x09, 0x31, 0x09, 0x32, 0x09,
+    0x33, 0x09, 0x34, 0x09, 0x40, 0x09, 0x41, 0x09, 0x42, 0x09, 0x43, 0x09,
+    0x28, 0x25, 0x0c, 0x15, 0x01, 0x35, 0x01, 0x45, 0x0c, 0x75, 0x08, 0x95,
+    0x01, 0x91, 0x00, 0xc0, 0x09, 0x50, 0x09, 0x54, 0x09, 0x51, 0x15, 0x00,
+    0x26, 0xff, 0x7f, 0x35, 0x00, 0x46, 0xff, 0x7f, 0x66, 0x03, 0x10, 0x55,
+    0xfd, 0x75, 0x10, 0x95, 0x03, 0x91, 0x02, 0x55, 0x00, 0x66, 0x00, 0x00,
+    0x09, 0x52, 0x15, 0x00, 0x26, 0xff, 0x00, 0x35, 0x00, 0x46, 0x10, 0x27,
+    0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0x09, 0x53, 0x15, 0x01, 0x25, 0x08,
+    0x35, 0x01, 0x45, 0x08, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0x09, 0x55,
+    0xa1, 0x02, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x02, 0x91, 0x02, 0xc0, 0x05, 0x0f, 0x09, 0x56, 0x95,
+    0x01, 0x91, 0x02, 0x95, 0x05, 0x91, 0x03, 0x09, 0x57, 0xa1, 0x02, 0x0b,
+    0x01, 0x00, 0x0a, 0x00, 0x0b, 0x02, 0x00, 0x0a, 0x00, 0x66, 0x14, 0x00,
+    0x55, 0xfe, 0x15, 0x00, 0x26, 0xff, 0x00, 0x35, 0x00, 0x47, 0xa0, 0x8c,
+    0x00, 0x00, 0x66, 0x00, 0x00, 0x75, 0x08, 0x95, 0x02, 0x91, 0x02, 0x55,
+    0x00, 0x66, 0x00, 0x00, 0xc0, 0x05, 0x0f, 0x09, 0xa7, 0x66, 0x03, 0x10,
+    0x55, 0xfd, 0x15, 0x00, 0x26, 0xff, 0x7f, 0x35, 0x00, 0x46, 0xff, 0x7f,
+    0x75, 0x10, 0x95, 0x01, 0x91, 0x02, 0x66, 0x00, 0x00, 0x55, 0x00, 0xc0,
+    0x05, 0x0f, 0x09, 0x5a, 0xa1, 0x02, 0x85, 0x02, 0x09, 0x22, 0x15, 0x01,
+    0x25, 0x28, 0x35, 0x01, 0x45, 0x28, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02,
+    0x09, 0x5b, 0x09, 0x5d, 0x15, 0x00, 0x26, 0xff, 0x00, 0x35, 0x00, 0x46,
+    0x10, 0x27, 0x95, 0x02, 0x91, 0x02, 0x09, 0x5c, 0x09, 0x5e, 0x66, 0x03,
+    0x10, 0x55, 0xfd, 0x26, 0xff, 0x7f, 0x46, 0xff, 0x7f, 0x75, 0x10, 0x91,
+    0x02, 0x45, 0x00, 0x66, 0x00, 0x00, 0x55, 0x00, 0xc0, 0x09, 0x5f, 0xa1,
+    0x02, 0x85, 0x03, 0x09, 0x22, 0x15, 0x01, 0x25, 0x28, 0x35, 0x01, 0x45,
+    0x28, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0x09, 0x23, 0x15, 0x00, 0x25,
+    0x01, 0x35, 0x00, 0x45, 0x01, 0x75, 0x04, 0x95, 0x01, 0x91, 0x02, 0x09,
+    0x58, 0xa1, 0x02, 0x0b, 0x01, 0x00, 0x0a, 0x00, 0x0b, 0x02, 0x00, 0x0a,
+    0x00, 0x75, 0x02, 0x95, 0x02, 0x91, 0x02, 0xc0, 0x15, 0x80, 0x25, 0x7f,
+    0x36, 0xf0, 0xd8, 0x46, 0x10, 0x27, 0x09, 0x60, 0x75, 0x08, 0x95, 0x01,
+    0x91, 0x02, 0x36, 0xf0, 0xd8, 0x46, 0x10, 0x27, 0x09, 0x61, 0x09, 0x62,
+    0x95, 0x02, 0x91, 0x02, 0x15, 0x00, 0x26, 0xff, 0x00, 0x35, 0x00, 0x46,
+    0x10, 0x27, 0x09, 0x63, 0x09, 0x64, 0x75, 0x08, 0x95, 0x02, 0x91, 0x02,
+    0x09, 0x65, 0x46, 0x10, 0x27, 0x95, 0x01, 0x91, 0x02, 0xc0, 0x09, 0x6e,
+    0xa1, 0x02, 0x85, 0x04, 0x09, 0x22, 0x15, 0x01, 0x25, 0x28, 0x35, 0x01,
+    0x45, 0x28, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0x09, 0x70, 0x15, 0x00,
+    0x26, 0xff, 0x00, 0x35, 0x00, 0x46, 0x10, 0x27, 0x75, 0x08, 0x95, 0x01,
+    0x91, 0x02, 0x09, 0x6f, 0x15, 0x80, 0x25, 0x7f, 0x36, 0xf0, 0xd8, 0x46,
+    0x10, 0x27, 0x95, 0x01, 0x91, 0x02, 0x09, 0x71, 0x66, 0x14, 0x00, 0x55,
+    0xfe, 0x15, 0x00, 0x26, 0xff, 0x00, 0x35, 0x00, 0x47, 0xa0, 0x8c, 0x00,
+    0x00, 0x91, 0x02, 0x09, 0x72, 0x26, 0xff, 0x7f, 0x46, 0xff, 0x7f, 0x66,
+    0x03, 0x10, 0x55, 0xfd, 0x75, 0x10, 0x95, 0x01, 0x91, 0x02, 0x66, 0x00,
+    0x00, 0x55, 0x00, 0xc0, 0x09, 0x73, 0xa1, 0x02, 0x85, 0x05, 0x09, 0x22,
+    0x15, 0x01, 0x25, 0x28, 0x35, 0x01, 0x45, 0x28, 0x75, 0x08, 0x95, 0x01,
+    0x91, 0x02, 0x09, 0x70, 0x16, 0x01, 0xff, 0x26, 0xff, 0x00, 0x36, 0xf0,
+    0xd8, 0x46, 0x10, 0x27, 0x75, 0x10, 0x95, 0x01, 0x91, 0x02, 0xc0, 0x09,
+    0x74, 0xa1, 0x02, 0x85, 0x06, 0x09, 0x22, 0x15, 0x01, 0x25, 0x28, 0x35,
+    0x01, 0x45, 0x28, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0x09, 0x75, 0x09,
+    0x76, 0x15, 0x80, 0x25, 0x7f, 0x36, 0xf0, 0xd8, 0x46, 0x10, 0x27, 0x75,
+    0x08, 0x95, 0x02, 0x91, 0x02, 0xc0, 0x09, 0x68, 0xa1, 0x02, 0x85, 0x07,
+    0x09, 0x22, 0x15, 0x01, 0x25, 0x28, 0x35, 0x01, 0x45, 0x28, 0x75, 0x08,
+    0x95, 0x01, 0x91, 0x02, 0x09, 0x6c, 0x15, 0x00, 0x26, 0x10, 0x27, 0x35,
+    0x00, 0x46, 0x10, 0x27, 0x75, 0x10, 0x95, 0x01, 0x91, 0x02, 0x09, 0x69,
+    0x15, 0x81, 0x25, 0x7f, 0x35, 0x00, 0x46, 0xff, 0x00, 0x75, 0x08, 0x95,
+    0x0c, 0x92, 0x02, 0x01, 0xc0, 0x09, 0x66, 0xa1, 0x02, 0x85, 0x08, 0x05,
+    0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7f, 0x35, 0x00, 0x46,
+    0xff, 0x00, 0x75, 0x08, 0x95, 0x02, 0x91, 0x02, 0xc0, 0x05, 0x0f, 0x09,
+    0x77, 0xa1, 0x02, 0x85, 0x0a, 0x09, 0x22, 0x15, 0x01, 0x25, 0x28, 0x35,
+    0x01, 0x45, 0x28, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0x09, 0x78, 0xa1,
+    0x02, 0x09, 0x79, 0x09, 0x7a, 0x09, 0x7b, 0x15, 0x01, 0x25, 0x03, 0x75,
+    0x08, 0x95, 0x01, 0x91, 0x00, 0xc0, 0x09, 0x7c, 0x15, 0x00, 0x26, 0xff,
+    0x00, 0x35, 0x00, 0x46, 0xff, 0x00, 0x91, 0x02, 0xc0, 0x09, 0x90, 0xa1,
+    0x02, 0x85, 0x0b, 0x09, 0x22, 0x25, 0x28, 0x15, 0x01, 0x35, 0x01, 0x45,
+    0x28, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0xc0, 0x09, 0x96, 0xa1, 0x02,
+    0x85, 0x0c, 0x09, 0x97, 0x09, 0x98, 0x09, 0x99, 0x09, 0x9a, 0x09, 0x9b,
+    0x09, 0x9c, 0x15, 0x01, 0x25, 0x06, 0x75, 0x08, 0x95, 0x01, 0x91, 0x00,
+    0xc0, 0x09, 0x7d, 0xa1, 0x02, 0x85, 0x0d, 0x09, 0x7e, 0x15, 0x00, 0x26,
+    0xff, 0x00, 0x35, 0x00, 0x46, 0x10, 0x27, 0x75, 0x08, 0x95, 0x01, 0x91,
+    0x02, 0xc0, 0x09, 0x6b, 0xa1, 0x02, 0x85, 0x0e, 0x09, 0x22, 0x15, 0x01,
+    0x25, 0x28, 0x35, 0x01, 0x45, 0x28, 0x75, 0x08, 0x95, 0x01, 0x91, 0x02,
+    0x09, 0x6d, 0x15, 0x00, 0x26, 0xff, 0x00, 0x35, 0x00, 0x46, 0xff, 0x00,
+    0x75, 0x08, 0x95, 0x01, 0x91, 0x02, 0x09, 0x51, 0x66, 0x03, 0x10, 0x55,
+    0xfd, 0x15, 0x00, 0x26, 0xff, 0x7f, 0x35, 0x00, 0x46, 0xff, 0x7f, 0x75,
+    0x10, 0x95, 0x01, 0x91, 0x02, 0x55, 0x00, 0x66, 0x00, 0x00, 0xc0, 0x09,
+    0xab, 0xa1, 0x02, 0x85, 0x01, 0x09, 0x25, 0xa1, 0x02, 0x09, 0x26, 0x09,
+    0x27, 0x09, 0x30, 0x09, 0x31, 0x09, 0x32, 0x09, 0x33, 0x09, 0x34, 0x09,
+    0x40, 0x09, 0x41, 0x09, 0x42, 0x09, 0x43, 0x09, 0x28, 0x25, 0x0c, 0x15,
+    0x01, 0x35, 0x01, 0x45, 0x0c, 0x75, 0x08, 0x95, 0x01, 0xb1, 0x00, 0xc0,
+    0x05, 0x01, 0x09, 0x3b, 0x15, 0x00, 0x26, 0xff, 0x01, 0x35, 0x00, 0x46,
+    0xff, 0x01, 0x75, 0x0a, 0x95, 0x01, 0xb1, 0x02, 0x75, 0x06, 0xb1, 0x01,
+    0xc0, 0x05, 0x0f, 0x09, 0x89, 0xa1, 0x02, 0x85, 0x02, 0x09, 0x22, 0x25,
+    0x28, 0x15, 0x01, 0x35, 0x01, 0x45, 0x28, 0x75, 0x08, 0x95, 0x01, 0xb1,
+    0x02, 0x09, 0x8b, 0xa1, 0x02, 0x09, 0x8c, 0x09, 0x8d, 0x09, 0x8e, 0x25,
+    0x03, 0x15, 0x01, 0x35, 0x01, 0x45, 0x03, 0x75, 0x08, 0x95, 0x01, 0xb1,
+    0x00, 0xc0, 0x09, 0xac, 0x15, 0x00, 0x27, 0xff, 0xff, 0x00, 0x00, 0x35,
+    0x00, 0x47, 0xff, 0xff, 0x00, 0x00, 0x75, 0x10, 0x95, 0x01, 0xb1, 0x00,
+    0xc0, 0x09, 0x7f, 0xa1, 0x02, 0x85, 0x03, 0x09, 0x80, 0x75, 0x10, 0x95,
+    0x01, 0x15, 0x00, 0x35, 0x00, 0x27, 0xff, 0xff, 0x00, 0x00, 0x47, 0xff,
+    0xff, 0x00, 0x00, 0xb1, 0x02, 0x09, 0x83, 0x26, 0xff, 0x00, 0x46, 0xff,
+    0x00, 0x75, 0x08, 0x95, 0x01, 0xb1, 0x02, 0x09, 0xa9, 0x09, 0xaa, 0x75,
+    0x01, 0x95, 0x02, 0x15, 0x00, 0x25, 0x01, 0x35, 0x00, 0x45, 0x01, 0xb1,
+    0x02, 0x75, 0x06, 0x95, 0x01, 0xb1, 0x03, 0xc0, 0xc0,
+};
+
+uint16_t read16(const unsigned char* bytes) {
+  return bytes[0] | bytes[1] << 8;
+}
+
+}  // namespace
+
+CLSPSimTransport::CLSPSimTransport(const CLSPSimConfig& config)
+    : config(config) {
+  this->config.block_count =
+      std::max(1, std::min(this->config.block_count, MAX_BLOCKS));
+
+  this->pipes[PIPE_MAIN].pool = std::make_unique<CLSPTransferPool>(
+      nullptr, POOL_SIZE_MAIN, REPORT_SIZE_MAIN);
+  this->pipes[PIPE_MAIN].latency_ns = config.output_latency * 1000ull;
+
+  this->pipes[PIPE_FX].pool = std::make_unique<CLSPTransferPool>(
+      nullptr, POOL_SIZE_FX, REPORT_SIZE_FX);
+  this->pipes[PIPE_FX].latency_ns = config.output_latency * 1000ull;
+
+  this->pipes[PIPE_CONTROL].pool = std::make_unique<CLSPTransferPool>(
+      nullptr, POOL_SIZE_CONTROL, REPORT_SIZE_FX);
+  this->pipes[PIPE_CONTROL].latency_ns = config.control_latency * 1000ull;
+
+  resetDevice();
+
+  this->thread = std::thread(&CLSPSimTransport::run, this);
+}
+
+CLSPSimTransport::~CLSPSimTransport() {
+  unwatchHotplug();
+
+  close();
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->cv.notify_all();
+  this->thread.join();
+}
+
+CLSPDeviceInfo CLSPSimTransport::open(const std::string& device_id) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (!this->attached ||
+      !(device_id.empty() || device_id == this->config.serial ||
+        device_id == this->config.path)) {
+    throw std::runtime_error("Unable to open device");
+  }
+
+  this->opened = true;
+  this->next_input_ns = clspMonotonicNs();
+  this->cv.notify_all();
+
+  CLSPDeviceInfo info;
+  info.serial = this->config.serial;
+  info.path = this->config.path;
+  info.firmware = this->config.firmware;
+
+  return info;
+}
+
+void CLSPSimTransport::close() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    // Same status as the transfers cancelled by the libusb backend
+    failQueued(LIBUSB_ERROR_INTERRUPTED);
+    this->opened = false;
+  }
+
+  this->input_cv.notify_all();
+}
+
+CLSPCompletion CLSPSimTransport::writeReport(int interface,
+                                             const unsigned char* report,
+                                             int length) {
+  return submit(interface == 1 ? PIPE_FX : PIPE_MAIN, report, length,
+                nullptr, false);
+}
+
+CLSPCompletion CLSPSimTransport::writeReservedReport(
+    int interface, const unsigned char* report, int length) {
+  return submit(interface == 1 ? PIPE_FX : PIPE_MAIN, report, length,
+                nullptr, true);
+}
+
+CLSPCompletion CLSPSimTransport::setFeature(int /* interface */,
+                                            const unsigned char* report,
+                                            int length) {
+  return submit(PIPE_CONTROL, report, length, nullptr, false);
+}
+
+CLSPCompletion CLSPSimTransport::getFeature(int /* interface */,
+                                            unsigned char* report,
+                                            int length) {
+  return submit(PIPE_CONTROL, report, length, report, false);
+}
+
+int CLSPSimTransport::reportDescriptor(int interface,
+                                       std::vector<uint8_t>& descriptor) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (!this->opened) {
+    return LIBUSB_ERROR_NO_DEVICE;
+  }
+
+  // The FX interface is not simulated beyond its output reports
+  if (interface != 0) {
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+  }
+
+  descriptor.assign(std::begin(REPORT_DESCRIPTOR),
+                    std::end(REPORT_DESCRIPTOR));
+
+  return LIBUSB_SUCCESS;
+}
+
+void CLSPSimTransport::setInputHandler(InputHandler handler) {
+  this->input_handler = std::move(handler);
+}
+
+bool CLSPSimTransport::waitInput(uint64_t sequence, unsigned int timeout) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  auto done = [this, sequence] {
+    return this->sequence > sequence || !this->opened;
+  };
+
+  if (timeout == 0) {
+    this->input_cv.wait(lock, done);
+  } else {
+    this->input_cv.wait_for(lock, std::chrono::milliseconds(timeout), done);
+  }
+
+  return this->sequence > sequence;
+}
+
+std::vector<CLSPDeviceInfo> CLSPSimTransport::listDevices() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (!this->attached) {
+    return {};
+  }
+
+  CLSPDeviceInfo info;
+  info.serial = this->config.serial;
+  info.path = this->config.path;
+  info.firmware = this->config.firmware;
+
+  return {info};
+}
+
+bool CLSPSimTransport::watchHotplug(HotplugHandler handler) {
+  std::lock_guard<std::mutex> lock(this->hotplug_mutex);
+  this->hotplug_handler = std::move(handler);
+
+  return true;
+}
+
+void CLSPSimTransport::unwatchHotplug() {
+  std::lock_guard<std::mutex> lock(this->hotplug_mutex);
+  this->hotplug_handler = nullptr;
+}
+
+CLSPPoolStats CLSPSimTransport::poolStats(int endpoint) {
+  // Same endpoint addresses as the libusb backend
+  switch (endpoint) {
+    case 0x00:
+      return this->pipes[PIPE_CONTROL].pool->stats();
+    case 0x01:
+      return this->pipes[PIPE_MAIN].pool->stats();
+    case 0x02:
+      return this->pipes[PIPE_FX].pool->stats();
+    default:
+      return CLSPPoolStats();
+  }
+}
+
+CLSPRealtimeStatus CLSPSimTransport::setRealtimeProfile(
+    const CLSPRealtimeProfile& profile) {
+  CLSPRealtimeStatus status =
+      clspApplyRealtime(this->thread.native_handle(), profile);
+
+  if (profile.prefault_stack) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->prefault_pending = true;
+    this->cv.notify_all();
+  }
+
+  return status;
+}
+
+void CLSPSimTransport::setAttached(bool attached) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    if (this->attached == attached) {
+      return;
+    }
+
+    this->attached = attached;
+    this->hotplug_pending = true;
+
+    if (!attached) {
+      failQueued(LIBUSB_ERROR_NO_DEVICE);
+      this->opened = false;
+
+      // Powered off, the stick comes back without any effect
+      resetDevice();
+    }
+  }
+
+  this->cv.notify_all();
+  this->input_cv.notify_all();
+}
+
+CLSPSimState CLSPSimTransport::state() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->device;
+}
+
+CLSPSimEffect CLSPSimTransport::effect(uint8_t block) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  if (block < 1 || block > this->config.block_count) {
+    return CLSPSimEffect();
+  }
+
+  return this->blocks[block - 1];
+}
+
+CLSPCompletion CLSPSimTransport::submit(int pipe, const unsigned char* report,
+                                        int length, unsigned char* read_data,
+                                        bool reserved) {
+  Pipe& target = this->pipes[pipe];
+
+  if (length < 1 || length > target.pool->bufferSize()) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_OVERFLOW);
+  }
+
+  // Waits for a completion of the device thread if the pool is exhausted,
+  // unless the report goes through the reserved slot
+  CLSPTransferSlot* slot =
+      reserved ? target.pool->acquireReserved() : target.pool->acquire();
+  if (slot == nullptr) {
+    return CLSPCompletion::immediate(LIBUSB_ERROR_BUSY);
+  }
+  CLSPCompletion completion = target.pool->track(slot);
+
+  std::memcpy(slot->buffer, report, length);
+  slot->read_data = read_data;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    if (!this->opened) {
+      target.pool->complete(slot, LIBUSB_ERROR_NO_DEVICE);
+      return completion;
+    }
+
+    // The endpoint carries one report at a time
+    uint64_t due = std::max(clspMonotonicNs(), target.last_due_ns) +
+                   target.latency_ns;
+    target.last_due_ns = due;
+
+    target.queue.push_back({slot, length, read_data != nullptr, due});
+  }
+
+  this->cv.notify_all();
+
+  return completion;
+}
+
+void CLSPSimTransport::failQueued(int status) {
+  for (Pipe& pipe : this->pipes) {
+    for (const Pending& pending : pipe.queue) {
+      pipe.pool->complete(pending.slot, status);
+    }
+
+    pipe.queue.clear();
+    pipe.last_due_ns = 0;
+  }
+}
+
+void CLSPSimTransport::run() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  while (!this->stopping) {
+    if (this->prefault_pending) {
+      this->prefault_pending = false;
+      clspPrefaultStack();
+    }
+
+    uint64_t now = clspMonotonicNs();
+
+    for (int i = 0; i < PIPE_COUNT; i++) {
+      std::deque<Pending>& queue = this->pipes[i].queue;
+
+      while (!queue.empty() && queue.front().due_ns <= now) {
+        carryOut(i, queue.front(), now);
+        queue.pop_front();
+      }
+    }
+
+    expireEffects(now);
+
+    if (this->opened && this->config.input_rate > 0 &&
+        this->next_input_ns <= now) {
+      publishInput(now);
+    }
+
+    if (this->hotplug_pending) {
+      this->hotplug_pending = false;
+      bool attached = this->attached;
+
+      // The handler may call back into the transport
+      lock.unlock();
+      {
+        std::lock_guard<std::mutex> hotplug_lock(this->hotplug_mutex);
+        if (this->hotplug_handler) {
+          this->hotplug_handler(attached);
+        }
+      }
+      lock.lock();
+
+      continue;
+    }
+
+    uint64_t next = std::numeric_limits<uint64_t>::max();
+
+    for (const Pipe& pipe : this->pipes) {
+      if (!pipe.queue.empty()) {
+        next = std::min(next, pipe.queue.front().due_ns);
+      }
+    }
+
+    if (this->opened && this->config.input_rate > 0) {
+      next = std::min(next, this->next_input_ns);
+    }
+
+    if (!this->device.paused) {
+      for (int i = 0; i < this->config.block_count; i++) {
+        if (this->blocks[i].playing && this->play_end_ns[i] != 0) {
+          next = std::min(next, this->play_end_ns[i]);
+        }
+      }
+    }
+
+    if (next == std::numeric_limits<uint64_t>::max()) {
+      this->cv.wait(lock);
+    } else if (next > now) {
+      this->cv.wait_for(lock, std::chrono::nanoseconds(next - now));
+    }
+  }
+}
+
+void CLSPSimTransport::carryOut(int pipe, const Pending& pending,
+                                uint64_t now) {
+  CLSPTransferSlot* slot = pending.slot;
+  int status = LIBUSB_SUCCESS;
+
+  if (pipe == PIPE_FX) {
+    // Vendor reports, only counted
+    this->device.fx_reports++;
+  } else if (pipe == PIPE_MAIN) {
+    this->device.output_reports++;
+
+    // An interrupt OUT transfer succeeds even if the firmware drops it
+    if (!handleOutput(slot->buffer, pending.length, now)) {
+      this->device.rejected_reports++;
+    }
+  } else {
+    this->device.feature_reports++;
+
+    bool accepted =
+        pending.read ? handleGetFeature(slot->buffer, pending.length)
+                     : handleSetFeature(slot->buffer, pending.length);
+
+    if (!accepted) {
+      // The firmware stalls the requests it does not support
+      this->device.rejected_reports++;
+      status = LIBUSB_ERROR_PIPE;
+    } else if (pending.read) {
+      std::memcpy(slot->read_data, slot->buffer, pending.length);
+    }
+  }
+
+  updateCounts();
+
+  this->pipes[pipe].pool->complete(slot, status);
+}
+
+void CLSPSimTransport::publishInput(uint64_t now) {
+  double angle = 2.0 * M_PI * CIRCLE_HZ * (now / 1e9);
+
+  unsigned char report[REPORT_INPUT_SIZE] = {};
+  auto x = static_cast<uint16_t>(AXIS_CENTER + CIRCLE_RADIUS * std::cos(angle));
+  auto y = static_cast<uint16_t>(AXIS_CENTER + CIRCLE_RADIUS * std::sin(angle));
+
+  report[0] = REPORT_INPUT;
+  report[3] = x & 0xff;
+  report[4] = x >> 8;
+  report[5] = y & 0xff;
+  report[6] = y >> 8;
+
+  if (this->input_handler) {
+    this->input_handler(report, sizeof(report));
+  }
+
+  CLSPInputSample sample;
+  clspDecodeInput(report, sizeof(report), sample);
+
+  sample.sequence = ++this->sequence;
+  sample.timestamp_ns = now;
+  this->input_state.publish(sample);
+
+  this->device.input_reports++;
+
+  // Skips the reports missed while the thread was late, like the endpoint
+  // only holds the latest one
+  uint64_t period = 1000000000ull / this->config.input_rate;
+  this->next_input_ns += period;
+  if (this->next_input_ns <= now) {
+    this->next_input_ns = now + period;
+  }
+
+  this->input_cv.notify_all();
+}
+
+void CLSPSimTransport::expireEffects(uint64_t now) {
+  if (this->device.paused) {
+    return;
+  }
+
+  for (int i = 0; i < this->config.block_count; i++) {
+    if (this->blocks[i].playing && this->play_end_ns[i] != 0 &&
+        this->play_end_ns[i] <= now) {
+      this->blocks[i].playing = false;
+      this->blocks[i].loop_count = 0;
+    }
+  }
+
+  updateCounts();
+}
+
+void CLSPSimTransport::resetDevice() {
+  for (int i = 0; i < MAX_BLOCKS; i++) {
+    this->blocks[i] = CLSPSimEffect();
+    this->play_end_ns[i] = 0;
+  }
+
+  // Without block management every report goes to block 1
+  if (!this->config.block_management) {
+    this->blocks[0].allocated = true;
+  }
+
+  std::memset(this->block_load, 0, sizeof(this->block_load));
+
+  this->device.actuators_enabled = true;
+  this->device.paused = false;
+  this->device.gain = 0xff;
+
+  updateCounts();
+}
+
+bool CLSPSimTransport::handleOutput(const unsigned char* report, int length,
+                                    uint64_t now) {
+  if (length < 2) {
+    return false;
+  }
+
+  // Reports without an effect block
+  switch (report[0]) {
+    case REPORT_FORCE_SAMPLE:
+      this->device.force_samples++;
+      return length >= 3;
+
+    case REPORT_DEVICE_CONTROL:
+      switch (report[1]) {
+        case CONTROL_ENABLE_ACTUATORS:
+          this->device.actuators_enabled = true;
+          return true;
+        case CONTROL_DISABLE_ACTUATORS:
+          this->device.actuators_enabled = false;
+          return true;
+        case CONTROL_STOP_ALL:
+          for (CLSPSimEffect& effect : this->blocks) {
+            effect.playing = false;
+          }
+          return true;
+        case CONTROL_RESET:
+          resetDevice();
+          return true;
+        case CONTROL_PAUSE:
+          if (!this->device.paused) {
+            this->device.paused = true;
+            this->paused_ns = now;
+          }
+          return true;
+        case CONTROL_CONTINUE:
+          if (this->device.paused) {
+            // The plays resume where they stopped
+            for (uint64_t& end : this->play_end_ns) {
+              if (end != 0) {
+                end += now - this->paused_ns;
+              }
+            }
+            this->device.paused = false;
+          }
+          return true;
+        default:
+          return false;
+      }
+
+    case REPORT_DEVICE_GAIN:
+      this->device.gain = report[1];
+      return true;
+
+    default:
+      break;
+  }
+
+  CLSPSimEffect* effect = findBlock(report[1]);
+  if (effect == nullptr) {
+    return false;
+  }
+
+  switch (report[0]) {
+    case REPORT_SET_EFFECT:
+      if (length < 16 || report[2] < FIRST_EFFECT_TYPE ||
+          report[2] > LAST_EFFECT_TYPE) {
+        return false;
+      }
+      effect->type = report[2];
+      effect->duration = read16(report + 3);
+      effect->gain = report[9];
+      effect->direction = static_cast<int8_t>(report[12]);
+      effect->start_delay = read16(report + 14);
+      return true;
+
+    case REPORT_ENVELOPE:
+      if (length < 8) {
+        return false;
+      }
+      effect->attack_level = report[2];
+      effect->fade_level = report[3];
+      effect->attack_time = read16(report + 4);
+      effect->fade_time = read16(report + 6);
+      return true;
+
+    case REPORT_CONDITION: {
+      if (length < 9) {
+        return false;
+      }
+      // Parameter block offset, one condition per axis
+      int axis = report[2] & 0x01;
+      effect->positive_coefficient[axis] = report[4];
+      effect->negative_coefficient[axis] = report[5];
+      effect->positive_saturation[axis] = report[6];
+      effect->negative_saturation[axis] = report[7];
+      effect->deadband[axis] = report[8];
+      return true;
+    }
+
+    case REPORT_PERIODIC:
+      if (length < 7) {
+        return false;
+      }
+      effect->periodic_magnitude = report[2];
+      effect->periodic_offset = static_cast<int8_t>(report[3]);
+      effect->phase = report[4];
+      effect->period = read16(report + 5);
+      return true;
+
+    case REPORT_CONSTANT:
+      if (length < 4) {
+        return false;
+      }
+      effect->magnitude = static_cast<int16_t>(read16(report + 2));
+      return true;
+
+    case REPORT_RAMP:
+      if (length < 4) {
+        return false;
+      }
+      effect->ramp_start = static_cast<int8_t>(report[2]);
+      effect->ramp_end = static_cast<int8_t>(report[3]);
+      return true;
+
+    case REPORT_CUSTOM_DATA:
+      // Chunks past the size given to Create New Effect are dropped
+      return length >= 4 && (!this->config.block_management ||
+                             read16(report + 2) < effect->custom_bytes);
+
+    case REPORT_CUSTOM_FORCE:
+      if (length < 5) {
+        return false;
+      }
+      effect->sample_count = report[2];
+      effect->sample_period = read16(report + 3);
+      return true;
+
+    case REPORT_EFFECT_OPERATION: {
+      if (length < 4) {
+        return false;
+      }
+      int index = effect - this->blocks;
+
+      if (report[2] == OP_START_SOLO) {
+        for (CLSPSimEffect& other : this->blocks) {
+          other.playing = false;
+        }
+      }
+
+      if (report[2] == OP_START || report[2] == OP_START_SOLO) {
+        startEffect(index, report[3], now);
+        return true;
+      }
+      if (report[2] == OP_STOP) {
+        effect->playing = false;
+        return true;
+      }
+      return false;
+    }
+
+    case REPORT_BLOCK_FREE:
+      if (this->config.block_management) {
+        *effect = CLSPSimEffect();
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+bool CLSPSimTransport::handleSetFeature(const unsigned char* report,
+                                        int length) {
+  if (report[0] != FEATURE_CREATE_EFFECT || length < 4 ||
+      !this->config.block_management) {
+    return false;
+  }
+
+  // 10b byte count, custom data only
+  createEffect(report[1], read16(report + 2) & 0x03ff);
+
+  return true;
+}
+
+bool CLSPSimTransport::handleGetFeature(unsigned char* report, int length) {
+  if (!this->config.block_management) {
+    return false;
+  }
+
+  if (report[0] == FEATURE_BLOCK_LOAD && length >= 5) {
+    std::memcpy(report, this->block_load, sizeof(this->block_load));
+    return true;
+  }
+
+  if (report[0] == FEATURE_PID_POOL && length >= 4) {
+    report[1] = this->config.ram_pool_size & 0xff;
+    report[2] = this->config.ram_pool_size >> 8;
+    report[3] = this->config.block_count;  // Simultaneous effects max
+    if (length >= 5) {
+      report[4] = 0x01;  // Device managed pool
+    }
+    return true;
+  }
+
+  return false;
+}
+
+void CLSPSimTransport::createEffect(uint8_t type, uint16_t byte_count) {
+  uint8_t status = BLOCK_LOAD_FULL;
+  uint8_t index = 0;
+
+  if (type < FIRST_EFFECT_TYPE || type > LAST_EFFECT_TYPE) {
+    status = BLOCK_LOAD_ERROR;
+  } else if (BLOCK_BYTES + byte_count <= ramPoolAvailable()) {
+    for (int i = 0; i < this->config.block_count; i++) {
+      if (!this->blocks[i].allocated) {
+        this->blocks[i] = CLSPSimEffect();
+        this->blocks[i].allocated = true;
+        this->blocks[i].type = type;
+        this->blocks[i].custom_bytes = byte_count;
+        this->play_end_ns[i] = 0;
+
+        status = BLOCK_LOAD_SUCCESS;
+        index = i + 1;
+        break;
+      }
+    }
+  }
+
+  updateCounts();
+
+  uint16_t available = this->device.ram_pool_available;
+
+  this->block_load[0] = FEATURE_BLOCK_LOAD;
+  this->block_load[1] = index;
+  this->block_load[2] = status;
+  this->block_load[3] = available & 0xff;
+  this->block_load[4] = available >> 8;
+}
+
+void CLSPSimTransport::startEffect(int index, uint8_t loop_count,
+                                   uint64_t now) {
+  CLSPSimEffect& effect = this->blocks[index];
+
+  effect.playing = true;
+  effect.loop_count = std::max<uint8_t>(loop_count, 1);
+  this->device.effect_starts++;
+
+  if (effect.loop_count == INFINITE_LOOPS ||
+      effect.duration == INFINITE_DURATION) {
+    this->play_end_ns[index] = 0;
+    return;
+  }
+
+  uint64_t play_ms =
+      effect.start_delay +
+      static_cast<uint64_t>(effect.duration) * effect.loop_count;
+
+  this->play_end_ns[index] = now + play_ms * 1000000ull;
+}
+
+CLSPSimEffect* CLSPSimTransport::findBlock(uint8_t block) {
+  if (block < 1 || block > this->config.block_count ||
+      !this->blocks[block - 1].allocated) {
+    return nullptr;
+  }
+
+  return &this->blocks[block - 1];
+}
+
+uint16_t CLSPSimTransport::ramPoolAvailable() const {
+  int used = 0;
+
+  for (int i = 0; i < this->config.block_count; i++) {
+    if (this->blocks[i].allocated) {
+      used += BLOCK_BYTES + this->blocks[i].custom_bytes;
+    }
+  }
+
+  return std::max(0, this->config.ram_pool_size - used);
+}
+
+void CLSPSimTransport::updateCounts() {
+  this->device.allocated_blocks = 0;
+  this->device.playing_effects = 0;
+
+  for (int i = 0; i < this->config.block_count; i++) {
+    this->device.allocated_blocks += this->blocks[i].allocated;
+    this->device.playing_effects += this->blocks[i].playing;
+  }
+
+  this->device.ram_pool_available = ramPoolAvailable();
+}
@@ -0,0 +1,270 @@
+#ifndef CLS_P_TRANSPORT_SIM_HPP
+#define CLS_P_TRANSPORT_SIM_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clsp_transport.hpp"
+
+/**
+ * Behaviour of a simulated stick
+ */
+struct CLSPSimConfig {
+  // Rate of the input reports 1, in Hz, 0 for none
+  unsigned int input_rate = 1000;
+  // Time each output report spends on its interrupt endpoint, in us. The
+  // reports of an endpoint are carried one after the other, so this also
+  // bounds the report rate.
+  unsigned int output_latency = 1000;
+  // Same for the feature reports on the control pipe, in us
+  unsigned int control_latency = 2000;
+  // Effect blocks of the device memory, at most 40
+  int block_count = 40;
+  // Size of the effect RAM pool reported by the device, in bytes
+  uint16_t ram_pool_size = 4096;
+  // false to simulate a firmware without block management: Create New Effect
+  // stalls and only block 1 is used
+  bool block_management = true;
+  // Serial number, bus path and firmware version (bcdDevice) of the
+  // simulated stick
+  std::string serial = "SIM00001";
+  std::string path = "sim";
+  uint16_t firmware = 0x0100;
+};
+
+/**
+ * State of an effect block of the simulated stick
+ */
+struct CLSPSimEffect {
+  bool allocated = false;
+  uint8_t type = 0;
+  bool playing = false;
+  // Remaining plays, 0xff for infinite
+  uint8_t loop_count = 0;
+  // Set Effect report, in ms, 0xffff for infinite
+  uint16_t duration = 0;
+  uint16_t start_delay = 0;
+  uint8_t gain = 0;
+  int8_t direction = 0;
+  // Constant force, 16b signed
+  int16_t magnitude = 0;
+  // Periodic
+  uint8_t periodic_magnitude = 0;
+  int8_t periodic_offset = 0;
+  uint8_t phase = 0;
+  uint16_t period = 0;
+  // Ramp
+  int8_t ramp_start = 0;
+  int8_t ramp_end = 0;
+  // Envelope
+  uint8_t attack_level = 0;
+  uint8_t fade_level = 0;
+  uint16_t attack_time = 0;
+  uint16_t fade_time = 0;
+  // Condition, by axis
+  uint8_t positive_coefficient[2] = {};
+  uint8_t negative_coefficient[2] = {};
+  uint8_t positive_saturation[2] = {};
+  uint8_t negative_saturation[2] = {};
+  uint8_t deadband[2] = {};
+  // Custom force
+  uint16_t custom_bytes = 0;
+  uint8_t sample_count = 0;
+  uint16_t sample_period = 0;
+};
+
+/**
+ * Device-wide state and report counters of the simulated stick
+ */
+struct CLSPSimState {
+  bool actuators_enabled = true;
+  bool paused = false;
+  uint8_t gain = 0xff;
+  int allocated_blocks = 0;
+  int playing_effects = 0;
+  uint16_t ram_pool_available = 0;
+  // Reports carried out, by kind
+  uint64_t output_reports = 0;
+  uint64_t fx_reports = 0;
+  uint64_t feature_reports = 0;
+  uint64_t input_reports = 0;
+  // Reports with an unknown ID or a bad length, or naming a free block
+  uint64_t rejected_reports = 0;
+  // Effect Operation start and start solo reports
+  uint64_t effect_starts = 0;
+  // Download Force Sample reports
+  uint64_t force_samples = 0;
+};
+
+/**
+ * In-process stick implementing the PID protocol of the report descriptor:
+ * effect blocks and their parameter reports, effect operations, device
+ * control, device gain, and input report 1 at a fixed rate with a slowly
+ * circling stick. No USB device is needed, so the benchmarks and tools run on
+ * any Linux box.
+ *
+ * The reports go through the same transfer pools as the libusb backend and
+ * complete asynchronously on the device thread once their latency has
+ * elapsed; the device state changes at the completion, as it would on the
+ * stick.
+ */
+class CLSPSimTransport : public CLSPTransport {
+ public:
+  /**
+   * Starts the device thread
+   * @param config behaviour of the simulated stick
+   */
+  explicit CLSPSimTransport(const CLSPSimConfig& config);
+
+  /**
+   * Fails the reports still queued and stops the device thread
+   */
+  ~CLSPSimTransport() override;
+
+  CLSPSimTransport(const CLSPSimTransport&) = delete;
+  CLSPSimTransport& operator=(const CLSPSimTransport&) = delete;
+
+  CLSPDeviceInfo open(const std::string& device_id) override;
+  void close() override;
+
+  CLSPCompletion writeReport(int interface, const unsigned char* report,
+                             int length) override;
+  CLSPCompletion writeReservedReport(int interface,
+                                     const unsigned char* report,
+                                     int length) override;
+  bool reservedReportsWait() const override { return false; }
+  CLSPCompletion setFeature(int interface, const unsigned char* report,
+                            int length) override;
+  CLSPCompletion getFeature(int interface, unsigned char* report,
+                            int length) override;
+  int reportDescriptor(int interface,
+                       std::vector<uint8_t>& descriptor) override;
+
+  const CLSPInputState& input() const override { return this->input_state; }
+  void setInputHandler(InputHandler handler) override;
+  bool waitInput(uint64_t sequence, unsigned int timeout) override;
+
+  std::vector<CLSPDeviceInfo> listDevices() override;
+
+  bool watchHotplug(HotplugHandler handler) override;
+  void unwatchHotplug() override;
+
+  CLSPPoolStats poolStats(int endpoint) override;
+
+  CLSPRealtimeStatus setRealtimeProfile(
+      const CLSPRealtimeProfile& profile) override;
+
+  /**
+   * Simulates an unplug or a re-attach of the stick. An unplug fails the
+   * queued reports and resets the device state; the hotplug handler is
+   * called from the device thread.
+   * @param attached true to plug the stick back in
+   */
+  void setAttached(bool attached);
+
+  /**
+   * @return device-wide state and report counters
+   */
+  CLSPSimState state();
+
+  /**
+   * @param block effect block index, from 1
+   * @return state of the block, default if the index is out of range
+   */
+  CLSPSimEffect effect(uint8_t block);
+
+ private:
+  static const int PIPE_MAIN = 0;
+  static const int PIPE_FX = 1;
+  static const int PIPE_CONTROL = 2;
+  static const int PIPE_COUNT = 3;
+
+  static constexpr int MAX_BLOCKS = 40;
+
+  /**
+   * Report queued on a pipe until its latency has elapsed
+   */
+  struct Pending {
+    CLSPTransferSlot* slot;
+    int length;
+    // GET_REPORT, the answer goes to the slot read_data
+    bool read;
+    uint64_t due_ns;
+  };
+
+  /**
+   * Endpoint carrying the reports one after the other
+   */
+  struct Pipe {
+    std::unique_ptr<CLSPTransferPool> pool;
+    std::deque<Pending> queue;
+    uint64_t latency_ns = 0;
+    // Completion time of the last report queued
+    uint64_t last_due_ns = 0;
+  };
+
+  CLSPSimConfig config;
+
+  Pipe pipes[PIPE_COUNT];
+
+  // Guards the pipes and the device state
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  std::thread thread;
+  bool stopping = false;
+  bool prefault_pending = false;
+
+  bool attached = true;
+  bool opened = false;
+  // Set by setAttached, reported from the device thread
+  bool hotplug_pending = false;
+
+  // Held while a hotplug handler runs
+  std::mutex hotplug_mutex;
+  HotplugHandler hotplug_handler;
+
+  CLSPSimState device;
+  CLSPSimEffect blocks[MAX_BLOCKS];
+  // Plays end at this CLOCK_MONOTONIC time, in ns, 0 for infinite
+  uint64_t play_end_ns[MAX_BLOCKS] = {};
+  // CLOCK_MONOTONIC time of the Device Control pause, in ns
+  uint64_t paused_ns = 0;
+  // Answer to the next PID Block Load GET_REPORT
+  uint8_t block_load[5] = {};
+
+  // Published by the device thread
+  CLSPInputState input_state;
+  InputHandler input_handler;
+  uint64_t sequence = 0;
+  uint64_t next_input_ns = 0;
+  std::condition_variable input_cv;
+
+  CLSPCompletion submit(int pipe, const unsigned char* report, int length,
+                        unsigned char* read_data, bool reserved);
+  void failQueued(int status);
+
+  void run();
+  void carryOut(int pipe, const Pending& pending, uint64_t now);
+  void publishInput(uint64_t now);
+  void expireEffects(uint64_t now);
+  void resetDevice();
+
+  bool handleOutput(const unsigned char* report, int length, uint64_t now);
+  bool handleSetFeature(const unsigned char* report, int length);
+  bool handleGetFeature(unsigned char* report, int length);
+  void createEffect(uint8_t type, uint16_t byte_count);
+  void startEffect(int index, uint8_t loop_count, uint64_t now);
+
+  CLSPSimEffect* findBlock(uint8_t block);
+  uint16_t ramPoolAvailable() const;
+  void updateCounts();
+};
+
+#endif
@@ -0,0 +1,542 @@
+#include "clsp_uinput.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "clsp_clock.hpp"
+#include "clsp_transport.hpp"
+
+namespace {
+
+const char* UINPUT_NODE = "/dev/uinput";
+const char* DEVICE_NAME = "BRUNNER CLS-P (uinput)";
+
+// Buttons of input report 1, bit order
+const int BUTTONS[] = {BTN_TRIGGER, BTN_THUMB, BTN_THUMB2, BTN_TOP, BTN_TOP2};
+const int BUTTON_COUNT = sizeof(BUTTONS) / sizeof(BUTTONS[0]);
+
+// Hat switch value [0,8] to ABS_HAT0X/ABS_HAT0Y, clockwise from up
+const int HAT_X[] = {0, 0, 1, 1, 1, 0, -1, -1, -1};
+const int HAT_Y[] = {0, -1, -1, 0, 1, 1, 1, 0, -1};
+
+const int FF_BITS[] = {FF_CONSTANT, FF_RAMP,     FF_PERIODIC, FF_SQUARE,
+                       FF_SINE,     FF_TRIANGLE, FF_SAW_UP,   FF_SAW_DOWN,
+                       FF_SPRING,   FF_DAMPER,   FF_INERTIA,  FF_FRICTION,
+                       FF_GAIN};
+
+// Null duration, the effect plays until stopped
+const uint16_t INFINITE_DURATION = 0xffff;
+
+// Largest duration and time parameter of the PID reports, in ms
+const int MAX_TIME = 32767;
+
+// Effect ID of the General Settings report, 0 if not supported
+uint8_t functionId(const struct ff_effect& effect) {
+  switch (effect.type) {
+    case FF_CONSTANT:
+      return CLSP_CONSTANT_FORCE;
+    case FF_RAMP:
+      return CLSP_RAMP;
+    case FF_SPRING:
+      return CLSP_PERIODIC_COND_SPRING;
+    case FF_DAMPER:
+      return CLSP_PERIODIC_COND_DAMPER;
+    case FF_INERTIA:
+      return CLSP_PERIODIC_COND_INERTIA;
+    case FF_FRICTION:
+      return CLSP_PERIODIC_COND_FRICTION;
+    case FF_PERIODIC:
+      break;
+    default:
+      return 0;
+  }
+
+  switch (effect.u.periodic.waveform) {
+    case FF_SQUARE:
+      return CLSP_PERIODIC_SQUARE;
+    case FF_SINE:
+      return CLSP_PERIODIC_SINE;
+    case FF_TRIANGLE:
+      return CLSP_PERIODIC_TRIANGLE;
+    case FF_SAW_UP:
+      return CLSP_PERIODIC_SAWTOOTHUP;
+    case FF_SAW_DOWN:
+      return CLSP_PERIODIC_SAWTOOTHDOWN;
+    default:
+      return 0;
+  }
+}
+
+// evdev level [-32767,32767] to a normalized [0,255] amplitude
+uint8_t amplitude(int level) { return std::min(std::abs(level) >> 7, 255); }
+
+uint16_t clampTime(int ms) { return std::min(ms, MAX_TIME); }
+
+// Kernel timestamp of a uinput event, CLOCK_MONOTONIC like clspMonotonicNs()
+uint64_t eventTime(const struct input_event& event) {
+  return static_cast<uint64_t>(event.input_event_sec) * 1000000000ull +
+         static_cast<uint64_t>(event.input_event_usec) * 1000ull;
+}
+
+}  // namespace
+
+CLSPUinputBridge::CLSPUinputBridge(CLSPJoystick& joystick)
+    : joystick(joystick) {
+  this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->wake_fd < 0) {
+    throw std::runtime_error("Unable to create the bridge wake-up descriptor");
+  }
+
+  try {
+    createDevice();
+  } catch (const std::runtime_error&) {
+    ::close(this->wake_fd);
+    throw;
+  }
+
+  // Runs on the connection thread of the joystick, must not block
+  this->joystick.setConnectionCallback([this](CLSPConnectionState state) {
+    if (state == CLSP_DEVICE_DISCONNECTED) {
+      this->device_lost = true;
+    } else if (state == CLSP_DEVICE_CONNECTED) {
+      this->device_back = true;
+    } else {
+      return;
+    }
+    eventfd_write(this->wake_fd, 1);
+  });
+
+  this->ff_thread = std::thread(&CLSPUinputBridge::ffLoop, this);
+  this->input_thread = std::thread(&CLSPUinputBridge::inputLoop, this);
+}
+
+CLSPUinputBridge::~CLSPUinputBridge() {
+  this->joystick.setConnectionCallback(nullptr);
+
+  this->stopping = true;
+  eventfd_write(this->wake_fd, 1);
+
+  this->ff_thread.join();
+  this->input_thread.join();
+
+  freeEffects();
+  destroyDevice();
+
+  ::close(this->wake_fd);
+}
+
+CLSPBridgeStats CLSPUinputBridge::stats() {
+  std::lock_guard<std::mutex> lock(this->stats_mutex);
+  return this->published;
+}
+
+void CLSPUinputBridge::createDevice() {
+  int fd = ::open(UINPUT_NODE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open /dev/uinput");
+  }
+
+  bool ok = ioctl(fd, UI_SET_EVBIT, EV_KEY) >= 0 &&
+            ioctl(fd, UI_SET_EVBIT, EV_ABS) >= 0 &&
+            ioctl(fd, UI_SET_EVBIT, EV_FF) >= 0 &&
+            ioctl(fd, UI_SET_EVBIT, EV_SYN) >= 0;
+
+  for (int button : BUTTONS) {
+    ok = ok && ioctl(fd, UI_SET_KEYBIT, button) >= 0;
+  }
+
+  for (int bit : FF_BITS) {
+    ok = ok && ioctl(fd, UI_SET_FFBIT, bit) >= 0;
+  }
+
+  struct uinput_abs_setup axes[4] = {};
+  axes[0].code = ABS_X;
+  axes[0].absinfo.maximum = 65535;
+  axes[1].code = ABS_Y;
+  axes[1].absinfo.maximum = 65535;
+  axes[2].code = ABS_HAT0X;
+  axes[2].absinfo.minimum = -1;
+  axes[2].absinfo.maximum = 1;
+  axes[3].code = ABS_HAT0Y;
+  axes[3].absinfo.minimum = -1;
+  axes[3].absinfo.maximum = 1;
+
+  for (const auto& axis : axes) {
+    ok = ok && ioctl(fd, UI_SET_ABSBIT, axis.code) >= 0 &&
+         ioctl(fd, UI_ABS_SETUP, &axis) >= 0;
+  }
+
+  struct uinput_setup setup = {};
+  setup.id.bustype = BUS_USB;
+  setup.id.vendor = CLSPTransport::VENDOR_ID;
+  setup.id.product = CLSPTransport::PRODUCT_ID;
+  setup.ff_effects_max = MAX_EFFECTS;
+  std::strncpy(setup.name, DEVICE_NAME, UINPUT_MAX_NAME_SIZE - 1);
+
+  ok = ok && ioctl(fd, UI_DEV_SETUP, &setup) >= 0 &&
+       ioctl(fd, UI_DEV_CREATE) >= 0;
+
+  if (!ok) {
+    ::close(fd);
+    throw std::runtime_error("Unable to create the uinput device");
+  }
+
+  std::lock_guard<std::mutex> lock(this->device_mutex);
+  this->fd = fd;
+}
+
+void CLSPUinputBridge::destroyDevice() {
+  std::lock_guard<std::mutex> lock(this->device_mutex);
+
+  if (this->fd < 0) {
+    return;
+  }
+
+  ioctl(this->fd, UI_DEV_DESTROY);
+  ::close(this->fd);
+  this->fd = -1;
+}
+
+void CLSPUinputBridge::ffLoop() {
+  struct input_event events[16];
+
+  while (!this->stopping) {
+    // Only this thread replaces the descriptor
+    struct pollfd fds[2] = {};
+    fds[0].fd = this->wake_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = this->fd;
+    fds[1].events = POLLIN;
+
+    if (poll(fds, 2, -1) < 0) {
+      continue;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      eventfd_t value;
+      eventfd_read(this->wake_fd, &value);
+
+      // The evdev device follows the stick, the games see an unplug
+      if (this->device_lost.exchange(false)) {
+        freeEffects();
+        destroyDevice();
+      }
+
+      if (this->device_back.exchange(false) && this->fd < 0) {
+        try {
+          createDevice();
+        } catch (const std::runtime_error& e) {
+          std::cerr << e.what() << std::endl;
+        }
+      }
+
+      continue;
+    }
+
+    if (!(fds[1].revents & POLLIN)) {
+      continue;
+    }
+
+    ssize_t length;
+    while ((length = ::read(this->fd, events, sizeof(events))) > 0) {
+      for (size_t i = 0; i < length / sizeof(events[0]); i++) {
+        handleEvent(events[i]);
+      }
+    }
+  }
+}
+
+void CLSPUinputBridge::inputLoop() {
+  CLSPInputSample last;
+  uint64_t mirrored = 0;
+  int mirrored_fd = -1;
+
+  while (!this->stopping) {
+    if (!this->joystick.updateStatus(INPUT_TIMEOUT)) {
+      // Returns right away while the stick is unplugged
+      if (!this->joystick.isConnected()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(INPUT_TIMEOUT));
+      }
+      continue;
+    }
+
+    CLSPInputSample sample = this->joystick.getInputSample();
+
+    struct input_event events[BUTTON_COUNT + 5] = {};
+    int count = 0;
+
+    auto add = [&events, &count](int type, int code, int value) {
+      events[count].type = type;
+      events[count].code = code;
+      events[count].value = value;
+      count++;
+    };
+
+    std::lock_guard<std::mutex> lock(this->device_mutex);
+
+    if (this->fd < 0) {
+      continue;
+    }
+
+    // A new evdev device starts from the full state
+    bool full = this->fd != mirrored_fd;
+
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+      if (full || sample.buttons[i] != last.buttons[i]) {
+        add(EV_KEY, BUTTONS[i], sample.buttons[i]);
+      }
+    }
+
+    int hat = sample.hat_switch <= 8 ? sample.hat_switch : 0;
+    int last_hat = last.hat_switch <= 8 ? last.hat_switch : 0;
+    if (full || HAT_X[hat] != HAT_X[last_hat]) {
+      add(EV_ABS, ABS_HAT0X, HAT_X[hat]);
+    }
+    if (full || HAT_Y[hat] != HAT_Y[last_hat]) {
+      add(EV_ABS, ABS_HAT0Y, HAT_Y[hat]);
+    }
+
+    if (full || sample.x != last.x) {
+      add(EV_ABS, ABS_X, sample.x);
+    }
+    if (full || sample.y != last.y) {
+      add(EV_ABS, ABS_Y, sample.y);
+    }
+
+    last = sample;
+    mirrored_fd = this->fd;
+
+    if (count == 0) {
+      continue;
+    }
+
+    add(EV_SYN, SYN_REPORT, 0);
+
+    // One write per report, the frame reaches the readers at once
+    if (::write(this->fd, events, count * sizeof(events[0])) > 0) {
+      mirrored++;
+
+      std::lock_guard<std::mutex> stats_lock(this->stats_mutex);
+      this->published.input_reports = mirrored;
+    }
+  }
+}
+
+void CLSPUinputBridge::handleEvent(const struct input_event& event) {
+  uint64_t event_ns = eventTime(event);
+
+  if (event.type == EV_UINPUT && event.code == UI_FF_UPLOAD) {
+    handleUpload(event.value, event_ns);
+  } else if (event.type == EV_UINPUT && event.code == UI_FF_ERASE) {
+    handleErase(event.value, event_ns);
+  } else if (event.type == EV_FF) {
+    handlePlay(event.code, event.value, event_ns);
+  }
+}
+
+void CLSPUinputBridge::handleUpload(uint32_t request_id, uint64_t event_ns) {
+  struct uinput_ff_upload upload = {};
+  upload.request_id = request_id;
+
+  if (ioctl(this->fd, UI_BEGIN_FF_UPLOAD, &upload) < 0) {
+    return;
+  }
+
+  upload.retval = uploadEffect(upload.effect);
+  record(&CLSPBridgeStats::uploads, event_ns, upload.retval < 0);
+
+  // Unblocks the EVIOCSFF call of the game
+  ioctl(this->fd, UI_END_FF_UPLOAD, &upload);
+}
+
+void CLSPUinputBridge::handleErase(uint32_t request_id, uint64_t event_ns) {
+  struct uinput_ff_erase erase = {};
+  erase.request_id = request_id;
+
+  if (ioctl(this->fd, UI_BEGIN_FF_ERASE, &erase) < 0) {
+    return;
+  }
+
+  auto found = this->effects.find(erase.effect_id);
+  if (found != this->effects.end()) {
+    this->joystick.playEffect(false, 0, found->second.block);
+
+    if (found->second.allocated) {
+      this->joystick.freeEffect(found->second.block);
+    }
+
+    this->effects.erase(found);
+  }
+
+  erase.retval = 0;
+  record(&CLSPBridgeStats::erases, event_ns, false);
+
+  ioctl(this->fd, UI_END_FF_ERASE, &erase);
+}
+
+void CLSPUinputBridge::handlePlay(int code, int value, uint64_t event_ns) {
+  CLSPCompletion sent;
+
+  if (code == FF_GAIN) {
+    // [0,0xffff] to [0,255]
+    sent = this->joystick.setGain(std::min(value, 0xffff) * 255 / 0xffff);
+    record(&CLSPBridgeStats::gains, event_ns,
+           sent.ready() && sent.status() < 0);
+    return;
+  }
+
+  auto found = this->effects.find(code);
+  if (found == this->effects.end()) {
+    record(&CLSPBridgeStats::plays, event_ns, true);
+    return;
+  }
+
+  // The value is the repeat count, 0 stops the effect
+  sent = this->joystick.playEffect(value > 0, std::min(value, 255),
+                                   found->second.block);
+  record(&CLSPBridgeStats::plays, event_ns,
+         sent.ready() && sent.status() < 0);
+}
+
+int CLSPUinputBridge::uploadEffect(const struct ff_effect& effect) {
+  uint8_t function_id = functionId(effect);
+  if (function_id == 0) {
+    return -EINVAL;
+  }
+
+  auto found = this->effects.find(effect.id);
+
+  // Another effect type needs another block
+  if (found != this->effects.end() &&
+      found->second.function_id != function_id) {
+    if (found->second.allocated) {
+      this->joystick.freeEffect(found->second.block);
+    }
+    this->effects.erase(found);
+    found = this->effects.end();
+  }
+
+  if (found == this->effects.end()) {
+    Effect entry;
+    entry.function_id = function_id;
+
+    int block = this->joystick.createEffect(function_id);
+    if (block == LIBUSB_ERROR_NO_MEM) {
+      return -ENOSPC;
+    }
+    if (block == LIBUSB_ERROR_NO_DEVICE) {
+      return -ENODEV;
+    }
+
+    if (block > 0) {
+      entry.block = block;
+      entry.allocated = true;
+      // Keeps the other uploads and the effect helpers off the block
+      this->joystick.pinEffect(block, true);
+    } else {
+      // Firmwares without block management only use the first block
+      entry.block = 0x01;
+    }
+
+    found = this->effects.emplace(effect.id, entry).first;
+  }
+
+  uint8_t block = found->second.block;
+  const struct ff_envelope* envelope = nullptr;
+
+  switch (effect.type) {
+    case FF_CONSTANT:
+      this->joystick.setConstantForce(
+          effect.u.constant.level * CLSPForceStream::MAX_MAGNITUDE / 32767,
+          block);
+      envelope = &effect.u.constant.envelope;
+      break;
+    case FF_RAMP:
+      this->joystick.setRampSettings(effect.u.ramp.start_level >> 8,
+                                     effect.u.ramp.end_level >> 8, block);
+      envelope = &effect.u.ramp.envelope;
+      break;
+    case FF_PERIODIC: {
+      const struct ff_periodic_effect& periodic = effect.u.periodic;
+
+      // A negative magnitude is the same wave half a period later
+      uint8_t phase =
+          (periodic.phase >> 8) + (periodic.magnitude < 0 ? 0x80 : 0);
+
+      this->joystick.setPeriodicSettings(
+          amplitude(periodic.magnitude), periodic.offset >> 8, phase,
+          std::min<uint16_t>(periodic.period, 32767), block);
+      envelope = &periodic.envelope;
+      break;
+    }
+    default:
+      // Conditions: one parameter block per axis. The coefficients are
+      // signed on both sides, a negative one pushes away from the center.
+      for (uint8_t axis = 0; axis < 2; axis++) {
+        const struct ff_condition_effect& condition = effect.u.condition[axis];
+
+        this->joystick.setAxisConditionSettings(
+            axis, static_cast<int8_t>(condition.right_coeff >> 8),
+            static_cast<int8_t>(condition.left_coeff >> 8),
+            condition.right_saturation >> 8, condition.left_saturation >> 8,
+            condition.deadband >> 8, block);
+      }
+      break;
+  }
+
+  if (envelope != nullptr) {
+    this->joystick.setEnvelopeSettings(
+        envelope->attack_level >> 7, envelope->fade_level >> 7,
+        clampTime(envelope->attack_length), clampTime(envelope->fade_length),
+        block);
+  }
+
+  uint16_t duration = effect.replay.length == 0
+                          ? INFINITE_DURATION
+                          : clampTime(effect.replay.length);
+
+  // Direction: 0x0000 down, 0x4000 left, over the 8b polar range
+  CLSPCompletion sent = this->joystick.setGeneralSettings(
+      function_id, duration, clampTime(effect.trigger.interval), 0, 255, 0xff,
+      static_cast<int8_t>(effect.direction >> 8),
+      clampTime(effect.replay.delay), block);
+
+  return sent.ready() && sent.status() < 0 ? -EIO : 0;
+}
+
+void CLSPUinputBridge::freeEffects() {
+  for (const auto& entry : this->effects) {
+    if (entry.second.allocated) {
+      this->joystick.freeEffect(entry.second.block);
+    }
+  }
+
+  this->effects.clear();
+}
+
+void CLSPUinputBridge::record(uint64_t CLSPBridgeStats::*counter,
+                              uint64_t event_ns, bool failed) {
+  double latency_us = (clspMonotonicNs() - event_ns) / 1000.0;
+
+  std::lock_guard<std::mutex> lock(this->stats_mutex);
+
+  CLSPBridgeStats& stats = this->published;
+  stats.*counter += 1;
+  stats.errors += failed;
+
+  uint64_t handled = stats.uploads + stats.erases + stats.plays + stats.gains;
+  this->latency_sum_us += latency_us;
+  stats.latency_mean_us = this->latency_sum_us / handled;
+  stats.latency_max_us = std::max(stats.latency_max_us, latency_us);
+}
@@ -0,0 +1,123 @@
+#ifndef CLS_P_UINPUT_HPP
+#define CLS_P_UINPUT_HPP
+
+#include <linux/input.h>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "clsp.hpp"
+
+/**
+ * FF requests handled by the bridge and their latency
+ */
+struct CLSPBridgeStats {
+  uint64_t uploads = 0;
+  uint64_t erases = 0;
+  uint64_t plays = 0;
+  uint64_t gains = 0;
+  // Requests that could not be translated or were rejected by the device
+  uint64_t errors = 0;
+  // From the evdev write of the game to the submission of the last report
+  // it translates into, in us
+  double latency_mean_us = 0.0;
+  double latency_max_us = 0.0;
+  // Input reports mirrored to the evdev device
+  uint64_t input_reports = 0;
+};
+
+/**
+ * Exposes a stick as a uinput joystick with force feedback, for programs
+ * that only use evdev. Input report 1 is mirrored as 5 buttons, a hat and
+ * 16-bit X/Y axes; the EV_FF uploads and plays are translated into the PID
+ * reports of CLSPJoystick.
+ *
+ * Each FF id keeps its own pinned effect block, reused while its effect
+ * type does not change. The evdev device is removed while the stick is
+ * unplugged, which drops the uploaded effects like a real unplug would.
+ */
+class CLSPUinputBridge {
+ public:
+  /**
+   * Creates the evdev device and starts the bridge threads
+   * @param joystick opened stick, must outlive the bridge. Its connection
+   * callback is taken over.
+   * @throw std::runtime_error if /dev/uinput cannot be used
+   */
+  explicit CLSPUinputBridge(CLSPJoystick& joystick);
+
+  /**
+   * Stops the threads, frees the effect blocks and removes the evdev device
+   */
+  ~CLSPUinputBridge();
+
+  CLSPUinputBridge(const CLSPUinputBridge&) = delete;
+  CLSPUinputBridge& operator=(const CLSPUinputBridge&) = delete;
+
+  /**
+   * @return request counters and latency since the bridge creation
+   */
+  CLSPBridgeStats stats();
+
+ private:
+  // Same limit as the effect block table of the device
+  static constexpr int MAX_EFFECTS = CLSPEffectBlocks::MAX_EFFECT_BLOCK;
+
+  // Wake-up period of the input thread, to notice the stop request
+  static constexpr unsigned int INPUT_TIMEOUT = 100;
+
+  /**
+   * Effect block holding an uploaded FF effect
+   */
+  struct Effect {
+    uint8_t block = 0;
+    uint8_t function_id = 0;
+    // false if the firmware has no block management and block 1 is shared
+    bool allocated = false;
+  };
+
+  CLSPJoystick& joystick;
+
+  // evdev device, -1 while the stick is unplugged. Held by the input thread
+  // while it writes and while the device is created or removed.
+  std::mutex device_mutex;
+  int fd = -1;
+
+  // Wakes the FF thread on stop and connection changes
+  int wake_fd = -1;
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> device_lost{false};
+  std::atomic<bool> device_back{false};
+
+  std::thread ff_thread;
+  std::thread input_thread;
+
+  // By FF id, FF thread only
+  std::map<int, Effect> effects;
+
+  std::mutex stats_mutex;
+  CLSPBridgeStats published;
+  double latency_sum_us = 0.0;
+
+  void createDevice();
+  void destroyDevice();
+
+  void ffLoop();
+  void inputLoop();
+
+  void handleEvent(const struct input_event& event);
+  void handleUpload(uint32_t request_id, uint64_t event_ns);
+  void handleErase(uint32_t request_id, uint64_t event_ns);
+  void handlePlay(int code, int value, uint64_t event_ns);
+
+  int uploadEffect(const struct ff_effect& effect);
+  void freeEffects();
+
+  void record(uint64_t CLSPBridgeStats::*counter, uint64_t event_ns,
+              bool failed);
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "clsp_watchdog.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// Highest SCHED_FIFO priority
+const int MAX_PRIORITY = 99;
+
+std::chrono::steady_clock::time_point toTimePoint(uint64_t ns) {
+  // CLOCK_MONOTONIC on Linux
+  return std::chrono::steady_clock::time_point(std::chrono::nanoseconds(ns));
+}
+
+}  // namespace
+
+CLSPWatchdog::~CLSPWatchdog() { stop(); }
+
+int CLSPWatchdog::start(Stopper stopper, unsigned int deadline_ms,
+                        const CLSPRealtimeProfile& profile) {
+  if (running() || deadline_ms == 0 || !stopper) {
+    return -1;
+  }
+
+  this->stopper = std::move(stopper);
+  this->deadline_ns = deadline_ms * 1000000ull;
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = false;
+    this->current = CLSPWatchdogStats();
+    this->current.deadline_ms = deadline_ms;
+    this->reaction_sum = 0.0;
+    this->zeroing_sum = 0.0;
+    this->zeroed = 0;
+  }
+
+  feed();
+
+  this->thread = std::thread(&CLSPWatchdog::run, this, profile.prefault_stack);
+
+  CLSPRealtimeProfile watchdog_profile = profile;
+  if (profile.priority > 0) {
+    watchdog_profile.priority = std::min(profile.priority + 1, MAX_PRIORITY);
+  }
+  // The memory is locked by the stream or the backend thread if requested
+  watchdog_profile.lock_memory = false;
+
+  CLSPRealtimeStatus status =
+      clspApplyRealtime(this->thread.native_handle(), watchdog_profile);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->current.realtime = status.realtime;
+
+  return 0;
+}
+
+void CLSPWatchdog::stop() {
+  if (!running()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->cv.notify_all();
+
+  this->thread.join();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->current.deadline_ms = 0;
+}
+
+CLSPWatchdogStats CLSPWatchdog::stats() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->current;
+}
+
+void CLSPWatchdog::run(bool prefault_stack) {
+  if (prefault_stack) {
+    clspPrefaultStack();
+  }
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  uint64_t seen = this->fed_ns.load(std::memory_order_acquire);
+  uint64_t wake = seen + this->deadline_ns;
+
+  // Stop of the current stall and the deadline it was sent for
+  CLSPCompletion stop;
+  uint64_t missed = 0;
+  bool pending = false;
+  bool retry = false;
+
+  while (true) {
+    this->cv.wait_until(lock, toTimePoint(wake),
+                        [this] { return this->stopping; });
+    if (this->stopping) {
+      break;
+    }
+
+    if (pending && stop.ready()) {
+      pending = false;
+
+      int status = stop.status();
+      uint64_t completed = stop.completionTime();
+
+      if (status < 0) {
+        this->current.failed++;
+        retry = true;
+      } else if (completed > missed) {
+        double zeroing = (completed - missed) / 1000.0;
+        this->zeroed++;
+        this->zeroing_sum += zeroing;
+        this->current.zeroing_mean_us = this->zeroing_sum / this->zeroed;
+        this->current.zeroing_max_us =
+            std::max(this->current.zeroing_max_us, zeroing);
+      }
+    }
+
+    uint64_t fed = this->fed_ns.load(std::memory_order_acquire);
+    if (fed != seen) {
+      seen = fed;
+      wake = seen + this->deadline_ns;
+      this->current.tripped = false;
+      retry = false;
+      continue;
+    }
+
+    if (!this->current.tripped) {
+      missed = seen + this->deadline_ns;
+
+      pending = sendStop(stop);
+      retry = !pending;
+
+      uint64_t submitted = clspMonotonicNs();
+      double reaction =
+          submitted > missed ? (submitted - missed) / 1000.0 : 0.0;
+
+      this->current.tripped = true;
+      this->current.fired++;
+      this->reaction_sum += reaction;
+      this->current.reaction_mean_us =
+          this->reaction_sum / this->current.fired;
+      this->current.reaction_max_us =
+          std::max(this->current.reaction_max_us, reaction);
+    } else if (retry && !pending) {
+      pending = sendStop(stop);
+      retry = !pending;
+    }
+
+    // Checked again one deadline later, until an update comes
+    wake += this->deadline_ns;
+  }
+}
+
+bool CLSPWatchdog::sendStop(CLSPCompletion& stop) {
+  stop = this->stopper();
+
+  if (stop.ready() && stop.status() < 0) {
+    this->current.failed++;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,120 @@
+#ifndef CLS_P_WATCHDOG_HPP
+#define CLS_P_WATCHDOG_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "clsp_clock.hpp"
+#include "clsp_realtime.hpp"
+#include "clsp_transfer.hpp"
+
+/**
+ * Activity of a force watchdog since its start
+ */
+struct CLSPWatchdogStats {
+  // Deadline, in ms, 0 while stopped
+  unsigned int deadline_ms = 0;
+  // Deadlines missed, each one stopping all the effects
+  uint64_t fired = 0;
+  // Stops that could not be submitted or failed, sent again one deadline
+  // later, e.g. while the stick is unplugged
+  uint64_t failed = 0;
+  // Missed deadline to the submission of the stop, in us
+  double reaction_mean_us = 0.0;
+  double reaction_max_us = 0.0;
+  // Missed deadline to the completion of the stop, in us
+  double zeroing_mean_us = 0.0;
+  double zeroing_max_us = 0.0;
+  // True from a missed deadline until the next update
+  bool tripped = false;
+  // True if the thread got the SCHED_FIFO policy
+  bool realtime = false;
+  // False if the stop may wait for the reports other threads are writing,
+  // e.g. on the hidraw backend
+  bool priority_path = true;
+};
+
+/**
+ * Stops all the effects when the host stops updating the forces. Every force
+ * update or heartbeat feeds the watchdog; when none comes for a whole
+ * deadline, its thread sends a stop and counts the deadline as missed.
+ *
+ * Feeding is a lock-free store, callable from any thread. The thread sleeps
+ * until the deadline of the last update rather than polling.
+ */
+class CLSPWatchdog {
+ public:
+  // Submits a stop through a path that never waits for the other reports
+  typedef std::function<CLSPCompletion()> Stopper;
+
+  CLSPWatchdog() = default;
+
+  /**
+   * Stops the thread
+   */
+  ~CLSPWatchdog();
+
+  CLSPWatchdog(const CLSPWatchdog&) = delete;
+  CLSPWatchdog& operator=(const CLSPWatchdog&) = delete;
+
+  /**
+   * Starts the watchdog thread, fed once. It runs one SCHED_FIFO priority
+   * above the profile, so a busy force stream thread cannot starve it.
+   * @param stopper called on the watchdog thread when a deadline is missed
+   * @param deadline_ms longest time without update, in ms
+   * @param profile real-time profile of the thread
+   * @return 0 on success, -1 if the watchdog runs or the deadline is 0
+   */
+  int start(Stopper stopper, unsigned int deadline_ms,
+            const CLSPRealtimeProfile& profile);
+
+  /**
+   * Stops the watchdog thread
+   */
+  void stop();
+
+  /**
+   * @return true while the watchdog thread runs
+   */
+  bool running() const { return this->thread.joinable(); }
+
+  /**
+   * Records a force update or a heartbeat. Lock-free, callable from any
+   * thread, also when the watchdog is stopped.
+   */
+  void feed() {
+    this->fed_ns.store(clspMonotonicNs(), std::memory_order_release);
+  }
+
+  /**
+   * @return activity counters since the last start
+   */
+  CLSPWatchdogStats stats();
+
+ private:
+  Stopper stopper;
+  uint64_t deadline_ns = 0;
+
+  // CLOCK_MONOTONIC time of the last update, in ns
+  std::atomic<uint64_t> fed_ns{0};
+
+  // Guards the stats and the stop request
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopping = false;
+  std::thread thread;
+
+  CLSPWatchdogStats current;
+  double reaction_sum = 0.0;
+  double zeroing_sum = 0.0;
+  uint64_t zeroed = 0;
+
+  void run(bool prefault_stack);
+  bool sendStop(CLSPCompletion& stop);
+};
+
+#endif
@@ -1,7 +1,15 @@
+#include <cstring>
+
 #include "clsp.hpp"
 
 int main(int argc, char* argv[]) {
-  CLSPJoystick joystick;
+  // Keeps the kernel driver bound
+  bool hidraw = argc > 1 && std::strcmp(argv[1], "--hidraw") == 0;
+  int arg = hidraw ? 2 : 1;
+
+  // Optional serial number or bus path, to pick one of several sticks
+  CLSPJoystick joystick(argc > arg ? argv[arg] : "",
+                        hidraw ? CLSP_BACKEND_HIDRAW : CLSP_BACKEND_LIBUSB);
 
   getchar();
 
@@ -0,0 +1,161 @@
+// Replays a capture on a stick or on the simulated stick, then prints the
+// timing drift against the capture and the transfers whose outcome differs.
+
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+#include "clsp.hpp"
+#include "clsp_recorder.hpp"
+#include "clsp_replay.hpp"
+#include "clsp_transport_hidraw.hpp"
+#include "clsp_transport_libusb.hpp"
+#include "clsp_transport_sim.hpp"
+
+namespace {
+
+// Differences printed, the count covers all of them
+const size_t MAX_PRINTED = 20;
+
+const size_t RECORD_CAPACITY = 65536;
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program
+            << " [--backend libusb|hidraw|sim] [--fast] [--init]"
+               " [--device bus:address] [--record file] [--serial id]"
+               " capture"
+            << std::endl;
+}
+
+std::string hex(const std::vector<uint8_t>& bytes) {
+  std::string text;
+  char byte[4];
+
+  for (uint8_t value : bytes) {
+    std::snprintf(byte, sizeof(byte), "%02x ", value);
+    text += byte;
+  }
+
+  return text;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string backend = "sim";
+  std::string device_id;
+  const char* record_path = nullptr;
+  bool realtime = true;
+  bool init = false;
+  int bus = -1;
+  int address = -1;
+  int arg = 1;
+
+  for (; arg < argc && std::strncmp(argv[arg], "--", 2) == 0; arg++) {
+    bool has_value = arg + 1 < argc;
+
+    if (std::strcmp(argv[arg], "--fast") == 0) {
+      realtime = false;
+    } else if (std::strcmp(argv[arg], "--init") == 0) {
+      init = true;
+    } else if (std::strcmp(argv[arg], "--backend") == 0 && has_value) {
+      backend = argv[++arg];
+    } else if (std::strcmp(argv[arg], "--serial") == 0 && has_value) {
+      device_id = argv[++arg];
+    } else if (std::strcmp(argv[arg], "--record") == 0 && has_value) {
+      record_path = argv[++arg];
+    } else if (std::strcmp(argv[arg], "--device") == 0 && has_value &&
+               std::sscanf(argv[++arg], "%d:%d", &bus, &address) == 2) {
+      continue;
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (arg + 1 != argc) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::unique_ptr<CLSPTransport> owned;
+  if (backend == "libusb") {
+    owned = std::make_unique<CLSPLibusbTransport>(nullptr);
+  } else if (backend == "hidraw") {
+    owned = std::make_unique<CLSPHidrawTransport>();
+  } else if (backend == "sim") {
+    owned = std::make_unique<CLSPSimTransport>(CLSPSimConfig());
+  } else {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<CLSPRecordEntry> entries;
+  std::unique_ptr<CLSPRecorder> recorder;
+  std::unique_ptr<CLSPJoystick> joystick;
+  CLSPTransport* transport = owned.get();
+
+  try {
+    entries = clspLoadCapture(argv[arg], bus, address);
+
+    if (record_path != nullptr) {
+      recorder = std::make_unique<CLSPRecorder>(record_path, RECORD_CAPACITY);
+    }
+
+    // Our own recordings start after the library initialisation
+    if (init) {
+      joystick = std::make_unique<CLSPJoystick>(std::move(owned), device_id);
+    } else {
+      transport->open(device_id);
+    }
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::cout << "Replaying " << entries.size() << " transfers "
+            << (realtime ? "with the captured timing" : "as fast as possible")
+            << std::endl;
+
+  CLSPReplayResult result =
+      clspReplay(*transport, entries, realtime, recorder.get());
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "transfers  " << result.reports << " reports | "
+            << result.reads << " reads" << std::endl;
+  std::cout << "duration   captured " << result.captured_s * 1000.0
+            << " ms | replayed " << result.replayed_s * 1000.0 << " ms"
+            << std::endl;
+  if (realtime) {
+    std::cout << "drift      mean " << result.drift_mean_us << " us | p99 "
+              << result.drift_p99_us << " us | max " << result.drift_max_us
+              << " us" << std::endl;
+  }
+  std::cout << "latency    p50 " << result.latency_p50_us << " us | p99 "
+            << result.latency_p99_us << " us | max " << result.latency_max_us
+            << " us" << std::endl;
+  std::cout << "different  " << result.differences.size() << " transfers"
+            << std::endl;
+
+  for (size_t i = 0;
+       i < result.differences.size() && i < MAX_PRINTED; i++) {
+    const CLSPReplayDifference& difference = result.differences[i];
+
+    std::cout << "  #" << difference.index << " status "
+              << difference.expected_status << " -> "
+              << difference.actual_status;
+    if (!difference.expected.empty()) {
+      std::cout << " | " << hex(difference.expected) << "-> "
+                << hex(difference.actual);
+    }
+    std::cout << std::endl;
+  }
+
+  if (!init) {
+    transport->close();
+  }
+
+  return result.differences.empty() ? 0 : 3;
+}
@@ -0,0 +1,191 @@
+// Drives the report pipeline against the simulated stick and checks the
+// device state it ends up in: initialisation, the parameter setters, the
+// double-buffered effect switch and an unplug/replug restoring the resident
+// effects. Prints every failed check and exits with 1 if there is any.
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "clsp.hpp"
+#include "clsp_transport_sim.hpp"
+
+namespace {
+
+// Longest wait for the reconnection after a replug
+const auto RECONNECT_TIMEOUT = std::chrono::seconds(2);
+const auto RECONNECT_POLL = std::chrono::milliseconds(5);
+
+int failures = 0;
+
+void check(bool passed, const char* what) {
+  if (!passed) {
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+// The single playing block, 0 when none or several play
+int playingBlock(CLSPSimTransport& sim) {
+  int playing = 0;
+
+  for (int block = 1; block <= CLSPSimConfig().block_count; block++) {
+    if (sim.effect(block).playing) {
+      if (playing != 0) {
+        return 0;
+      }
+      playing = block;
+    }
+  }
+
+  return playing;
+}
+
+bool waitConnected(CLSPJoystick& joystick, bool connected) {
+  auto end = std::chrono::steady_clock::now() + RECONNECT_TIMEOUT;
+
+  while (joystick.isConnected() != connected) {
+    if (std::chrono::steady_clock::now() > end) {
+      return false;
+    }
+    std::this_thread::sleep_for(RECONNECT_POLL);
+  }
+
+  return true;
+}
+
+void checkInit(CLSPSimTransport& sim) {
+  CLSPSimState state = sim.state();
+
+  check(state.actuators_enabled, "init enables the actuators");
+  check(!state.paused, "init leaves the device running");
+  check(state.allocated_blocks > 0, "init loads an effect block");
+  check(state.rejected_reports == 0, "init sends no rejected report");
+}
+
+void checkSetters(CLSPJoystick& joystick, CLSPSimTransport& sim) {
+  check(joystick.setGain(0x80).wait() == 0, "device gain is sent");
+  check(sim.state().gain == 0x80, "device gain reaches the device");
+
+  int block = joystick.createEffect(CLSP_PERIODIC_SINE);
+  check(block > 0, "periodic block is created");
+
+  joystick.setPeriodicSettings(200, 10, 0x40, 250, block);
+  check(joystick.setEnvelopeSettings(100, 50, 300, 400, block).wait() == 0,
+        "periodic parameters are sent");
+
+  CLSPSimEffect periodic = sim.effect(block);
+  check(periodic.allocated && periodic.type == CLSP_PERIODIC_SINE,
+        "periodic block holds a sine");
+  check(periodic.periodic_magnitude == 200 && periodic.periodic_offset == 10 &&
+            periodic.phase == 0x40 && periodic.period == 250,
+        "periodic parameters reach the device");
+  check(periodic.attack_level == 100 && periodic.fade_level == 50 &&
+            periodic.attack_time == 300 && periodic.fade_time == 400,
+        "envelope reaches the device");
+
+  int spring = joystick.createEffect(CLSP_PERIODIC_COND_SPRING);
+  check(spring > 0, "condition block is created");
+
+  joystick.setAxisConditionSettings(0, 10, 20, 30, 40, 5, spring);
+  joystick.setAxisConditionSettings(1, 50, 60, 70, 80, 6, spring).wait();
+
+  CLSPSimEffect condition = sim.effect(spring);
+  check(condition.positive_coefficient[0] == 10 &&
+            condition.negative_coefficient[0] == 20 &&
+            condition.positive_saturation[0] == 30 &&
+            condition.negative_saturation[0] == 40 &&
+            condition.deadband[0] == 5,
+        "X condition reaches parameter block 0");
+  check(condition.positive_coefficient[1] == 50 &&
+            condition.negative_coefficient[1] == 60 &&
+            condition.positive_saturation[1] == 70 &&
+            condition.negative_saturation[1] == 80 &&
+            condition.deadband[1] == 6,
+        "Y condition reaches parameter block 1");
+
+  check(joystick.freeEffect(spring).wait() == 0, "condition block is freed");
+  check(!sim.effect(spring).allocated, "freed block is released");
+
+  check(sim.state().rejected_reports == 0, "setters send no rejected report");
+}
+
+void checkSwitch(CLSPJoystick& joystick, CLSPSimTransport& sim) {
+  joystick.setSwitchMode(CLSP_SWITCH_DOUBLE_BUFFERED);
+
+  check(joystick.constantForceEffect().wait() == 0, "constant force starts");
+  int constant = joystick.getEffectBlock(CLSP_CONSTANT_FORCE);
+  check(constant > 0 && sim.effect(constant).playing,
+        "constant force plays");
+
+  uint64_t starts = sim.state().effect_starts;
+
+  check(joystick.periodicEffect(CLSP_PERIODIC_SINE).wait() == 0,
+        "sine starts");
+  int sine = playingBlock(sim);
+  check(sine > 0 && sim.effect(sine).type == CLSP_PERIODIC_SINE,
+        "sine plays alone");
+  check(!sim.effect(constant).playing, "switch stops the constant force");
+  check(sim.state().effect_starts == starts + 1,
+        "switch sends a single Start Solo");
+
+  // The playing sine keeps playing while the next one is uploaded
+  check(joystick.periodicEffect(CLSP_PERIODIC_SINE).wait() == 0,
+        "second sine starts");
+  int next = playingBlock(sim);
+  check(next > 0 && next != sine, "second sine is uploaded into a new block");
+  check(!sim.effect(sine).playing, "second sine replaces the first one");
+
+  check(sim.state().rejected_reports == 0, "switch sends no rejected report");
+}
+
+void checkReplug(CLSPJoystick& joystick, CLSPSimTransport& sim) {
+  CLSPSimEffect before = sim.effect(playingBlock(sim));
+
+  sim.setAttached(false);
+  check(waitConnected(joystick, false), "unplug is detected");
+  check(sim.state().allocated_blocks == 0, "unplug clears the device");
+
+  sim.setAttached(true);
+  check(waitConnected(joystick, true), "replug reconnects");
+
+  // Restored by the reconnection, possibly into another block
+  int restored = joystick.getEffectBlock(CLSP_PERIODIC_SINE);
+  check(restored > 0, "sine block is restored");
+
+  CLSPSimEffect after = sim.effect(restored);
+  check(after.allocated && after.type == CLSP_PERIODIC_SINE,
+        "restored block holds a sine");
+  check(after.periodic_magnitude == before.periodic_magnitude &&
+            after.period == before.period &&
+            after.duration == before.duration,
+        "restored sine keeps its parameters");
+
+  check(joystick.setGain(0x40).wait() == 0 && sim.state().gain == 0x40,
+        "reports reach the device after the replug");
+  check(sim.state().rejected_reports == 0, "replug sends no rejected report");
+}
+
+}  // namespace
+
+int main() {
+  auto transport = std::make_unique<CLSPSimTransport>(CLSPSimConfig());
+  CLSPSimTransport& sim = *transport;
+
+  CLSPJoystick joystick(std::move(transport), "");
+
+  checkInit(sim);
+  checkSetters(joystick, sim);
+  checkSwitch(joystick, sim);
+  checkReplug(joystick, sim);
+
+  if (failures > 0) {
+    std::cerr << failures << " checks failed" << std::endl;
+    return 1;
+  }
+
+  std::cout << "All checks passed" << std::endl;
+
+  return 0;
+}
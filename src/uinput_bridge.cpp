@@ -0,0 +1,77 @@
+// Mirrors a stick as an evdev joystick with force feedback until SIGINT or
+// SIGTERM, then prints the FF request latency. With --record, the reports
+// sent to the stick are kept in a ring file.
+
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+
+#include <pthread.h>
+
+#include "clsp.hpp"
+#include "clsp_recorder.hpp"
+#include "clsp_uinput.hpp"
+
+namespace {
+
+// About 90 min of FF traffic at 10 reports/s
+const size_t RECORD_CAPACITY = 65536;
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  bool hidraw = false;
+  const char* record_path = nullptr;
+  int arg = 1;
+
+  for (; arg < argc && std::strncmp(argv[arg], "--", 2) == 0; arg++) {
+    if (std::strcmp(argv[arg], "--hidraw") == 0) {
+      // Keeps the kernel driver bound, which also exposes its own event
+      // device
+      hidraw = true;
+    } else if (std::strcmp(argv[arg], "--record") == 0 && arg + 1 < argc) {
+      record_path = argv[++arg];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--hidraw] [--record file] [serial|bus path]"
+                << std::endl;
+      return 2;
+    }
+  }
+
+  // Blocked before any thread starts, so only sigwait() receives them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  // Optional serial number or bus path, to pick one of several sticks
+  CLSPJoystick joystick(argc > arg ? argv[arg] : "",
+                        hidraw ? CLSP_BACKEND_HIDRAW : CLSP_BACKEND_LIBUSB);
+
+  if (record_path != nullptr) {
+    joystick.setRecorder(
+        std::make_shared<CLSPRecorder>(record_path, RECORD_CAPACITY));
+  }
+
+  CLSPUinputBridge bridge(joystick);
+
+  std::cout << "uinput bridge running, Ctrl-C to stop" << std::endl;
+
+  int signal;
+  sigwait(&signals, &signal);
+
+  CLSPBridgeStats stats = bridge.stats();
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "requests   uploads " << stats.uploads << " | erases "
+            << stats.erases << " | plays " << stats.plays << " | gains "
+            << stats.gains << " | errors " << stats.errors << std::endl;
+  std::cout << "latency    mean " << stats.latency_mean_us << " us | max "
+            << stats.latency_max_us << " us" << std::endl;
+  std::cout << "input      " << stats.input_reports << " reports mirrored"
+            << std::endl;
+
+  return 0;
+}